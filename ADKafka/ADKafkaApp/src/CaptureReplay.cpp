@@ -0,0 +1,278 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  CaptureReplay.cpp
+ *  @brief Implementation of the capture file reader.
+ */
+
+#include "CaptureReplay.h"
+#include <algorithm>
+#include <cerrno>
+#include <ciso646>
+#include <cstring>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief How far ahead of the current position the kernel should read.
+const std::size_t ReadAheadBytes{64 * 1024 * 1024};
+
+std::size_t paddedSize(std::size_t size) { return (size + 7) / 8 * 8; }
+} // namespace
+
+constexpr char CaptureReplay::Magic[8];
+
+CaptureReplay::~CaptureReplay() { Close(); }
+
+bool CaptureReplay::Open(std::string const &path, double newSpeed,
+                         bool newLoop) {
+  Close();
+  errorMessage.clear();
+#ifdef _WIN32
+  errorMessage = "Replay of capture files is not supported on Windows.";
+  return false;
+#else
+  std::string pattern{path};
+  struct stat pathStat;
+  if (0 == stat(path.c_str(), &pathStat) and S_ISDIR(pathStat.st_mode)) {
+    pattern = path + "/*.adar";
+  }
+  glob_t globResult;
+  int globStatus = glob(pattern.c_str(), 0, nullptr, &globResult);
+  if (0 == globStatus) {
+    // glob() sorts the matches, i.e. segments are in recording order
+    for (std::size_t i = 0; i < globResult.gl_pathc; ++i) {
+      struct stat fileStat;
+      if (0 == stat(globResult.gl_pathv[i], &fileStat) and
+          S_ISREG(fileStat.st_mode)) {
+        files.emplace_back(globResult.gl_pathv[i]);
+        fileSizes.push_back(static_cast<std::size_t>(fileStat.st_size));
+        totalBytes += fileSizes.back();
+      }
+    }
+  }
+  globfree(&globResult);
+  if (files.empty()) {
+    errorMessage = "No capture files match \"" + pattern + "\".";
+    fileSizes.clear();
+    totalBytes = 0;
+    return false;
+  }
+  speed = std::max(0.0, newSpeed);
+  loop = newLoop;
+  return true;
+#endif
+}
+
+void CaptureReplay::Close() {
+  CloseSegment();
+  files.clear();
+  fileSizes.clear();
+  totalBytes = 0;
+  bytesBefore = 0;
+  currentFile = 0;
+  havePending = false;
+  last = Message();
+  retry = false;
+  paceStarted = false;
+  messageCount = 0;
+  passMessageCount = 0;
+}
+
+bool CaptureReplay::OpenSegment(std::size_t fileIndex) {
+#ifdef _WIN32
+  return false;
+#else
+  auto const &fileName = files.at(fileIndex);
+  fileDescriptor = open(fileName.c_str(), O_RDONLY);
+  if (-1 == fileDescriptor) {
+    errorMessage = "Unable to open \"" + fileName + "\": " + strerror(errno);
+    return false;
+  }
+  struct stat fileStat;
+  if (0 != fstat(fileDescriptor, &fileStat) or
+      static_cast<std::size_t>(fileStat.st_size) < sizeof(SegmentHeader)) {
+    errorMessage = "\"" + fileName + "\" is not a capture file.";
+    CloseSegment();
+    return false;
+  }
+  mappedSize = static_cast<std::size_t>(fileStat.st_size);
+  void *data = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE,
+                    fileDescriptor, 0);
+  if (MAP_FAILED == data) {
+    errorMessage = "Unable to map \"" + fileName + "\": " + strerror(errno);
+    mappedSize = 0;
+    CloseSegment();
+    return false;
+  }
+  mapped = static_cast<const unsigned char *>(data);
+  madvise(data, mappedSize, MADV_SEQUENTIAL);
+
+  SegmentHeader header;
+  std::memcpy(&header, mapped, sizeof(header));
+  if (0 != std::memcmp(header.Magic, Magic, sizeof(Magic)) or
+      FormatVersion != header.Version or
+      header.HeaderSize < sizeof(SegmentHeader) or
+      header.HeaderSize > mappedSize) {
+    errorMessage = "\"" + fileName + "\" is not a capture file.";
+    CloseSegment();
+    return false;
+  }
+  position = header.HeaderSize;
+  readAheadEnd = 0;
+  ReadAhead();
+  return true;
+#endif
+}
+
+void CaptureReplay::CloseSegment() {
+#ifndef _WIN32
+  if (nullptr != mapped) {
+    munmap(const_cast<unsigned char *>(mapped), mappedSize);
+  }
+  if (-1 != fileDescriptor) {
+    close(fileDescriptor);
+  }
+#endif
+  mapped = nullptr;
+  mappedSize = 0;
+  fileDescriptor = -1;
+  position = 0;
+  readAheadEnd = 0;
+}
+
+void CaptureReplay::ReadAhead() {
+#ifndef _WIN32
+  if (readAheadEnd >= mappedSize or
+      position + ReadAheadBytes / 2 < readAheadEnd) {
+    return;
+  }
+  static const std::size_t PageSize =
+      static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  std::size_t start = readAheadEnd / PageSize * PageSize;
+  std::size_t end = std::min(position + ReadAheadBytes, mappedSize);
+  madvise(const_cast<unsigned char *>(mapped) + start, end - start,
+          MADV_WILLNEED);
+  readAheadEnd = end;
+#endif
+}
+
+CaptureReplay::Result CaptureReplay::ReadNext(Message &msg) {
+  while (true) {
+    if (nullptr == mapped) {
+      if (currentFile >= files.size()) {
+        if (0 == passMessageCount) {
+          if (errorMessage.empty()) {
+            errorMessage = "The capture files contain no messages.";
+          }
+          return Result::ERROR;
+        }
+        if (not loop) {
+          return Result::END;
+        }
+        currentFile = 0;
+        bytesBefore = 0;
+        passMessageCount = 0;
+        paceStarted = false;
+      }
+      if (not OpenSegment(currentFile)) {
+        // Skip unreadable files
+        bytesBefore += fileSizes.at(currentFile);
+        ++currentFile;
+        continue;
+      }
+    }
+    RecordHeader header;
+    bool haveRecord{false};
+    if (position + sizeof(header) <= mappedSize) {
+      std::memcpy(&header, mapped + position, sizeof(header));
+      haveRecord = 0 != header.Size and
+                   header.Size <= mappedSize - position - sizeof(header);
+    }
+    if (not haveRecord) {
+      // End of the segment or a segment which was not closed properly
+      CloseSegment();
+      bytesBefore += fileSizes.at(currentFile);
+      ++currentFile;
+      continue;
+    }
+    msg.Data = mapped + position + sizeof(header);
+    msg.Size = header.Size;
+    msg.TimestampNs = header.TimestampNs;
+    position += sizeof(header) + paddedSize(header.Size);
+    ReadAhead();
+    return Result::MESSAGE;
+  }
+}
+
+CaptureReplay::Clock::time_point CaptureReplay::DueTime(Message const &msg) {
+  if (not paceStarted) {
+    paceStarted = true;
+    paceStart = Clock::now();
+    paceFirstTimestampNs = msg.TimestampNs;
+  }
+  auto offsetNs = std::max<std::int64_t>(0, msg.TimestampNs -
+                                                paceFirstTimestampNs);
+  return paceStart + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double, std::nano>(
+                             static_cast<double>(offsetNs) / speed));
+}
+
+CaptureReplay::Result CaptureReplay::WaitForMessage(Message &msg,
+                                                    int timeoutMs) {
+  if (retry) {
+    retry = false;
+    msg = last;
+    return Result::MESSAGE;
+  }
+  if (not IsOpen()) {
+    if (errorMessage.empty()) {
+      errorMessage = "No capture files opened.";
+    }
+    return Result::ERROR;
+  }
+  if (not havePending) {
+    auto result = ReadNext(pending);
+    if (Result::MESSAGE != result) {
+      return result;
+    }
+    havePending = true;
+  }
+  if (speed > 0) {
+    auto due = DueTime(pending);
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    if (due > deadline) {
+      std::this_thread::sleep_until(deadline);
+      return Result::TIMEOUT;
+    }
+    std::this_thread::sleep_until(due);
+  }
+  havePending = false;
+  last = pending;
+  msg = pending;
+  ++messageCount;
+  ++passMessageCount;
+  return Result::MESSAGE;
+}
+
+void CaptureReplay::RetryMessage() {
+  if (nullptr != last.Data) {
+    retry = true;
+  }
+}
+
+double CaptureReplay::GetProgress() const {
+  if (0 == totalBytes) {
+    return 0;
+  }
+  return std::min(1.0, static_cast<double>(bytesBefore + position) /
+                           static_cast<double>(totalBytes));
+}
+} // namespace KafkaInterface
@@ -0,0 +1,164 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  CaptureReplay.h
+ *  @brief Reads messages from capture (segment) files, used instead of Kafka
+ * by the areaDetector driver.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief Replays the messages of a capture made by the MessageRecorder of
+ * ADPluginKafka.
+ * A capture is a set of segment files. Each segment starts with a
+ * CaptureReplay::SegmentHeader which is followed by records. A record is a
+ * CaptureReplay::RecordHeader followed by the message, padded to a multiple of
+ * 8 bytes. A record with size 0 or one which does not fit in the file ends the
+ * segment. All values are in host byte order.
+ *
+ * The segments are memory mapped and read sequentially; the kernel is asked
+ * to read ahead of the current position so that replay is not limited by
+ * page faults. Messages are not copied, the data returned by
+ * CaptureReplay::WaitForMessage() points into the mapping.
+ *
+ * Messages are replayed as fast as possible or paced by their (Kafka)
+ * timestamps, optionally sped up or slowed down by a factor. The class is not
+ * thread safe; it is used by the consume thread of the driver only. Only
+ * supported on POSIX systems.
+ */
+class CaptureReplay {
+public:
+  /// @brief Magic bytes at the start of every segment file.
+  static constexpr char Magic[8]{'A', 'D', 'A', 'R', 'S', 'E', 'G', '\0'};
+  static const std::uint32_t FormatVersion{1};
+
+  struct SegmentHeader {
+    char Magic[8];
+    std::uint32_t Version;
+    std::uint32_t HeaderSize;
+  };
+
+  struct RecordHeader {
+    std::uint32_t Size;
+    std::uint32_t Reserved;
+    std::int64_t TimestampNs;
+  };
+
+  /// @brief A replayed message, valid until the next call to
+  /// CaptureReplay::WaitForMessage().
+  struct Message {
+    const unsigned char *Data{nullptr};
+    std::size_t Size{0};
+    /// @brief Kafka timestamp of the message in ns since the Unix epoch.
+    std::int64_t TimestampNs{0};
+  };
+
+  enum class Result {
+    MESSAGE, ///< A message was returned.
+    TIMEOUT, ///< The next message is not due yet.
+    END,     ///< All messages have been replayed.
+    ERROR,   ///< No (readable) capture files, see GetErrorMessage().
+  };
+
+  CaptureReplay() = default;
+  CaptureReplay(CaptureReplay const &) = delete;
+  CaptureReplay &operator=(CaptureReplay const &) = delete;
+  ~CaptureReplay();
+
+  /** @brief Starts a replay.
+   * @param[in] path A segment file, a directory (all segments in it are
+   * replayed) or a glob pattern. Files are replayed in alphabetical order,
+   * i.e. in the order they were recorded.
+   * @param[in] speed Factor applied to the time between the messages. 0 to
+   * replay as fast as possible, 1 for the original pace.
+   * @param[in] loop Start from the first message again when all messages have
+   * been replayed.
+   * @return False if no file matched, see GetErrorMessage().
+   */
+  bool Open(std::string const &path, double speed, bool loop);
+
+  /// @brief Stops the replay and unmaps the current segment.
+  void Close();
+
+  bool IsOpen() const { return not files.empty(); }
+
+  /** @brief Returns the next message once it is due.
+   * @param[out] msg The message, if the result is Result::MESSAGE.
+   * @param[in] timeoutMs Maximum time to wait for the next message to be due.
+   */
+  Result WaitForMessage(Message &msg, int timeoutMs);
+
+  /** @brief Makes the next call to CaptureReplay::WaitForMessage() return the
+   * last message again, without waiting.
+   * Used if the message could not be processed, e.g. because the NDArray pool
+   * was exhausted.
+   */
+  void RetryMessage();
+
+  std::string GetErrorMessage() const { return errorMessage; }
+
+  /// @brief The number of files being replayed.
+  std::size_t GetFileCount() const { return files.size(); }
+
+  /// @brief The number of messages returned, not counting retries.
+  std::uint64_t GetMessageCount() const { return messageCount; }
+
+  /// @brief The fraction (0 to 1) of the capture replayed so far.
+  double GetProgress() const;
+
+protected:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief Maps a file, returns false (and sets the error message) on
+  /// failure.
+  bool OpenSegment(std::size_t fileIndex);
+  void CloseSegment();
+
+  /// @brief Reads the next record, opening the following segments as needed.
+  Result ReadNext(Message &msg);
+
+  /// @brief Asks the kernel to read the data after the current position.
+  void ReadAhead();
+
+  /// @brief Returns the time the message is due.
+  Clock::time_point DueTime(Message const &msg);
+
+  std::vector<std::string> files;
+  std::vector<std::size_t> fileSizes;
+  std::size_t totalBytes{0};
+  /// @brief Bytes in the files before the current one.
+  std::size_t bytesBefore{0};
+  std::size_t currentFile{0};
+  int fileDescriptor{-1};
+  const unsigned char *mapped{nullptr};
+  std::size_t mappedSize{0};
+  std::size_t position{0};
+  std::size_t readAheadEnd{0};
+
+  double speed{0};
+  bool loop{false};
+
+  /// @brief Message read but not yet due.
+  bool havePending{false};
+  Message pending;
+  Message last;
+  bool retry{false};
+
+  /// @brief The first message (after opening or looping) sets the pace.
+  bool paceStarted{false};
+  Clock::time_point paceStart;
+  std::int64_t paceFirstTimestampNs{0};
+
+  std::uint64_t messageCount{0};
+  /// @brief Messages returned since opening or looping.
+  std::uint64_t passMessageCount{0};
+  std::string errorMessage;
+};
+} // namespace KafkaInterface
@@ -0,0 +1,153 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FetchTuner.cpp
+ *  @brief Implementation of the fetch settings controller.
+ */
+
+#include "FetchTuner.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstdio>
+
+namespace KafkaInterface {
+
+namespace {
+const std::int64_t MiB{1024 * 1024};
+/// @brief Limits of the sizes, well below the librdkafka maximum of 2 GB.
+const std::int64_t MinPartitionFetch{1 * MiB};
+const std::int64_t MaxPartitionFetch{512 * MiB};
+const std::int64_t MinFetch{64 * MiB};
+const std::int64_t MaxFetch{1024 * MiB};
+const std::int64_t MinQueue{16 * MiB};
+const std::int64_t MaxQueue{1024 * MiB};
+const int WaitSteps[]{10, 20, 50, 100, 200, 500};
+/// @brief Weight of the newest window in the moving averages.
+const double Smoothing{0.3};
+
+std::string formatSize(double bytes) {
+  char buffer[32];
+  if (bytes >= MiB) {
+    std::snprintf(buffer, sizeof(buffer), "%.1f MB", bytes / MiB);
+  } else {
+    std::snprintf(buffer, sizeof(buffer), "%.1f kB", bytes / 1024);
+  }
+  return buffer;
+}
+} // namespace
+
+constexpr double FetchTuner::WindowSeconds;
+constexpr double FetchTuner::QueueSeconds;
+const std::size_t FetchTuner::Windows;
+const std::size_t FetchTuner::MinWindows;
+const int FetchTuner::MinRetuneInterval;
+
+std::int64_t FetchTuner::RoundUpPow2(std::int64_t value) {
+  std::int64_t result{1};
+  while (result < value) {
+    result *= 2;
+  }
+  return result;
+}
+
+void FetchTuner::RotateWindows(Clock::time_point now) {
+  if (not windowStarted) {
+    windowStarted = true;
+    windowStart = now;
+    return;
+  }
+  auto window = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(WindowSeconds));
+  while (now - windowStart >= window) {
+    double rate = windowMessages / WindowSeconds;
+    double size = 0 == windowMessages
+                      ? meanSize
+                      : static_cast<double>(windowBytes) / windowMessages;
+    if (0 == completedWindows) {
+      meanRate = rate;
+      meanSize = size;
+    } else {
+      meanRate += Smoothing * (rate - meanRate);
+      meanSize += Smoothing * (size - meanSize);
+    }
+    ++completedWindows;
+    windowIndex = (windowIndex + 1) % Windows;
+    windowPeaks[windowIndex] = 0;
+    windowMessages = 0;
+    windowBytes = 0;
+    windowStart += window;
+    if (completedWindows > Windows and now - windowStart >= Windows * window) {
+      // Idle for longer than the kept windows, skip ahead
+      windowStart = now;
+      meanRate = 0;
+      windowPeaks.fill(0);
+    }
+  }
+}
+
+void FetchTuner::AddMessage(std::size_t size, Clock::time_point time) {
+  RotateWindows(time);
+  ++windowMessages;
+  windowBytes += size;
+  windowPeaks[windowIndex] = std::max(windowPeaks[windowIndex], size);
+}
+
+std::size_t FetchTuner::PeakSize() const {
+  return *std::max_element(windowPeaks.begin(), windowPeaks.end());
+}
+
+FetchSettings FetchTuner::Recommend() const {
+  if (completedWindows < MinWindows) {
+    return current;
+  }
+  FetchSettings result;
+  auto peak = static_cast<std::int64_t>(
+      std::max(static_cast<double>(PeakSize()), meanSize));
+  auto partitionFetch = std::min(
+      std::max(RoundUpPow2(2 * peak), MinPartitionFetch), MaxPartitionFetch);
+  result.MaxPartitionFetchBytes = static_cast<int>(partitionFetch);
+  result.FetchMaxBytes = static_cast<int>(
+      std::min(std::max(2 * partitionFetch, MinFetch), MaxFetch));
+  auto queue = static_cast<std::int64_t>(
+      std::max(4.0 * peak, QueueSeconds * meanRate * meanSize));
+  queue = std::min(std::max(RoundUpPow2(queue), MinQueue), MaxQueue);
+  result.QueuedMaxKBytes = static_cast<int>(queue / 1024);
+  result.FetchWaitMaxMs = WaitSteps[0];
+  double interval = meanRate > 0 ? 1000.0 / meanRate : 1e9;
+  for (auto wait : WaitSteps) {
+    if (wait <= interval) {
+      result.FetchWaitMaxMs = wait;
+    }
+  }
+  return result;
+}
+
+std::string FetchTuner::Reason() const {
+  if (completedWindows < MinWindows) {
+    return "Observing messages.";
+  }
+  auto settings = Recommend();
+  char rate[32];
+  std::snprintf(rate, sizeof(rate), "%.1f Hz", meanRate);
+  return formatSize(std::max(static_cast<double>(PeakSize()), meanSize)) +
+         " @ " + rate + ": " +
+         formatSize(settings.MaxPartitionFetchBytes) + "/partition, queue " +
+         formatSize(settings.QueuedMaxKBytes * 1024.0) + ", wait " +
+         std::to_string(settings.FetchWaitMaxMs) + " ms";
+}
+
+bool FetchTuner::RetuneDue(Clock::time_point now) {
+  RotateWindows(now);
+  if (completedWindows < MinWindows or
+      (applied and now - lastApplied < std::chrono::seconds(MinRetuneInterval))) {
+    return false;
+  }
+  return Recommend() != current;
+}
+
+void FetchTuner::Applied(FetchSettings const &settings,
+                         Clock::time_point now) {
+  current = settings;
+  applied = true;
+  lastApplied = now;
+}
+} // namespace KafkaInterface
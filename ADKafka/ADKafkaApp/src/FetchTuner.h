@@ -0,0 +1,127 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FetchTuner.h
+ *  @brief Derives librdkafka fetch settings from the observed message sizes
+ * and rates.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace KafkaInterface {
+
+/// @brief The librdkafka consumer settings adjusted by FetchTuner.
+struct FetchSettings {
+  /// @brief "fetch.max.bytes", maximum size of a fetch response.
+  int FetchMaxBytes{52428800};
+  /// @brief "max.partition.fetch.bytes", maximum data per partition and fetch.
+  int MaxPartitionFetchBytes{1048576};
+  /// @brief "queued.max.messages.kbytes", size of the pre-fetch queue in kB.
+  int QueuedMaxKBytes{65536};
+  /// @brief "fetch.wait.max.ms", time the broker waits for data.
+  int FetchWaitMaxMs{500};
+
+  bool operator==(FetchSettings const &other) const {
+    return FetchMaxBytes == other.FetchMaxBytes and
+           MaxPartitionFetchBytes == other.MaxPartitionFetchBytes and
+           QueuedMaxKBytes == other.QueuedMaxKBytes and
+           FetchWaitMaxMs == other.FetchWaitMaxMs;
+  }
+  bool operator!=(FetchSettings const &other) const {
+    return not(*this == other);
+  }
+};
+
+/** @brief Recommends fetch settings for the consumed stream of messages.
+ * Message sizes and arrival times are summarised in one second windows. Once
+ * a few windows have been observed, the settings are derived from the mean
+ * message rate and the largest message of the last windows:
+ * * A partition fetch holds at least two of the largest messages, so that a
+ * fetch never stops in the middle of a frame.
+ * * A fetch response holds two partition fetches.
+ * * The pre-fetch queue holds one second of data, but at least four of the
+ * largest messages, so that consumption does not stall while the next fetch
+ * is in flight.
+ * * The broker waits at most about one message interval for new data.
+ *
+ * Sizes are rounded up to powers of two (and the wait to 10, 20, 50, 100, 200
+ * or 500 ms), so a retune is only recommended when a setting changes by at
+ * least a factor of two, and at most once per FetchTuner::MinRetuneInterval.
+ * The class is not thread safe.
+ */
+class FetchTuner {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief Length of the windows in which messages are summarised.
+  static constexpr double WindowSeconds{1.0};
+
+  /// @brief Number of windows kept for the largest message size.
+  static const std::size_t Windows{8};
+
+  /// @brief Windows to observe before the first recommendation.
+  static const std::size_t MinWindows{3};
+
+  /// @brief Minimum time between two retunes.
+  static const int MinRetuneInterval{30};
+
+  /// @brief Amount of data (in seconds) the pre-fetch queue should hold.
+  static constexpr double QueueSeconds{1.0};
+
+  /// @brief Records a consumed message.
+  void AddMessage(std::size_t size, Clock::time_point time);
+
+  /** @brief Returns true if the recommended settings differ from the applied
+   * ones and the last retune is long enough ago.
+   */
+  bool RetuneDue(Clock::time_point now);
+
+  /// @brief The settings for the messages observed so far.
+  FetchSettings Recommend() const;
+
+  /** @brief A short explanation of the recommended settings, e.g.
+   * "50.0 MB @ 10.0 Hz: 128.0 MB/partition, queue 512.0 MB, wait 100 ms".
+   */
+  std::string Reason() const;
+
+  /// @brief To be called when the settings have been applied.
+  void Applied(FetchSettings const &settings, Clock::time_point now);
+
+  /// @brief The settings currently in use.
+  FetchSettings const &Current() const { return current; }
+
+  /// @brief Sets the settings in use without starting the retune interval.
+  void SetCurrent(FetchSettings const &settings) { current = settings; }
+
+  /// @brief Smallest power of two which is not smaller than the value.
+  static std::int64_t RoundUpPow2(std::int64_t value);
+
+protected:
+  /// @brief Ends the current window if it is over at the given time.
+  void RotateWindows(Clock::time_point now);
+
+  /// @brief The largest message of the kept windows.
+  std::size_t PeakSize() const;
+
+  FetchSettings current;
+  bool applied{false};
+  Clock::time_point lastApplied;
+
+  bool windowStarted{false};
+  Clock::time_point windowStart;
+  std::uint64_t windowMessages{0};
+  std::uint64_t windowBytes{0};
+  std::array<std::size_t, Windows> windowPeaks{};
+  std::size_t windowIndex{0};
+  std::size_t completedWindows{0};
+
+  /// @brief Exponential moving averages over the completed windows.
+  double meanRate{0};
+  double meanSize{0};
+};
+} // namespace KafkaInterface
@@ -6,11 +6,26 @@
  */
 
 #include "KafkaConsumer.h"
+#include "ThreadPlacement.h"
+#include "Tracing.h"
 #include <ciso646>
 #include <algorithm>
+#include <cstdlib>
+#include <sstream>
 
 namespace KafkaInterface {
 
+namespace {
+/// @brief The librdkafka names of the settings adjusted by the fetch tuner.
+const std::vector<std::pair<std::string, int FetchSettings::*>>
+    FetchSettingNames{
+        {"fetch.max.bytes", &FetchSettings::FetchMaxBytes},
+        {"max.partition.fetch.bytes", &FetchSettings::MaxPartitionFetchBytes},
+        {"queued.max.messages.kbytes", &FetchSettings::QueuedMaxKBytes},
+        {"fetch.wait.max.ms", &FetchSettings::FetchWaitMaxMs},
+    };
+} // namespace
+
 int KafkaConsumer::GetNumberOfPVs() { return PV::count; }
 
 KafkaMessage::KafkaMessage(RdKafka::Message *msg) : msg(msg) {}
@@ -19,27 +34,87 @@ void *KafkaMessage::GetDataPtr() { return msg->payload(); }
 
 size_t KafkaMessage::size() { return msg->len(); }
 
+std::int64_t KafkaMessage::GetOffset() { return msg->offset(); }
+
+std::int32_t KafkaMessage::GetPartition() { return msg->partition(); }
+
+std::string KafkaMessage::GetTopicName() { return msg->topic_name(); }
+
+bool KafkaMessage::GetHeader(std::string const &key, std::string &value) {
+  auto headers = msg->headers();
+  if (nullptr == headers) {
+    return false;
+  }
+  bool found{false};
+  for (auto const &header : headers->get_all()) {
+    if (header.key() == key) {
+      value.assign(static_cast<const char *>(header.value()),
+                   header.value_size());
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool KafkaMessage::GetFrameHeaders(FrameHeaders &frame) {
+  auto headers = msg->headers();
+  if (nullptr == headers) {
+    return false;
+  }
+  bool found{false};
+  for (auto const &header : headers->get_all()) {
+    found = DecodeFrameHeader(header.key(), header.value(),
+                              header.value_size(), frame) or
+            found;
+  }
+  return found;
+}
+
+std::int64_t KafkaMessage::GetTimestampMs() {
+  auto timestamp = msg->timestamp();
+  if (RdKafka::MessageTimestamp::MSG_TIMESTAMP_NOT_AVAILABLE ==
+      timestamp.type) {
+    return -1;
+  }
+  return timestamp.timestamp;
+}
+
 KafkaConsumer::KafkaConsumer(std::string const &broker,
                              std::string const &topic,
-                             std::string const &groupId)
+                             std::string const &groupId,
+                             bool deferConnection)
     : topicName(topic), conf(RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL)),
       brokerAddr(broker) {
+  autoApply = not deferConnection;
+  ResetFirstFrameTime();
   KafkaConsumer::InitRdKafka(groupId);
+  // Also assigns the topic, which has already been set
   KafkaConsumer::SetBrokerAddr(broker);
-  KafkaConsumer::SetTopic(topic);
 }
 
 KafkaConsumer::KafkaConsumer(std::string const &groupId)
     : conf(RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL)) {
+  ResetFirstFrameTime();
   KafkaConsumer::InitRdKafka(groupId);
 }
 
-KafkaConsumer::~KafkaConsumer() {
+KafkaConsumer::~KafkaConsumer() { CloseConsumer(); }
+
+void KafkaConsumer::CloseConsumer() {
   if (nullptr != consumer) {
-    consumer->unassign();
+    if (not subscribed) {
+      CommitOffsets(true);
+      consumer->unassign();
+    }
+    // Leaves the group, the revoked partitions are committed by rebalance_cb()
     consumer->close();
     delete consumer;
     consumer = nullptr;
+    subscribed = false;
+    std::lock_guard<std::mutex> lock(commitMutex);
+    storedOffsets.clear();
+    storedCount = 0;
+    commitsInFlight.clear();
   }
 }
 
@@ -52,7 +127,8 @@ void KafkaConsumer::InitRdKafka(std::string const &groupId) {
   }
 
   RdKafka::Conf::ConfResult configResult;
-  configResult = conf->set("event_cb", this, errstr);
+  configResult =
+      conf->set("event_cb", static_cast<RdKafka::EventCb *>(this), errstr);
   if (RdKafka::Conf::CONF_OK != configResult) {
     errorState = true;
     KafkaConsumer::SetConStat(KafkaConsumer::ConStat::ERROR,
@@ -67,6 +143,58 @@ void KafkaConsumer::InitRdKafka(std::string const &groupId) {
                               "Unable to set statistics interval.");
   }
 
+  // Applies the CPU affinity and scheduling of the librdkafka threads
+  if (not DriverThreads::Placer.installInterceptors(conf.get(), errstr)) {
+    KafkaConsumer::SetConStat(KafkaConsumer::ConStat::ERROR,
+                              "Unable to place librdkafka threads.");
+  }
+
+  // Only used in subscribe mode
+  configResult = conf->set(
+      "rebalance_cb", static_cast<RdKafka::RebalanceCb *>(this), errstr);
+  if (RdKafka::Conf::CONF_OK != configResult) {
+    errorState = true;
+    KafkaConsumer::SetConStat(KafkaConsumer::ConStat::ERROR,
+                              "Can not set rebalance callback.");
+    return;
+  }
+  configResult =
+      conf->set("partition.assignment.strategy", "cooperative-sticky", errstr);
+  if (RdKafka::Conf::CONF_OK != configResult) {
+    // Older librdkafka, use the default (eager) strategies
+    KafkaConsumer::SetConStat(KafkaConsumer::ConStat::ERROR,
+                              "Cooperative rebalancing unavailable.");
+  }
+
+  // Offsets are stored once the plugins have been called, see StoreOffset()
+  for (auto name : {"enable.auto.commit", "enable.auto.offset.store"}) {
+    configResult = conf->set(name, "false", errstr);
+    if (RdKafka::Conf::CONF_OK != configResult) {
+      errorState = true;
+      KafkaConsumer::SetConStat(KafkaConsumer::ConStat::ERROR,
+                                "Can not disable automatic commits.");
+      return;
+    }
+  }
+  configResult = conf->set(
+      "offset_commit_cb", static_cast<RdKafka::OffsetCommitCb *>(this), errstr);
+  if (RdKafka::Conf::CONF_OK != configResult) {
+    errorState = true;
+    KafkaConsumer::SetConStat(KafkaConsumer::ConStat::ERROR,
+                              "Can not set offset commit callback.");
+    return;
+  }
+
+  // The defaults of this librdkafka version, the starting point of the tuning
+  FetchSettings fetchSettings;
+  for (auto const &setting : FetchSettingNames) {
+    std::string value;
+    if (RdKafka::Conf::CONF_OK == conf->get(setting.first, value)) {
+      fetchSettings.*setting.second = std::atoi(value.c_str());
+    }
+  }
+  fetchTuner.SetCurrent(fetchSettings);
+
   if (groupId.empty()) {
     KafkaConsumer::SetConStat(KafkaConsumer::ConStat::ERROR,
                               "Unable to set group id.");
@@ -94,22 +222,94 @@ bool KafkaConsumer::SetOffset(std::int64_t offset) {
     }
   }
   topicOffset = offset;
-  setParam(paramCallback, paramsList.at(msg_offset), static_cast<int>(offset));
-  UpdateTopic();
+  pendingUpdates.discard(PV::msg_offset);
+  setParam(paramCallback, paramsList.at(msg_offset), offset);
+  RequestTopicUpdate();
   return true;
 }
 
+bool KafkaConsumer::SetOffsetFromTime(std::int64_t timestampMs) {
+  if (nullptr == consumer or topicName.empty() or timestampMs < 0) {
+    return false;
+  }
+  std::vector<RdKafka::TopicPartition *> partitions{
+      RdKafka::TopicPartition::create(topicName, 0, timestampMs)};
+  auto result = consumer->offsetsForTimes(partitions, offsetLookupTimeout);
+  std::int64_t newOffset = partitions[0]->offset();
+  bool success = RdKafka::ERR_NO_ERROR == result and
+                 RdKafka::ERR_NO_ERROR == partitions[0]->err();
+  RdKafka::TopicPartition::destroy(partitions);
+  if (not success) {
+    SetConStat(KafkaConsumer::ConStat::ERROR,
+               "Unable to look up offset from time.");
+    return false;
+  }
+  if (newOffset < 0) {
+    // No message at or after the given time.
+    newOffset = RdKafka::Topic::OFFSET_END;
+  }
+  return SetOffset(newOffset);
+}
+
+void KafkaConsumer::SetStopTime(std::int64_t timestampMs) {
+  stopTime = timestampMs;
+}
+
+std::int64_t KafkaConsumer::GetStopTime() { return stopTime; }
+
+bool KafkaConsumer::StopTimeReached() { return stopTimeReached; }
+
 std::string KafkaConsumer::GetTopic() { return topicName; }
 
 std::string KafkaConsumer::GetBrokerAddr() { return brokerAddr; }
 
 std::unique_ptr<KafkaMessage> KafkaConsumer::WaitForPkg(int timeout) {
+  if (nullptr != consumer and fetchTuning) {
+    TuneFetchSettings();
+  }
   if (nullptr != consumer and not topicName.empty()) {
+    CommitIfDue();
+    DRIVER_TRACE_START(traceStart);
     RdKafka::Message *msg = consumer->consume(timeout);
+    if (msg->err() == RdKafka::ERR_NO_ERROR and latestFrameMode) {
+      msg = SkipToLatest(msg, timeout);
+      if (nullptr == msg) {
+        return nullptr;
+      }
+    }
     if (msg->err() == RdKafka::ERR_NO_ERROR) {
+      auto stopTimeMs = stopTime.load();
+      auto msgTime = msg->timestamp();
+      if (0 < stopTimeMs and
+          RdKafka::MessageTimestamp::MSG_TIMESTAMP_NOT_AVAILABLE !=
+              msgTime.type and
+          msgTime.timestamp > stopTimeMs) {
+        stopTimeReached = true;
+        delete msg;
+        return nullptr;
+      }
+      fetchTuner.AddMessage(msg->len(), std::chrono::steady_clock::now());
       topicOffset = msg->offset();
-      setParam(paramCallback, paramsList[PV::msg_offset],
-               static_cast<int>(topicOffset));
+      pendingUpdates.post(PV::msg_offset, topicOffset);
+      // The watermarks are cached by librdkafka, this does not block. When
+      // subscribed, the lag of all partitions is taken from the statistics.
+      std::int64_t low, high;
+      if (not subscribed and
+          RdKafka::ERR_NO_ERROR ==
+              consumer->get_watermark_offsets(msg->topic_name(),
+                                              msg->partition(), &low, &high) and
+          0 <= high) {
+        UpdatePartitionLag(std::max<std::int64_t>(high - topicOffset - 1, 0));
+      }
+      if (not firstFrameReceived) {
+        firstFrameReceived = true;
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        auto elapsedNs =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() -
+            firstFrameStartTime;
+        pendingUpdates.post(PV::time_to_first_frame, elapsedNs / 1e6);
+      }
+      DRIVER_TRACE_END(traceStart, "consume", topicOffset);
       return std::unique_ptr<KafkaMessage>(new KafkaMessage(msg));
     } else if (msg->err() == RdKafka::ERR__TIMED_OUT) {
         // Timeout is not an error
@@ -127,6 +327,375 @@ std::unique_ptr<KafkaMessage> KafkaConsumer::WaitForPkg(int timeout) {
   return nullptr;
 }
 
+RdKafka::Message *KafkaConsumer::SkipToLatest(RdKafka::Message *msg,
+                                               int timeout) {
+  std::int64_t skipped{0};
+  // Drop the messages which have already been fetched, without deserializing
+  // them.
+  while (true) {
+    std::unique_ptr<RdKafka::Message> next(consumer->consume(0));
+    if (next->err() != RdKafka::ERR_NO_ERROR) {
+      break;
+    }
+    delete msg;
+    msg = next.release();
+    ++skipped;
+  }
+  // Skip the part of the backlog which has not yet been fetched.
+  std::int64_t low, high;
+  auto result = consumer->get_watermark_offsets(
+      msg->topic_name(), msg->partition(), &low, &high);
+  if (RdKafka::ERR_NO_ERROR == result and high - 1 > msg->offset()) {
+    std::unique_ptr<RdKafka::TopicPartition> partition(
+        RdKafka::TopicPartition::create(msg->topic_name(), msg->partition(),
+                                        high - 1));
+    if (RdKafka::ERR_NO_ERROR == consumer->seek(*partition, 0)) {
+      skipped += high - 1 - msg->offset();
+      delete msg;
+      msg = consumer->consume(timeout);
+      if (msg->err() != RdKafka::ERR_NO_ERROR) {
+        delete msg;
+        msg = nullptr;
+      }
+    }
+  }
+  if (skipped > 0) {
+    skippedMessages += skipped;
+    pendingUpdates.post(PV::skipped_frames,
+                        static_cast<int>(skippedMessages));
+  }
+  return msg;
+}
+
+void KafkaConsumer::SetLatestFrameMode(bool enable) {
+  latestFrameMode = enable;
+}
+
+bool KafkaConsumer::GetLatestFrameMode() { return latestFrameMode; }
+
+bool KafkaConsumer::SetSubscribeMode(bool enable) {
+  if (errorState) {
+    return false;
+  }
+  if (enable == subscribeMode) {
+    return true;
+  }
+  subscribeMode = enable;
+  return RequestReconnect();
+}
+
+bool KafkaConsumer::GetSubscribeMode() { return subscribeMode; }
+
+void KafkaConsumer::rebalance_cb(
+    RdKafka::KafkaConsumer *kafkaConsumer, RdKafka::ErrorCode err,
+    std::vector<RdKafka::TopicPartition *> &partitions) {
+  bool cooperative = "COOPERATIVE" == kafkaConsumer->rebalance_protocol();
+  std::unique_ptr<RdKafka::Error> error;
+  if (RdKafka::ERR__ASSIGN_PARTITIONS == err) {
+    if (cooperative) {
+      error.reset(kafkaConsumer->incremental_assign(partitions));
+    } else {
+      kafkaConsumer->assign(partitions);
+    }
+    if (consumptionHalted or backpressurePaused) {
+      kafkaConsumer->pause(partitions);
+    }
+    double rebalanceTime{0};
+    if (rebalanceInProgress) {
+      rebalanceInProgress = false;
+      rebalanceTime = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - rebalanceStartTime)
+                          .count();
+    }
+    ++rebalanceCount;
+    pendingUpdates.post(PV::rebalance_time, rebalanceTime);
+    pendingUpdates.post(PV::rebalance_count, rebalanceCount);
+  } else if (RdKafka::ERR__REVOKE_PARTITIONS == err) {
+    if (not rebalanceInProgress) {
+      rebalanceInProgress = true;
+      rebalanceStartTime = std::chrono::steady_clock::now();
+    }
+    if (kafkaConsumer->assignment_lost()) {
+      // Committing would fail, the partitions already have a new owner
+      std::lock_guard<std::mutex> lock(commitMutex);
+      storedOffsets.clear();
+      storedCount = 0;
+    } else {
+      // So that the next owner continues after the last processed message
+      CommitOffsets(true);
+    }
+    if (cooperative) {
+      error.reset(kafkaConsumer->incremental_unassign(partitions));
+    } else {
+      kafkaConsumer->unassign();
+    }
+  } else {
+    kafkaConsumer->unassign();
+    SetConStat(KafkaConsumer::ConStat::ERROR,
+               "Rebalance failed: " + RdKafka::err2str(err));
+  }
+  if (nullptr != error) {
+    SetConStat(KafkaConsumer::ConStat::ERROR,
+               "Unable to update assignment: " + error->str());
+  }
+  PostAssignment(kafkaConsumer);
+}
+
+void KafkaConsumer::SetFetchTuning(bool enable) {
+  fetchTuning = enable;
+  if (not enable) {
+    pendingUpdates.post(PV::fetch_tuning_reason, std::string("Disabled."));
+  }
+}
+
+void KafkaConsumer::TuneFetchSettings() {
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastTuneCheck < std::chrono::seconds(1)) {
+    return;
+  }
+  lastTuneCheck = now;
+  auto reason = fetchTuner.Reason();
+  if (subscribed) {
+    reason += " (from next re-connect)";
+  }
+  pendingUpdates.post(PV::fetch_tuning_reason, reason);
+  if (fetchTuner.RetuneDue(now)) {
+    retunePending = true;
+  }
+}
+
+void KafkaConsumer::ApplyPendingRetune() {
+  if (not retunePending) {
+    return;
+  }
+  retunePending = false;
+  if (nullptr != consumer and fetchTuning) {
+    ApplyFetchSettings(fetchTuner.Recommend());
+  }
+}
+
+bool KafkaConsumer::ApplyFetchSettings(FetchSettings const &settings) {
+  auto now = std::chrono::steady_clock::now();
+  bool success{true};
+  for (auto const &setting : FetchSettingNames) {
+    success = success and
+              RdKafka::Conf::CONF_OK ==
+                  conf->set(setting.first,
+                            std::to_string(settings.*setting.second), errstr);
+  }
+  // Must hold a complete fetch response
+  success = success and
+            RdKafka::Conf::CONF_OK ==
+                conf->set("receive.message.max.bytes",
+                          std::to_string(settings.FetchMaxBytes + 512), errstr);
+  if (not success) {
+    // Not retried before the next retune interval
+    fetchTuner.Applied(fetchTuner.Current(), now);
+    SetConStat(KafkaConsumer::ConStat::ERROR,
+               "Unable to set fetch settings.");
+    return false;
+  }
+  fetchTuner.Applied(settings, now);
+  ++retuneCount;
+  PostFetchSettings();
+  if (subscribed) {
+    // Re-creating the consumer would trigger a rebalance of the group
+    return true;
+  }
+  // librdkafka can not change the settings of an existing consumer, continue
+  // with a new one at the current position. Fetched but not yet consumed
+  // messages are fetched again.
+  std::vector<RdKafka::TopicPartition *> assigned;
+  consumer->assignment(assigned);
+  consumer->position(assigned);
+  for (auto partition : assigned) {
+    if (0 == partition->partition() and 0 <= partition->offset()) {
+      topicOffset = partition->offset();
+    }
+  }
+  RdKafka::TopicPartition::destroy(assigned);
+  bool frameReceived = firstFrameReceived;
+  bool result = MakeConnection();
+  firstFrameReceived = frameReceived;
+  return result;
+}
+
+void KafkaConsumer::PostFetchSettings() {
+  auto const &settings = fetchTuner.Current();
+  pendingUpdates.post(PV::fetch_max_bytes, settings.FetchMaxBytes);
+  pendingUpdates.post(PV::partition_fetch_bytes,
+                      settings.MaxPartitionFetchBytes);
+  pendingUpdates.post(PV::queued_max_kbytes, settings.QueuedMaxKBytes);
+  pendingUpdates.post(PV::fetch_wait_ms, settings.FetchWaitMaxMs);
+  pendingUpdates.post(PV::retune_count, retuneCount);
+}
+
+void KafkaConsumer::StoreOffset(std::string const &topic,
+                                std::int32_t partition, std::int64_t offset) {
+  {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (0 == storedCount) {
+      firstStoreTime = std::chrono::steady_clock::now();
+    }
+    // The committed offset is that of the next message to consume
+    auto &stored = storedOffsets[PartitionKey(topic, partition)];
+    stored = std::max(stored, offset + 1);
+    ++storedCount;
+    pendingUpdates.post(PV::uncommitted, storedCount);
+  }
+  CommitIfDue();
+}
+
+bool KafkaConsumer::SetCommitBatch(int messages) {
+  if (messages < 1) {
+    return false;
+  }
+  commitBatch = messages;
+  return true;
+}
+
+bool KafkaConsumer::SetCommitIntervalMS(int interval) {
+  if (interval < 0) {
+    return false;
+  }
+  commitInterval = interval;
+  return true;
+}
+
+void KafkaConsumer::CommitIfDue() {
+  {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (storedOffsets.empty()) {
+      return;
+    }
+    auto interval = commitInterval.load();
+    if (storedCount < commitBatch and
+        (0 >= interval or std::chrono::steady_clock::now() - firstStoreTime <
+                              std::chrono::milliseconds(interval))) {
+      return;
+    }
+  }
+  CommitOffsets(false);
+}
+
+void KafkaConsumer::CommitOffsets(bool synchronous) {
+  if (nullptr == consumer) {
+    return;
+  }
+  std::vector<RdKafka::TopicPartition *> offsets;
+  {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (storedOffsets.empty()) {
+      return;
+    }
+    for (auto const &stored : storedOffsets) {
+      offsets.push_back(RdKafka::TopicPartition::create(
+          stored.first.first, stored.first.second, stored.second));
+    }
+    storedOffsets.clear();
+    storedCount = 0;
+    pendingUpdates.post(PV::uncommitted, storedCount);
+    // The result of both kinds of commit is passed to offset_commit_cb() by
+    // librdkafka, unless the commit could not be sent at all.
+    commitsInFlight.push_back(std::chrono::steady_clock::now());
+  }
+  // Not called with the lock held, as librdkafka calls offset_commit_cb()
+  // from commitSync()
+  if (synchronous) {
+    consumer->commitSync(offsets);
+  } else if (RdKafka::ERR_NO_ERROR != consumer->commitAsync(offsets)) {
+    {
+      std::lock_guard<std::mutex> lock(commitMutex);
+      if (not commitsInFlight.empty()) {
+        commitsInFlight.pop_back();
+      }
+    }
+    RetryCommit(offsets);
+  }
+  RdKafka::TopicPartition::destroy(offsets);
+}
+
+void KafkaConsumer::RetryCommit(
+    std::vector<RdKafka::TopicPartition *> const &offsets) {
+  if (nullptr == consumer) {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    ++commitFailures;
+    pendingUpdates.post(PV::commit_failures, commitFailures);
+    return;
+  }
+  // Partitions which have been revoked in the meantime belong to another
+  // consumer of the group and are not retried.
+  std::vector<RdKafka::TopicPartition *> assigned;
+  consumer->assignment(assigned);
+  std::lock_guard<std::mutex> lock(commitMutex);
+  ++commitFailures;
+  pendingUpdates.post(PV::commit_failures, commitFailures);
+  for (auto partition : offsets) {
+    if (partition->offset() < 0 or
+        std::none_of(assigned.begin(), assigned.end(),
+                     [partition](RdKafka::TopicPartition *current) {
+                       return current->partition() ==
+                                  partition->partition() and
+                              current->topic() == partition->topic();
+                     })) {
+      continue;
+    }
+    auto &stored = storedOffsets[PartitionKey(partition->topic(),
+                                              partition->partition())];
+    stored = std::max(stored, partition->offset());
+  }
+  pendingUpdates.post(PV::uncommitted, storedCount);
+  RdKafka::TopicPartition::destroy(assigned);
+}
+
+void KafkaConsumer::offset_commit_cb(
+    RdKafka::ErrorCode err, std::vector<RdKafka::TopicPartition *> &offsets) {
+  {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (not commitsInFlight.empty()) {
+      auto latency = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() -
+                         commitsInFlight.front())
+                         .count();
+      commitsInFlight.pop_front();
+      pendingUpdates.post(PV::commit_latency, latency);
+    }
+  }
+  bool failed = RdKafka::ERR_NO_ERROR != err and RdKafka::ERR__NO_OFFSET != err;
+  failed = failed or std::any_of(offsets.begin(), offsets.end(),
+                                 [](RdKafka::TopicPartition *partition) {
+                                   return RdKafka::ERR_NO_ERROR !=
+                                          partition->err();
+                                 });
+  if (failed) {
+    // Retried with the next batch
+    RetryCommit(offsets);
+    SetConStat(KafkaConsumer::ConStat::ERROR,
+               "Offset commit failed: " + RdKafka::err2str(err));
+  } else {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    ++commitCount;
+    pendingUpdates.post(PV::commit_count, commitCount);
+  }
+}
+
+void KafkaConsumer::PostAssignment(RdKafka::KafkaConsumer *kafkaConsumer) {
+  std::vector<RdKafka::TopicPartition *> assigned;
+  kafkaConsumer->assignment(assigned);
+  std::vector<std::int32_t> ids;
+  for (auto partition : assigned) {
+    ids.push_back(partition->partition());
+  }
+  RdKafka::TopicPartition::destroy(assigned);
+  std::sort(ids.begin(), ids.end());
+  std::ostringstream list;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    list << (0 == i ? "" : ",") << ids[i];
+  }
+  pendingUpdates.post(PV::assigned_partitions, list.str());
+  pendingUpdates.post(PV::partition_count, static_cast<int>(ids.size()));
+}
+
 void KafkaConsumer::event_cb(RdKafka::Event &event) {
   /// @todo This member function really needs some expanded capability
   switch (event.type()) {
@@ -181,20 +750,77 @@ void KafkaConsumer::ParseStatusString(std::string const &msg) {
     }
     SetConStat(tempStat, statString);
   }
+  auto partitions = root["topics"][topicName]["partitions"];
+  if (partitions.isObject()) {
+    std::int64_t lag{0};
+    bool lagKnown{false};
+    for (auto it = partitions.begin(); it != partitions.end(); ++it) {
+      // Partition "-1" holds messages not yet assigned to a partition
+      auto consumerLag = (*it)["consumer_lag"];
+      if ("-1" == it.key().asString() or not consumerLag.isNumeric() or
+          consumerLag.asInt64() < 0) {
+        continue;
+      }
+      lag += consumerLag.asInt64();
+      lagKnown = true;
+    }
+    if (lagKnown) {
+      UpdatePartitionLag(lag);
+    }
+  }
+}
+
+bool KafkaConsumer::SetLagAlarmThreshold(std::int64_t threshold) {
+  if (threshold < 0) {
+    return false;
+  }
+  lagAlarmThreshold = threshold;
+  PostLagAlarm();
+  return true;
+}
+
+void KafkaConsumer::UpdatePartitionLag(std::int64_t lag) {
+  partitionLag = lag;
+  pendingUpdates.post(PV::partition_lag, lag);
+  PostLagAlarm();
+}
+
+void KafkaConsumer::PostLagAlarm() {
+  auto threshold = lagAlarmThreshold.load();
+  bool alarm = 0 < threshold and partitionLag >= threshold;
+  pendingUpdates.post(PV::lag_alarm, static_cast<int>(alarm));
 }
 
 std::int64_t KafkaConsumer::GetCurrentOffset() { return topicOffset; }
 
 bool KafkaConsumer::UpdateTopic() {
   if (nullptr != consumer and not topicName.empty()) {
+    if (subscribeMode) {
+      // Replaces any current subscription, the partitions are assigned by
+      // rebalance_cb()
+      if (not rebalanceInProgress) {
+        rebalanceInProgress = true;
+        rebalanceStartTime = std::chrono::steady_clock::now();
+      }
+      auto result = consumer->subscribe({topicName});
+      if (RdKafka::ERR_NO_ERROR != result) {
+        SetConStat(KafkaConsumer::ConStat::ERROR,
+                   "Unable to subscribe to topic.");
+        return false;
+      }
+      subscribed = true;
+      return true;
+    }
     consumer->unassign();
     std::vector<RdKafka::TopicPartition *> topics;
     topics.push_back(
         RdKafka::TopicPartition::create(topicName, 0, topicOffset));
     consumer->assign(topics);
-    if (consumptionHalted) {
+    if (consumptionHalted or backpressurePaused) {
       consumer->pause(topics);
     }
+    RdKafka::TopicPartition::destroy(topics);
+    PostAssignment(consumer);
   } else {
     return false;
   }
@@ -202,12 +828,12 @@ bool KafkaConsumer::UpdateTopic() {
 }
 
 void KafkaConsumer::StartConsumption() {
+  stopTimeReached = false;
   if (consumptionHalted) {
+    ResetFirstFrameTime();
     consumptionHalted = false;
-    if (consumer != nullptr) {
-      std::vector<RdKafka::TopicPartition *> topics;
-      consumer->assignment(topics);
-      consumer->resume(topics);
+    if (not backpressurePaused) {
+      SetPartitionsPaused(false);
     }
   }
 }
@@ -215,21 +841,117 @@ void KafkaConsumer::StartConsumption() {
 void KafkaConsumer::StopConsumption() {
   if (not consumptionHalted) {
     consumptionHalted = true;
-    if (consumer != nullptr) {
-      std::vector<RdKafka::TopicPartition *> topics;
-      consumer->assignment(topics);
-      consumer->pause(topics);
+    SetPartitionsPaused(true);
+    CommitOffsets(false);
+  }
+}
+
+void KafkaConsumer::SetPartitionsPaused(bool paused) {
+  if (consumer == nullptr) {
+    return;
+  }
+  std::vector<RdKafka::TopicPartition *> topics;
+  consumer->assignment(topics);
+  if (paused) {
+    consumer->pause(topics);
+  } else {
+    consumer->resume(topics);
+  }
+  RdKafka::TopicPartition::destroy(topics);
+}
+
+int KafkaConsumer::GetUsedBuffers(NDArrayPool *pool) {
+  if (nullptr == pool) {
+    return 0;
+  }
+  return std::max(0, pool->getNumBuffers() - pool->getNumFree());
+}
+
+int KafkaConsumer::GetPoolOccupancy(NDArrayPool *pool, int maxBuffers) {
+  if (nullptr == pool) {
+    return 0;
+  }
+  int usedBuffers = GetUsedBuffers(pool);
+  double occupancy = 0;
+  if (maxBuffers > 0) {
+    occupancy = 100.0 * usedBuffers / maxBuffers;
+  }
+  int numBuffers = pool->getNumBuffers();
+  if (0 != pool->getMaxMemory() and numBuffers > 0) {
+    double usedMemory = static_cast<double>(pool->getMemorySize()) *
+                        usedBuffers / numBuffers;
+    occupancy =
+        std::max(occupancy, 100.0 * usedMemory / pool->getMaxMemory());
+  }
+  return static_cast<int>(occupancy);
+}
+
+void KafkaConsumer::UpdateBackpressure(NDArrayPool *pool, int maxBuffers) {
+  int occupancy = GetPoolOccupancy(pool, maxBuffers);
+  if (allocFailedUsedBuffers > 0 and
+      GetUsedBuffers(pool) < allocFailedUsedBuffers) {
+    // An NDArray has been released since the allocation failed
+    allocFailedUsedBuffers = 0;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (not backpressurePaused and occupancy >= poolHighWatermark) {
+    backpressurePaused = true;
+    pauseStartTime = now;
+    SetPartitionsPaused(true);
+  } else if (backpressurePaused and 0 == allocFailedUsedBuffers and
+             occupancy <= poolLowWatermark) {
+    backpressurePaused = false;
+    totalPausedTime +=
+        std::chrono::duration<double>(now - pauseStartTime).count();
+    if (not consumptionHalted) {
+      SetPartitionsPaused(false);
     }
   }
+  double pausedTime = totalPausedTime;
+  if (backpressurePaused) {
+    pausedTime += std::chrono::duration<double>(now - pauseStartTime).count();
+  }
+  pendingUpdates.post(PV::pool_occupancy, occupancy);
+  pendingUpdates.post(PV::fetch_paused, static_cast<int>(backpressurePaused));
+  pendingUpdates.post(PV::paused_time, pausedTime);
 }
 
-bool KafkaConsumer::MakeConnection() {
-  if (consumer != nullptr) {
-    consumer->unassign();
-    consumer->close();
-    delete consumer;
-    consumer = nullptr;
+void KafkaConsumer::RetryMessage(KafkaMessage &msg, NDArrayPool *pool) {
+  if (consumer == nullptr) {
+    return;
+  }
+  allocFailedUsedBuffers = GetUsedBuffers(pool);
+  if (not backpressurePaused) {
+    backpressurePaused = true;
+    pauseStartTime = std::chrono::steady_clock::now();
+    SetPartitionsPaused(true);
   }
+  std::unique_ptr<RdKafka::TopicPartition> partition(
+      RdKafka::TopicPartition::create(msg.GetTopicName(), msg.GetPartition(),
+                                      msg.GetOffset()));
+  auto result = consumer->seek(*partition, 0);
+  if (RdKafka::ERR_NO_ERROR != result) {
+    SetConStat(KafkaConsumer::ConStat::ERROR,
+               "Unable to rewind, NDArray dropped.");
+  }
+}
+
+bool KafkaConsumer::SetPoolWatermarks(int highPercent, int lowPercent) {
+  if (highPercent <= 0 or highPercent > 100 or lowPercent < 0 or
+      lowPercent >= highPercent) {
+    return false;
+  }
+  poolHighWatermark = highPercent;
+  poolLowWatermark = lowPercent;
+  return true;
+}
+
+bool KafkaConsumer::MakeConnection() {
+  CloseConsumer();
+  rebalanceInProgress = false;
+  pendingUpdates.post(PV::assigned_partitions, std::string());
+  pendingUpdates.post(PV::partition_count, 0);
+  ResetFirstFrameTime();
   if (not brokerAddr.empty()) {
     consumer = RdKafka::KafkaConsumer::create(conf.get(), errstr);
     if (nullptr == consumer) {
@@ -246,7 +968,7 @@ bool KafkaConsumer::SetTopic(std::string const &topicName) {
     return false;
   }
   KafkaConsumer::topicName = topicName;
-  UpdateTopic();
+  RequestTopicUpdate();
   return true;
 }
 
@@ -261,7 +983,7 @@ bool KafkaConsumer::SetBrokerAddr(std::string const &brokerAddr) {
     return false;
   }
   KafkaConsumer::brokerAddr = brokerAddr;
-  MakeConnection();
+  RequestReconnect();
   return true;
 }
 
@@ -278,19 +1000,49 @@ bool KafkaConsumer::SetGroupId(std::string const &groupId) {
     return false;
   }
   groupName = groupId;
-  MakeConnection();
+  RequestReconnect();
   return true;
 }
 
 void KafkaConsumer::SetConStat(ConStat stat, std::string const &msg) {
-  setParam(paramCallback, paramsList[PV::con_status], static_cast<int>(stat));
-  setParam(paramCallback, paramsList[PV::con_msg], msg);
+  pendingUpdates.post(PV::con_status, static_cast<int>(stat));
+  pendingUpdates.post(PV::con_msg, msg);
+}
+
+bool KafkaConsumer::PublishParamUpdates() {
+  if (nullptr == paramCallback) {
+    return false;
+  }
+  return pendingUpdates.publish(paramCallback, paramsList);
 }
 
 void KafkaConsumer::RegisterParamCallbackClass(asynNDArrayDriver *ptr) {
   paramCallback = ptr;
   setParam(paramCallback, paramsList[PV::msg_offset],
-           static_cast<int>(RdKafka::Topic::OFFSET_STORED));
+           static_cast<std::int64_t>(RdKafka::Topic::OFFSET_STORED));
+  setParam(paramCallback, paramsList[PV::partition_lag],
+           static_cast<std::int64_t>(-1));
+  setParam(paramCallback, paramsList[PV::lag_alarm], 0);
+  setParam(paramCallback, paramsList[PV::assigned_partitions], std::string());
+  setParam(paramCallback, paramsList[PV::partition_count], 0);
+  setParam(paramCallback, paramsList[PV::rebalance_time], 0.0);
+  setParam(paramCallback, paramsList[PV::rebalance_count], 0);
+  setParam(paramCallback, paramsList[PV::commit_latency], 0.0);
+  setParam(paramCallback, paramsList[PV::commit_count], 0);
+  setParam(paramCallback, paramsList[PV::commit_failures], 0);
+  setParam(paramCallback, paramsList[PV::uncommitted], 0);
+  auto const &fetchSettings = fetchTuner.Current();
+  setParam(paramCallback, paramsList[PV::fetch_max_bytes],
+           fetchSettings.FetchMaxBytes);
+  setParam(paramCallback, paramsList[PV::partition_fetch_bytes],
+           fetchSettings.MaxPartitionFetchBytes);
+  setParam(paramCallback, paramsList[PV::queued_max_kbytes],
+           fetchSettings.QueuedMaxKBytes);
+  setParam(paramCallback, paramsList[PV::fetch_wait_ms],
+           fetchSettings.FetchWaitMaxMs);
+  setParam(paramCallback, paramsList[PV::fetch_tuning_reason],
+           std::string("Disabled."));
+  setParam(paramCallback, paramsList[PV::retune_count], 0);
 }
 
 bool KafkaConsumer::SetStatsTimeIntervalMS(int timeInterval) {
@@ -306,10 +1058,69 @@ bool KafkaConsumer::SetStatsTimeIntervalMS(int timeInterval) {
     return false;
   }
   kafka_stats_interval = timeInterval;
-  MakeConnection();
+  RequestReconnect();
+  return true;
+}
+
+bool KafkaConsumer::SetAutoApply(bool enable) {
+  autoApply = enable;
+  if (enable) {
+    return ApplyConfiguration();
+  }
+  return true;
+}
+
+bool KafkaConsumer::GetAutoApply() { return autoApply; }
+
+bool KafkaConsumer::ApplyConfiguration() {
+  bool reconnect = reconnectPending;
+  bool updateTopic = topicUpdatePending;
+  reconnectPending = false;
+  topicUpdatePending = false;
+  PostConfigPending();
+  if (reconnect) {
+    // Also assigns the topic
+    return MakeConnection();
+  } else if (updateTopic) {
+    return UpdateTopic();
+  }
+  return true;
+}
+
+bool KafkaConsumer::ConfigurationPending() {
+  return reconnectPending or topicUpdatePending;
+}
+
+bool KafkaConsumer::RequestReconnect() {
+  if (autoApply) {
+    return MakeConnection();
+  }
+  reconnectPending = true;
+  PostConfigPending();
   return true;
 }
 
+bool KafkaConsumer::RequestTopicUpdate() {
+  if (autoApply) {
+    return UpdateTopic();
+  }
+  topicUpdatePending = true;
+  PostConfigPending();
+  return true;
+}
+
+void KafkaConsumer::PostConfigPending() {
+  pendingUpdates.post(PV::config_pending,
+                      static_cast<int>(ConfigurationPending()));
+}
+
+void KafkaConsumer::ResetFirstFrameTime() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  firstFrameStartTime =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+  firstFrameReceived = false;
+}
+
 int KafkaConsumer::GetStatsTimeMS() { return kafka_stats_interval; }
 
 int KafkaConsumer::GetOffsetPVIndex() {
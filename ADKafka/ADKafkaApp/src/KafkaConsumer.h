@@ -7,8 +7,11 @@
 
 #pragma once
 
+#include "FetchTuner.h"
+#include "FrameHeaders.h"
 #include "ParamUtility.h"
 #include "json.h"
+#include <NDArray.h>
 #include <asynNDArrayDriver.h>
 #ifdef _WIN32
 #include <rdkafkacpp.h>
@@ -16,8 +19,14 @@
 #include <librdkafka/rdkafkacpp.h>
 #endif
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 /** @brief The KafkaInterface namespace is used primarily to seperate
@@ -52,6 +61,41 @@ public:
    */
   size_t size();
 
+  /// @brief The offset of the message in its partition.
+  std::int64_t GetOffset();
+
+  /// @brief The partition the message was consumed from.
+  std::int32_t GetPartition();
+
+  /// @brief The name of the topic the message was consumed from.
+  std::string GetTopicName();
+
+  /** @brief The Kafka timestamp of the message, in ms since the Unix epoch.
+   * This is the time the message was appended to the log by the broker if the
+   * topic uses LogAppendTime, otherwise the time it was created by the
+   * producer.
+   * @return The timestamp or -1 if the message has no timestamp.
+   */
+  std::int64_t GetTimestampMs();
+
+  /** @brief Looks up a Kafka message header. Does not access the payload.
+   * @param[in] key The key of the header. If there are several headers with
+   * the same key, the last one is used.
+   * @param[out] value The (binary) value of the header.
+   * @return False if the message has no header with the key.
+   */
+  bool GetHeader(std::string const &key, std::string &value);
+
+  /** @brief Decodes the frame metadata headers attached by ADPluginKafka
+   * (source name, unique id, timestamp, data type, dimensions, size, codec
+   * and schema id), see KafkaInterface::FrameHeaders. Allows messages to be
+   * routed or filtered without accessing the payload.
+   * @param[out] frame The metadata; fields without a header keep their
+   * default value.
+   * @return False if the message has none of the frame metadata headers.
+   */
+  bool GetFrameHeaders(FrameHeaders &frame);
+
 private:
   /// @brief The pointer to the actual RdKafka::Message.
   std::unique_ptr<RdKafka::Message> msg;
@@ -75,7 +119,9 @@ private:
  * @todo Move the callback functionality to a separate class when it is
  * extended.
  */
-class KafkaConsumer : public RdKafka::EventCb {
+class KafkaConsumer : public RdKafka::EventCb,
+                      public RdKafka::RebalanceCb,
+                      public RdKafka::OffsetCommitCb {
 public:
   /** @brief Sets up the class to consume messages from a Kafka broker.
    * @note After calling the constructor, the PV:s must be configured and
@@ -96,9 +142,12 @@ public:
    * one topic can be specified.
    * @param[in] groupId The group id of the consumer, see the documentation for
    * KafkaConsumer::GetGroupId().
+   * @param[in] deferConnection If true, the librdkafka consumer is not created
+   * until KafkaConsumer::ApplyConfiguration() is called, see
+   * KafkaConsumer::SetAutoApply().
    */
   KafkaConsumer(std::string const &broker, std::string const &topic,
-                std::string const &groupId);
+                std::string const &groupId, bool deferConnection = false);
 
   /** @brief Simple consumer constructor which will not connect to a broker.
    * @note After calling the constructor, the PV:s must be configured and
@@ -175,6 +224,125 @@ public:
    */
   virtual std::unique_ptr<KafkaMessage> WaitForPkg(int timeout);
 
+  /** @brief Enables or disables the latest-frame (conflating) consume mode.
+   * In this mode, KafkaConsumer::WaitForPkg() returns the newest available
+   * message instead of the next one in order. Older messages are skipped
+   * without being deserialized and, if the backlog on the broker is larger
+   * than what has already been fetched, the consumer seeks to the newest
+   * message. Intended for live-view where latency matters more than
+   * completeness. Skipped messages are counted in a PV.
+   * @param[in] enable True to only consume the latest message.
+   */
+  virtual void SetLatestFrameMode(bool enable);
+
+  /// @brief Returns true if the latest-frame consume mode is enabled.
+  virtual bool GetLatestFrameMode();
+
+  /** @brief Selects between consuming partition 0 of the topic and
+   * subscribing to the topic as a member of the consumer group.
+   * When subscribed, the group coordinator splits the partitions of the topic
+   * between all consumers with the same group id (using the
+   * cooperative-sticky strategy, i.e. a rebalance only moves the partitions
+   * which have to move) and consumption starts at the offsets committed by
+   * the group. The offsets of revoked partitions are committed before they
+   * are handed over. The offset setting (KafkaConsumer::SetOffset()) is not
+   * used in this mode. Changing the mode re-creates the consumer.
+   * @param[in] enable True to subscribe to the topic.
+   * @return The result of the re-connect.
+   */
+  virtual bool SetSubscribeMode(bool enable);
+
+  /// @brief Returns true if the subscribe (consumer group) mode is selected.
+  virtual bool GetSubscribeMode();
+
+  /** @brief Stores the offset of a message which has been processed, i.e.
+   * passed to the plugins.
+   * Automatic offset storage and commits of librdkafka are disabled; only
+   * stored offsets are committed, so that a restarted consumer resumes after
+   * the last processed message. The stored offsets are committed
+   * asynchronously once KafkaConsumer::SetCommitBatch() messages have been
+   * stored or KafkaConsumer::SetCommitIntervalMS() has passed, whichever
+   * comes first. Must be called by the thread calling
+   * KafkaConsumer::WaitForPkg().
+   * @param[in] topic The topic of the message.
+   * @param[in] partition The partition of the message.
+   * @param[in] offset The offset of the message.
+   */
+  virtual void StoreOffset(std::string const &topic, std::int32_t partition,
+                           std::int64_t offset);
+
+  /** @brief Sets the number of stored offsets after which they are committed.
+   * @param[in] messages The batch size, at least 1.
+   * @return False if the value is not valid.
+   */
+  virtual bool SetCommitBatch(int messages);
+
+  int GetCommitBatch() const { return commitBatch; }
+
+  /** @brief Sets the maximum time between storing an offset and committing it.
+   * @param[in] interval Time in ms, 0 to only commit full batches.
+   * @return False if the value is negative.
+   */
+  virtual bool SetCommitIntervalMS(int interval);
+
+  int GetCommitIntervalMS() const { return commitInterval; }
+
+  /** @brief Enables the automatic tuning of the fetch settings, see
+   * FetchTuner. librdkafka only reads these settings when a consumer is
+   * created: with a partition assigned directly the consumer is re-created at
+   * the current position, in subscribe mode the settings are used from the
+   * next re-connect. Disabling keeps the settings in use.
+   */
+  virtual void SetFetchTuning(bool enable);
+
+  bool GetFetchTuning() const { return fetchTuning; }
+
+  /** @brief Applies the fetch settings recommended by the tuner if a retune
+   * is due, which might re-create the consumer. KafkaConsumer::WaitForPkg()
+   * only marks a retune as pending, as other threads may be using the
+   * consumer at that time. Must be called by the thread calling
+   * KafkaConsumer::WaitForPkg() while no other thread can call into this
+   * class (i.e. while holding the lock of the driver).
+   */
+  void ApplyPendingRetune();
+
+  /** @brief Called by librdkafka, from KafkaConsumer::WaitForPkg(), with the
+   * result of a commit. Posts the commit latency and failure count; the
+   * offsets of failed commits are stored again so that they are retried with
+   * the next batch.
+   */
+  void offset_commit_cb(RdKafka::ErrorCode err,
+                        std::vector<RdKafka::TopicPartition *> &offsets) override;
+
+  /** @brief Called by librdkafka, from KafkaConsumer::WaitForPkg(), when the
+   * group coordinator assigns or revokes partitions in subscribe mode.
+   * Updates the assignment, commits the stored offsets before partitions are
+   * revoked and posts the assigned partitions and the duration of the rebalance.
+   */
+  void rebalance_cb(RdKafka::KafkaConsumer *kafkaConsumer,
+                    RdKafka::ErrorCode err,
+                    std::vector<RdKafka::TopicPartition *> &partitions) override;
+
+  /// @brief Number of messages skipped in latest-frame mode.
+  std::int64_t GetSkippedMessages() const { return skippedMessages; }
+
+  /** @brief Sets the partition lag (in messages) at which the lag alarm PV is
+   * set.
+   * The lag is the difference between the high watermark of the partition and
+   * the offset of the latest consumed message. It is updated for every
+   * consumed message and, also while no messages are consumed, from the
+   * librdkafka statistics (see KafkaConsumer::SetStatsTimeIntervalMS()).
+   * @param[in] threshold The lag threshold, 0 disables the alarm.
+   * @return False if the threshold is negative.
+   */
+  virtual bool SetLagAlarmThreshold(std::int64_t threshold);
+
+  /// @brief Returns the threshold set by KafkaConsumer::SetLagAlarmThreshold().
+  std::int64_t GetLagAlarmThreshold() const { return lagAlarmThreshold; }
+
+  /// @brief The latest known partition lag, -1 if not yet known.
+  std::int64_t GetPartitionLag() const { return partitionLag; }
+
   /** @brief Start the consumption of messages.
    * KafkaInterface::KafkaConsumer does not start consumption automatically.
    * This function must be
@@ -214,6 +382,54 @@ public:
    */
   virtual bool SetOffset(std::int64_t offset);
 
+  /** @brief Sets the message offset to that of the first message with a
+   * timestamp equal to or later than the given time.
+   * Uses librdkafka's offsetsForTimes() to look the offset up on the broker,
+   * so that consumption can start in the middle of a large topic immediately.
+   * If there is no such message, the offset is set to the end of the
+   * partition. Blocks for at most KafkaConsumer::offsetLookupTimeout ms.
+   * @param[in] timestampMs Time in milliseconds since the Unix epoch.
+   * @return True on success, false if the lookup failed.
+   */
+  virtual bool SetOffsetFromTime(std::int64_t timestampMs);
+
+  /** @brief Sets a time after which no more messages are returned.
+   * When KafkaConsumer::WaitForPkg() receives a message with a timestamp later
+   * than this time, the message is dropped and
+   * KafkaConsumer::StopTimeReached() returns true until consumption is
+   * restarted.
+   * @param[in] timestampMs Time in milliseconds since the Unix epoch. A value
+   * of 0 disables the stop time.
+   */
+  virtual void SetStopTime(std::int64_t timestampMs);
+
+  /// @brief Returns the stop time, see KafkaConsumer::SetStopTime().
+  virtual std::int64_t GetStopTime();
+
+  /// @brief True if a message later than the stop time has been received.
+  virtual bool StopTimeReached();
+
+  /** @brief Sets if configuration changes are applied immediately.
+   * If false, changes of the broker address, group id, stats interval, topic
+   * and offset are only stored and are applied together by
+   * KafkaConsumer::ApplyConfiguration(), which re-creates the consumer (or
+   * only re-assigns the topic) at most once. Setting this to true applies any
+   * pending changes.
+   * @param[in] enable True to apply changes immediately.
+   * @return The result of KafkaConsumer::ApplyConfiguration() or true.
+   */
+  virtual bool SetAutoApply(bool enable);
+
+  virtual bool GetAutoApply();
+
+  /** @brief Applies pending configuration changes.
+   * @return True on success or if there was nothing to apply.
+   */
+  virtual bool ApplyConfiguration();
+
+  /// @brief True if there are configuration changes not yet applied.
+  virtual bool ConfigurationPending();
+
   /** @brief Used by the driver class in order for it to be able set the message
    * offset.
    * @return The PV index used to set or get the current offset value in the PV
@@ -282,6 +498,69 @@ public:
    */
   static int GetNumberOfPVs();
 
+  /** @brief Writes the PV values posted by librdkafka callbacks and the
+   * consumer thread to the parameter library.
+   * Status and offset updates are posted without taking the port lock, see
+   * PendingParamUpdates. This member function must be called periodically by
+   * a single thread holding the port lock. Does not call
+   * asynPortDriver::callParamCallbacks().
+   * @return True if any PV was updated.
+   */
+  virtual bool PublishParamUpdates();
+
+  /** @brief Pauses or resumes fetching of messages based on how full the
+   * NDArrayPool of the driver is.
+   * Fetching is paused when the occupancy reaches the high watermark and
+   * resumed when it has dropped to the low watermark, see
+   * KafkaConsumer::SetPoolWatermarks(). While paused, messages are kept by the
+   * broker instead of being fetched and dropped when no NDArray can be
+   * allocated. Must be called by the thread calling KafkaConsumer::WaitForPkg()
+   * before every call to it. Also updates the occupancy and paused time PV:s.
+   * @param[in] pool The pool from which the driver allocates NDArrays.
+   * @param[in] maxBuffers The maximum number of NDArrays of the driver, 0 if
+   * not limited. See KafkaConsumer::GetPoolOccupancy().
+   */
+  virtual void UpdateBackpressure(NDArrayPool *pool, int maxBuffers);
+
+  /** @brief Pauses fetching and rewinds to a message which could not be
+   * handled as no NDArray could be allocated.
+   * The message will be consumed again once fetching has been resumed by
+   * KafkaConsumer::UpdateBackpressure(), which does not happen before one of
+   * the NDArrays in use has been released.
+   * @param[in] msg The message which should be consumed again.
+   * @param[in] pool The pool from which the allocation failed.
+   */
+  virtual void RetryMessage(KafkaMessage &msg, NDArrayPool *pool);
+
+  /** @brief Sets the pool occupancy thresholds used by
+   * KafkaConsumer::UpdateBackpressure().
+   * @param[in] highPercent Occupancy (in percent of the maximum amount of
+   * NDArrayPool memory) at which fetching is paused.
+   * @param[in] lowPercent Occupancy at which fetching is resumed. Must be
+   * lower than highPercent.
+   * @return True on success, false if the values are not valid.
+   */
+  virtual bool SetPoolWatermarks(int highPercent, int lowPercent);
+
+  /// @brief Returns true if fetching is paused due to backpressure.
+  bool IsBackpressurePaused() const { return backpressurePaused; }
+
+  /** @brief The fraction of the maximum NDArrayPool memory or of the maximum
+   * number of NDArrays which is in use, in percent, whichever is larger.
+   * NDArrayPool only keeps track of the total amount of memory allocated,
+   * including arrays in its free list. The memory in use is therefore
+   * estimated assuming that all arrays have the same size, which is the case
+   * for a stream of frames from a detector.
+   * @param[in] maxBuffers The maximum number of NDArrays the driver was
+   * configured with, which NDArrayPool does not keep. 0 if not limited.
+   * @return The occupancy or 0 if neither the memory nor the number of
+   * NDArrays is limited.
+   */
+  static int GetPoolOccupancy(NDArrayPool *pool, int maxBuffers = 0);
+
+  /// @brief The number of NDArrays of the pool which are in use.
+  static int GetUsedBuffers(NDArrayPool *pool);
+
 protected:
   /** @brief I set to tru if initialization of librdkafka fails. Only changed by
    * KafkaConsumer::InitRdKafka().
@@ -291,6 +570,200 @@ protected:
   /// @brief Used keep track of if consumption is currently halted.
   bool consumptionHalted{true};
 
+  /** @brief Set while fetching is paused because the NDArrayPool is (nearly)
+   * exhausted. Only changed by the consumer thread.
+   */
+  bool backpressurePaused{false};
+
+  /** @brief The number of NDArrays in use when an allocation last failed or 0.
+   * Fetching is not resumed while set, it is cleared once fewer NDArrays are
+   * in use. Only changed by the consumer thread.
+   */
+  int allocFailedUsedBuffers{0};
+
+  /// @brief Pool occupancy (%) at which fetching is paused.
+  std::atomic<int> poolHighWatermark{90};
+
+  /// @brief Pool occupancy (%) at which fetching is resumed.
+  std::atomic<int> poolLowWatermark{70};
+
+  /// @brief Time at which fetching was last paused due to backpressure.
+  std::chrono::steady_clock::time_point pauseStartTime;
+
+  /// @brief Total time (in seconds) of completed backpressure pauses.
+  double totalPausedTime{0};
+
+  /// @brief Pauses or resumes all assigned partitions.
+  void SetPartitionsPaused(bool paused);
+
+  /// @brief Set if only the latest message should be consumed.
+  std::atomic<bool> latestFrameMode{false};
+
+  /// @brief See KafkaConsumer::SetSubscribeMode().
+  bool subscribeMode{false};
+
+  /// @brief True while the current librdkafka consumer is subscribed.
+  std::atomic<bool> subscribed{false};
+
+  /// @brief Set from a revoke (or a new subscription) until the next assign.
+  bool rebalanceInProgress{false};
+
+  /// @brief Start of the rebalance in progress.
+  std::chrono::steady_clock::time_point rebalanceStartTime;
+
+  /// @brief Number of completed rebalances.
+  int rebalanceCount{0};
+
+  /// @brief Posts the partitions currently assigned to the consumer.
+  void PostAssignment(RdKafka::KafkaConsumer *kafkaConsumer);
+
+  /// @brief Topic and partition of a stored offset.
+  using PartitionKey = std::pair<std::string, std::int32_t>;
+
+  /** @brief Guards the offsets to commit, the commits in flight and the
+   * commit counters. The offsets are stored and committed by the thread
+   * calling KafkaConsumer::WaitForPkg() (also from the librdkafka callbacks),
+   * but also committed and cleared by the port thread when re-connecting.
+   * Not held while calling into librdkafka.
+   */
+  std::mutex commitMutex;
+
+  /// @brief Offsets to commit, i.e. the offset after the last processed one.
+  std::map<PartitionKey, std::int64_t> storedOffsets;
+
+  /// @brief Number of offsets stored since the last commit.
+  int storedCount{0};
+
+  /// @brief See KafkaConsumer::SetCommitBatch().
+  std::atomic<int> commitBatch{100};
+
+  /// @brief See KafkaConsumer::SetCommitIntervalMS().
+  std::atomic<int> commitInterval{1000};
+
+  /// @brief Time the first offset of the current batch was stored.
+  std::chrono::steady_clock::time_point firstStoreTime;
+
+  /// @brief Send times of the asynchronous commits not yet acknowledged.
+  std::deque<std::chrono::steady_clock::time_point> commitsInFlight;
+
+  int commitCount{0};
+  int commitFailures{0};
+
+  /** @brief Counts a failed commit and stores the offsets again, except for
+   * partitions no longer assigned, so that they are retried with the next
+   * batch.
+   */
+  void RetryCommit(std::vector<RdKafka::TopicPartition *> const &offsets);
+
+  /// @brief Commits the stored offsets if the batch is full or due.
+  void CommitIfDue();
+
+  /** @brief Commits the stored offsets.
+   * @param[in] synchronous Wait for the result, used before partitions are
+   * handed over to another consumer or the consumer is closed.
+   */
+  void CommitOffsets(bool synchronous);
+
+  /// @brief Unassigns (if not subscribed), closes and deletes the consumer.
+  void CloseConsumer();
+
+  /// @brief See KafkaConsumer::SetFetchTuning().
+  std::atomic<bool> fetchTuning{false};
+
+  /// @brief Only used by the thread calling KafkaConsumer::WaitForPkg().
+  FetchTuner fetchTuner;
+
+  /// @brief Last time the fetch tuner was asked for a recommendation.
+  std::chrono::steady_clock::time_point lastTuneCheck;
+
+  int retuneCount{0};
+
+  /// @brief Set when the tuner has new settings, see ApplyPendingRetune().
+  bool retunePending{false};
+
+  /** @brief Asks the fetch tuner for new settings about once per second and
+   * marks a retune as pending if one is due.
+   */
+  void TuneFetchSettings();
+
+  /** @brief Sets the fetch settings in the configuration and re-creates the
+   * consumer at its current position (unless subscribed).
+   * @return False if the settings could not be set.
+   */
+  bool ApplyFetchSettings(FetchSettings const &settings);
+
+  /// @brief Posts the fetch settings in use.
+  void PostFetchSettings();
+
+  /// @brief Messages skipped in latest-frame mode.
+  std::int64_t skippedMessages{0};
+
+  /// @brief See KafkaConsumer::SetLagAlarmThreshold().
+  std::atomic<std::int64_t> lagAlarmThreshold{0};
+
+  /// @brief See KafkaConsumer::GetPartitionLag().
+  std::atomic<std::int64_t> partitionLag{-1};
+
+  /** @brief Stores and posts a new partition lag value and the resulting
+   * state of the lag alarm. Never blocks, may be called from librdkafka
+   * callbacks.
+   */
+  void UpdatePartitionLag(std::int64_t lag);
+
+  /// @brief Posts the lag alarm PV based on the current lag and threshold.
+  void PostLagAlarm();
+
+  /// @brief See KafkaConsumer::SetStopTime().
+  std::atomic<std::int64_t> stopTime{0};
+
+  /// @brief Set by the consumer thread when the stop time has been reached.
+  std::atomic<bool> stopTimeReached{false};
+
+  /// @brief Time (ms) to wait for the broker in SetOffsetFromTime().
+  int offsetLookupTimeout{2000};
+
+  /// @brief See KafkaConsumer::SetAutoApply().
+  bool autoApply{true};
+
+  /// @brief Set when a change requiring a new consumer has not been applied.
+  bool reconnectPending{false};
+
+  /// @brief Set when a topic or offset change has not been applied.
+  bool topicUpdatePending{false};
+
+  /** @brief Calls KafkaConsumer::MakeConnection() if auto-apply is enabled,
+   * otherwise marks the configuration as pending.
+   */
+  bool RequestReconnect();
+
+  /** @brief Calls KafkaConsumer::UpdateTopic() if auto-apply is enabled,
+   * otherwise marks the topic assignment as pending.
+   */
+  bool RequestTopicUpdate();
+
+  /// @brief Posts the value of the config pending PV.
+  void PostConfigPending();
+
+  /** @brief Restarts the time-to-first-frame measurement. Called when the
+   * consumer is re-created and when consumption is started.
+   */
+  void ResetFirstFrameTime();
+
+  /// @brief Start of the time-to-first-frame measurement, in steady clock ns.
+  std::atomic<std::int64_t> firstFrameStartTime{0};
+
+  /// @brief Set when the first message after a reset has been received.
+  std::atomic<bool> firstFrameReceived{false};
+
+  /** @brief Replaces a consumed message with the newest available message
+   * from the same partition. Used in latest-frame mode.
+   * @param[in] msg A successfully consumed message, ownership is taken.
+   * @param[in] timeout Time to wait for a message after seeking to the end of
+   * the partition.
+   * @return The newest message or nullptr if none was received after a seek.
+   */
+  RdKafka::Message *SkipToLatest(RdKafka::Message *msg, int timeout);
+
   size_t bufferSize{100000000};
 
   /** @brief Used to store the current message offset. Updated by
@@ -312,7 +785,9 @@ protected:
   };
 
   /** @brief Sets the status PV:s with a status id and status string.
-   * Is not guaranteed to actually set any PV:s if they are not initialized.
+   * Never blocks and may be called from librdkafka callbacks as the values are
+   * only posted, see KafkaConsumer::PublishParamUpdates(). Is not guaranteed
+   * to actually set any PV:s if they are not initialized.
    * @param[in] stat The integer value representing the current status of the
    * Kafka system.
    * Should be a KafkaPlugin::ConStat enum value.
@@ -358,7 +833,8 @@ protected:
    * librdkafka buffer and
    * if the number of connected brokers are 0. Based on this it sets the
    * relevant PVs containing
-   * the number of packets in the buffer and connection status.
+   * the number of packets in the buffer and connection status. The partition
+   * lag is the sum of the consumer lag of the partitions of the current topic.
    */
   virtual void ParseStatusString(std::string const &msg);
 
@@ -414,6 +890,29 @@ protected:
     con_status,
     con_msg,
     msg_offset,
+    msg_buffer_size,
+    pool_occupancy,
+    fetch_paused,
+    paused_time,
+    skipped_frames,
+    config_pending,
+    time_to_first_frame,
+    partition_lag,
+    lag_alarm,
+    assigned_partitions,
+    partition_count,
+    rebalance_time,
+    rebalance_count,
+    commit_latency,
+    commit_count,
+    commit_failures,
+    uncommitted,
+    fetch_max_bytes,
+    partition_fetch_bytes,
+    queued_max_kbytes,
+    fetch_wait_ms,
+    fetch_tuning_reason,
+    retune_count,
     count,
   };
 
@@ -422,8 +921,37 @@ protected:
       PV_param("KAFKA_MAX_MSG_SIZE", asynParamInt32),       // max_msg_size
       PV_param("KAFKA_CONNECTION_STATUS", asynParamInt32),  // con_status
       PV_param("KAFKA_CONNECTION_MESSAGE", asynParamOctet), // con_msg
-      PV_param("KAFKA_CURRENT_OFFSET", asynParamInt32),     // msg_offset
+      PV_param("KAFKA_CURRENT_OFFSET", asynParamInt64),     // msg_offset
       PV_param("KAFKA_MSG_BUFFER_SIZE", asynParamInt32),    // msg_buffer_size
+      PV_param("KAFKA_POOL_OCCUPANCY", asynParamInt32),     // pool_occupancy
+      PV_param("KAFKA_FETCH_PAUSED", asynParamInt32),       // fetch_paused
+      PV_param("KAFKA_PAUSED_TIME", asynParamFloat64),      // paused_time
+      PV_param("KAFKA_SKIPPED_FRAMES", asynParamInt32),     // skipped_frames
+      PV_param("KAFKA_CONFIG_PENDING", asynParamInt32),     // config_pending
+      PV_param("KAFKA_TIME_TO_FIRST_FRAME",
+               asynParamFloat64), // time_to_first_frame
+      PV_param("KAFKA_PARTITION_LAG", asynParamInt64), // partition_lag
+      PV_param("KAFKA_LAG_ALARM", asynParamInt32),     // lag_alarm
+      PV_param("KAFKA_ASSIGNED_PARTITIONS",
+               asynParamOctet),                          // assigned_partitions
+      PV_param("KAFKA_PARTITION_COUNT", asynParamInt32), // partition_count
+      PV_param("KAFKA_REBALANCE_TIME", asynParamFloat64), // rebalance_time
+      PV_param("KAFKA_REBALANCE_COUNT", asynParamInt32),  // rebalance_count
+      PV_param("KAFKA_COMMIT_LATENCY", asynParamFloat64), // commit_latency
+      PV_param("KAFKA_COMMIT_COUNT", asynParamInt32),     // commit_count
+      PV_param("KAFKA_COMMIT_FAILURES", asynParamInt32),  // commit_failures
+      PV_param("KAFKA_UNCOMMITTED", asynParamInt32),      // uncommitted
+      PV_param("KAFKA_FETCH_MAX_BYTES", asynParamInt32),  // fetch_max_bytes
+      PV_param("KAFKA_PARTITION_FETCH_BYTES",
+               asynParamInt32), // partition_fetch_bytes
+      PV_param("KAFKA_QUEUED_MAX_KBYTES", asynParamInt32), // queued_max_kbytes
+      PV_param("KAFKA_FETCH_WAIT_MS", asynParamInt32),     // fetch_wait_ms
+      PV_param("KAFKA_FETCH_TUNING_REASON",
+               asynParamOctet),                       // fetch_tuning_reason
+      PV_param("KAFKA_RETUNE_COUNT", asynParamInt32), // retune_count
   };
+
+  /// @brief PV values waiting to be published, indexed by KafkaConsumer::PV.
+  PendingParamUpdates pendingUpdates{PV::count};
 };
 } // namespace KafkaInterface
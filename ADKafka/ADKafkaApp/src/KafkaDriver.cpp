@@ -8,17 +8,37 @@
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
 #include <epicsTime.h>
+#include <errlog.h>
+#include <initHooks.h>
 #include <iocsh.h>
 
+#include <algorithm>
 #include <asynDriver.h>
 #include <cassert>
+#include <chrono>
 #include <ciso646>
 #include <epicsExport.h>
+#include <limits>
+#include <vector>
 #include "KafkaDriver.h"
 #include "NDArrayDeSerializer.h"
+#include "ThreadPlacement.h"
+#include "Tracing.h"
 
 static const char *driverName = "KafkaDriver";
 
+/// @brief All drivers, used to notify them when the IOC has been started.
+static std::vector<KafkaDriver *> driverInstances;
+
+/// @brief Converts seconds since the EPICS epoch to ms since the Unix epoch.
+static std::int64_t EpicsSecondsToUnixMs(double epicsSeconds) {
+  if (epicsSeconds <= 0) {
+    return 0;
+  }
+  return static_cast<std::int64_t>((epicsSeconds + POSIX_TIME_AT_EPICS_EPOCH) *
+                                   1000.0);
+}
+
 asynStatus KafkaDriver::writeOctet(asynUser *pasynUser, const char *value,
                                    size_t nChars, size_t *nActual) {
   int addr = 0;
@@ -40,6 +60,12 @@ asynStatus KafkaDriver::writeOctet(asynUser *pasynUser, const char *value,
     consumer.SetTopic(std::string(value, nChars));
   } else if (function == *paramsList.at(PV::kafka_group).index) {
     consumer.SetGroupId(std::string(value, nChars));
+  } else if (function == *paramsList.at(PV::demux_source).index) {
+    setStringParam(addr, function, std::string(value, nChars).c_str());
+    updateSourceAddresses();
+  } else if (function == *paramsList.at(PV::replay_path).index) {
+    // Written by a waveform record, i.e. not necessarily null terminated
+    setStringParam(addr, function, std::string(value, nChars).c_str());
   } else if (function < MIN_PARAM_INDEX) {
     ADDriver::writeOctet(pasynUser, value, nChars, nActual);
   }
@@ -93,8 +119,8 @@ asynStatus KafkaDriver::writeInt32(asynUser *pasynUser, epicsInt32 value) {
   if (function == *paramsList[set_offset].index) {
     int cOffsetSetting;
     getIntegerParam(*paramsList[set_offset].index, &cOffsetSetting);
-    // If new start offset value is one of 4 different
-    if (value >= 0 and value <= 3) {
+    // If new start offset value is one of 5 different
+    if (value >= 0 and value <= 4) {
       // Map start offset settings to the ones used by RdKafka.
       if (KafkaDriver::Beginning == value) {
         consumer.SetOffset(RdKafka::Topic::OFFSET_BEGINNING);
@@ -103,24 +129,85 @@ asynStatus KafkaDriver::writeInt32(asynUser *pasynUser, epicsInt32 value) {
       } else if (KafkaDriver::Stored == value) {
         consumer.SetOffset(RdKafka::Topic::OFFSET_STORED);
       } else if (KafkaDriver::Manual == value) {
-        int cOffsetValue;
-        getIntegerParam(consumer.GetOffsetPVIndex(), &cOffsetValue);
+        epicsInt64 cOffsetValue;
+        getInteger64Param(consumer.GetOffsetPVIndex(), &cOffsetValue);
         consumer.SetOffset(cOffsetValue);
+      } else if (KafkaDriver::Time == value) {
+        double startTime;
+        getDoubleParam(*paramsList[start_time].index, &startTime);
+        consumer.SetOffsetFromTime(EpicsSecondsToUnixMs(startTime));
       }
       usedOffsetSetting = OffsetSetting(value);
     } else {
       value = cOffsetSetting;
     }
-  } else if (function == consumer.GetOffsetPVIndex()) {
-    if (KafkaDriver::Manual == usedOffsetSetting) {
-      consumer.SetOffset(value);
-    } else {
-      getIntegerParam(consumer.GetOffsetPVIndex(), &value);
-    }
   } else if (function == *paramsList[stats_time].index) {
     if (value > 0) {
       consumer.SetStatsTimeIntervalMS(value);
     }
+  } else if (function == *paramsList[pool_high].index or
+             function == *paramsList[pool_low].index) {
+    int highValue, lowValue;
+    getIntegerParam(*paramsList[pool_high].index, &highValue);
+    getIntegerParam(*paramsList[pool_low].index, &lowValue);
+    int oldValue = (function == *paramsList[pool_high].index) ? highValue
+                                                              : lowValue;
+    if (function == *paramsList[pool_high].index) {
+      highValue = value;
+    } else {
+      lowValue = value;
+    }
+    if (not consumer.SetPoolWatermarks(highValue, lowValue)) {
+      value = oldValue;
+    }
+  } else if (function == *paramsList[consume_mode].index) {
+    if (KafkaDriver::AllFrames == value or KafkaDriver::LatestFrame == value) {
+      consumer.SetLatestFrameMode(KafkaDriver::LatestFrame == value);
+    } else {
+      value = consumer.GetLatestFrameMode() ? KafkaDriver::LatestFrame
+                                            : KafkaDriver::AllFrames;
+    }
+  } else if (function == *paramsList[commit_batch].index) {
+    if (not consumer.SetCommitBatch(value)) {
+      value = consumer.GetCommitBatch();
+    }
+  } else if (function == *paramsList[commit_interval].index) {
+    if (not consumer.SetCommitIntervalMS(value)) {
+      value = consumer.GetCommitIntervalMS();
+    }
+  } else if (function == *paramsList[fetch_tuning].index) {
+    value = (value != 0);
+    consumer.SetFetchTuning(value != 0);
+  } else if (function == *paramsList[assign_mode].index) {
+    if (KafkaDriver::Partition0 == value or
+        KafkaDriver::ConsumerGroup == value) {
+      consumer.SetSubscribeMode(KafkaDriver::ConsumerGroup == value);
+    } else {
+      value = consumer.GetSubscribeMode() ? KafkaDriver::ConsumerGroup
+                                          : KafkaDriver::Partition0;
+    }
+  } else if (function == *paramsList[auto_apply].index) {
+    value = (value != 0);
+    if (iocIsRunning and not consumer.SetAutoApply(value != 0)) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:writeInt32: Unable to apply configuration.\n", driverName);
+    }
+  } else if (function == *paramsList[lag_threshold].index) {
+    if (not consumer.SetLagAlarmThreshold(value)) {
+      value = static_cast<epicsInt32>(consumer.GetLagAlarmThreshold());
+    }
+  } else if (function == *paramsList[data_source].index) {
+    if (KafkaDriver::Kafka != value and KafkaDriver::File != value) {
+      getIntegerParam(function, &value);
+    }
+  } else if (function == *paramsList[replay_loop].index) {
+    value = (value != 0);
+  } else if (function == *paramsList[apply].index) {
+    if (not consumer.ApplyConfiguration()) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:writeInt32: Unable to apply configuration.\n", driverName);
+    }
+    value = 0;
   }
   /* Set the parameter and readback in the parameter library.  This may be
    * overwritten when we
@@ -163,23 +250,84 @@ asynStatus KafkaDriver::writeInt32(asynUser *pasynUser, epicsInt32 value) {
   return status;
 }
 
+asynStatus KafkaDriver::writeInt64(asynUser *pasynUser, epicsInt64 value) {
+  int function = pasynUser->reason;
+  asynStatus status = asynSuccess;
+
+  if (function == consumer.GetOffsetPVIndex()) {
+    if (KafkaDriver::Manual == usedOffsetSetting) {
+      if (not consumer.SetOffset(value)) {
+        status = asynError;
+      }
+    } else {
+      status = asynError;
+    }
+    getInteger64Param(function, &value);
+  } else {
+    return ADDriver::writeInt64(pasynUser, value);
+  }
+  callParamCallbacks();
+  if (status != asynSuccess) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:writeInt64 error, status=%d function=%d, value=%lld\n",
+              driverName, status, function, static_cast<long long>(value));
+  }
+  return status;
+}
+
+asynStatus KafkaDriver::writeFloat64(asynUser *pasynUser, epicsFloat64 value) {
+  int function = pasynUser->reason;
+
+  if (function == *paramsList[start_time].index) {
+    setDoubleParam(function, value);
+    if (KafkaDriver::Time == usedOffsetSetting) {
+      consumer.SetOffsetFromTime(EpicsSecondsToUnixMs(value));
+    }
+  } else if (function == *paramsList[stop_time].index) {
+    setDoubleParam(function, value);
+    consumer.SetStopTime(EpicsSecondsToUnixMs(value));
+  } else if (function == *paramsList[replay_speed].index) {
+    // Used when the next replay is started
+    if (value < 0) {
+      callParamCallbacks();
+      return asynError;
+    }
+    setDoubleParam(function, value);
+  } else {
+    return ADDriver::writeFloat64(pasynUser, value);
+  }
+  callParamCallbacks();
+  return asynSuccess;
+}
+
 static void consumeTaskC(void *drvPvt) {
   auto *pPvt = reinterpret_cast<KafkaDriver *>(drvPvt);
 
   pPvt->consumeTask();
 }
 
+static void statusTaskC(void *drvPvt) {
+  auto *pPvt = reinterpret_cast<KafkaDriver *>(drvPvt);
+
+  pPvt->statusTask();
+}
+
 KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
                          int priority, int stackSize, const char *brokerAddress,
-                         const char *brokerTopic)
+                         const char *brokerTopic, int numAddresses)
     // Invoke the base class constructor
-    : ADDriver(portName, 1,
+    : ADDriver(portName, std::max(1, numAddresses),
                KafkaInterface::KafkaConsumer::GetNumberOfPVs() + PV::count,
-               maxBuffers, maxMemory, 0,
-               0,    /* No interfaces beyond those set in ADDriver.cpp */
-               0, 1, /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=0, autoConnect=1 */
+               maxBuffers, maxMemory,
+               /* For the 64-bit message offset and the latency histograms */
+               asynInt64Mask | asynInt32ArrayMask | asynFloat64ArrayMask,
+               asynInt64Mask | asynInt32ArrayMask | asynFloat64ArrayMask,
+               /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE if several sources */
+               numAddresses > 1 ? ASYN_MULTIDEVICE : 0, 1, /* autoConnect=1 */
                priority, stackSize),
-      consumer(brokerAddress, brokerTopic, asynPortDriver::portName) {
+      numAddresses(std::max(1, numAddresses)), maxBuffers(maxBuffers),
+      // The consumer is created once the IOC is running, see iocRunning()
+      consumer(brokerAddress, brokerTopic, asynPortDriver::portName, true) {
 
   const char *functionName = "KafkaDriver";
   int status{asynStatus::asynSuccess};
@@ -204,11 +352,20 @@ KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
     return;
   }
 
+  statusStopEventId_ = epicsEventCreate(epicsEventEmpty);
+  statusExitEventId_ = epicsEventCreate(epicsEventEmpty);
+  if (statusStopEventId_ == nullptr or statusExitEventId_ == nullptr) {
+    printf("%s:%s epicsEventCreate failure for status events\n", driverName,
+           functionName);
+    return;
+  }
+
   MIN_PARAM_INDEX = InitPvParams(this, paramsList);
 
   // The following two calls must be made in this particular order
   InitPvParams(this, consumer.GetParams());
   consumer.RegisterParamCallbackClass(this);
+  driverInstances.push_back(this);
 
   // Set start values in the PV database.
   status = setParam(this, paramsList.at(PV::kafka_addr), brokerAddress);
@@ -218,6 +375,49 @@ KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
   status |=
       setParam(this, paramsList.at(PV::stats_time), consumer.GetStatsTimeMS());
   status |= setParam(this, paramsList.at(PV::set_offset), usedOffsetSetting);
+  status |= setParam(this, paramsList.at(PV::pool_high), 90);
+  status |= setParam(this, paramsList.at(PV::pool_low), 70);
+  consumer.SetPoolWatermarks(90, 70);
+  status |= setParam(this, paramsList.at(PV::consume_mode),
+                     KafkaDriver::AllFrames);
+  status |= setParam(this, paramsList.at(PV::assign_mode),
+                     KafkaDriver::Partition0);
+  status |= setParam(this, paramsList.at(PV::commit_batch),
+                     consumer.GetCommitBatch());
+  status |= setParam(this, paramsList.at(PV::commit_interval),
+                     consumer.GetCommitIntervalMS());
+  status |= setParam(this, paramsList.at(PV::fetch_tuning),
+                     static_cast<int>(consumer.GetFetchTuning()));
+  status |= setParam(this, paramsList.at(PV::start_time), 0.0);
+  status |= setParam(this, paramsList.at(PV::stop_time), 0.0);
+  status |= setParam(this, paramsList.at(PV::auto_apply), 1);
+  status |= setParam(this, paramsList.at(PV::apply), 0);
+  status |= setParam(this, paramsList.at(PV::decode_time), 0.0);
+  status |= setParam(this, paramsList.at(PV::decode_time_max), 0.0);
+  status |= setParam(this, paramsList.at(PV::frame_rate), 0.0);
+  status |= setParam(this, paramsList.at(PV::byte_rate), 0.0);
+  status |= setParam(this, paramsList.at(PV::lag_threshold), 0);
+  status |= setParam(this, paramsList.at(PV::data_source), KafkaDriver::Kafka);
+  status |= setParam(this, paramsList.at(PV::replay_path), std::string("."));
+  status |= setParam(this, paramsList.at(PV::replay_speed), 1.0);
+  status |= setParam(this, paramsList.at(PV::replay_loop), 0);
+  status |= setParam(this, paramsList.at(PV::replay_file_count), 0);
+  status |= setParam(this, paramsList.at(PV::replay_progress), 0.0);
+  status |= setParam(this, paramsList.at(PV::demux_unmapped), 0);
+  sourceFrames.assign(this->numAddresses, 0);
+  lastSourceFrames.assign(this->numAddresses, 0);
+  for (int addr = 0; addr < this->numAddresses; ++addr) {
+    status |= setStringParam(addr, *paramsList.at(PV::demux_source).index, "");
+    status |=
+        setDoubleParam(addr, *paramsList.at(PV::demux_frame_rate).index, 0.0);
+    status |=
+        setIntegerParam(addr, *paramsList.at(PV::demux_frame_count).index, 0);
+  }
+  for (auto p : {PV::broker_latency_p50, PV::broker_latency_p90,
+                 PV::broker_latency_p99, PV::source_latency_p50,
+                 PV::source_latency_p90, PV::source_latency_p99}) {
+    status |= setParam(this, paramsList.at(p), 0.0);
+  }
 
   // Array callbacks are required to send data to plugins
   setIntegerParam(NDArrayCallbacks, 1);
@@ -227,10 +427,17 @@ KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
     return;
   }
 
-  /* Create the thread that updates the images */
+  /* Create the thread that updates the images, with the same defaults as
+   * asynManager */
+  auto consumePriority =
+      0 == priority ? static_cast<unsigned int>(epicsThreadPriorityMedium)
+                    : static_cast<unsigned int>(priority);
+  auto consumeStackSize =
+      0 == stackSize ? epicsThreadGetStackSize(epicsThreadStackMedium)
+                     : static_cast<unsigned int>(stackSize);
   auto CreateThreadSuccess = (
-      epicsThreadCreate("ConsumeKafkaMsgsTask", epicsThreadPriorityMedium,
-                        epicsThreadGetStackSize(epicsThreadStackMedium),
+      epicsThreadCreate("ConsumeKafkaMsgsTask", consumePriority,
+                        consumeStackSize,
                         reinterpret_cast<EPICSTHREADFUNC>(consumeTaskC),
                         this) != nullptr );
   if (not CreateThreadSuccess) {
@@ -238,6 +445,149 @@ KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
            functionName);
     return;
   }
+
+  statusTaskStarted =
+      (epicsThreadCreate("KafkaConsumerStatusTask", epicsThreadPriorityLow,
+                         epicsThreadGetStackSize(epicsThreadStackSmall),
+                         reinterpret_cast<EPICSTHREADFUNC>(statusTaskC),
+                         this) != nullptr);
+  if (not statusTaskStarted) {
+    printf("%s:%s epicsThreadCreate failure for status task\n", driverName,
+           functionName);
+    return;
+  }
+}
+
+void KafkaDriver::statusTask() {
+  double timeSinceStats{0};
+  while (epicsEventWaitWithTimeout(statusStopEventId_, statusUpdatePeriod) ==
+         epicsEventWaitTimeout) {
+    this->lock();
+    bool updated = consumer.PublishParamUpdates();
+    timeSinceStats += statusUpdatePeriod;
+    if (timeSinceStats >= decodeStatsPeriod) {
+      timeSinceStats = 0;
+      publishDecodeStats();
+      publishLatencyStats();
+      publishDemuxStats();
+      updated = true;
+    }
+    if (updated) {
+      callParamCallbacks();
+    }
+    this->unlock();
+  }
+  epicsEventSignal(statusExitEventId_);
+}
+
+void KafkaDriver::publishDecodeStats() {
+  auto summary = decodeStats.summarize();
+  setParam(this, paramsList.at(PV::decode_time),
+           summary.mean(decodeTimeChannel));
+  setParam(this, paramsList.at(PV::decode_time_max),
+           summary.Max[decodeTimeChannel]);
+  setParam(this, paramsList.at(PV::frame_rate), summary.rate());
+  setParam(this, paramsList.at(PV::byte_rate),
+           summary.rate(messageBytesChannel));
+}
+
+void KafkaDriver::publishLatency(LatencyHistogram const &histogram, PV p50,
+                                 PV p90, PV p99, PV histogramPV) {
+  setParam(this, paramsList.at(p50), histogram.percentile(0.5));
+  setParam(this, paramsList.at(p90), histogram.percentile(0.9));
+  setParam(this, paramsList.at(p99), histogram.percentile(0.99));
+  auto const &counts = histogram.counts();
+  for (size_t i = 0; i < counts.size(); ++i) {
+    histogramBuffer[i] = static_cast<epicsInt32>(
+        std::min<std::uint64_t>(counts[i], std::numeric_limits<epicsInt32>::max()));
+  }
+  doCallbacksInt32Array(histogramBuffer.data(), histogramBuffer.size(),
+                        *paramsList.at(histogramPV).index, 0);
+}
+
+void KafkaDriver::publishLatencyStats() {
+  publishLatency(brokerLatency.summarize(), PV::broker_latency_p50,
+                 PV::broker_latency_p90, PV::broker_latency_p99,
+                 PV::broker_latency_hist);
+  publishLatency(sourceLatency.summarize(), PV::source_latency_p50,
+                 PV::source_latency_p90, PV::source_latency_p99,
+                 PV::source_latency_hist);
+  brokerLatency.rotate();
+  sourceLatency.rotate();
+  std::array<epicsFloat64, LatencyHistogram::BinCount> edges;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    edges[i] = LatencyHistogram::lowerEdge(i);
+  }
+  doCallbacksFloat64Array(edges.data(), edges.size(),
+                          *paramsList.at(PV::latency_bin_edges).index, 0);
+}
+
+void KafkaDriver::updateSourceAddresses() {
+  sourceAddresses.clear();
+  for (int addr = 0; addr < numAddresses; ++addr) {
+    std::string sourceName;
+    getStringParam(addr, *paramsList[demux_source].index, sourceName);
+    if (not sourceName.empty()) {
+      // The lowest address wins if a source name is used twice
+      sourceAddresses.emplace(sourceName, addr);
+    }
+  }
+}
+
+int KafkaDriver::routeMessage(KafkaInterface::KafkaMessage *message,
+                              const unsigned char *data, size_t size) {
+  if (sourceAddresses.empty()) {
+    return 0;
+  }
+  std::string sourceName;
+  if ((nullptr != message and
+       message->GetHeader(KafkaInterface::FrameHeaderKeys::SourceName,
+                          sourceName)) or
+      PeekSourceName(data, size, sourceName)) {
+    auto match = sourceAddresses.find(sourceName);
+    if (sourceAddresses.end() != match) {
+      return match->second;
+    }
+  }
+  return -1;
+}
+
+void KafkaDriver::publishDemuxStats() {
+  for (int addr = 0; addr < numAddresses; ++addr) {
+    auto frames = sourceFrames[addr];
+    setDoubleParam(addr, *paramsList[demux_frame_rate].index,
+                   (frames - lastSourceFrames[addr]) / decodeStatsPeriod);
+    setIntegerParam(addr, *paramsList[demux_frame_count].index,
+                    static_cast<int>(frames));
+    lastSourceFrames[addr] = frames;
+    if (0 != addr) {
+      // Address 0 is updated by the caller
+      callParamCallbacks(addr);
+    }
+  }
+  setParam(this, paramsList.at(PV::demux_unmapped),
+           static_cast<int>(unmappedFrames));
+}
+
+bool KafkaDriver::startReplay() {
+  std::string path;
+  double speed;
+  int loop;
+  getStringParam(*paramsList[replay_path].index, path);
+  getDoubleParam(*paramsList[replay_speed].index, &speed);
+  getIntegerParam(*paramsList[replay_loop].index, &loop);
+  bool opened = replay.Open(path, speed, loop != 0);
+  setParam(this, paramsList.at(PV::replay_file_count),
+           static_cast<int>(replay.GetFileCount()));
+  setParam(this, paramsList.at(PV::replay_progress), 0.0);
+  if (not opened) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:startReplay: %s\n", driverName,
+              replay.GetErrorMessage().c_str());
+    setStringParam(ADStatusMessage, replay.GetErrorMessage().c_str());
+    setIntegerParam(ADStatus, ADStatusError);
+  }
+  return opened;
 }
 
 void KafkaDriver::consumeTask() {
@@ -247,9 +597,16 @@ void KafkaDriver::consumeTask() {
   int arrayCallbacks;
   int acquire{0};
   NDArray *pImage{nullptr};
+  int callbackAddr{0};
+  // Position of the message in pImage, stored once the plugins have it
+  std::string storeTopic;
+  std::int32_t storePartition{0};
+  std::int64_t storeOffset{-1};
   double acquirePeriod;
   const char *functionName = "consumeTask";
   double startWaitTimeout;
+  DriverThreads::Placer.placeCurrentThread(DriverThreads::Role::CONSUME,
+                                           std::string(portName) + " consume");
   keepThreadAlive = true;
   this->lock();
   /* Loop forever */
@@ -267,6 +624,7 @@ void KafkaDriver::consumeTask() {
       this->unlock();
       startWaitTimeout = consumer.GetStatsTimeMS() / 1000.0;
       consumer.StopConsumption();
+      replay.Close();
       // Loop waiting for start acquisition event
       do {
         status = epicsEventWaitWithTimeout(startEventId_, startWaitTimeout);
@@ -281,14 +639,30 @@ void KafkaDriver::consumeTask() {
           std::abort(); // This should never happen
         }
       } while (status == asynStatus::asynTimeout);
-      consumer.StartConsumption();
       this->lock();
+      int dataSource;
+      getIntegerParam(*paramsList[data_source].index, &dataSource);
+      if (KafkaDriver::File == dataSource) {
+        if (not startReplay()) {
+          setIntegerParam(ADAcquire, 0);
+          callParamCallbacks();
+          continue;
+        }
+      } else {
+        this->unlock();
+        consumer.StartConsumption();
+        this->lock();
+      }
       acquire = 1;
       setStringParam(ADStatusMessage, "Acquiring data");
       setIntegerParam(ADNumImagesCounter, 0);
     }
 
     /* We are acquiring. */
+    // Might re-create the consumer, which the port thread only does while
+    // holding the lock. The offset bookkeeping, which is also changed without
+    // the lock, is guarded by the consumer itself.
+    consumer.ApplyPendingRetune();
     getIntegerParam(ADImageMode, &imageMode);
 
     setIntegerParam(ADStatus, ADStatusAcquire);
@@ -315,24 +689,123 @@ void KafkaDriver::consumeTask() {
     getDoubleParam(ADAcquirePeriod, &acquirePeriod);
     this->unlock();
     {
-      auto fbImg = consumer.WaitForPkg(static_cast<int>(acquirePeriod * 1000));
+      bool replaying = replay.IsOpen();
+      std::unique_ptr<KafkaInterface::KafkaMessage> fbImg;
+      KafkaInterface::CaptureReplay::Message replayMsg;
+      auto replayResult = KafkaInterface::CaptureReplay::Result::TIMEOUT;
+      if (replaying) {
+        replayResult = replay.WaitForMessage(
+            replayMsg, std::max(static_cast<int>(acquirePeriod * 1000), 100));
+      } else {
+        // Stop fetching (instead of dropping data) if the plugins are too
+        // slow to release the NDArrays.
+        consumer.UpdateBackpressure(this->pNDArrayPool, maxBuffers);
+        fbImg = consumer.WaitForPkg(static_cast<int>(acquirePeriod * 1000));
+      }
       this->lock();
 
+      const unsigned char *msgData{nullptr};
+      size_t msgSize{0};
+      if (replaying and
+          KafkaInterface::CaptureReplay::Result::MESSAGE == replayResult) {
+        msgData = replayMsg.Data;
+        msgSize = replayMsg.Size;
+        setParam(this, paramsList.at(PV::replay_progress),
+                 replay.GetProgress() * 100.0);
+      } else if (nullptr != fbImg) {
+        msgData = reinterpret_cast<unsigned char *>(fbImg->GetDataPtr());
+        msgSize = fbImg->size();
+      }
+
       // If we get no image, go to start of loop
-      if (nullptr == fbImg) {
+      if (nullptr == msgData) {
+        if (replaying and acquire != 0 and
+            (KafkaInterface::CaptureReplay::Result::END == replayResult or
+             KafkaInterface::CaptureReplay::Result::ERROR == replayResult)) {
+          acquire = 0;
+          replay.Close();
+          if (KafkaInterface::CaptureReplay::Result::END == replayResult) {
+            setStringParam(ADStatusMessage, "Replay finished");
+            setIntegerParam(ADStatus, ADStatusIdle);
+            setParam(this, paramsList.at(PV::replay_progress), 100.0);
+          } else {
+            setStringParam(ADStatusMessage,
+                           replay.GetErrorMessage().c_str());
+            setIntegerParam(ADStatus, ADStatusError);
+          }
+          setIntegerParam(ADAcquire, acquire);
+          callParamCallbacks();
+        } else if (not replaying and consumer.StopTimeReached() and
+                   acquire != 0) {
+          acquire = 0;
+          consumer.StopConsumption();
+          setStringParam(ADStatusMessage, "Stop time reached");
+          setIntegerParam(ADStatus, ADStatusIdle);
+          setIntegerParam(ADAcquire, acquire);
+          callParamCallbacks();
+        }
         continue;
       }
 
+      // Drop frames of unmapped sources before copying the array data
+      int routedAddr = routeMessage(fbImg.get(), msgData, msgSize);
+      if (routedAddr < 0) {
+        ++unmappedFrames;
+        continue;
+      }
+      callbackAddr = routedAddr;
+
       // We can only know if there is any data in the NDArray at this point
       if (pImage != nullptr) {
         pImage->release();
+        pImage = nullptr;
       }
 
-      /// @todo Make sure that there is actual a free NDArray to which the data
-      /// can be copied.
-      DeSerializeData(this->pNDArrayPool,
-                      reinterpret_cast<unsigned char *>(fbImg->GetDataPtr()),
-                      pImage);
+      auto decodeStart = std::chrono::steady_clock::now();
+      auto result =
+          DeSerializeData(this->pNDArrayPool, msgData, msgSize, pImage);
+      auto decodeEnd = std::chrono::steady_clock::now();
+      if (DeSerializeResult::ALLOC_FAILED == result) {
+        // The pool is exhausted, consume the message again once there is room.
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                  "%s:%s: Unable to allocate NDArray, pausing consumption.\n",
+                  driverName, functionName);
+        if (replaying) {
+          replay.RetryMessage();
+          // Give the plugins some time to release NDArrays
+          this->unlock();
+          epicsThreadSleep(0.01);
+          this->lock();
+        } else {
+          consumer.RetryMessage(*fbImg, this->pNDArrayPool);
+        }
+        continue;
+      } else if (DeSerializeResult::SUCCESS != result) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                  "%s:%s: Unknown or invalid message format, dropping it.\n",
+                  driverName, functionName);
+        continue;
+      }
+      decodeStats.add(
+          {{std::chrono::duration<double, std::milli>(decodeEnd - decodeStart)
+                .count(),
+            static_cast<double>(msgSize)}},
+          decodeEnd);
+      ++sourceFrames[callbackAddr];
+      storeOffset = -1;
+      if (not replaying) {
+        storeTopic = fbImg->GetTopicName();
+        storePartition = fbImg->GetPartition();
+        storeOffset = fbImg->GetOffset();
+      }
+      // The broker latency of replayed messages is meaningless
+      auto messageTime = replaying ? -1 : fbImg->GetTimestampMs();
+      if (0 <= messageTime) {
+        auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+        brokerLatency.add(static_cast<double>(nowMs - messageTime));
+      }
     }
 
     /* Close the shutter */
@@ -361,13 +834,25 @@ void KafkaDriver::consumeTask() {
       /* Must release the lock here, or we can get into a deadlock, because we
        * can
        * block on the plugin lock, and the plugin can be calling us */
+      epicsTimeStamp callbackTime;
+      epicsTimeGetCurrent(&callbackTime);
+      sourceLatency.add(
+          epicsTimeDiffInSeconds(&callbackTime, &pImage->epicsTS) * 1000.0);
       this->unlock();
       asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
                 "%s:%s: calling imageData callback\n", driverName,
                 functionName);
-      doCallbacksGenericPointer(pImage, NDArrayData, 0);
+      {
+        DRIVER_TRACE_SCOPE("callbacks", pImage->uniqueId);
+        doCallbacksGenericPointer(pImage, NDArrayData, callbackAddr);
+      }
       this->lock();
     }
+    // Committed asynchronously in batches, after the plugins have the NDArray
+    if (0 <= storeOffset) {
+      consumer.StoreOffset(storeTopic, storePartition, storeOffset);
+      storeOffset = -1;
+    }
 
     /* See if acquisition is done */
     getIntegerParam(ADNumImages, &numImages);
@@ -407,26 +892,52 @@ void KafkaDriver::consumeTask() {
   }
   this->unlock();
 exitConsumeTaskLabel:
+  DriverThreads::Placer.forgetCurrentThread();
   epicsEventSignal(threadExitEventId_);
 }
 
+void KafkaDriver::iocRunning() {
+  this->lock();
+  iocIsRunning = true;
+  int autoApply;
+  getIntegerParam(*paramsList[auto_apply].index, &autoApply);
+  if (autoApply != 0) {
+    consumer.SetAutoApply(true);
+  }
+  this->unlock();
+}
+
 KafkaDriver::~KafkaDriver() {
+  driverInstances.erase(
+      std::remove(driverInstances.begin(), driverInstances.end(), this),
+      driverInstances.end());
   keepThreadAlive = false;
   epicsEventSignal(startEventId_);
   epicsEventWait(threadExitEventId_);
 
+  if (statusTaskStarted) {
+    epicsEventSignal(statusStopEventId_);
+    epicsEventWait(statusExitEventId_);
+  }
+
   epicsEventDestroy(startEventId_);
   epicsEventDestroy(stopEventId_);
   epicsEventDestroy(threadExitEventId_);
+  if (statusStopEventId_ != nullptr) {
+    epicsEventDestroy(statusStopEventId_);
+  }
+  if (statusExitEventId_ != nullptr) {
+    epicsEventDestroy(statusExitEventId_);
+  }
 }
 
 // Configuration routine.  Called directly, or from the iocsh function
 extern "C" int KafkaDriverConfigure(const char *portName, int maxBuffers,
                                     size_t maxMemory, int priority,
                                     int stackSize, const char *brokerAddrStr,
-                                    const char *topicName) {
+                                    const char *topicName, int numAddresses) {
   new KafkaDriver(portName, maxBuffers, maxMemory, priority, stackSize,
-                  brokerAddrStr, topicName);
+                  brokerAddrStr, topicName, std::max(1, numAddresses));
 
   return (asynSuccess);
 }
@@ -439,18 +950,119 @@ static const iocshArg initArg3 = {"priority", iocshArgInt};
 static const iocshArg initArg4 = {"stackSize", iocshArgInt};
 static const iocshArg initArg5 = {"broker address", iocshArgString};
 static const iocshArg initArg6 = {"broker topic", iocshArgString};
+static const iocshArg initArg7 = {"number of addresses", iocshArgInt};
 static const iocshArg *const initArgs[] = {&initArg0, &initArg1, &initArg2,
                                            &initArg3, &initArg4, &initArg5,
-                                           &initArg6};
-static const iocshFuncDef initFuncDef = {"KafkaDriverConfigure", 7, initArgs};
+                                           &initArg6, &initArg7};
+static const iocshFuncDef initFuncDef = {"KafkaDriverConfigure", 8, initArgs};
 
 static void initCallFunc(const iocshArgBuf *args) {
   KafkaDriverConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].ival,
-                       args[4].ival, args[5].sval, args[6].sval);
+                       args[4].ival, args[5].sval, args[6].sval, args[7].ival);
+}
+
+extern "C" int KafkaDriverTraceEnable(int enable) {
+#ifdef KAFKA_TRACE_DISABLE
+  (void)enable;
+  errlogPrintf("KafkaDriverTraceEnable: Tracing was disabled at compile "
+               "time (KAFKA_TRACE_DISABLE).\n");
+  return asynError;
+#else
+  DriverTracing::Log.setEnabled(0 != enable);
+  return asynSuccess;
+#endif
+}
+
+extern "C" int KafkaDriverTraceDump(const char *fileName) {
+  if (nullptr == fileName or not DriverTracing::Log.dump(fileName)) {
+    errlogPrintf("KafkaDriverTraceDump: Unable to write trace to \"%s\".\n",
+                 nullptr == fileName ? "" : fileName);
+    return asynError;
+  }
+  printf("KafkaDriverTraceDump: Wrote trace to \"%s\".\n", fileName);
+  return asynSuccess;
+}
+
+static const iocshArg traceEnableArg0 = {"enable", iocshArgInt};
+static const iocshArg *const traceEnableArgs[] = {&traceEnableArg0};
+static const iocshFuncDef traceEnableFuncDef = {"KafkaDriverTraceEnable", 1,
+                                                traceEnableArgs};
+static void traceEnableCallFunc(const iocshArgBuf *args) {
+  KafkaDriverTraceEnable(args[0].ival);
+}
+
+static const iocshArg traceDumpArg0 = {"file name", iocshArgString};
+static const iocshArg *const traceDumpArgs[] = {&traceDumpArg0};
+static const iocshFuncDef traceDumpFuncDef = {"KafkaDriverTraceDump", 1,
+                                              traceDumpArgs};
+static void traceDumpCallFunc(const iocshArgBuf *args) {
+  KafkaDriverTraceDump(args[0].sval);
+}
+
+extern "C" int KafkaDriverThreadPlacement(const char *role, const char *cpus,
+                                          const char *scheduling) {
+  int usedRole;
+  KafkaThreads::Placement placement;
+  if (nullptr == role or not DriverThreads::Placer.parseRole(role, usedRole)) {
+    errlogPrintf("KafkaDriverThreadPlacement: Unknown role \"%s\", use "
+                 "\"consume\" or \"librdkafka\".\n",
+                 nullptr == role ? "" : role);
+    return asynError;
+  }
+  if (not KafkaThreads::parseCpuList(nullptr == cpus ? "" : cpus,
+                                     placement.Cpus)) {
+    errlogPrintf("KafkaDriverThreadPlacement: Invalid CPU list \"%s\".\n",
+                 cpus);
+    return asynError;
+  }
+  if (not KafkaThreads::parseScheduling(
+          nullptr == scheduling ? "" : scheduling, placement)) {
+    errlogPrintf("KafkaDriverThreadPlacement: Invalid scheduling \"%s\", use "
+                 "\"nice:N\" or \"fifo:N\".\n",
+                 scheduling);
+    return asynError;
+  }
+  DriverThreads::Placer.setPlacement(usedRole, placement);
+  return asynSuccess;
+}
+
+extern "C" int KafkaDriverThreadReport() {
+  printf("%s", DriverThreads::Placer.threadReport().c_str());
+  return asynSuccess;
+}
+
+static const iocshArg threadPlacementArg0 = {"role", iocshArgString};
+static const iocshArg threadPlacementArg1 = {"cpus", iocshArgString};
+static const iocshArg threadPlacementArg2 = {"scheduling", iocshArgString};
+static const iocshArg *const threadPlacementArgs[] = {
+    &threadPlacementArg0, &threadPlacementArg1, &threadPlacementArg2};
+static const iocshFuncDef threadPlacementFuncDef = {
+    "KafkaDriverThreadPlacement", 3, threadPlacementArgs};
+static void threadPlacementCallFunc(const iocshArgBuf *args) {
+  KafkaDriverThreadPlacement(args[0].sval, args[1].sval, args[2].sval);
+}
+
+static const iocshFuncDef threadReportFuncDef = {"KafkaDriverThreadReport", 0,
+                                                 nullptr};
+static void threadReportCallFunc(const iocshArgBuf *) {
+  KafkaDriverThreadReport();
+}
+
+static void KafkaDriverInitHook(initHookState state) {
+  if (initHookAfterIocRunning == state) {
+    for (auto driver : driverInstances) {
+      driver->iocRunning();
+    }
+  }
 }
 
 extern "C" void KafkaDriverReg(void) {
+  initHookRegister(KafkaDriverInitHook);
   iocshRegister(&initFuncDef, initCallFunc);
+  iocshRegister(&traceEnableFuncDef, traceEnableCallFunc);
+  iocshRegister(&traceDumpFuncDef, traceDumpCallFunc);
+  iocshRegister(&threadPlacementFuncDef, threadPlacementCallFunc);
+  iocshRegister(&threadReportFuncDef, threadReportCallFunc);
 }
 
 extern "C" {
@@ -10,11 +10,16 @@
 #include <ADDriver.h>
 #include <atomic>
 #include <epicsEvent.h>
+#include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
 
+#include "CaptureReplay.h"
 #include "KafkaConsumer.h"
+#include "LatencyHistogram.h"
 #include "ParamUtility.h"
+#include "RollingStats.h"
 
 using KafkaInterface::KafkaConsumer;
 
@@ -61,7 +66,8 @@ public:
    * ASYN_CANBLOCK is set
    * in asynFlags. If it is 0 then the default value of
    * epicsThreadGetStackSize(epicsThreadStackMedium) will be assigned by
-   * asynManager.
+   * asynManager. The priority and stack size are also used for the thread
+   * consuming the Kafka messages, with the same defaults.
    * @param[in] brokerAddress The address of the Kafka broker in the form
    * "address:port". Can take
    * several addresses seperated by a comma (e.g.
@@ -69,10 +75,13 @@ public:
    * @param[in] brokerTopic Topic from which the driver should consume messages.
    * Note that only
    * one topic can be specified.
+   * @param[in] numAddresses Number of asyn addresses. With more than one
+   * address, frames are routed to the address whose DEMUX_SOURCE_NAME
+   * parameter matches their source name, see KafkaDriver::sourceAddresses.
    */
   KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
               int priority, int stackSize, const char *brokerAddress,
-              const char *brokerTopic);
+              const char *brokerTopic, int numAddresses = 1);
 
   /** @brief Shuts down consumer thread and deallocates dynamically allocated
    * resources which are
@@ -126,6 +135,23 @@ public:
    */
   virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
 
+  /** @brief Used to set the 64-bit message offset of the Kafka consumer.
+   * The offset can only be set if the start offset setting is
+   * KafkaDriver::Manual.
+   * @param[in] pasynUser pasynUser structure that encodes the reason and
+   * address.
+   * @param[in] value New offset.
+   */
+  virtual asynStatus writeInt64(asynUser *pasynUser, epicsInt64 value);
+
+  /** @brief Used to set the start and stop time of the acquisition window.
+   * The times are given in seconds since the EPICS epoch, 0 disables them.
+   * @param[in] pasynUser pasynUser structure that encodes the reason and
+   * address.
+   * @param[in] value New time.
+   */
+  virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+
   /** @brief The thread function which does the heavy lifting in this driver.
    * This function uses an endless loop to consume NDArray messages. Should be
    * protected/private
@@ -137,6 +163,23 @@ public:
    */
   virtual void consumeTask();
 
+  /** @brief Periodically publishes the PV values posted by
+   * KafkaInterface::KafkaConsumer.
+   * Status updates are posted from librdkafka callbacks (and the consumer
+   * thread) without taking the port lock. This thread takes the lock at most
+   * once every KafkaDriver::statusUpdatePeriod seconds in order to write them
+   * to the parameter library. Public for the same reason as
+   * KafkaDriver::consumeTask().
+   */
+  virtual void statusTask();
+
+  /** @brief Called when the IOC has been started.
+   * The Kafka consumer is not created before this (the configuration set by
+   * the PINI records is collected instead) and is then created once, unless
+   * the KAFKA_AUTO_APPLY parameter is 0.
+   */
+  void iocRunning();
+
 protected:
   /** @brief Used to keep track of the lowest PV index in order to know which
    * write events should
@@ -144,10 +187,22 @@ protected:
    */
   int MIN_PARAM_INDEX;
 
+  /// @brief Number of asyn addresses (detectors/sources) of the port.
+  const int numAddresses;
+
+  /// @brief The maximum number of NDArrays, not kept by NDArrayPool.
+  const int maxBuffers;
+
   /** @brief Implements all communication with the Kafka brokers.
    */
   KafkaConsumer consumer;
 
+  /** @brief Reads the messages from capture files instead of Kafka if the
+   * data source is DataSource::File. Only used by the consume thread, which
+   * opens it when an acquisition is started.
+   */
+  KafkaInterface::CaptureReplay replay;
+
   /// @brief Used to pass a start acquisition event from writeInt32 to the
   /// processing thread.
   epicsEventId startEventId_;
@@ -160,6 +215,102 @@ protected:
    */
   epicsEventId threadExitEventId_;
 
+  /// @brief Used to ask the status thread to exit.
+  epicsEventId statusStopEventId_{nullptr};
+  /// @brief Signalled by the status thread when it has exited.
+  epicsEventId statusExitEventId_{nullptr};
+  /// @brief Set if the status thread was started.
+  bool statusTaskStarted{false};
+  /// @brief Time in seconds between updates of the consumer status PV:s.
+  const double statusUpdatePeriod{0.02};
+
+  /// @brief The values added to KafkaDriver::decodeStats for each message.
+  enum DecodeStatsChannel {
+    decodeTimeChannel, ///< ms
+    messageBytesChannel,
+  };
+
+  /** @brief Decode time and size of the messages deserialized during the last
+   * 5 s. Only accessed with the port lock held.
+   */
+  RollingStats<2> decodeStats{std::chrono::milliseconds(5000)};
+
+  /// @brief Time in seconds between updates of the decode statistics PV:s.
+  const double decodeStatsPeriod{1.0};
+
+  /** @brief Writes a summary of KafkaDriver::decodeStats to the parameter
+   * library. Called by KafkaDriver::statusTask() with the port lock held.
+   */
+  void publishDecodeStats();
+
+  /** @brief Time (ms) from the Kafka timestamp of a message until it was
+   * consumed. Only accessed with the port lock held.
+   */
+  RollingLatencyHistogram brokerLatency;
+
+  /** @brief Time (ms) from the timestamp of the NDArray in the message until
+   * the NDArray callbacks are called. Only accessed with the port lock held.
+   */
+  RollingLatencyHistogram sourceLatency;
+
+  /// @brief Buffer used to publish the histogram PV:s.
+  std::array<epicsInt32, LatencyHistogram::BinCount> histogramBuffer{};
+
+  /** @brief Writes the percentiles of KafkaDriver::brokerLatency and
+   * KafkaDriver::sourceLatency to the parameter library, calls the histogram
+   * array callbacks and starts a new histogram slice. Called by
+   * KafkaDriver::statusTask() with the port lock held.
+   */
+  void publishLatencyStats();
+
+  /** @brief Opens the capture files set by the REPLAY_PATH parameter. Called
+   * by the consume thread with the port lock held when an acquisition is
+   * started with the File data source.
+   * @return False if no capture file could be found; the status message is
+   * then set.
+   */
+  bool startReplay();
+
+  /** @brief Maps source names to asyn addresses. Built from the
+   * DEMUX_SOURCE_NAME parameters of all addresses. If empty, all frames are
+   * passed to address 0; otherwise frames of sources not in the map are
+   * dropped before being deserialized. Only accessed with the port lock held.
+   */
+  std::map<std::string, int> sourceAddresses;
+
+  /// @brief Frames passed to the callbacks of each address. Only accessed
+  /// with the port lock held.
+  std::vector<std::uint64_t> sourceFrames;
+
+  /// @brief Value of KafkaDriver::sourceFrames at the last statistics update.
+  std::vector<std::uint64_t> lastSourceFrames;
+
+  /// @brief Frames dropped because their source is not mapped to an address.
+  std::uint64_t unmappedFrames{0};
+
+  /// @brief Rebuilds KafkaDriver::sourceAddresses. Called with the port lock
+  /// held.
+  void updateSourceAddresses();
+
+  /** @brief Returns the address the message should be passed to, or -1 if it
+   * should be dropped. Uses the source name header of Kafka messages if
+   * present, the source name in the flatbuffer otherwise. Called with the
+   * port lock held.
+   * @param[in] message The Kafka message, nullptr for replayed messages.
+   * @param[in] data The serialized NDArray.
+   * @param[in] size Size of the serialized NDArray in bytes.
+   */
+  int routeMessage(KafkaInterface::KafkaMessage *message,
+                   const unsigned char *data, size_t size);
+
+  /** @brief Writes the per-address frame counts and rates to the parameter
+   * library. Called by KafkaDriver::statusTask() with the port lock held.
+   */
+  void publishDemuxStats();
+
+  /// @brief Set by KafkaDriver::iocRunning().
+  bool iocIsRunning{false};
+
   /// @brief Used to keep track of the PV:s made available by this driver.
   enum PV {
     kafka_addr,
@@ -167,15 +318,73 @@ protected:
     kafka_group,
     stats_time,
     set_offset,
+    pool_high,
+    pool_low,
+    consume_mode,
+    start_time,
+    stop_time,
+    auto_apply,
+    apply,
+    decode_time,
+    decode_time_max,
+    frame_rate,
+    byte_rate,
+    lag_threshold,
+    broker_latency_p50,
+    broker_latency_p90,
+    broker_latency_p99,
+    source_latency_p50,
+    source_latency_p90,
+    source_latency_p99,
+    broker_latency_hist,
+    source_latency_hist,
+    latency_bin_edges,
+    data_source,
+    replay_path,
+    replay_speed,
+    replay_loop,
+    replay_file_count,
+    replay_progress,
+    demux_source,
+    demux_frame_rate,
+    demux_frame_count,
+    demux_unmapped,
+    assign_mode,
+    commit_batch,
+    commit_interval,
+    fetch_tuning,
     count,
   };
 
+  /// @brief Publishes the percentiles and the histogram of one latency.
+  void publishLatency(LatencyHistogram const &histogram, PV p50, PV p90,
+                      PV p99, PV histogramPV);
+
   /// @brief Defines possible Kafka message offset settings.
   enum OffsetSetting {
     Beginning = 0,
     Stored = 1,
     Manual = 2,
     End = 3,
+    Time = 4,
+  };
+
+  /// @brief Defines the possible consume modes.
+  enum ConsumeMode {
+    AllFrames = 0,
+    LatestFrame = 1,
+  };
+
+  /// @brief Defines how partitions are assigned to the consumer.
+  enum AssignMode {
+    Partition0 = 0,
+    ConsumerGroup = 1,
+  };
+
+  /// @brief Defines where the messages are read from.
+  enum DataSource {
+    Kafka = 0,
+    File = 1,
   };
 
   /// @brief Keeps track of the current Kafka message offset setting.
@@ -188,6 +397,41 @@ protected:
       PV_param("KAFKA_GROUP", asynParamOctet),          // kafka_group
       PV_param("KAFKA_STATS_INT_MS", asynParamInt32),   // stats_time
       PV_param("KAFKA_SET_OFFSET", asynParamInt32),     // set_offset
+      PV_param("KAFKA_POOL_HIGH_WATERMARK", asynParamInt32), // pool_high
+      PV_param("KAFKA_POOL_LOW_WATERMARK", asynParamInt32),  // pool_low
+      PV_param("KAFKA_CONSUME_MODE", asynParamInt32),        // consume_mode
+      PV_param("KAFKA_START_TIME", asynParamFloat64),        // start_time
+      PV_param("KAFKA_STOP_TIME", asynParamFloat64),         // stop_time
+      PV_param("KAFKA_AUTO_APPLY", asynParamInt32),          // auto_apply
+      PV_param("KAFKA_APPLY", asynParamInt32),               // apply
+      PV_param("KAFKA_DECODE_TIME", asynParamFloat64),       // decode_time
+      PV_param("KAFKA_DECODE_TIME_MAX", asynParamFloat64),   // decode_time_max
+      PV_param("KAFKA_FRAME_RATE", asynParamFloat64),        // frame_rate
+      PV_param("KAFKA_BYTE_RATE", asynParamFloat64),         // byte_rate
+      PV_param("KAFKA_LAG_ALARM_THRESHOLD", asynParamInt32), // lag_threshold
+      PV_param("KAFKA_BROKER_LATENCY_P50", asynParamFloat64),
+      PV_param("KAFKA_BROKER_LATENCY_P90", asynParamFloat64),
+      PV_param("KAFKA_BROKER_LATENCY_P99", asynParamFloat64),
+      PV_param("KAFKA_SOURCE_LATENCY_P50", asynParamFloat64),
+      PV_param("KAFKA_SOURCE_LATENCY_P90", asynParamFloat64),
+      PV_param("KAFKA_SOURCE_LATENCY_P99", asynParamFloat64),
+      PV_param("KAFKA_BROKER_LATENCY_HIST", asynParamInt32Array),
+      PV_param("KAFKA_SOURCE_LATENCY_HIST", asynParamInt32Array),
+      PV_param("KAFKA_LATENCY_BIN_EDGES", asynParamFloat64Array),
+      PV_param("DATA_SOURCE", asynParamInt32),           // data_source
+      PV_param("REPLAY_PATH", asynParamOctet),           // replay_path
+      PV_param("REPLAY_SPEED", asynParamFloat64),        // replay_speed
+      PV_param("REPLAY_LOOP", asynParamInt32),           // replay_loop
+      PV_param("REPLAY_FILE_COUNT", asynParamInt32),     // replay_file_count
+      PV_param("REPLAY_PROGRESS", asynParamFloat64),     // replay_progress
+      PV_param("DEMUX_SOURCE_NAME", asynParamOctet),     // demux_source
+      PV_param("DEMUX_FRAME_RATE", asynParamFloat64),    // demux_frame_rate
+      PV_param("DEMUX_FRAME_COUNT", asynParamInt32),     // demux_frame_count
+      PV_param("DEMUX_UNMAPPED_FRAMES", asynParamInt32), // demux_unmapped
+      PV_param("KAFKA_ASSIGN_MODE", asynParamInt32),     // assign_mode
+      PV_param("KAFKA_COMMIT_BATCH", asynParamInt32),    // commit_batch
+      PV_param("KAFKA_COMMIT_INT_MS", asynParamInt32),   // commit_interval
+      PV_param("KAFKA_FETCH_TUNING", asynParamInt32),    // fetch_tuning
   };
 
   /// @brief The consumeTask() function will keep running as long as this
@@ -0,0 +1,139 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  LatencyHistogram.h
+ *  @brief Fixed-size latency histograms with percentile estimates.
+ */
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/** @brief Histogram of latencies in ms with logarithmic bins.
+ * There are four bins per decade from 0.1 ms to 100 s, one bin for latencies
+ * below 0.1 ms (including negative values caused by clock differences) and one
+ * for latencies of 100 s or more. Adding a value does not allocate memory.
+ */
+class LatencyHistogram {
+public:
+  /// @brief Number of bins, including the under- and overflow bins.
+  static const std::size_t BinCount{26};
+
+  /// @brief Lower edge (ms) of the first bin which is not the underflow bin.
+  static constexpr double FirstEdge{0.1};
+
+  /// @brief Number of bins per decade.
+  static const int BinsPerDecade{4};
+
+  /// @brief The lower edge of a bin in ms, 0 for the underflow bin.
+  static double lowerEdge(std::size_t bin) {
+    if (0 == bin) {
+      return 0.0;
+    }
+    return FirstEdge *
+           std::pow(10.0, static_cast<double>(bin - 1) / BinsPerDecade);
+  }
+
+  /// @brief The bin a latency (ms) is counted in.
+  static std::size_t binIndex(double latencyMs) {
+    if (not(latencyMs >= FirstEdge)) {
+      return 0;
+    }
+    auto bin = static_cast<std::size_t>(
+                   std::floor(BinsPerDecade * std::log10(latencyMs / FirstEdge))) +
+               1;
+    return bin < BinCount ? bin : BinCount - 1;
+  }
+
+  void add(double latencyMs) {
+    ++bins[binIndex(latencyMs)];
+    ++total;
+  }
+
+  /// @brief Adds the counts of another histogram to this one.
+  void add(LatencyHistogram const &other) {
+    for (std::size_t i = 0; i < BinCount; ++i) {
+      bins[i] += other.bins[i];
+    }
+    total += other.total;
+  }
+
+  void clear() {
+    bins = {};
+    total = 0;
+  }
+
+  std::uint64_t count() const { return total; }
+
+  std::array<std::uint64_t, BinCount> const &counts() const { return bins; }
+
+  /** @brief Estimates a percentile by interpolating linearly within the bin
+   * it falls in.
+   * @param[in] fraction The percentile as a fraction, e.g. 0.99.
+   * @return The estimated latency in ms or 0 if the histogram is empty.
+   * Percentiles in the overflow bin are reported as its lower edge.
+   */
+  double percentile(double fraction) const {
+    if (0 == total) {
+      return 0.0;
+    }
+    double target = fraction * total;
+    double below{0};
+    for (std::size_t i = 0; i < BinCount; ++i) {
+      if (0 == bins[i] or below + bins[i] < target) {
+        below += bins[i];
+        continue;
+      }
+      if (BinCount - 1 == i) {
+        break;
+      }
+      double position = (target - below) / bins[i];
+      return lowerEdge(i) + position * (lowerEdge(i + 1) - lowerEdge(i));
+    }
+    return lowerEdge(BinCount - 1);
+  }
+
+private:
+  std::array<std::uint64_t, BinCount> bins{};
+  std::uint64_t total{0};
+};
+
+/** @brief A LatencyHistogram covering the last few publishing periods.
+ * Values are added to the current slice; rotate() starts a new slice and
+ * drops the oldest one. Not thread safe, the caller serialises access (e.g.
+ * with the port lock).
+ */
+class RollingLatencyHistogram {
+public:
+  /// @brief Number of slices (publishing periods) in the window.
+  static const std::size_t Slices{5};
+
+  void add(double latencyMs) { sliceList[current].add(latencyMs); }
+
+  /// @brief Starts a new slice, dropping the oldest one.
+  void rotate() {
+    current = (current + 1) % Slices;
+    sliceList[current].clear();
+  }
+
+  /// @brief The combined histogram of all slices.
+  LatencyHistogram summarize() const {
+    LatencyHistogram result;
+    for (auto const &slice : sliceList) {
+      result.add(slice);
+    }
+    return result;
+  }
+
+  void clear() {
+    for (auto &slice : sliceList) {
+      slice.clear();
+    }
+  }
+
+private:
+  std::array<LatencyHistogram, Slices> sliceList{};
+  std::size_t current{0};
+};
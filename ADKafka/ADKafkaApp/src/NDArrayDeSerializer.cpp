@@ -6,118 +6,434 @@
  */
 
 #include "NDArrayDeSerializer.h"
-#include <cassert>
+#include "Tracing.h"
+#include <algorithm>
 #include <ciso646>
 #include <cstdlib>
+#include <cstring>
+#include <utility>
 #include <vector>
 
-NDDataType_t GetND_DType(FB_Tables::DType arrType) {
+namespace {
+
+using ByteVector = flatbuffers::Vector<std::uint8_t>;
+
+bool GetND_DType(FB_Tables::DType arrType, NDDataType_t &ndType) {
   switch (arrType) {
   case FB_Tables::DType::DType_int8:
-    return NDInt8;
+    ndType = NDInt8;
+    return true;
   case FB_Tables::DType::DType_uint8:
-    return NDUInt8;
+    ndType = NDUInt8;
+    return true;
   case FB_Tables::DType::DType_int16:
-    return NDInt16;
+    ndType = NDInt16;
+    return true;
   case FB_Tables::DType::DType_uint16:
-    return NDUInt16;
+    ndType = NDUInt16;
+    return true;
   case FB_Tables::DType::DType_int32:
-    return NDInt32;
+    ndType = NDInt32;
+    return true;
   case FB_Tables::DType::DType_uint32:
-    return NDUInt32;
+    ndType = NDUInt32;
+    return true;
   case FB_Tables::DType::DType_float32:
-    return NDFloat32;
+    ndType = NDFloat32;
+    return true;
   case FB_Tables::DType::DType_float64:
-    return NDFloat64;
+    ndType = NDFloat64;
+    return true;
   default:
-    assert(false);
+    return false;
   }
-  return NDInt8;
 }
 
-NDAttrDataType_t GetND_AttrDType(FB_Tables::DType attrType) {
-  switch (attrType) {
-  case FB_Tables::DType::DType_int8:
-    return NDAttrInt8;
-  case FB_Tables::DType::DType_uint8:
-    return NDAttrUInt8;
-  case FB_Tables::DType::DType_int16:
-    return NDAttrInt16;
-  case FB_Tables::DType::DType_uint16:
-    return NDAttrUInt16;
-  case FB_Tables::DType::DType_int32:
-    return NDAttrInt32;
-  case FB_Tables::DType::DType_uint32:
-    return NDAttrUInt32;
-  case FB_Tables::DType::DType_float32:
-    return NDAttrFloat32;
-  case FB_Tables::DType::DType_float64:
-    return NDAttrFloat64;
-  case FB_Tables::DType::DType_c_string:
-    return NDAttrString;
+bool GetND_DType(DType arrType, NDDataType_t &ndType) {
+  switch (arrType) {
+  case DType::DType_int8:
+    ndType = NDInt8;
+    return true;
+  case DType::DType_uint8:
+    ndType = NDUInt8;
+    return true;
+  case DType::DType_int16:
+    ndType = NDInt16;
+    return true;
+  case DType::DType_uint16:
+    ndType = NDUInt16;
+    return true;
+  case DType::DType_int32:
+    ndType = NDInt32;
+    return true;
+  case DType::DType_uint32:
+    ndType = NDUInt32;
+    return true;
+  case DType::DType_int64:
+    ndType = NDInt64;
+    return true;
+  case DType::DType_uint64:
+    ndType = NDUInt64;
+    return true;
+  case DType::DType_float32:
+    ndType = NDFloat32;
+    return true;
+  case DType::DType_float64:
+    ndType = NDFloat64;
+    return true;
   default:
-    assert(false);
+    return false;
   }
-  return NDAttrInt8;
 }
 
-size_t GetTypeSize(FB_Tables::DType attrType) {
-  switch (attrType) {
-  case FB_Tables::DType::DType_int8:
-    return 1;
-  case FB_Tables::DType::DType_uint8:
-    return 1;
-  case FB_Tables::DType::DType_int16:
-    return 2;
-  case FB_Tables::DType::DType_uint16:
-    return 2;
-  case FB_Tables::DType::DType_int32:
-    return 4;
-  case FB_Tables::DType::DType_uint32:
-    return 4;
-  case FB_Tables::DType::DType_float32:
-    return 4;
-  case FB_Tables::DType::DType_float64:
-    return 8;
-  case FB_Tables::DType::DType_c_string:
-    return 1;
+bool GetND_AttrDType(FB_Tables::DType attrType, NDAttrDataType_t &ndType) {
+  if (FB_Tables::DType::DType_c_string == attrType) {
+    ndType = NDAttrString;
+    return true;
+  }
+  NDDataType_t arrType;
+  if (not GetND_DType(attrType, arrType)) {
+    return false;
+  }
+  // NDAttrDataType_t uses the same values as NDDataType_t for numeric types
+  ndType = static_cast<NDAttrDataType_t>(arrType);
+  return true;
+}
+
+bool GetND_AttrDType(DType attrType, NDAttrDataType_t &ndType) {
+  if (DType::DType_c_string == attrType) {
+    ndType = NDAttrString;
+    return true;
+  }
+  NDDataType_t arrType;
+  if (not GetND_DType(attrType, arrType)) {
+    return false;
+  }
+  ndType = static_cast<NDAttrDataType_t>(arrType);
+  return true;
+}
+
+/** @brief Copies whole elements of type T from the flatbuffer into the array.
+ * The copy is limited to the size of the allocated array and any elements not
+ * present in the message are set to zero.
+ */
+template <typename T>
+void CopyElements(void *destination, size_t destinationElements,
+                  const ByteVector *source) {
+  size_t sourceElements = 0;
+  if (nullptr != source) {
+    sourceElements = source->size() / sizeof(T);
+  }
+  size_t elements = std::min(destinationElements, sourceElements);
+  if (elements > 0) {
+    std::memcpy(destination, source->Data(), elements * sizeof(T));
+  }
+  auto destinationPtr = static_cast<T *>(destination);
+  std::fill(destinationPtr + elements, destinationPtr + destinationElements,
+            T(0));
+}
+
+void CopyArrayData(NDArray *pArray, const ByteVector *source) {
+  NDArrayInfo_t arrayInfo;
+  pArray->getInfo(&arrayInfo);
+  size_t elements = arrayInfo.nElements;
+  switch (pArray->dataType) {
+  case NDInt8:
+    CopyElements<epicsInt8>(pArray->pData, elements, source);
+    break;
+  case NDUInt8:
+    CopyElements<epicsUInt8>(pArray->pData, elements, source);
+    break;
+  case NDInt16:
+    CopyElements<epicsInt16>(pArray->pData, elements, source);
+    break;
+  case NDUInt16:
+    CopyElements<epicsUInt16>(pArray->pData, elements, source);
+    break;
+  case NDInt32:
+    CopyElements<epicsInt32>(pArray->pData, elements, source);
+    break;
+  case NDUInt32:
+    CopyElements<epicsUInt32>(pArray->pData, elements, source);
+    break;
+  case NDInt64:
+    CopyElements<epicsInt64>(pArray->pData, elements, source);
+    break;
+  case NDUInt64:
+    CopyElements<epicsUInt64>(pArray->pData, elements, source);
+    break;
+  case NDFloat32:
+    CopyElements<epicsFloat32>(pArray->pData, elements, source);
+    break;
+  case NDFloat64:
+    CopyElements<epicsFloat64>(pArray->pData, elements, source);
+    break;
+  }
+}
+
+/** @brief Creates a numeric attribute from the flatbuffer data.
+ * The value is copied to a (correctly aligned) local variable first as the
+ * flatbuffer gives no alignment guarantee for the payload.
+ */
+template <typename T>
+NDAttribute *MakeAttribute(const char *name, const char *description,
+                           const char *source, NDAttrDataType_t type,
+                           const ByteVector *data) {
+  T value{0};
+  if (nullptr != data and data->size() >= sizeof(T)) {
+    std::memcpy(&value, data->Data(), sizeof(T));
+  }
+  return new NDAttribute(name, description, NDAttrSourceDriver, source, type,
+                         &value);
+}
+
+NDAttribute *MakeAttribute(const char *name, const char *description,
+                           const char *source, NDAttrDataType_t type,
+                           const ByteVector *data) {
+  switch (type) {
+  case NDAttrInt8:
+    return MakeAttribute<epicsInt8>(name, description, source, type, data);
+  case NDAttrUInt8:
+    return MakeAttribute<epicsUInt8>(name, description, source, type, data);
+  case NDAttrInt16:
+    return MakeAttribute<epicsInt16>(name, description, source, type, data);
+  case NDAttrUInt16:
+    return MakeAttribute<epicsUInt16>(name, description, source, type, data);
+  case NDAttrInt32:
+    return MakeAttribute<epicsInt32>(name, description, source, type, data);
+  case NDAttrUInt32:
+    return MakeAttribute<epicsUInt32>(name, description, source, type, data);
+  case NDAttrInt64:
+    return MakeAttribute<epicsInt64>(name, description, source, type, data);
+  case NDAttrUInt64:
+    return MakeAttribute<epicsUInt64>(name, description, source, type, data);
+  case NDAttrFloat32:
+    return MakeAttribute<epicsFloat32>(name, description, source, type, data);
+  case NDAttrFloat64:
+    return MakeAttribute<epicsFloat64>(name, description, source, type, data);
   default:
-    assert(false);
+    break;
+  }
+  // The string is not necessarily null terminated in the message
+  std::string value;
+  if (nullptr != data) {
+    value.assign(reinterpret_cast<const char *>(data->Data()), data->size());
   }
-  return 1;
+  return new NDAttribute(name, description, NDAttrSourceDriver, source,
+                         NDAttrString, const_cast<char *>(value.c_str()));
 }
 
-void DeSerializeData(NDArrayPool *pNDArrayPool, const unsigned char *bufferPtr,
-                     NDArray *&pArray) {
-  auto recvArr = FB_Tables::GetNDArray(bufferPtr);
-  int id = recvArr->id();
-  double timeStamp = recvArr->timeStamp();
-  int EPICSsecPastEpoch = recvArr->epicsTS()->secPastEpoch();
-  int nsec = recvArr->epicsTS()->nsec();
-  std::vector<size_t> dims(recvArr->dims()->begin(), recvArr->dims()->end());
-  NDDataType_t dataType = GetND_DType(recvArr->dataType());
-  const void *pData = reinterpret_cast<const void *>(recvArr->pData()->Data());
-  int pData_size = recvArr->pData()->size();
+const char *StringOrEmpty(const flatbuffers::String *string) {
+  if (nullptr == string) {
+    return "";
+  }
+  return string->c_str();
+}
 
+DeSerializeResult AllocArray(NDArrayPool *pNDArrayPool,
+                             std::vector<size_t> &dims, NDDataType_t dataType,
+                             NDArray *&pArray) {
   pArray = pNDArrayPool->alloc(static_cast<int>(dims.size()), dims.data(),
                                dataType, 0, nullptr);
+  if (nullptr == pArray) {
+    return DeSerializeResult::ALLOC_FAILED;
+  }
+  pArray->pAttributeList->clear();
+  return DeSerializeResult::SUCCESS;
+}
+
+/// @brief Decodes the legacy NDArray_schema.fbs ("NDAr") format.
+DeSerializeResult DeSerializeNDAr(NDArrayPool *pNDArrayPool,
+                                  const unsigned char *bufferPtr, size_t size,
+                                  NDArray *&pArray) {
+  // Truncated or corrupt buffers would otherwise be read out of bounds
+  flatbuffers::Verifier verifier(bufferPtr, size);
+  if (not FB_Tables::VerifyNDArrayBuffer(verifier)) {
+    return DeSerializeResult::UNKNOWN_FORMAT;
+  }
+  auto recvArr = FB_Tables::GetNDArray(bufferPtr);
+  NDDataType_t dataType;
+  if (nullptr == recvArr->dims() or nullptr == recvArr->epicsTS() or
+      not GetND_DType(recvArr->dataType(), dataType)) {
+    return DeSerializeResult::UNKNOWN_FORMAT;
+  }
+  std::vector<size_t> dims(recvArr->dims()->begin(), recvArr->dims()->end());
+
+  auto result = AllocArray(pNDArrayPool, dims, dataType, pArray);
+  if (DeSerializeResult::SUCCESS != result) {
+    return result;
+  }
+
+  if (nullptr != recvArr->pAttributeList()) {
+    NDAttributeList *attrPtr = pArray->pAttributeList;
+    for (auto cAttr : *recvArr->pAttributeList()) {
+      NDAttrDataType_t attrType;
+      if (nullptr == cAttr->pName() or
+          not GetND_AttrDType(cAttr->dataType(), attrType)) {
+        continue;
+      }
+      attrPtr->add(MakeAttribute(cAttr->pName()->c_str(),
+                                 StringOrEmpty(cAttr->pDescription()),
+                                 StringOrEmpty(cAttr->pSource()), attrType,
+                                 cAttr->pData()));
+    }
+  }
+
+  CopyArrayData(pArray, recvArr->pData());
+
+  pArray->uniqueId = recvArr->id();
+  pArray->timeStamp = recvArr->timeStamp();
+  pArray->epicsTS.secPastEpoch = recvArr->epicsTS()->secPastEpoch();
+  pArray->epicsTS.nsec = recvArr->epicsTS()->nsec();
+  return DeSerializeResult::SUCCESS;
+}
+
+/// @brief Decodes the ADArray_schema.fbs ("ADAr") format.
+DeSerializeResult DeSerializeADAr(NDArrayPool *pNDArrayPool,
+                                  const unsigned char *bufferPtr, size_t size,
+                                  NDArray *&pArray) {
+  flatbuffers::Verifier verifier(bufferPtr, size);
+  if (not VerifyADArrayBuffer(verifier)) {
+    return DeSerializeResult::UNKNOWN_FORMAT;
+  }
+  auto recvArr = GetADArray(bufferPtr);
+  NDDataType_t dataType;
+  if (nullptr == recvArr->dimensions() or
+      not GetND_DType(recvArr->data_type(), dataType)) {
+    return DeSerializeResult::UNKNOWN_FORMAT;
+  }
+  std::vector<size_t> dims(recvArr->dimensions()->begin(),
+                           recvArr->dimensions()->end());
+
+  auto result = AllocArray(pNDArrayPool, dims, dataType, pArray);
+  if (DeSerializeResult::SUCCESS != result) {
+    return result;
+  }
+
+  if (nullptr != recvArr->attributes()) {
+    NDAttributeList *attrPtr = pArray->pAttributeList;
+    for (auto cAttr : *recvArr->attributes()) {
+      NDAttrDataType_t attrType;
+      if (nullptr == cAttr->name() or
+          not GetND_AttrDType(cAttr->data_type(), attrType)) {
+        continue;
+      }
+      attrPtr->add(MakeAttribute(
+          cAttr->name()->c_str(), StringOrEmpty(cAttr->description()),
+          StringOrEmpty(cAttr->source()), attrType, cAttr->data()));
+    }
+  }
+
+  CopyArrayData(pArray, recvArr->data());
 
-  NDAttributeList *attrPtr = pArray->pAttributeList;
-  attrPtr->clear();
-  for (int i = 0; i < recvArr->pAttributeList()->size(); i++) {
-    auto cAttr = recvArr->pAttributeList()->Get(i);
-    attrPtr->add(
-        new NDAttribute(cAttr->pName()->c_str(), cAttr->pDescription()->c_str(),
-                        NDAttrSourceDriver, cAttr->pSource()->c_str(),
-                        GetND_AttrDType(cAttr->dataType()),
-                        reinterpret_cast<void *>(const_cast<std::uint8_t *>(
-                            cAttr->pData()->Data()))));
+  // The timestamp is in ns since the UNIX epoch
+  const std::uint64_t TimeDiffUNIXtoEPICSepoch = 631152000;
+  const std::uint64_t NSecMultiplier = 1000000000;
+  std::uint64_t timestamp = recvArr->timestamp();
+  std::uint64_t seconds = timestamp / NSecMultiplier;
+  if (seconds >= TimeDiffUNIXtoEPICSepoch) {
+    pArray->epicsTS.secPastEpoch =
+        static_cast<epicsUInt32>(seconds - TimeDiffUNIXtoEPICSepoch);
+    pArray->epicsTS.nsec = static_cast<epicsUInt32>(timestamp % NSecMultiplier);
+  } else {
+    pArray->epicsTS.secPastEpoch = 0;
+    pArray->epicsTS.nsec = 0;
   }
+  pArray->timeStamp =
+      pArray->epicsTS.secPastEpoch + pArray->epicsTS.nsec / 1.e9;
+  pArray->uniqueId = recvArr->id();
+  return DeSerializeResult::SUCCESS;
+}
 
-  std::memcpy(pArray->pData, pData, pData_size);
+using DeSerializerList =
+    std::vector<std::pair<std::string, DeSerializerFunction>>;
 
-  pArray->uniqueId = id;
-  pArray->timeStamp = timeStamp;
-  pArray->epicsTS.secPastEpoch = EPICSsecPastEpoch;
-  pArray->epicsTS.nsec = nsec;
+DeSerializerList &GetDeSerializers() {
+  static DeSerializerList deSerializers{
+      {ADArrayIdentifier(), DeSerializeADAr},
+      {FB_Tables::NDArrayIdentifier(), DeSerializeNDAr},
+  };
+  return deSerializers;
+}
+} // namespace
+
+bool RegisterDeSerializer(std::string const &identifier,
+                          DeSerializerFunction decoder) {
+  if (flatbuffers::FlatBufferBuilder::kFileIdentifierLength !=
+          identifier.size() or
+      nullptr == decoder) {
+    return false;
+  }
+  auto &deSerializers = GetDeSerializers();
+  for (auto &entry : deSerializers) {
+    if (entry.first == identifier) {
+      entry.second = decoder;
+      return true;
+    }
+  }
+  deSerializers.emplace_back(identifier, decoder);
+  return true;
+}
+
+bool UnregisterDeSerializer(std::string const &identifier) {
+  auto &deSerializers = GetDeSerializers();
+  auto entry = std::find_if(
+      deSerializers.begin(), deSerializers.end(),
+      [&identifier](DeSerializerList::value_type const &current) {
+        return current.first == identifier;
+      });
+  if (deSerializers.end() == entry) {
+    return false;
+  }
+  deSerializers.erase(entry);
+  return true;
+}
+
+namespace {
+/// @brief True if the buffer is large enough to hold a file identifier.
+bool HasIdentifier(const unsigned char *bufferPtr, size_t size) {
+  // Root table offset followed by the file identifier
+  return nullptr != bufferPtr and
+         size >= sizeof(flatbuffers::uoffset_t) +
+                     flatbuffers::FlatBufferBuilder::kFileIdentifierLength;
+}
+} // namespace
+
+DeSerializeResult DeSerializeData(NDArrayPool *pNDArrayPool,
+                                  const unsigned char *bufferPtr, size_t size,
+                                  NDArray *&pArray) {
+  pArray = nullptr;
+  if (not HasIdentifier(bufferPtr, size)) {
+    return DeSerializeResult::UNKNOWN_FORMAT;
+  }
+  auto identifier = flatbuffers::GetBufferIdentifier(bufferPtr);
+  for (auto const &entry : GetDeSerializers()) {
+    if (0 == std::memcmp(identifier, entry.first.data(),
+                         entry.first.size())) {
+      DRIVER_TRACE_START(traceStart);
+      auto result = entry.second(pNDArrayPool, bufferPtr, size, pArray);
+      DRIVER_TRACE_END(traceStart, "decode",
+                       nullptr == pArray ? -1 : pArray->uniqueId);
+      return result;
+    }
+  }
+  return DeSerializeResult::UNKNOWN_FORMAT;
+}
+
+bool PeekSourceName(const unsigned char *bufferPtr, size_t size,
+                    std::string &sourceName) {
+  if (not HasIdentifier(bufferPtr, size) or
+      not flatbuffers::BufferHasIdentifier(bufferPtr, ADArrayIdentifier())) {
+    return false;
+  }
+  flatbuffers::Verifier verifier(bufferPtr, size);
+  if (not VerifyADArrayBuffer(verifier)) {
+    return false;
+  }
+  auto name = GetADArray(bufferPtr)->source_name();
+  if (nullptr == name) {
+    return false;
+  }
+  sourceName = name->str();
+  return true;
 }
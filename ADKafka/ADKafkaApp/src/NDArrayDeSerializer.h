@@ -6,28 +6,81 @@
 
 #pragma once
 
+#include "ADArray_schema_generated.h"
 #include "NDArray_schema_generated.h"
 #include <NDArray.h>
+#include <string>
+
+/// @brief Outcome of deserializing a flatbuffer message.
+enum class DeSerializeResult {
+  SUCCESS,
+  ALLOC_FAILED,   ///< The NDArrayPool is exhausted, the message can be retried.
+  UNKNOWN_FORMAT, ///< Unknown file identifier or invalid content; drop it.
+};
+
+/** @brief Signature of the decode routine of one flatbuffer schema.
+ * The arguments are the same as those of DeSerializeData(). The buffer comes
+ * from the network or a file: the routine must verify it (e.g. with
+ * flatbuffers::Verifier) before accessing it and return
+ * DeSerializeResult::UNKNOWN_FORMAT if it is invalid.
+ */
+using DeSerializerFunction = DeSerializeResult (*)(
+    NDArrayPool *pNDArrayPool, const unsigned char *bufferPtr, size_t size,
+    NDArray *&pArray);
+
+/** @brief Registers the decode routine used for buffers with the given file
+ * identifier.
+ * Decoders for the "ADAr" (ADArray_schema.fbs) and "NDAr"
+ * (NDArray_schema.fbs) identifiers are registered by default. The registry is
+ * not protected by a lock; only call this function before iocInit.
+ * @param[in] identifier The four character flatbuffer file identifier.
+ * @param[in] decoder The decode routine. Replaces any previously registered
+ * routine for the same identifier.
+ * @return False if the identifier is not four characters long or if decoder
+ * is nullptr.
+ */
+bool RegisterDeSerializer(std::string const &identifier,
+                          DeSerializerFunction decoder);
+
+/** @brief Removes the decode routine registered for the given file identifier,
+ * including the default ones. Same restrictions as RegisterDeSerializer().
+ * @return False if no routine was registered for the identifier.
+ */
+bool UnregisterDeSerializer(std::string const &identifier);
 
 /** @brief Deserializes NDArray data previously serialized by flatbuffers.
- * The deserialization requires that a NDArrayPool provides a NDArray instance
- * to which the data can
- * be copied. The function currently does no checks to ensure that there is
- * memory available. This
- * should probably be rectified and taken care of here.
+ * The decode routine is selected using the file identifier of the buffer (bytes
+ * 4 to 7), see RegisterDeSerializer(). The deserialization requires that a
+ * NDArrayPool provides a NDArray instance to which the data can be copied. If
+ * the pool is exhausted, nothing is deserialized and
+ * DeSerializeResult::ALLOC_FAILED is returned, see
+ * KafkaInterface::KafkaConsumer::UpdateBackpressure() for how this is avoided.
  * @param[in] pNDArrayPool A pointer to the NDArrayPool which is used to
  * allocate NDArray which
  * will store the data in the buffer.
  * @param[in] bufferPtr Pointer to the buffer containing the data which is to be
  * deserialized.
- * @param[in] size Size of the data in bytes. Note that this value is not used
- * and that no checks
- * are made for overflows.
+ * @param[in] size Size of the data in bytes. The array data copied is limited
+ * to the size of the allocated NDArray.
  * @param[out] pArray The pointer to the NDArray containing the deserialized
  * data. Note that the
  * caller has ownership of the pointer and must thus call NDArray::release()
  * when the array is no
- * longer needed.
+ * longer needed. Set to nullptr on failure.
+ * @return DeSerializeResult::SUCCESS on success.
+ */
+DeSerializeResult DeSerializeData(NDArrayPool *pNDArrayPool,
+                                  const unsigned char *bufferPtr, size_t size,
+                                  NDArray *&pArray);
+
+/** @brief Reads the source name of a serialized NDArray without
+ * deserializing it, i.e. without copying the array data.
+ * Only the "ADAr" format (ADArray_schema.fbs) has a source name. The buffer
+ * is verified first.
+ * @param[in] bufferPtr Pointer to the serialized data.
+ * @param[in] size Size of the data in bytes.
+ * @param[out] sourceName The source name.
+ * @return False if the buffer does not contain a source name.
  */
-void DeSerializeData(NDArrayPool *pNDArrayPool, const unsigned char *bufferPtr,
-                     NDArray *&pArray);
+bool PeekSourceName(const unsigned char *bufferPtr, size_t size,
+                    std::string &sourceName);
@@ -8,8 +8,12 @@
 #pragma once
 
 #include <asynNDArrayDriver.h>
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <ciso646>
@@ -150,3 +154,197 @@ asynStatus setParam(asynNDArrType *driverPtr, const PV_param &param,
   }
   return retStatus;
 }
+
+/** @brief Overloaded function used to set 64-bit integer PV values.
+ * See the integer version of setParam() for details. Calls std::abort() if the
+ * type of the PV is not asynParamInt64.
+ * @param[in] driverPtr Pointer to the instance of the class which calls this
+ * function.
+ * @param[in] param Has the relevant PV information for updating the value in
+ * the PV database.
+ * @param[in] value The new value of the PV.
+ * @return The result of setting the parameter in the form of
+ * asynPortDriver::asynStatus.
+ */
+template <typename asynNDArrType>
+asynStatus setParam(asynNDArrType *driverPtr, const PV_param &param,
+                    const std::int64_t value) {
+  if (nullptr == driverPtr or 0 == *param.index) {
+    return asynStatus::asynError;
+  }
+  asynStatus retStatus;
+  if (asynParamInt64 == param.type) {
+    retStatus = driverPtr->setInteger64Param(*param.index, value);
+  } else {
+    std::abort();
+  }
+  return retStatus;
+}
+
+/** @brief Overloaded function used to set PV floating point values.
+ * See the integer version of setParam() for details. Calls std::abort() if the
+ * type of the PV is not asynParamFloat64.
+ * @param[in] driverPtr Pointer to the instance of the class which calls this
+ * function.
+ * @param[in] param Has the relevant PV information for updating the value in
+ * the PV database.
+ * @param[in] value The new value of the PV.
+ * @return The result of setting the parameter in the form of
+ * asynPortDriver::asynStatus.
+ */
+template <typename asynNDArrType>
+asynStatus setParam(asynNDArrType *driverPtr, const PV_param &param,
+                    const double value) {
+  if (nullptr == driverPtr or 0 == *param.index) {
+    return asynStatus::asynError;
+  }
+  asynStatus retStatus;
+  if (asynParamFloat64 == param.type) {
+    retStatus = driverPtr->setDoubleParam(*param.index, value);
+  } else {
+    std::abort();
+  }
+  return retStatus;
+}
+
+/** @brief Hands PV values from threads which do not hold the asyn port lock
+ * (e.g. librdkafka callbacks) to a thread which does.
+ * Every PV has a slot holding the latest value which has not yet been
+ * published; a value which has not been published yet is replaced, i.e.
+ * updates are coalesced per PV. Numeric values are stored in the atomics of
+ * the slot and never block or allocate. Strings are copied into a buffer of
+ * the slot which is swapped with a second buffer when published, under a lock
+ * only held for the copy or the swap; the buffers are reused, so posting a
+ * string only allocates when it is longer than the ones posted to the slot
+ * before. The values are written to the parameter library by
+ * PendingParamUpdates::publish(), which must only be called by one thread at a
+ * time while holding the port lock. A slot must always be posted with the same
+ * type.
+ */
+class PendingParamUpdates {
+public:
+  /** @brief Allocates the slots.
+   * @param[in] nrOfSlots The number of PVs, slot i corresponds to element i of
+   * the PV_param list passed to PendingParamUpdates::publish().
+   */
+  explicit PendingParamUpdates(size_t nrOfSlots)
+      : slots(new Slot[nrOfSlots]), nrOfSlots(nrOfSlots) {}
+
+  PendingParamUpdates(PendingParamUpdates const &) = delete;
+  PendingParamUpdates &operator=(PendingParamUpdates const &) = delete;
+
+  /// @brief Posts a new value for an asynParamInt32 PV.
+  void post(size_t slot, int value) {
+    postNumber(slot, asynParamInt32, value);
+  }
+
+  /// @brief Posts a new value for an asynParamInt64 PV.
+  void post(size_t slot, std::int64_t value) {
+    postNumber(slot, asynParamInt64, value);
+  }
+
+  /// @brief Posts a new value for an asynParamFloat64 PV.
+  void post(size_t slot, double value) {
+    std::int64_t bits;
+    static_assert(sizeof(bits) == sizeof(value), "Unexpected double size.");
+    std::memcpy(&bits, &value, sizeof(bits));
+    postNumber(slot, asynParamFloat64, bits);
+  }
+
+  /// @brief Posts a new value for an asynParamOctet PV.
+  void post(size_t slot, std::string const &value) {
+    if (slot >= nrOfSlots) {
+      return;
+    }
+    auto &current = slots[slot];
+    std::lock_guard<std::mutex> lock(current.stringMutex);
+    // Reuses the capacity of the buffer, only allocates for a longer string
+    current.postedString.assign(value);
+    current.type.store(asynParamOctet, std::memory_order_relaxed);
+    current.pending.store(true, std::memory_order_release);
+  }
+
+  /** @brief Drops a value which has not yet been published. Used when a PV
+   * is set directly in order to not have it overwritten by an older value.
+   */
+  void discard(size_t slot) {
+    if (slot < nrOfSlots) {
+      slots[slot].pending.store(false, std::memory_order_release);
+    }
+  }
+
+  /** @brief Writes all posted values to the parameter library.
+   * Does not call asynPortDriver::callParamCallbacks().
+   * @param[in] driverPtr Pointer to the driver, see setParam().
+   * @param[in] paramList The PV definitions corresponding to the slots.
+   * @return True if any value was written.
+   */
+  template <class asynNDArrType>
+  bool publish(asynNDArrType *driverPtr,
+               std::vector<PV_param> const &paramList) {
+    bool published{false};
+    for (size_t i = 0; i < nrOfSlots and i < paramList.size(); ++i) {
+      auto &current = slots[i];
+      if (not current.pending.load(std::memory_order_acquire)) {
+        continue;
+      }
+      if (asynParamOctet == current.type.load(std::memory_order_relaxed)) {
+        {
+          // The flag is cleared under the lock so that a string posted
+          // meanwhile is not left behind in the swapped out buffer
+          std::lock_guard<std::mutex> lock(current.stringMutex);
+          if (not current.pending.exchange(false, std::memory_order_acquire)) {
+            continue;
+          }
+          current.postedString.swap(current.publishedString);
+        }
+        setParam(driverPtr, paramList[i], current.publishedString);
+        published = true;
+        continue;
+      }
+      if (not current.pending.exchange(false, std::memory_order_acquire)) {
+        continue;
+      }
+      auto type = current.type.load(std::memory_order_relaxed);
+      auto bits = current.number.load(std::memory_order_relaxed);
+      if (asynParamInt64 == type) {
+        setParam(driverPtr, paramList[i], bits);
+      } else if (asynParamFloat64 == type) {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        setParam(driverPtr, paramList[i], value);
+      } else {
+        setParam(driverPtr, paramList[i], static_cast<int>(bits));
+      }
+      published = true;
+    }
+    return published;
+  }
+
+private:
+  /// @brief The latest posted value of a PV.
+  struct Slot {
+    std::atomic<bool> pending{false};
+    std::atomic<int> type{asynParamInt32};
+    /// @brief The value, doubles are stored as their bit pattern.
+    std::atomic<std::int64_t> number{0};
+    std::mutex stringMutex;
+    /// @brief Written by post(), guarded by stringMutex.
+    std::string postedString;
+    /// @brief Only used by publish().
+    std::string publishedString;
+  };
+
+  void postNumber(size_t slot, asynParamType type, std::int64_t value) {
+    if (slot >= nrOfSlots) {
+      return;
+    }
+    auto &current = slots[slot];
+    current.type.store(type, std::memory_order_relaxed);
+    current.number.store(value, std::memory_order_relaxed);
+    current.pending.store(true, std::memory_order_release);
+  }
+
+  std::unique_ptr<Slot[]> slots;
+  size_t nrOfSlots;
+};
@@ -0,0 +1,12 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThreadPlacement.cpp
+ *  @brief The thread placer of ADKafka.
+ */
+
+#include "ThreadPlacement.h"
+
+namespace DriverThreads {
+KafkaThreads::ThreadPlacer Placer{
+    {"consume", "librdkafka"}, Role::LIBRDKAFKA, "ADKafka thread placement"};
+} // namespace DriverThreads
@@ -0,0 +1,28 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThreadPlacement.h
+ *  @brief The thread placement of ADKafka.
+ *
+ * The placement of each kind of thread (see DriverThreads::Role) is set before
+ * iocInit with the iocsh command KafkaDriverThreadPlacement. The effective
+ * placement of every running thread is printed by
+ * KafkaDriverThreadReport. See ThreadPlacer.h.
+ */
+
+#pragma once
+
+#include "ThreadPlacer.h"
+
+namespace DriverThreads {
+
+/// @brief The kinds of threads which can be placed.
+namespace Role {
+enum {
+  CONSUME = 0, ///< The thread consuming and decoding the Kafka messages.
+  LIBRDKAFKA,  ///< The internal (main and broker) threads of librdkafka.
+};
+} // namespace Role
+
+/// @brief The placements of the threads of ADKafka.
+extern KafkaThreads::ThreadPlacer Placer;
+} // namespace DriverThreads
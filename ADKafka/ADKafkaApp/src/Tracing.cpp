@@ -0,0 +1,12 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Tracing.cpp
+ *  @brief The trace of the driver.
+ */
+
+#include "Tracing.h"
+
+namespace DriverTracing {
+// Process id 1 is used by the plugin
+KafkaTracing::TraceLog Log{2, "KafkaDriver"};
+} // namespace DriverTracing
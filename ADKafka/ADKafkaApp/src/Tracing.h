@@ -0,0 +1,26 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Tracing.h
+ *  @brief Trace points of the driver, see TraceLog.h.
+ *
+ * Tracing is enabled with the iocsh command KafkaDriverTraceEnable and the
+ * trace is written to a file with KafkaDriverTraceDump.
+ */
+
+#pragma once
+
+#include "TraceLog.h"
+
+namespace DriverTracing {
+/// @brief The trace of ADKafka.
+extern KafkaTracing::TraceLog Log;
+} // namespace DriverTracing
+
+#define DRIVER_TRACE_SCOPE(Name, Id)                                           \
+  KAFKA_TRACE_SCOPE(DriverTracing::Log, Name, Id)
+#define DRIVER_TRACE_START(Variable)                                           \
+  KAFKA_TRACE_START(DriverTracing::Log, Variable)
+#define DRIVER_TRACE_END(Variable, Name, Id)                                   \
+  KAFKA_TRACE_END(DriverTracing::Log, Variable, Name, Id)
+#define DRIVER_TRACE_EVENT(Name, StartNs, DurationNs, Id)                      \
+  KAFKA_TRACE_EVENT(DriverTracing::Log, Name, StartNs, DurationNs, Id)
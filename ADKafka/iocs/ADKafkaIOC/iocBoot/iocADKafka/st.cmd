@@ -10,6 +10,9 @@ epicsEnvSet("K_PORT", "$(PREFIX)K")
 epicsEnvSet("QSIZE", "20")
 epicsEnvSet("EPICS_DB_INCLUDE_PATH", "$(ADCORE)/db")
 
+# CPU affinity and scheduling of the Kafka threads, role "consume" or "librdkafka" (Linux only).
+# KafkaDriverThreadPlacement(const char *role, const char *cpus, const char *scheduling)
+# KafkaDriverThreadPlacement("consume", "2", "fifo:50")
 
 KafkaDriverConfigure("$(KFKDET_PORT)", 10, 0, 0, 0, "localhost:9092", "url_data_topic")
 dbLoadRecords("$(ADKAFKA)/db/ADKafka.template", "P=$(PREFIX):, R=KFK_DRVR:, PORT=$(KFKDET_PORT), ADDR=0, TIMEOUT=1")
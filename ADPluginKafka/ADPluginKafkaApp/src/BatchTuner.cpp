@@ -0,0 +1,169 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  BatchTuner.cpp
+ *  @brief Implementation of the producer batching controller.
+ */
+
+#include "BatchTuner.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstdio>
+
+namespace KafkaInterface {
+
+namespace {
+const std::int64_t MiB{1024 * 1024};
+const std::int64_t MinBuffer{16 * MiB};
+const std::int64_t MaxBuffer{4096 * MiB};
+const std::int64_t MinQueueMessages{16};
+const std::int64_t MaxQueueMessages{8388608};
+/// @brief The maximum of "batch.num.messages".
+const std::int64_t MaxBatchMessages{1000000};
+const int LingerSteps[]{0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+/// @brief Weight of the newest sample in the moving averages.
+const double Smoothing{0.3};
+const double MinLingerScale{1.0 / 8};
+
+std::string formatSize(double Bytes) {
+  char Buffer[32];
+  if (Bytes >= 1024.0 * MiB) {
+    std::snprintf(Buffer, sizeof(Buffer), "%.1f GB", Bytes / (1024.0 * MiB));
+  } else if (Bytes >= MiB) {
+    std::snprintf(Buffer, sizeof(Buffer), "%.1f MB", Bytes / MiB);
+  } else {
+    std::snprintf(Buffer, sizeof(Buffer), "%.1f kB", Bytes / 1024);
+  }
+  return Buffer;
+}
+} // namespace
+
+const std::int64_t BatchTuner::TargetBatchBytes;
+const std::size_t BatchTuner::Samples;
+const std::size_t BatchTuner::MinSamples;
+const int BatchTuner::MinRetuneInterval;
+
+std::int64_t BatchTuner::RoundUpPow2(std::int64_t Value) {
+  std::int64_t Result{1};
+  while (Result < Value) {
+    Result *= 2;
+  }
+  return Result;
+}
+
+bool BatchTuner::SetLatencyTargetMS(double Target) {
+  if (Target <= 0) {
+    return false;
+  }
+  LatencyTargetMS = Target;
+  return true;
+}
+
+bool BatchTuner::SetBufferSeconds(double Seconds) {
+  if (Seconds <= 0) {
+    return false;
+  }
+  BufferSeconds = Seconds;
+  return true;
+}
+
+void BatchTuner::Update(Sample const &Stats) {
+  if (0 == Stats.Messages or Stats.Seconds <= 0) {
+    // Idle, e.g. between acquisitions
+    return;
+  }
+  double Rate = Stats.Messages / Stats.Seconds;
+  double Size = static_cast<double>(Stats.Bytes) / Stats.Messages;
+  if (0 == SampleCount) {
+    MeanRate = Rate;
+    MeanSize = Size;
+    MeanLatencyMS = Stats.LatencyMS;
+  } else {
+    MeanRate += Smoothing * (Rate - MeanRate);
+    MeanSize += Smoothing * (Size - MeanSize);
+    MeanLatencyMS += Smoothing * (Stats.LatencyMS - MeanLatencyMS);
+  }
+  ++SampleCount;
+  PeakIndex = (PeakIndex + 1) % Samples;
+  Peaks[PeakIndex] = Stats.PeakSize;
+  QueuedMessages = Stats.QueuedMessages;
+
+  if (Stats.LatencyMS > LatencyTargetMS) {
+    if (QueuedMessages > 2 * CurrentSettings.BatchMessages) {
+      // Saturated, larger batches increase the throughput
+      LingerScale = std::min(1.0, 2 * LingerScale);
+    } else {
+      LingerScale = std::max(MinLingerScale, LingerScale / 2);
+    }
+  } else if (Stats.LatencyMS < LatencyTargetMS / 2) {
+    LingerScale = std::min(1.0, 2 * LingerScale);
+  }
+}
+
+std::size_t BatchTuner::PeakSize() const {
+  return *std::max_element(Peaks.begin(), Peaks.end());
+}
+
+BatchSettings BatchTuner::Recommend() const {
+  if (SampleCount < MinSamples) {
+    return CurrentSettings;
+  }
+  BatchSettings Result;
+  auto Size = static_cast<std::int64_t>(std::max(MeanSize, 1.0));
+  auto PerBatch = std::min(
+      RoundUpPow2(std::max<std::int64_t>(1, TargetBatchBytes / Size)),
+      MaxBatchMessages);
+  Result.BatchMessages = static_cast<int>(PerBatch);
+
+  double LingerLimit = LingerScale * LatencyTargetMS / 2;
+  double Linger = std::min((PerBatch - 1) * 1000.0 / MeanRate, LingerLimit);
+  if (Linger * MeanRate / 1000.0 < 1.0) {
+    // Not even one more message would be collected
+    Linger = 0;
+  }
+  for (auto Step : LingerSteps) {
+    if (Step <= Linger) {
+      Result.LingerMS = Step;
+    }
+  }
+
+  auto Peak = static_cast<std::int64_t>(
+      std::max(static_cast<double>(PeakSize()), MeanSize));
+  auto Buffer = static_cast<std::int64_t>(
+      std::max(2.0 * Peak, BufferSeconds * MeanRate * MeanSize));
+  Buffer = std::min(std::max(RoundUpPow2(Buffer), MinBuffer), MaxBuffer);
+  Result.BufferKBytes = static_cast<int>(Buffer / 1024);
+  auto Messages = static_cast<std::int64_t>(BufferSeconds * MeanRate);
+  Result.QueueMessages = static_cast<int>(std::min(
+      std::max(RoundUpPow2(Messages), MinQueueMessages), MaxQueueMessages));
+  return Result;
+}
+
+std::string BatchTuner::Reason() const {
+  if (SampleCount < MinSamples) {
+    return "Observing messages.";
+  }
+  auto Settings = Recommend();
+  char Rate[32];
+  std::snprintf(Rate, sizeof(Rate), "%.1f Hz", MeanRate);
+  return formatSize(MeanSize) + " @ " + Rate + ": linger " +
+         std::to_string(Settings.LingerMS) + " ms, " +
+         std::to_string(Settings.BatchMessages) + " msgs/batch, queue " +
+         formatSize(Settings.BufferKBytes * 1024.0);
+}
+
+bool BatchTuner::RetuneDue(Clock::time_point Now) const {
+  if (SampleCount < MinSamples or
+      (IsApplied and
+       Now - LastApplied < std::chrono::seconds(MinRetuneInterval))) {
+    return false;
+  }
+  return Recommend() != CurrentSettings;
+}
+
+void BatchTuner::Applied(BatchSettings const &Settings,
+                         Clock::time_point Now) {
+  CurrentSettings = Settings;
+  IsApplied = true;
+  LastApplied = Now;
+}
+} // namespace KafkaInterface
@@ -0,0 +1,155 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  BatchTuner.h
+ *  @brief Feedback controller for the batching and buffer settings of a
+ * librdkafka producer.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace KafkaInterface {
+
+/// @brief The librdkafka producer settings adjusted by BatchTuner.
+struct BatchSettings {
+  /// @brief "linger.ms", time to wait for more messages before sending.
+  int LingerMS{5};
+  /// @brief "batch.num.messages", maximum number of messages per batch.
+  int BatchMessages{10000};
+  /// @brief "queue.buffering.max.kbytes", size of the producer queue in kB.
+  int BufferKBytes{10240};
+  /// @brief "queue.buffering.max.messages", length of the producer queue.
+  int QueueMessages{10};
+
+  bool operator==(BatchSettings const &Other) const {
+    return LingerMS == Other.LingerMS and
+           BatchMessages == Other.BatchMessages and
+           BufferKBytes == Other.BufferKBytes and
+           QueueMessages == Other.QueueMessages;
+  }
+  bool operator!=(BatchSettings const &Other) const {
+    return not(*this == Other);
+  }
+};
+
+/** @brief Recommends batching and buffer settings for the produced messages.
+ * Updated with the messages produced, the delivery latency and the queue
+ * depth of every statistics interval:
+ * * A batch collects about BatchTuner::TargetBatchBytes, i.e. many small
+ * messages or a single large one.
+ * * The producer lingers for the time it takes to collect a batch, but at most
+ * half of the latency target and only if at least two messages arrive in that
+ * time. At low rates messages are thus sent immediately.
+ * * If the delivery latency exceeds the target while the queue is short, the
+ * linger time is the cause and its limit is halved. If the queue is long, the
+ * link is saturated and larger batches are used again.
+ * * The queue holds the data produced in the buffer time (frame size times
+ * rate times seconds), but at least two of the largest messages.
+ *
+ * Values are rounded up to powers of two (and the linger time down to 1, 2,
+ * 5, 10... ms), so a retune is only recommended on significant changes and at
+ * most once per BatchTuner::MinRetuneInterval. Intervals without messages are
+ * ignored, so the settings survive the pauses between acquisitions. The class
+ * is not thread safe.
+ */
+class BatchTuner {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief The statistics of one interval, see BatchTuner::Update().
+  struct Sample {
+    std::uint64_t Messages{0};
+    std::uint64_t Bytes{0};
+    std::size_t PeakSize{0};
+    /// @brief Mean delivery latency of the interval, in ms.
+    double LatencyMS{0};
+    /// @brief Messages waiting in the producer queue.
+    std::int64_t QueuedMessages{0};
+    /// @brief Length of the interval.
+    double Seconds{0};
+  };
+
+  /// @brief Bytes which are worth collecting into one request.
+  static const std::int64_t TargetBatchBytes{1048576};
+
+  /// @brief Number of samples kept for the largest message size.
+  static const std::size_t Samples{8};
+
+  /// @brief Samples with messages required before the first recommendation.
+  static const std::size_t MinSamples{3};
+
+  /// @brief Minimum time between two retunes, in seconds.
+  static const int MinRetuneInterval{30};
+
+  /// @brief Adds the statistics of one interval.
+  void Update(Sample const &Stats);
+
+  /** @brief Sets the upper bound of the delivery latency.
+   * @return False if not positive.
+   */
+  bool SetLatencyTargetMS(double Target);
+  double GetLatencyTargetMS() const { return LatencyTargetMS; }
+
+  /** @brief Sets how many seconds of data the producer queue should hold.
+   * @return False if not positive.
+   */
+  bool SetBufferSeconds(double Seconds);
+  double GetBufferSeconds() const { return BufferSeconds; }
+
+  /** @brief Returns true if the recommended settings differ from the applied
+   * ones and the last retune is long enough ago.
+   */
+  bool RetuneDue(Clock::time_point Now) const;
+
+  /// @brief The settings for the messages observed so far.
+  BatchSettings Recommend() const;
+
+  /** @brief A short explanation of the recommended settings, e.g.
+   * "48.0 MB @ 14.0 Hz: linger 0 ms, 1 msgs/batch, queue 2.0 GB".
+   */
+  std::string Reason() const;
+
+  /// @brief To be called when the settings have been applied.
+  void Applied(BatchSettings const &Settings, Clock::time_point Now);
+
+  /// @brief The settings currently in use.
+  BatchSettings const &Current() const { return CurrentSettings; }
+
+  /// @brief Sets the settings in use without starting the retune interval.
+  void SetCurrent(BatchSettings const &Settings) {
+    CurrentSettings = Settings;
+  }
+
+  /// @brief Smallest power of two which is not smaller than the value.
+  static std::int64_t RoundUpPow2(std::int64_t Value);
+
+protected:
+  /// @brief The largest message of the kept samples.
+  std::size_t PeakSize() const;
+
+  BatchSettings CurrentSettings;
+  bool IsApplied{false};
+  Clock::time_point LastApplied;
+
+  double LatencyTargetMS{100};
+  double BufferSeconds{2};
+
+  std::size_t SampleCount{0};
+  std::array<std::size_t, Samples> Peaks{};
+  std::size_t PeakIndex{0};
+
+  /// @brief Exponential moving averages of the samples with messages.
+  double MeanRate{0};
+  double MeanSize{0};
+  double MeanLatencyMS{0};
+  std::int64_t QueuedMessages{0};
+
+  /// @brief Fraction (1/8 to 1) of the linger limit, see the class description.
+  double LingerScale{1};
+};
+} // namespace KafkaInterface
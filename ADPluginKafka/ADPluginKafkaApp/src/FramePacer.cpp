@@ -0,0 +1,41 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FramePacer.cpp
+ *  @brief Implementation of the schedule of the frames emitted by the load
+ * generator.
+ */
+
+#include "FramePacer.h"
+#include <algorithm>
+#include <ciso646>
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+
+FramePacer::Clock::duration toDuration(double Value) {
+  return std::chrono::duration_cast<FramePacer::Clock::duration>(
+      Seconds(Value));
+}
+} // namespace
+
+FramePacer::FramePacer(double FrameRate, double BurstLength,
+                       double IdleLength, Clock::time_point Now)
+    : Period(toDuration(0 < FrameRate ? 1.0 / FrameRate : 0.0)),
+      Burst(toDuration(BurstLength)), Idle(toDuration(IdleLength)),
+      BurstStart(Now), NextTime(Now) {}
+
+FramePacer::Clock::time_point FramePacer::schedule(Clock::time_point Now,
+                                                   bool &Late) {
+  Late = false;
+  if (Burst > Clock::duration::zero() and Now - BurstStart >= Burst) {
+    BurstStart = std::max(Now, BurstStart + Burst + Idle);
+    NextTime = BurstStart;
+  }
+  if (Period > Clock::duration::zero() and Now - NextTime > Period) {
+    Late = true;
+    NextTime = Now;
+  }
+  auto Due = std::max(Now, NextTime);
+  NextTime += Period;
+  return Due;
+}
@@ -0,0 +1,49 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FramePacer.h
+ *  @brief Schedule of the frames emitted by the load generator.
+ */
+
+#pragma once
+
+#include <chrono>
+
+/** @brief Decides when the load generator emits its frames.
+ * Frames are due at a fixed rate, optionally in bursts of a given length
+ * separated by idle time. A frame which is due more than one period in the
+ * past is late; it is sent immediately and the schedule is reset instead of
+ * catching up, as that would produce a burst.
+ *
+ * The current time is passed to every call in order for the schedule to be
+ * testable without waiting. The class is not thread safe; it is used by the
+ * generator thread only.
+ */
+class FramePacer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /** @brief Starts a new schedule.
+   * @param[in] FrameRate Frames per second, 0 for as fast as possible.
+   * @param[in] BurstLength Length of a burst in seconds, 0 for no bursts.
+   * @param[in] IdleLength Time between two bursts in seconds.
+   * @param[in] Now The time at which the first burst starts.
+   */
+  FramePacer(double FrameRate, double BurstLength, double IdleLength,
+             Clock::time_point Now);
+
+  /** @brief Schedules the next frame.
+   * Must be called exactly once per frame.
+   * @param[in] Now The current time.
+   * @param[out] Late Set to true if the frame was late.
+   * @return The time at which the frame should be sent, not later than Now if
+   * it should be sent immediately.
+   */
+  Clock::time_point schedule(Clock::time_point Now, bool &Late);
+
+private:
+  Clock::duration Period;
+  Clock::duration Burst;
+  Clock::duration Idle;
+  Clock::time_point BurstStart;
+  Clock::time_point NextTime;
+};
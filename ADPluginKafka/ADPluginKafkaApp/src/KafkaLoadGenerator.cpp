@@ -0,0 +1,420 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  KafkaLoadGenerator.cpp
+ *  @brief Implementation of an areaDetector driver which generates synthetic
+ * frames for load testing KafkaPlugin.
+ */
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include <algorithm>
+#include <asynDriver.h>
+#include <ciso646>
+#include <cstring>
+#include <epicsExport.h>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "KafkaLoadGenerator.h"
+#include "FramePacer.h"
+
+static const char *driverName = "KafkaLoadGenerator";
+
+namespace {
+/// @brief Largest generated pixel value; integer detectors rarely use more
+/// than 16 bits.
+template <typename T> double maxPixelValue() {
+  if (std::is_floating_point<T>::value) {
+    return 1000.0;
+  }
+  return std::min<double>(std::numeric_limits<T>::max(), 65535.0);
+}
+
+template <typename T>
+void fillFrame(std::vector<unsigned char> &Buffer, size_t Elements,
+               double Sparsity, std::mt19937 &Generator) {
+  Buffer.resize(Elements * sizeof(T));
+  auto Data = reinterpret_cast<T *>(Buffer.data());
+  std::bernoulli_distribution IsZero(Sparsity);
+  std::uniform_real_distribution<double> Value(0.0, maxPixelValue<T>());
+  for (size_t i = 0; i < Elements; ++i) {
+    Data[i] = IsZero(Generator) ? T(0) : static_cast<T>(Value(Generator));
+  }
+}
+
+/// @brief Fills the buffer with random pixels, returns false if the data
+/// type is not supported.
+bool fillFrame(NDDataType_t DataType, std::vector<unsigned char> &Buffer,
+               size_t Elements, double Sparsity, std::mt19937 &Generator) {
+  switch (DataType) {
+  case NDInt8:
+    fillFrame<epicsInt8>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDUInt8:
+    fillFrame<epicsUInt8>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDInt16:
+    fillFrame<epicsInt16>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDUInt16:
+    fillFrame<epicsUInt16>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDInt32:
+    fillFrame<epicsInt32>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDUInt32:
+    fillFrame<epicsUInt32>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDInt64:
+    fillFrame<epicsInt64>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDUInt64:
+    fillFrame<epicsUInt64>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDFloat32:
+    fillFrame<epicsFloat32>(Buffer, Elements, Sparsity, Generator);
+    break;
+  case NDFloat64:
+    fillFrame<epicsFloat64>(Buffer, Elements, Sparsity, Generator);
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+/// @brief Adds integer, floating point and string attributes, in turn.
+void addAttributes(NDAttributeList &Attributes, int Count,
+                   std::mt19937 &Generator) {
+  std::uniform_int_distribution<epicsInt32> IntValue(0, 1000000);
+  std::uniform_real_distribution<epicsFloat64> FloatValue(-1000.0, 1000.0);
+  for (int i = 0; i < Count; ++i) {
+    auto Name = "LoadGenAttr" + std::to_string(i);
+    if (0 == i % 3) {
+      epicsInt32 Value = IntValue(Generator);
+      Attributes.add(Name.c_str(), "Generated attribute", NDAttrInt32, &Value);
+    } else if (1 == i % 3) {
+      epicsFloat64 Value = FloatValue(Generator);
+      Attributes.add(Name.c_str(), "Generated attribute", NDAttrFloat64,
+                     &Value);
+    } else {
+      auto Value = "Generated value " + std::to_string(IntValue(Generator));
+      Attributes.add(Name.c_str(), "Generated attribute", NDAttrString,
+                     const_cast<char *>(Value.c_str()));
+    }
+  }
+}
+} // namespace
+
+static void generateTaskC(void *drvPvt) {
+  auto *pPvt = reinterpret_cast<KafkaLoadGenerator *>(drvPvt);
+
+  pPvt->generateTask();
+}
+
+KafkaLoadGenerator::KafkaLoadGenerator(const char *portName, int maxBuffers,
+                                       size_t maxMemory, int priority,
+                                       int stackSize)
+    : ADDriver(portName, 1, 10, maxBuffers, maxMemory, 0, 0,
+               0, 1, /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=0, autoConnect=1 */
+               priority, stackSize) {
+  const char *functionName = "KafkaLoadGenerator";
+  StartEventId = epicsEventCreate(epicsEventEmpty);
+  StopEventId = epicsEventCreate(epicsEventEmpty);
+  ThreadExitEventId = epicsEventCreate(epicsEventEmpty);
+  if (nullptr == StartEventId or nullptr == StopEventId or
+      nullptr == ThreadExitEventId) {
+    printf("%s:%s epicsEventCreate failure\n", driverName, functionName);
+    return;
+  }
+
+  setStringParam(ADManufacturer, "European Spallation Source");
+  setStringParam(ADModel, "Kafka load generator");
+  setIntegerParam(ADMaxSizeX, 16384);
+  setIntegerParam(ADMaxSizeY, 16384);
+  setIntegerParam(ADSizeX, 512);
+  setIntegerParam(ADSizeY, 512);
+  setIntegerParam(NDDataType, NDUInt16);
+  setIntegerParam(ADImageMode, ADImageContinuous);
+  setIntegerParam(ADNumImages, 100);
+  setIntegerParam(ADStatus, ADStatusIdle);
+  setIntegerParam(NDArrayCallbacks, 1);
+
+  std::vector<ParameterBase *> Parameters{
+      &FrameRateParam,  &BurstLengthParam, &IdleLengthParam,
+      &SparsityParam,   &NumAttributesParam, &PoolSizeParam,
+      &ActualRateParam, &FramesSentParam,  &LateFramesParam,
+      &AllocFailuresParam};
+  for (auto Param : Parameters) {
+    ParamRegistrar.registerParameter(Param);
+    Param->updateDbValue();
+  }
+  ParamRegistrar.setPeriodicTask([this]() { publishStats(); },
+                                 std::chrono::milliseconds(500));
+  ParamRegistrar.startUpdateThread();
+
+  ThreadStarted =
+      (epicsThreadCreate("KafkaLoadGeneratorTask", epicsThreadPriorityHigh,
+                         epicsThreadGetStackSize(epicsThreadStackMedium),
+                         reinterpret_cast<EPICSTHREADFUNC>(generateTaskC),
+                         this) != nullptr);
+  if (not ThreadStarted) {
+    printf("%s:%s epicsThreadCreate failure for generator task\n", driverName,
+           functionName);
+  }
+}
+
+KafkaLoadGenerator::~KafkaLoadGenerator() {
+  KeepRunning = false;
+  Acquiring = false;
+  if (ThreadStarted) {
+    epicsEventSignal(StopEventId);
+    epicsEventSignal(StartEventId);
+    epicsEventWait(ThreadExitEventId);
+  }
+  ParamRegistrar.stopUpdateThread();
+  for (auto Event : {StartEventId, StopEventId, ThreadExitEventId}) {
+    if (nullptr != Event) {
+      epicsEventDestroy(Event);
+    }
+  }
+}
+
+asynStatus KafkaLoadGenerator::writeInt32(asynUser *pasynUser,
+                                          epicsInt32 value) {
+  const int function{pasynUser->reason};
+  static const char *functionName = "writeInt32";
+  asynStatus status{asynSuccess};
+
+  if (ADAcquire == function) {
+    value = (value != 0);
+    if (value != 0 and not Acquiring) {
+      Acquiring = true;
+      epicsEventSignal(StartEventId);
+    } else if (value == 0 and Acquiring) {
+      Acquiring = false;
+      epicsEventSignal(StopEventId);
+    }
+    setIntegerParam(function, value);
+  } else if (ParamRegistrar.write<epicsInt32>(function, value)) {
+    setIntegerParam(function, value);
+  } else {
+    if (ADSizeX == function or ADSizeY == function or NDDataType == function) {
+      FramePoolStale = true;
+    }
+    status = ADDriver::writeInt32(pasynUser, value);
+  }
+
+  /* Do callbacks so higher layers see any changes */
+  callParamCallbacks();
+
+  if (status != asynSuccess) {
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%d", driverName,
+                  functionName, status, function, value);
+  }
+  return status;
+}
+
+asynStatus KafkaLoadGenerator::writeFloat64(asynUser *pasynUser,
+                                            epicsFloat64 value) {
+  const int function{pasynUser->reason};
+  asynStatus status{asynSuccess};
+
+  if (ParamRegistrar.write<double>(function, value)) {
+    setDoubleParam(function, value);
+  } else {
+    status = ADDriver::writeFloat64(pasynUser, value);
+  }
+  callParamCallbacks();
+  return status;
+}
+
+void KafkaLoadGenerator::generateFramePool() {
+  int SizeX, SizeY, DataType;
+  getIntegerParam(ADSizeX, &SizeX);
+  getIntegerParam(ADSizeY, &SizeY);
+  getIntegerParam(NDDataType, &DataType);
+  FramePool.clear();
+  FrameDims[0] = static_cast<size_t>(std::max(SizeX, 0));
+  FrameDims[1] = static_cast<size_t>(std::max(SizeY, 0));
+  FrameDataType = static_cast<NDDataType_t>(DataType);
+  auto Elements = FrameDims[0] * FrameDims[1];
+  std::mt19937 Generator(std::random_device{}());
+  for (int i = 0; i < PoolSize and 0 < Elements; ++i) {
+    Frame NewFrame;
+    if (not fillFrame(FrameDataType, NewFrame.Data, Elements, Sparsity,
+                      Generator)) {
+      FramePool.clear();
+      break;
+    }
+    NewFrame.Attributes.reset(new NDAttributeList);
+    addAttributes(*NewFrame.Attributes, NumAttributes, Generator);
+    FramePool.push_back(std::move(NewFrame));
+  }
+  FramePoolStale = FramePool.empty();
+  setIntegerParam(NDArraySizeX, SizeX);
+  setIntegerParam(NDArraySizeY, SizeY);
+}
+
+NDArray *KafkaLoadGenerator::makeFrame(Frame const &Source) {
+  NDArray *pArray =
+      pNDArrayPool->alloc(2, FrameDims, FrameDataType, 0, nullptr);
+  if (nullptr == pArray) {
+    return nullptr;
+  }
+  std::memcpy(pArray->pData, Source.Data.data(), Source.Data.size());
+  Source.Attributes->copy(pArray->pAttributeList);
+  pArray->uniqueId = ++LastUniqueId;
+  epicsTimeGetCurrent(&pArray->epicsTS);
+  pArray->timeStamp =
+      pArray->epicsTS.secPastEpoch + pArray->epicsTS.nsec / 1e9;
+  return pArray;
+}
+
+bool KafkaLoadGenerator::waitUntil(Clock::time_point Time) {
+  while (Acquiring) {
+    auto Remaining = Time - Clock::now();
+    if (Remaining <= Clock::duration::zero()) {
+      return true;
+    }
+    if (Remaining > std::chrono::milliseconds(10)) {
+      // Long waits (idle time between bursts) end when the acquisition is
+      // stopped.
+      epicsEventWaitWithTimeout(
+          StopEventId,
+          std::chrono::duration<double>(Remaining).count() - 0.005);
+    } else {
+      std::this_thread::sleep_until(Time);
+    }
+  }
+  return false;
+}
+
+void KafkaLoadGenerator::acquisitionDone(const char *Message) {
+  Acquiring = false;
+  this->lock();
+  setIntegerParam(ADAcquire, 0);
+  setIntegerParam(ADStatus, ADStatusIdle);
+  setStringParam(ADStatusMessage, Message);
+  setIntegerParam(ADNumImagesCounter, ImagesCounter);
+  callParamCallbacks();
+  this->unlock();
+}
+
+void KafkaLoadGenerator::generateTask() {
+  size_t NextFrame{0};
+  while (KeepRunning) {
+    epicsEventWait(StartEventId);
+    if (not KeepRunning) {
+      break;
+    }
+    if (not Acquiring) {
+      continue;
+    }
+    this->lock();
+    if (FramePoolStale) {
+      setStringParam(ADStatusMessage, "Generating frames");
+      callParamCallbacks();
+      generateFramePool();
+      NextFrame = 0;
+    }
+    if (FramePool.empty()) {
+      this->unlock();
+      acquisitionDone("Invalid frame size or data type");
+      continue;
+    }
+    int ImageMode, NumImages;
+    getIntegerParam(ADImageMode, &ImageMode);
+    getIntegerParam(ADNumImages, &NumImages);
+    epicsInt32 MaxImages{0};
+    if (ADImageSingle == ImageMode) {
+      MaxImages = 1;
+    } else if (ADImageMultiple == ImageMode) {
+      MaxImages = std::max(NumImages, 1);
+    }
+    ImagesCounter = 0;
+    setIntegerParam(ADStatus, ADStatusAcquire);
+    setStringParam(ADStatusMessage, "Acquiring data");
+    callParamCallbacks();
+    this->unlock();
+
+    FramePacer Pacer(FrameRate, BurstLength, IdleLength, Clock::now());
+    const char *DoneMessage = "Acquisition stopped";
+    while (Acquiring) {
+      bool Late{false};
+      if (not waitUntil(Pacer.schedule(Clock::now(), Late))) {
+        break;
+      }
+      if (Late) {
+        ++LateFrames;
+      }
+      auto pArray = makeFrame(FramePool[NextFrame]);
+      NextFrame = (NextFrame + 1) % FramePool.size();
+      if (nullptr == pArray) {
+        ++AllocFailures;
+        std::this_thread::yield();
+        continue;
+      }
+      doCallbacksGenericPointer(pArray, NDArrayData, 0);
+      pArray->release();
+      ++FramesSent;
+      if (0 < MaxImages and ++ImagesCounter >= MaxImages) {
+        DoneMessage = "Acquisition done";
+        break;
+      } else if (0 == MaxImages) {
+        ++ImagesCounter;
+      }
+    }
+    acquisitionDone(DoneMessage);
+  }
+  epicsEventSignal(ThreadExitEventId);
+}
+
+void KafkaLoadGenerator::publishStats() {
+  auto Now = Clock::now();
+  auto Sent = FramesSent.load();
+  double Elapsed = std::chrono::duration<double>(Now - LastStatsTime).count();
+  ActualFrameRate = 0 < Elapsed ? (Sent - LastFramesSent) / Elapsed : 0.0;
+  LastFramesSent = Sent;
+  LastStatsTime = Now;
+  setIntegerParam(ADNumImagesCounter, ImagesCounter);
+  setIntegerParam(NDArrayCounter, LastUniqueId);
+  for (auto Param : std::vector<ParameterBase *>{
+           &ActualRateParam, &FramesSentParam, &LateFramesParam,
+           &AllocFailuresParam}) {
+    Param->updateDbValue();
+  }
+}
+
+// Configuration routine.  Called directly, or from the iocsh function
+extern "C" int KafkaLoadGeneratorConfig(const char *portName, int maxBuffers,
+                                        size_t maxMemory) {
+  new KafkaLoadGenerator(portName, maxBuffers, maxMemory, 0, 0);
+  return asynSuccess;
+}
+
+// EPICS iocsh shell commands
+static const iocshArg initArg0 = {"portName", iocshArgString};
+static const iocshArg initArg1 = {"maxBuffers", iocshArgInt};
+static const iocshArg initArg2 = {"maxMemory", iocshArgInt};
+
+static const iocshArg *const initArgs[] = {&initArg0, &initArg1, &initArg2};
+static const iocshFuncDef initFuncDef = {"KafkaLoadGeneratorConfig", 3,
+                                         initArgs};
+static void initCallFunc(const iocshArgBuf *args) {
+  KafkaLoadGeneratorConfig(args[0].sval, args[1].ival, args[2].ival);
+}
+
+extern "C" {
+void KafkaLoadGeneratorReg(void) { iocshRegister(&initFuncDef, initCallFunc); }
+
+epicsExportRegistrar(KafkaLoadGeneratorReg);
+}
@@ -0,0 +1,204 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  KafkaLoadGenerator.h
+ *  @brief Header file of an areaDetector driver which generates synthetic
+ * frames for load testing KafkaPlugin.
+ */
+
+#pragma once
+
+#include "Parameter.h"
+#include "ParameterHandler.h"
+#include <ADDriver.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <epicsEvent.h>
+#include <memory>
+#include <vector>
+
+/** @brief areaDetector driver which emits synthetic frames at a configurable
+ * rate, for load testing the Kafka pipeline.
+ * The frame size and data type are set with the standard ADSizeX, ADSizeY and
+ * NDDataType parameters and the number of frames with ADImageMode and
+ * ADNumImages. The content of the frames (a given fraction of zero pixels, the
+ * rest random) and a number of attributes are generated once, when the
+ * acquisition is started, into a pool of frames which is then cycled through.
+ * Emitting a frame therefore only costs an NDArray allocation from the pool
+ * of the driver, a copy of the data and the attributes, and the callbacks; no
+ * random numbers are generated and the port lock is not taken. Frames can be
+ * sent in bursts (e.g. 1 s at 2 kHz followed by 4 s of idle time).
+ */
+class epicsShareClass KafkaLoadGenerator : public ADDriver {
+public:
+  /** @brief Creates the driver and starts its generator thread.
+   * @param[in] portName The name of the asyn port driver to be created.
+   * @param[in] maxBuffers The maximum number of NDArray buffers that the
+   * NDArrayPool for this driver is allowed to allocate. 0 = unlimited.
+   * @param[in] maxMemory The maximum amount of memory that the NDArrayPool for
+   * this driver is allowed to allocate. 0 = unlimited.
+   * @param[in] priority The thread priority for the asyn port driver thread.
+   * @param[in] stackSize The stack size for the asyn port driver thread.
+   */
+  KafkaLoadGenerator(const char *portName, int maxBuffers, size_t maxMemory,
+                     int priority, int stackSize);
+
+  /// @brief Stops the generator thread.
+  ~KafkaLoadGenerator();
+
+  /** @brief Starts and stops the acquisition, sets integer parameters.
+   * @param[in] pasynUser pasynUser structure that encodes the reason and
+   * address.
+   * @param[in] value New value.
+   */
+  virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value) override;
+
+  /** @brief Sets the frame rate, burst timing and sparsity.
+   * @param[in] pasynUser pasynUser structure that encodes the reason and
+   * address.
+   * @param[in] value New value.
+   */
+  virtual asynStatus writeFloat64(asynUser *pasynUser,
+                                  epicsFloat64 value) override;
+
+  /** @brief The thread function emitting the frames. Public because it is
+   * started from a C function.
+   */
+  void generateTask();
+
+protected:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief One pre-generated frame.
+  struct Frame {
+    std::vector<unsigned char> Data;
+    std::unique_ptr<NDAttributeList> Attributes;
+  };
+
+  /** @brief Generates the frame pool from the current settings. Called by the
+   * generator thread, with the port lock held, when the acquisition is
+   * started and the settings have changed since the pool was generated.
+   */
+  void generateFramePool();
+
+  /** @brief Returns a copy of a pre-generated frame with a new unique id and
+   * time stamp, or nullptr if no NDArray could be allocated.
+   */
+  NDArray *makeFrame(Frame const &Source);
+
+  /** @brief Waits until the given time or until the acquisition is stopped.
+   * @return False if the acquisition was stopped.
+   */
+  bool waitUntil(Clock::time_point Time);
+
+  /** @brief Updates the counter and rate PVs. Called periodically by the
+   * parameter update thread, with the port lock held.
+   */
+  void publishStats();
+
+  /// @brief Sets ADAcquire to 0 and the status to idle.
+  void acquisitionDone(const char *Message);
+
+  ParameterHandler ParamRegistrar{this};
+
+  std::vector<Frame> FramePool;
+  /// @brief Set when a setting affecting the frame pool has been changed.
+  bool FramePoolStale{true};
+  size_t FrameDims[2]{0, 0};
+  NDDataType_t FrameDataType{NDUInt16};
+
+  double FrameRate{100.0};
+  double BurstLength{0.0};
+  double IdleLength{0.0};
+  double Sparsity{0.0};
+  epicsInt32 NumAttributes{10};
+  epicsInt32 PoolSize{16};
+
+  std::atomic<bool> Acquiring{false};
+  std::atomic<bool> KeepRunning{true};
+  epicsEventId StartEventId{nullptr};
+  epicsEventId StopEventId{nullptr};
+  epicsEventId ThreadExitEventId{nullptr};
+  bool ThreadStarted{false};
+
+  std::atomic<std::uint64_t> FramesSent{0};
+  std::atomic<std::uint64_t> LateFrames{0};
+  std::atomic<std::uint64_t> AllocFailures{0};
+  /// @brief Frames sent in the current acquisition.
+  std::atomic<epicsInt32> ImagesCounter{0};
+  std::atomic<epicsInt32> LastUniqueId{0};
+  std::uint64_t LastFramesSent{0};
+  Clock::time_point LastStatsTime{Clock::now()};
+  double ActualFrameRate{0.0};
+
+  Parameter<double> FrameRateParam{"LOADGEN_FRAME_RATE",
+                                   [&](double Value) {
+                                     if (Value < 0) {
+                                       return false;
+                                     }
+                                     FrameRate = Value;
+                                     return true;
+                                   },
+                                   [&]() { return FrameRate; }};
+  Parameter<double> BurstLengthParam{"LOADGEN_BURST_LENGTH",
+                                     [&](double Value) {
+                                       if (Value < 0) {
+                                         return false;
+                                       }
+                                       BurstLength = Value;
+                                       return true;
+                                     },
+                                     [&]() { return BurstLength; }};
+  Parameter<double> IdleLengthParam{"LOADGEN_IDLE_LENGTH",
+                                    [&](double Value) {
+                                      if (Value < 0) {
+                                        return false;
+                                      }
+                                      IdleLength = Value;
+                                      return true;
+                                    },
+                                    [&]() { return IdleLength; }};
+  Parameter<double> SparsityParam{"LOADGEN_SPARSITY",
+                                  [&](double Value) {
+                                    if (Value < 0 or Value > 1) {
+                                      return false;
+                                    }
+                                    Sparsity = Value;
+                                    FramePoolStale = true;
+                                    return true;
+                                  },
+                                  [&]() { return Sparsity; }};
+  Parameter<epicsInt32> NumAttributesParam{
+      "LOADGEN_NUM_ATTRIBUTES",
+      [&](epicsInt32 Value) {
+        if (Value < 0) {
+          return false;
+        }
+        NumAttributes = Value;
+        FramePoolStale = true;
+        return true;
+      },
+      [&]() { return NumAttributes; }};
+  Parameter<epicsInt32> PoolSizeParam{"LOADGEN_POOL_SIZE",
+                                      [&](epicsInt32 Value) {
+                                        if (Value < 1) {
+                                          return false;
+                                        }
+                                        PoolSize = Value;
+                                        FramePoolStale = true;
+                                        return true;
+                                      },
+                                      [&]() { return PoolSize; }};
+  Parameter<double> ActualRateParam{"LOADGEN_ACTUAL_RATE",
+                                    [&](double) { return false; },
+                                    [&]() { return ActualFrameRate; }};
+  Parameter<epicsInt32> FramesSentParam{
+      "LOADGEN_FRAMES_SENT", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(FramesSent.load()); }};
+  Parameter<epicsInt32> LateFramesParam{
+      "LOADGEN_LATE_FRAMES", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(LateFrames.load()); }};
+  Parameter<epicsInt32> AllocFailuresParam{
+      "LOADGEN_ALLOC_FAILURES", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(AllocFailures.load()); }};
+};
@@ -8,46 +8,221 @@
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
 #include <epicsTime.h>
+#include <errlog.h>
+#include <initHooks.h>
 #include <iocsh.h>
 
 #include <asynDriver.h>
 #include <asynPortDriver.h>
+#include <algorithm>
 #include <ciso646>
 #include <epicsExport.h>
 #include <string.h>
+#include <thread>
+#include <vector>
 
 #include "KafkaPlugin.h"
+#include "ThreadPlacement.h"
+#include "Tracing.h"
 
 static const char *driverName = "KafkaPlugin";
 
+/// @brief All plugins, used to notify them when the IOC has been started.
+static std::vector<KafkaPlugin *> PluginInstances;
+
 void KafkaPlugin::processCallbacks(NDArray *pArray) {
   // We do not need to call reserve/release as this is done by the caller when
   // in blocking mode
   // and by the thread in non-blocking mode.
   /// @todo Check the order of these calls and if all of them are needed.
   NDArrayInfo_t arrayInfo;
+  PLUGIN_TRACE_SCOPE("process", pArray->uniqueId);
+  traceQueueWait(pArray);
 
   NDPluginDriver::beginProcessCallbacks(pArray);
 
   pArray->getInfo(&arrayInfo);
 
-  unsigned char *bufferPtr;
-  size_t bufferSize;
+  if (not Preprocessor.acceptArray(std::chrono::steady_clock::now())) {
+    SkippedArrays.updateDbValue();
+    callParamCallbacks();
+    return;
+  }
+
+  NDArray *pSendArray = Preprocessor.process(pArray, pNDArrayPool);
+  if (nullptr == pSendArray) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s: Unable to allocate array for ROI/binning.\n",
+              driverName, "processCallbacks");
+    incrementDroppedArrays();
+    callParamCallbacks();
+    return;
+  }
 
-  Serializer.SerializeData(*pArray, bufferPtr, bufferSize);
+  // Serialize once, the message is shared by all targets
+  PLUGIN_TRACE_START(SerializeStart);
+  auto SerializeStartTime = std::chrono::steady_clock::now();
+  auto Buffer = Serializer.SerializeDataShared(
+      *pSendArray, Preprocessor.getTransformAttributes());
+  auto SerializeEndTime = std::chrono::steady_clock::now();
+  PLUGIN_TRACE_END(SerializeStart, "serialize", pArray->uniqueId);
+  SharedMessage Message;
+  Message.Data = std::shared_ptr<const unsigned char>(Buffer, Buffer->data());
+  Message.Size = Buffer->size();
+  NDArrayInfo_t SendArrayInfo;
+  pSendArray->getInfo(&SendArrayInfo);
+  if (SendHeaders and not Recorder.KafkaBypassed()) {
+    Message.Headers = std::make_shared<const HeaderList>(
+        EncodeFrameHeaders(Serializer.CreateFrameHeaders(*pSendArray)));
+  }
+  if (pSendArray != pArray) {
+    pSendArray->release();
+  }
+  auto Timestamp = epicsTimeToTimePoint(pArray->epicsTS);
+  auto UsedTargets = Targets;
+  if (Recorder.KafkaBypassed()) {
+    UsedTargets.clear();
+  }
+  bool Recording = Recorder.GetEnabled();
   this->unlock();
-  bool addToQueueSuccess = producer.SendKafkaPacket(
-      bufferPtr, bufferSize, epicsTimeToTimePoint(pArray->epicsTS));
+  // Not holding the lock while being throttled
+  auto Delay = std::chrono::steady_clock::duration::zero();
+  if (not UsedTargets.empty() and
+      not Limiter.acquire(Message.Size, SerializeEndTime, Delay)) {
+    UsedTargets.clear();
+  }
+  if (Delay > std::chrono::steady_clock::duration::zero()) {
+    PLUGIN_TRACE_START(ThrottleStart);
+    std::this_thread::sleep_for(Delay);
+    PLUGIN_TRACE_END(ThrottleStart, "throttle", pArray->uniqueId);
+  }
+  auto EnqueueStartTime = std::chrono::steady_clock::now();
+  bool addToQueueSuccess{true};
+  PLUGIN_TRACE_START(EnqueueStart);
+  for (auto Target : UsedTargets) {
+    addToQueueSuccess =
+        Target->SendKafkaPacket(Message, Timestamp) and addToQueueSuccess;
+  }
+  if (Recording) {
+    addToQueueSuccess =
+        Recorder.Record(Message, Timestamp) and addToQueueSuccess;
+  }
+  PLUGIN_TRACE_END(EnqueueStart, "enqueue", pArray->uniqueId);
+  auto EnqueueEndTime = std::chrono::steady_clock::now();
   this->lock();
+  using MilliSeconds = std::chrono::duration<double, std::milli>;
+  Stats.add({{MilliSeconds(SerializeEndTime - SerializeStartTime).count(),
+              MilliSeconds(EnqueueEndTime - EnqueueStartTime).count(),
+              static_cast<double>(Message.Size),
+              static_cast<double>(SendArrayInfo.totalBytes),
+              UsedTargets.empty() ? 0.0 : static_cast<double>(Message.Size),
+              MilliSeconds(Delay).count()}},
+            EnqueueEndTime);
   if (not addToQueueSuccess) {
-    int droppedArrays;
-    getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
-    droppedArrays++;
-    setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays);
+    incrementDroppedArrays();
   }
   callParamCallbacks();
 }
 
+void KafkaPlugin::driverCallback(asynUser *pasynUser, void *genericPointer) {
+#ifndef KAFKA_TRACE_DISABLE
+  if (PluginTracing::Log.isEnabled()) {
+    auto pArray = reinterpret_cast<NDArray *>(genericPointer);
+    ArrivalTimes[static_cast<std::size_t>(pArray->uniqueId) %
+                 ArrivalTimes.size()] = KafkaTracing::now();
+  }
+#endif
+  NDPluginDriver::driverCallback(pasynUser, genericPointer);
+}
+
+void KafkaPlugin::traceQueueWait(NDArray *pArray) {
+#ifndef KAFKA_TRACE_DISABLE
+  if (not PluginTracing::Log.isEnabled()) {
+    return;
+  }
+  auto Received = ArrivalTimes[static_cast<std::size_t>(pArray->uniqueId) %
+                               ArrivalTimes.size()]
+                      .exchange(0);
+  auto Now = KafkaTracing::now();
+  if (0 != Received and Received <= Now) {
+    PluginTracing::Log.record("queue wait", Received, Now - Received,
+                              pArray->uniqueId);
+  }
+#else
+  (void)pArray;
+#endif
+}
+
+int KafkaPlugin::addTarget(std::string const &BrokerAddress,
+                           std::string const &Topic) {
+  this->lock();
+  auto TargetNumber = Targets.size() + 1;
+  ExtraTargets.emplace_back(new KafkaProducer(
+      BrokerAddress, Topic, &ParamRegistrar,
+      "_" + std::to_string(TargetNumber), not(IocIsRunning and AutoApply)));
+  ExtraTargets.back()->StartThread();
+  Targets.push_back(ExtraTargets.back().get());
+  this->unlock();
+  return static_cast<int>(TargetNumber);
+}
+
+void KafkaPlugin::iocRunning() {
+  this->lock();
+  IocIsRunning = true;
+  if (AutoApply) {
+    setAutoApply(true);
+  }
+  this->unlock();
+}
+
+bool KafkaPlugin::setAutoApply(bool Enable) {
+  AutoApply = Enable;
+  if (not IocIsRunning) {
+    return true;
+  }
+  bool Success{true};
+  for (auto Target : Targets) {
+    Success = Target->SetAutoApply(Enable) and Success;
+  }
+  return Success;
+}
+
+bool KafkaPlugin::applyConfiguration() {
+  bool Success{true};
+  for (auto Target : Targets) {
+    Success = Target->ApplyConfiguration() and Success;
+  }
+  return Success;
+}
+
+void KafkaPlugin::publishStats() {
+  auto Summary = Stats.summarize();
+  SerializeTimeMS = Summary.mean(SerializeTime);
+  SerializeTimeMaxMS = Summary.Max[SerializeTime];
+  EnqueueTimeMS = Summary.mean(EnqueueTime);
+  EnqueueTimeMaxMS = Summary.Max[EnqueueTime];
+  SerializedByteRate = Summary.rate(MessageBytes);
+  SerializedFrameRate = Summary.rate();
+  MeanMessageSize = Summary.mean(MessageBytes);
+  SerializationOverhead = 0 < Summary.Sum[PixelBytes]
+                              ? Summary.Sum[MessageBytes] / Summary.Sum[PixelBytes]
+                              : 0.0;
+  Throughput = Summary.rate(SentBytes) / (1024.0 * 1024.0);
+  ThrottleTimeMS = Summary.mean(ThrottleTime);
+  ThrottleTimeMaxMS = Summary.Max[ThrottleTime];
+  for (auto Param : StatsParams) {
+    Param->updateDbValue();
+  }
+  Recorder.PublishStats();
+}
+
+void KafkaPlugin::incrementDroppedArrays() {
+  int droppedArrays;
+  getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
+  droppedArrays++;
+  setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays);
+}
+
 asynStatus KafkaPlugin::writeOctet(asynUser *pasynUser, const char *value,
                                    size_t nChars, size_t *nActual) {
   int addr = 0;
@@ -99,7 +274,10 @@ asynStatus KafkaPlugin::readOctet(asynUser *pasynUser, char *value,
 
   std::string TempString;
   if (ParamRegistrar.read<std::string>(function, TempString)) {
-    strncpy(value, TempString.c_str(), TempString.size() + 1);
+    // Paths (e.g. the recording directory) may not fit
+    auto Length = std::min(TempString.size(), maxChars - 1);
+    strncpy(value, TempString.c_str(), Length);
+    value[Length] = '\0';
   } else if (NDPluginDriver::readOctet(pasynUser, value, maxChars, nActual, eomReason) == asynSuccess) {
     // Do nothing
   } else {
@@ -230,6 +408,60 @@ asynStatus KafkaPlugin::readInt64(asynUser *pasynUser, epicsInt64 *value) {
   return status;
 }
 
+asynStatus KafkaPlugin::writeFloat64(asynUser *pasynUser,
+                                     epicsFloat64 value) {
+  const int function{pasynUser->reason};
+  static const char *functionName = "writeFloat64";
+
+  if (ParamRegistrar.write<double>(function, value) or
+      NDPluginDriver::writeFloat64(pasynUser, value) == asynSuccess) {
+    /* Set the parameter in the parameter library. */
+    setDoubleParam(function, value);
+  }
+
+  /* Do callbacks so higher layers see any changes */
+  asynStatus status = callParamCallbacks();
+
+  if (status != 0) {
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%f", driverName,
+                  functionName, status, function, value);
+  } else {
+    asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, "%s:%s: function=%d, value=%f\n",
+              driverName, functionName, function, value);
+  }
+  return status;
+}
+
+asynStatus KafkaPlugin::readFloat64(asynUser *pasynUser, epicsFloat64 *value) {
+  int function;
+  const char *paramName;
+  int addr;
+  epicsTimeStamp timeStamp;
+  getTimeStamp(&timeStamp);
+  static const char *functionName = "readFloat64";
+
+  asynStatus status = parseAsynUser(pasynUser, &function, &addr, &paramName);
+  if (status != asynSuccess)
+    return status;
+
+  if (not ParamRegistrar.read<double>(function, *value) and NDPluginDriver::readFloat64(pasynUser, value) != asynSuccess) {
+    status = asynError;
+  }
+
+  /* Set the timestamp */
+  pasynUser->timestamp = timeStamp;
+  if (status)
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, name=%s, value=%f",
+                  driverName, functionName, status, function, paramName, *value);
+  else
+    asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s: function=%d, name=%s, value=%f\n", driverName,
+              functionName, function, paramName, *value);
+  return status;
+}
+
 KafkaPlugin::KafkaPlugin(const char *portName, int queueSize,
                          int blockingCallbacks, const char *NDArrayPort,
                          int NDArrayAddr, size_t maxMemory, int priority,
@@ -239,13 +471,34 @@ KafkaPlugin::KafkaPlugin(const char *portName, int queueSize,
     : NDPluginDriver(portName, queueSize, blockingCallbacks, NDArrayPort,
                      NDArrayAddr, 1, 2, maxMemory, intMask, intMask, 0, 1,
                      priority, stackSize, 1),
-      producer(brokerAddress, brokerTopic, &ParamRegistrar),
+      // The producer is created once the IOC is running, see iocRunning()
+      producer(brokerAddress, brokerTopic, &ParamRegistrar, "", true),
       Serializer(sourceName) {
 
   producer.StartThread();
 
   setStringParam(NDPluginDriverPluginType, "KafkaPlugin");
   ParamRegistrar.registerParameter(&SourceName);
+  ParamRegistrar.registerParameter(&RoiEnable);
+  ParamRegistrar.registerParameter(&RoiMinX);
+  ParamRegistrar.registerParameter(&RoiMinY);
+  ParamRegistrar.registerParameter(&RoiSizeX);
+  ParamRegistrar.registerParameter(&RoiSizeY);
+  ParamRegistrar.registerParameter(&BinX);
+  ParamRegistrar.registerParameter(&BinY);
+  ParamRegistrar.registerParameter(&BinMode);
+  ParamRegistrar.registerParameter(&Decimation);
+  ParamRegistrar.registerParameter(&MaxRate);
+  ParamRegistrar.registerParameter(&SkippedArrays);
+  ParamRegistrar.registerParameter(&RateLimit);
+  ParamRegistrar.registerParameter(&RateLimitBurst);
+  ParamRegistrar.registerParameter(&RateLimitPolicy);
+  ParamRegistrar.registerParameter(&AutoApplyParam);
+  ParamRegistrar.registerParameter(&ApplyParam);
+  ParamRegistrar.registerParameter(&SendHeadersParam);
+  for (auto Param : StatsParams) {
+    ParamRegistrar.registerParameter(Param);
+  }
 
   // Disable ArrayCallbacks.
   // This plugin currently does not do array callbacks, so make the setting
@@ -254,6 +507,18 @@ KafkaPlugin::KafkaPlugin(const char *portName, int queueSize,
 
   /* Try to connect to the NDArray port */
   connectToArrayPort();
+
+  ParamRegistrar.setPeriodicTask([this]() { publishStats(); },
+                                 StatsPublishPeriod);
+  ParamRegistrar.startUpdateThread();
+  PluginInstances.push_back(this);
+}
+
+KafkaPlugin::~KafkaPlugin() {
+  PluginInstances.erase(
+      std::remove(PluginInstances.begin(), PluginInstances.end(), this),
+      PluginInstances.end());
+  ParamRegistrar.stopUpdateThread();
 }
 
 // Configuration routine.  Called directly, or from the iocsh function
@@ -290,8 +555,170 @@ static void initCallFunc(const iocshArgBuf *args) {
                        args[8].sval);
 }
 
+extern "C" int KafkaPluginAddTarget(const char *portName,
+                                    const char *brokerAddress,
+                                    const char *topic) {
+  auto *pPlugin = dynamic_cast<KafkaPlugin *>(
+      reinterpret_cast<asynPortDriver *>(findAsynPortDriver(portName)));
+  if (nullptr == pPlugin or nullptr == brokerAddress or nullptr == topic) {
+    errlogPrintf("KafkaPluginAddTarget: Unable to find KafkaPlugin \"%s\" or "
+                 "missing broker address/topic.\n",
+                 portName);
+    return asynError;
+  }
+  int TargetNumber = pPlugin->addTarget(brokerAddress, topic);
+  printf("KafkaPluginAddTarget: Added target %d to \"%s\".\n", TargetNumber,
+         portName);
+  return asynSuccess;
+}
+
+static const iocshArg addTargetArg0 = {"portName", iocshArgString};
+static const iocshArg addTargetArg1 = {"broker address", iocshArgString};
+static const iocshArg addTargetArg2 = {"topic", iocshArgString};
+
+static const iocshArg *const addTargetArgs[] = {&addTargetArg0, &addTargetArg1,
+                                                &addTargetArg2};
+static const iocshFuncDef addTargetFuncDef = {"KafkaPluginAddTarget", 3,
+                                              addTargetArgs};
+static void addTargetCallFunc(const iocshArgBuf *args) {
+  KafkaPluginAddTarget(args[0].sval, args[1].sval, args[2].sval);
+}
+
+extern "C" int KafkaPluginTraceEnable(int enable) {
+#ifdef KAFKA_TRACE_DISABLE
+  (void)enable;
+  errlogPrintf("KafkaPluginTraceEnable: Tracing was disabled at compile "
+               "time (KAFKA_TRACE_DISABLE).\n");
+  return asynError;
+#else
+  PluginTracing::Log.setEnabled(0 != enable);
+  return asynSuccess;
+#endif
+}
+
+extern "C" int KafkaPluginTraceDump(const char *fileName) {
+  if (nullptr == fileName or not PluginTracing::Log.dump(fileName)) {
+    errlogPrintf("KafkaPluginTraceDump: Unable to write trace to \"%s\".\n",
+                 nullptr == fileName ? "" : fileName);
+    return asynError;
+  }
+  printf("KafkaPluginTraceDump: Wrote trace to \"%s\".\n", fileName);
+  return asynSuccess;
+}
+
+static const iocshArg traceEnableArg0 = {"enable", iocshArgInt};
+static const iocshArg *const traceEnableArgs[] = {&traceEnableArg0};
+static const iocshFuncDef traceEnableFuncDef = {"KafkaPluginTraceEnable", 1,
+                                                traceEnableArgs};
+static void traceEnableCallFunc(const iocshArgBuf *args) {
+  KafkaPluginTraceEnable(args[0].ival);
+}
+
+static const iocshArg traceDumpArg0 = {"file name", iocshArgString};
+static const iocshArg *const traceDumpArgs[] = {&traceDumpArg0};
+static const iocshFuncDef traceDumpFuncDef = {"KafkaPluginTraceDump", 1,
+                                              traceDumpArgs};
+static void traceDumpCallFunc(const iocshArgBuf *args) {
+  KafkaPluginTraceDump(args[0].sval);
+}
+
+extern "C" int KafkaPluginProducerBudget(int megaBytes) {
+  if (megaBytes < 0) {
+    errlogPrintf("KafkaPluginProducerBudget: The budget can not be "
+                 "negative.\n");
+    return asynError;
+  }
+  KafkaInterface::ProducerPool::instance().setBudgetKBytes(
+      static_cast<std::size_t>(megaBytes) * 1024);
+  return asynSuccess;
+}
+
+extern "C" int KafkaPluginProducerReport() {
+  printf("%s", KafkaInterface::ProducerPool::instance().report().c_str());
+  return asynSuccess;
+}
+
+static const iocshArg producerBudgetArg0 = {"budget in MB", iocshArgInt};
+static const iocshArg *const producerBudgetArgs[] = {&producerBudgetArg0};
+static const iocshFuncDef producerBudgetFuncDef = {
+    "KafkaPluginProducerBudget", 1, producerBudgetArgs};
+static void producerBudgetCallFunc(const iocshArgBuf *args) {
+  KafkaPluginProducerBudget(args[0].ival);
+}
+
+static const iocshFuncDef producerReportFuncDef = {"KafkaPluginProducerReport",
+                                                   0, nullptr};
+static void producerReportCallFunc(const iocshArgBuf *) {
+  KafkaPluginProducerReport();
+}
+
+extern "C" int KafkaPluginThreadPlacement(const char *role, const char *cpus,
+                                          const char *scheduling) {
+  int UsedRole;
+  KafkaThreads::Placement Placement;
+  if (nullptr == role or not PluginThreads::Placer.parseRole(role, UsedRole)) {
+    errlogPrintf("KafkaPluginThreadPlacement: Unknown role \"%s\", use "
+                 "\"poll\" or \"librdkafka\".\n",
+                 nullptr == role ? "" : role);
+    return asynError;
+  }
+  if (not KafkaThreads::parseCpuList(nullptr == cpus ? "" : cpus,
+                                     Placement.Cpus)) {
+    errlogPrintf("KafkaPluginThreadPlacement: Invalid CPU list \"%s\".\n",
+                 cpus);
+    return asynError;
+  }
+  if (not KafkaThreads::parseScheduling(
+          nullptr == scheduling ? "" : scheduling, Placement)) {
+    errlogPrintf("KafkaPluginThreadPlacement: Invalid scheduling \"%s\", use "
+                 "\"nice:N\" or \"fifo:N\".\n",
+                 scheduling);
+    return asynError;
+  }
+  PluginThreads::Placer.setPlacement(UsedRole, Placement);
+  return asynSuccess;
+}
+
+extern "C" int KafkaPluginThreadReport() {
+  printf("%s", PluginThreads::Placer.threadReport().c_str());
+  return asynSuccess;
+}
+
+static const iocshArg threadPlacementArg0 = {"role", iocshArgString};
+static const iocshArg threadPlacementArg1 = {"cpus", iocshArgString};
+static const iocshArg threadPlacementArg2 = {"scheduling", iocshArgString};
+static const iocshArg *const threadPlacementArgs[] = {
+    &threadPlacementArg0, &threadPlacementArg1, &threadPlacementArg2};
+static const iocshFuncDef threadPlacementFuncDef = {
+    "KafkaPluginThreadPlacement", 3, threadPlacementArgs};
+static void threadPlacementCallFunc(const iocshArgBuf *args) {
+  KafkaPluginThreadPlacement(args[0].sval, args[1].sval, args[2].sval);
+}
+
+static const iocshFuncDef threadReportFuncDef = {"KafkaPluginThreadReport", 0,
+                                                 nullptr};
+static void threadReportCallFunc(const iocshArgBuf *) {
+  KafkaPluginThreadReport();
+}
+
+static void KafkaPluginInitHook(initHookState State) {
+  if (initHookAfterIocRunning == State) {
+    for (auto Plugin : PluginInstances) {
+      Plugin->iocRunning();
+    }
+  }
+}
+
 extern "C" void KafkaPluginReg(void) {
+  initHookRegister(KafkaPluginInitHook);
   iocshRegister(&initFuncDef, initCallFunc);
+  iocshRegister(&addTargetFuncDef, addTargetCallFunc);
+  iocshRegister(&traceEnableFuncDef, traceEnableCallFunc);
+  iocshRegister(&traceDumpFuncDef, traceDumpCallFunc);
+  iocshRegister(&producerBudgetFuncDef, producerBudgetCallFunc);
+  iocshRegister(&producerReportFuncDef, producerReportCallFunc);
+  iocshRegister(&threadPlacementFuncDef, threadPlacementCallFunc);
+  iocshRegister(&threadReportFuncDef, threadReportCallFunc);
 }
 
 extern "C" {
@@ -11,11 +11,20 @@
 #include <string>
 
 #include "KafkaProducer.h"
+#include "MessageRecorder.h"
+#include "NDArrayPreprocessor.h"
 #include "NDArraySerializer.h"
 #include "Parameter.h"
 #include "ParameterHandler.h"
+#include "RateLimiter.h"
+#include "RollingStats.h"
 #include <NDPluginDriver.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <vector>
 
 using namespace KafkaInterface;
 /** @brief areaDetector plugin that produces Kafka messages and sends them to a
@@ -71,17 +80,30 @@ public:
               int priority, int stackSize, const char *brokerAddress,
               const char *brokerTopic, const char *sourceName);
 
-  /// @brief Destructor, currently empty.
-  ~KafkaPlugin() = default;
+  /** @brief Stops the parameter update thread before the producers (and
+   * their parameters) are destroyed.
+   */
+  ~KafkaPlugin();
 
   /** @brief Called when new data from the areaDetector is available.
    * Based on a implementation in one of the standard plugins. Calls
    * KafkaPlugin::SendKafkaPacket().
+   * Arrays are first passed through the (optional) decimation, ROI and binning
+   * stage, see NDArrayPreprocessor. The serialized messages are then subject to
+   * the byte rate limit (see RateLimiter), which is waited for without holding
+   * the port lock. The serialized arrays are also written to
+   * file when recording, see MessageRecorder.
    * This member function will throw away packets if the Kafka queue is full!
    * @param[in] pArray The NDArray from the callback.
    */
   void processCallbacks(NDArray *pArray) override;
 
+  /** @brief Called by the driver with new arrays, before they are queued.
+   * Only overridden to record the arrival time used for tracing the time the
+   * array spends in the input queue.
+   */
+  void driverCallback(asynUser *pasynUser, void *genericPointer) override;
+
   /** @brief Used to set the string parameters of the Kafka producer.
    * If a configuration string is updated, the Kafka prdoucer will be immediatly
    * destroyed and
@@ -116,10 +138,95 @@ public:
 
   asynStatus readInt64(asynUser *pasynUser, epicsInt64 *value) override;
 
+  asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value) override;
+
+  asynStatus readFloat64(asynUser *pasynUser, epicsFloat64 *value) override;
+
+  /** @brief Adds a Kafka producer to which all arrays are also sent.
+   * Each array is only serialized once; the serialized message is shared
+   * between all producers. The PVs of the producer have the same names as
+   * those of the first producer with "_N" appended, where N is the number of
+   * the target (starting at 2). Should be called before iocInit.
+   * @param[in] BrokerAddress Broker(s) of the new target.
+   * @param[in] Topic Topic of the new target.
+   * @return The number of the new target.
+   */
+  int addTarget(std::string const &BrokerAddress, std::string const &Topic);
+
+  /** @brief Called when the IOC has been started.
+   * The Kafka producers are not created before this (the configuration set by
+   * the PINI records is collected instead) and are then created once, unless
+   * KafkaPlugin::AutoApply is disabled.
+   */
+  void iocRunning();
+
+  /// @brief Applies pending configuration changes of all producers.
+  bool applyConfiguration();
+
 protected:
   /** @brief Interrupt mask passed to NDPluginDriver.
    */
-  static const int intMask{asynInt32Mask | asynInt64Mask | asynOctetMask};
+  static const int intMask{asynInt32Mask | asynInt64Mask | asynFloat64Mask |
+                           asynOctetMask};
+
+  /// @brief Records the time between driverCallback() and processCallbacks().
+  void traceQueueWait(NDArray *pArray);
+
+  /// @brief Arrival times (ns) indexed by NDArray::uniqueId modulo the size.
+  std::array<std::atomic<std::uint64_t>, 64> ArrivalTimes{};
+
+  /** @brief Updates the statistics PVs from KafkaPlugin::Stats.
+   * Called every KafkaPlugin::StatsPublishPeriod by the parameter update
+   * thread, with the port lock held.
+   */
+  void publishStats();
+
+  /// @brief The values added to KafkaPlugin::Stats for each array.
+  enum StatsChannel {
+    SerializeTime, ///< ms
+    EnqueueTime,   ///< ms, time to queue the message for all targets
+    MessageBytes,
+    PixelBytes, ///< Size of the (pre-processed) array data
+    SentBytes,  ///< Message size if passed on to the targets, otherwise 0
+    ThrottleTime, ///< ms, time the message was delayed by the rate limit
+  };
+
+  /// @brief Timing and sizes of the arrays sent during the last 5 s. Only
+  /// accessed with the port lock held.
+  RollingStats<6> Stats{std::chrono::milliseconds(5000)};
+
+  const std::chrono::milliseconds StatsPublishPeriod{1000};
+
+  double SerializeTimeMS{0};
+  double SerializeTimeMaxMS{0};
+  double EnqueueTimeMS{0};
+  double EnqueueTimeMaxMS{0};
+  double SerializedByteRate{0};
+  double SerializedFrameRate{0};
+  double MeanMessageSize{0};
+  double SerializationOverhead{0};
+  /// @brief MB/s passed on to the targets.
+  double Throughput{0};
+  double ThrottleTimeMS{0};
+  double ThrottleTimeMaxMS{0};
+
+  /// @brief Increments the NDPluginDriverDroppedArrays parameter.
+  void incrementDroppedArrays();
+
+  /// @brief Sets the auto-apply setting of all producers.
+  bool setAutoApply(bool Enable);
+
+  /// @brief Set by KafkaPlugin::iocRunning().
+  bool IocIsRunning{false};
+
+  /** @brief If false, configuration changes requiring a re-connect are only
+   * applied when the KAFKA_APPLY parameter is written.
+   */
+  bool AutoApply{true};
+
+  /// @brief Attach the metadata of the array as Kafka message headers, see
+  /// FrameHeaders.
+  bool SendHeaders{true};
 
   ParameterHandler ParamRegistrar{this};
 
@@ -127,11 +234,140 @@ protected:
   /// the broker.
   KafkaProducer producer;
 
+  /// @brief Additional producers (targets) added with
+  /// KafkaPlugin::addTarget().
+  std::vector<std::unique_ptr<KafkaProducer>> ExtraTargets;
+
+  /// @brief Pointers to all producers, including KafkaPlugin::producer.
+  /// Copied (while holding the lock) before being used without the lock.
+  std::vector<KafkaProducer *> Targets{&producer};
+
+  /// @brief Optionally writes the serialized arrays to segment files, in
+  /// addition to or instead of sending them to the targets.
+  MessageRecorder Recorder{&ParamRegistrar};
+
   /// @brief The class instance used to serialize NDArray data.
   NDArraySerializer Serializer;
 
+  /// @brief Optional decimation, ROI and binning applied before serializing.
+  NDArrayPreprocessor Preprocessor;
+
+  /// @brief Limits the bytes per second sent to the targets.
+  RateLimiter Limiter;
+
   Parameter<std::string> SourceName{
       "SOURCE_NAME",
       [&](std::string NewValue) { return Serializer.setSourceName(NewValue); },
       [&]() { return Serializer.getSourceName(); }};
+
+  Parameter<epicsInt32> RoiEnable{
+      "PREPROC_ROI_ENABLE",
+      [&](epicsInt32 Value) { return Preprocessor.setRoiEnabled(Value != 0); },
+      [&]() { return Preprocessor.getRoiEnabled(); }};
+  Parameter<epicsInt32> RoiMinX{
+      "PREPROC_ROI_MIN_X",
+      [&](epicsInt32 Value) { return Preprocessor.setRoiMinX(Value); },
+      [&]() { return Preprocessor.getRoiMinX(); }};
+  Parameter<epicsInt32> RoiMinY{
+      "PREPROC_ROI_MIN_Y",
+      [&](epicsInt32 Value) { return Preprocessor.setRoiMinY(Value); },
+      [&]() { return Preprocessor.getRoiMinY(); }};
+  Parameter<epicsInt32> RoiSizeX{
+      "PREPROC_ROI_SIZE_X",
+      [&](epicsInt32 Value) { return Preprocessor.setRoiSizeX(Value); },
+      [&]() { return Preprocessor.getRoiSizeX(); }};
+  Parameter<epicsInt32> RoiSizeY{
+      "PREPROC_ROI_SIZE_Y",
+      [&](epicsInt32 Value) { return Preprocessor.setRoiSizeY(Value); },
+      [&]() { return Preprocessor.getRoiSizeY(); }};
+  Parameter<epicsInt32> BinX{
+      "PREPROC_BIN_X",
+      [&](epicsInt32 Value) { return Preprocessor.setBinX(Value); },
+      [&]() { return Preprocessor.getBinX(); }};
+  Parameter<epicsInt32> BinY{
+      "PREPROC_BIN_Y",
+      [&](epicsInt32 Value) { return Preprocessor.setBinY(Value); },
+      [&]() { return Preprocessor.getBinY(); }};
+  Parameter<epicsInt32> BinMode{
+      "PREPROC_BIN_MODE",
+      [&](epicsInt32 Value) { return Preprocessor.setBinMode(Value); },
+      [&]() { return Preprocessor.getBinMode(); }};
+  Parameter<epicsInt32> Decimation{
+      "PREPROC_DECIMATION",
+      [&](epicsInt32 Value) { return Preprocessor.setDecimationFactor(Value); },
+      [&]() { return Preprocessor.getDecimationFactor(); }};
+  Parameter<double> MaxRate{
+      "PREPROC_MAX_RATE",
+      [&](double Value) { return Preprocessor.setMaxRate(Value); },
+      [&]() { return Preprocessor.getMaxRate(); }};
+  Parameter<double> RateLimit{
+      "KAFKA_RATE_LIMIT",
+      [&](double Value) { return Limiter.setRate(Value); },
+      [&]() { return Limiter.getRate(); }};
+  Parameter<double> RateLimitBurst{
+      "KAFKA_RATE_LIMIT_BURST",
+      [&](double Value) { return Limiter.setBurst(Value); },
+      [&]() { return Limiter.getBurst(); }};
+  Parameter<epicsInt32> RateLimitPolicy{
+      "KAFKA_RATE_LIMIT_POLICY",
+      [&](epicsInt32 Value) { return Limiter.setPolicy(Value); },
+      [&]() { return static_cast<epicsInt32>(Limiter.getPolicy()); }};
+  Parameter<epicsInt32> RateLimitDropped{
+      "KAFKA_RATE_LIMIT_DROPPED", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(Limiter.getDroppedMessages()); }};
+  Parameter<epicsInt32> AutoApplyParam{
+      "KAFKA_AUTO_APPLY",
+      [&](epicsInt32 Value) { return setAutoApply(Value != 0); },
+      [&]() { return static_cast<epicsInt32>(AutoApply); }};
+  Parameter<epicsInt32> SendHeadersParam{
+      "KAFKA_MESSAGE_HEADERS",
+      [&](epicsInt32 Value) {
+        SendHeaders = (Value != 0);
+        return true;
+      },
+      [&]() { return static_cast<epicsInt32>(SendHeaders); }};
+  Parameter<epicsInt32> ApplyParam{
+      "KAFKA_APPLY", [&](epicsInt32) { return applyConfiguration(); },
+      [&]() { return 0; }};
+  Parameter<double> SerializeTimeParam{
+      "STATS_SERIALIZE_TIME", [&](double) { return false; },
+      [&]() { return SerializeTimeMS; }};
+  Parameter<double> SerializeTimeMaxParam{
+      "STATS_SERIALIZE_TIME_MAX", [&](double) { return false; },
+      [&]() { return SerializeTimeMaxMS; }};
+  Parameter<double> EnqueueTimeParam{
+      "STATS_ENQUEUE_TIME", [&](double) { return false; },
+      [&]() { return EnqueueTimeMS; }};
+  Parameter<double> EnqueueTimeMaxParam{
+      "STATS_ENQUEUE_TIME_MAX", [&](double) { return false; },
+      [&]() { return EnqueueTimeMaxMS; }};
+  Parameter<double> ByteRateParam{
+      "STATS_BYTE_RATE", [&](double) { return false; },
+      [&]() { return SerializedByteRate; }};
+  Parameter<double> FrameRateParam{
+      "STATS_FRAME_RATE", [&](double) { return false; },
+      [&]() { return SerializedFrameRate; }};
+  Parameter<double> MeanMessageSizeParam{
+      "STATS_MEAN_MESSAGE_SIZE", [&](double) { return false; },
+      [&]() { return MeanMessageSize; }};
+  Parameter<double> OverheadParam{
+      "STATS_OVERHEAD_RATIO", [&](double) { return false; },
+      [&]() { return SerializationOverhead; }};
+  Parameter<double> ThroughputParam{
+      "STATS_THROUGHPUT", [&](double) { return false; },
+      [&]() { return Throughput; }};
+  Parameter<double> ThrottleTimeParam{
+      "STATS_THROTTLE_TIME", [&](double) { return false; },
+      [&]() { return ThrottleTimeMS; }};
+  Parameter<double> ThrottleTimeMaxParam{
+      "STATS_THROTTLE_TIME_MAX", [&](double) { return false; },
+      [&]() { return ThrottleTimeMaxMS; }};
+  std::vector<ParameterBase *> StatsParams{
+      &SerializeTimeParam,   &SerializeTimeMaxParam, &EnqueueTimeParam,
+      &EnqueueTimeMaxParam,  &ByteRateParam,         &FrameRateParam,
+      &MeanMessageSizeParam, &OverheadParam,         &ThroughputParam,
+      &ThrottleTimeParam,    &ThrottleTimeMaxParam,  &RateLimitDropped};
+  Parameter<epicsInt32> SkippedArrays{
+      "PREPROC_SKIPPED_ARRAYS", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(Preprocessor.getSkippedArrays()); }};
 };
@@ -5,6 +5,8 @@
  */
 
 #include "KafkaProducer.h"
+#include "ThreadPlacement.h"
+#include "Tracing.h"
 #include <algorithm>
 #include <cassert>
 #include <ciso646>
@@ -14,11 +16,24 @@ static const int RD_KAFKAP_MESSAGE_V2_MAX_OVERHEAD = 36;
 
 namespace KafkaInterface {
 
+namespace {
+/// @brief The librdkafka names of the settings adjusted by the batch tuner.
+const std::vector<std::pair<std::string, int BatchSettings::*>>
+    BatchSettingNames{
+        {"linger.ms", &BatchSettings::LingerMS},
+        {"batch.num.messages", &BatchSettings::BatchMessages},
+        {"queue.buffering.max.kbytes", &BatchSettings::BufferKBytes},
+        {"queue.buffering.max.messages", &BatchSettings::QueueMessages},
+    };
+} // namespace
+
 KafkaProducer::KafkaProducer(std::string const &broker, std::string topic,
-                             ParameterHandler *ParamRegistrar) :
+                             ParameterHandler *ParamRegistrar,
+                             std::string const &ParameterSuffix,
+                             bool DeferConnection) :
       conf(RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL)),
       tconf(RdKafka::Conf::create(RdKafka::Conf::CONF_TOPIC)),
-      TopicName(std::move(topic)) {
+      TopicName(std::move(topic)), ParamSuffix(ParameterSuffix) {
   ParamRegistrar->registerParameter(&ReconnectFlush);
   ParamRegistrar->registerParameter(&ReconnectFlushTime);
   ParamRegistrar->registerParameter(&MsgBufferSize);
@@ -30,9 +45,40 @@ KafkaProducer::KafkaProducer(std::string const &broker, std::string topic,
   ParamRegistrar->registerParameter(&KafkaBroker);
   ParamRegistrar->registerParameter(&KafkaStatsInterval);
   ParamRegistrar->registerParameter(&KafkaQueueSize);
+  ParamRegistrar->registerParameter(&KafkaDecimation);
+  ParamRegistrar->registerParameter(&KafkaPartitioner);
+  ParamRegistrar->registerParameter(&KafkaCompression);
+  ParamRegistrar->registerParameter(&KafkaDroppedMessages);
+  ParamRegistrar->registerParameter(&KafkaDeliveryLatency);
+  ParamRegistrar->registerParameter(&KafkaMaxDeliveryLatency);
+  ParamRegistrar->registerParameter(&KafkaConfigPending);
+  ParamRegistrar->registerParameter(&KafkaTimeToFirstFrame);
+  ParamRegistrar->registerParameter(&KafkaBatchTuning);
+  ParamRegistrar->registerParameter(&KafkaLatencyTarget);
+  ParamRegistrar->registerParameter(&KafkaBufferTime);
+  ParamRegistrar->registerParameter(&KafkaLinger);
+  ParamRegistrar->registerParameter(&KafkaBatchMessages);
+  ParamRegistrar->registerParameter(&KafkaRetuneCount);
+  ParamRegistrar->registerParameter(&KafkaTuningReason);
+  ParamRegistrar->registerParameter(&KafkaShards);
+  ParamRegistrar->registerParameter(&KafkaSharedProducer);
+  ParamRegistrar->registerParameter(&KafkaEffectiveBufferSize);
+  for (int i = 0; i < MaxShards; ++i) {
+    auto Number = std::to_string(i + 1);
+    ShardUnsentParams.emplace_back(new Parameter<epicsInt32>(
+        "KAFKA_SHARD_UNSENT_" + Number + ParamSuffix,
+        [](epicsInt32) { return false; },
+        [this, i]() { return Shards[i].UnsentMessages.load(); }));
+    ShardThroughputParams.emplace_back(new Parameter<double>(
+        "KAFKA_SHARD_THROUGHPUT_" + Number + ParamSuffix,
+        [](double) { return false; },
+        [this, i]() { return Shards[i].Throughput.load(); }));
+    ParamRegistrar->registerParameter(ShardUnsentParams.back().get());
+    ParamRegistrar->registerParameter(ShardThroughputParams.back().get());
+  }
+  AutoApply = not DeferConnection;
   InitRdKafka();
   SetBrokerAddr(broker);
-  MakeConnection();
 }
 
 KafkaProducer::KafkaProducer()
@@ -46,6 +92,8 @@ KafkaProducer::~KafkaProducer() {
     runThread = false;
     statusThread.join();
   }
+  std::lock_guard<std::timed_mutex> lock(brokerMutex);
+  ShutDownProducer();
 }
 
 bool KafkaProducer::StartThread() {
@@ -64,13 +112,26 @@ bool KafkaProducer::StartThread() {
 }
 
 void KafkaProducer::ThreadFunction() {
+  // The producers are polled by the ProducerPool, the callbacks only mark a
+  // retune as pending as the producers can not be re-created from them
   while (runThread) {
     auto startTime = std::chrono::steady_clock::now();
-    if (Producer != nullptr)
-    {
+    // Re-creating the producers would lose the queued messages and waiting
+    // for them would block the plugin, so only retune while none are in
+    // flight (checked again with the lock held, as none are produced then)
+    if (RetunePending and BatchTuning and not SharedProducer and
+        0 == InFlight) {
       bool Locked = brokerMutex.try_lock_for(PollSleepTime);
+      if (Locked and 0 == InFlight) {
+        RetunePending = false;
+        BatchSettings Settings;
+        {
+          std::lock_guard<std::mutex> Lock(StatsMutex);
+          Settings = Tuner.Recommend();
+        }
+        ApplyBatchSettings(Settings);
+      }
       if (Locked) {
-        Producer->poll(0);
         brokerMutex.unlock();
       }
     }
@@ -85,6 +146,17 @@ bool KafkaProducer::SetMaxMessageSize(size_t msgSize) {
   if (errorState or 0 == msgSize) {
     return false;
   }
+  {
+    std::lock_guard<std::timed_mutex> lock(brokerMutex);
+    if (not ConfigureMaxMessageSize(msgSize)) {
+      return false;
+    }
+  }
+  RequestReconnect();
+  return true;
+}
+
+bool KafkaProducer::ConfigureMaxMessageSize(size_t msgSize) {
   RdKafka::Conf::ConfResult configResult1, configResult2;
   configResult1 =
       conf->set("message.max.bytes", std::to_string(msgSize + RD_KAFKAP_MESSAGE_V2_MAX_OVERHEAD), errstr);
@@ -97,7 +169,6 @@ bool KafkaProducer::SetMaxMessageSize(size_t msgSize) {
     return false;
   }
   maxMessageSize = msgSize;
-  MakeConnection();
   return true;
 }
 
@@ -105,6 +176,17 @@ bool KafkaProducer::SetMessageBufferSizeKbytes(size_t msgBufferSize) {
   if (errorState or 0 == maxMessageBufferSizeKb) {
     return false;
   }
+  {
+    std::lock_guard<std::timed_mutex> lock(brokerMutex);
+    if (not ConfigureMessageBufferSizeKbytes(msgBufferSize)) {
+      return false;
+    }
+  }
+  RequestReconnect();
+  return true;
+}
+
+bool KafkaProducer::ConfigureMessageBufferSizeKbytes(size_t msgBufferSize) {
   auto configResult = conf->set("queue.buffering.max.kbytes",
                                 std::to_string(msgBufferSize), errstr);
   if (RdKafka::Conf::CONF_OK != configResult) {
@@ -113,86 +195,397 @@ bool KafkaProducer::SetMessageBufferSizeKbytes(size_t msgBufferSize) {
     return false;
   }
   maxMessageBufferSizeKb = msgBufferSize;
-  MakeConnection();
   return true;
 }
 
+// The sizes are set in the configuration whenever they change, the getters
+// return the stored values instead of reading the configuration without
+// holding the lock
+
 size_t KafkaProducer::GetMessageBufferSizeKbytes() {
-   std::string maxMessageBufferSizeStr;
-   conf->get("queue.buffering.max.kbytes", maxMessageBufferSizeStr);
-   if (maxMessageBufferSizeStr.size() > 0)
-     maxMessageBufferSizeKb = std::atoi(maxMessageBufferSizeStr.c_str());
   return maxMessageBufferSizeKb;
 }
 
-size_t KafkaProducer::GetMaxMessageSize() {
-  // This only needs to be read out on the first call.
-  std::string maxMessageSizeStr, bufferMemory;
-  conf->get("message.max.bytes", maxMessageSizeStr);
-  if (maxMessageSizeStr.size() > 0)
-    maxMessageSize = std::atoi(maxMessageSizeStr.c_str()) - RD_KAFKAP_MESSAGE_V2_MAX_OVERHEAD;
-  return maxMessageSize;
-}
+size_t KafkaProducer::GetMaxMessageSize() { return maxMessageSize; }
 
 bool KafkaProducer::SetMessageQueueLength(int queue) {
   if (errorState or 0 >= queue) {
     return false;
   }
-  RdKafka::Conf::ConfResult configResult;
-  configResult =
-      conf->set("queue.buffering.max.messages", std::to_string(queue), errstr);
-  if (RdKafka::Conf::CONF_OK != configResult) {
-    SetConStat(KafkaProducer::ConStat::ERROR,
-               "Unable to set message queue length.");
-    return false;
+  {
+    std::lock_guard<std::timed_mutex> lock(brokerMutex);
+    RdKafka::Conf::ConfResult configResult;
+    configResult = conf->set("queue.buffering.max.messages",
+                             std::to_string(queue), errstr);
+    if (RdKafka::Conf::CONF_OK != configResult) {
+      SetConStat(KafkaProducer::ConStat::ERROR,
+                 "Unable to set message queue length.");
+      return false;
+    }
+    msgQueueSize = queue;
   }
-  msgQueueSize = queue;
-  MakeConnection();
+  RequestReconnect();
   return true;
 }
 
-int KafkaProducer::GetMessageQueueLength() {
-  std::string msgQueueSizeStr;
-  conf->get("queue.buffering.max.messages", msgQueueSizeStr);
-  if (msgQueueSizeStr.size() > 0)
-    msgQueueSize = std::atoi(msgQueueSizeStr.c_str());
-  return msgQueueSize;
-}
+int KafkaProducer::GetMessageQueueLength() { return msgQueueSize; }
 
 bool KafkaProducer::SendKafkaPacket(const unsigned char *buffer,
                                     size_t buffer_size, time_point Timestamp) {
-  if (errorState or 0 == buffer_size) {
+  return ProduceMessage(const_cast<unsigned char *>(buffer), buffer_size,
+                        RdKafka::Producer::RK_MSG_COPY /* Copy payload */,
+                        Timestamp, nullptr);
+}
+
+bool KafkaProducer::SendKafkaPacket(SharedMessage const &Message,
+                                    time_point Timestamp) {
+  int UsedDecimation = Decimation;
+  if (UsedDecimation > 1 and 0 != DecimationCounter++ % UsedDecimation) {
+    return true;
+  }
+  rd_kafka_headers_t *Headers{nullptr};
+  if (nullptr != Message.Headers) {
+    Headers = rd_kafka_headers_new(Message.Headers->size());
+    for (auto const &Header : *Message.Headers) {
+      rd_kafka_header_add(Headers, Header.first.c_str(), -1,
+                          Header.second.data(),
+                          static_cast<ssize_t>(Header.second.size()));
+    }
+  }
+  // The payload is not copied, a reference to it is kept until the delivery
+  // report has been received
+  return ProduceMessage(const_cast<unsigned char *>(Message.Data.get()),
+                        Message.Size, 0, Timestamp, Message.Data, Headers);
+}
+
+bool KafkaProducer::ProduceMessage(void *Payload, size_t Size, int Flags,
+                                   time_point Timestamp,
+                                   std::shared_ptr<const unsigned char> Data,
+                                   rd_kafka_headers_t *Headers) {
+  // Only taken over by librdkafka if the message is queued
+  std::unique_ptr<rd_kafka_headers_t, void (*)(rd_kafka_headers_t *)>
+      HeadersGuard(Headers, rd_kafka_headers_destroy);
+  if (errorState or 0 == Size) {
     return false;
   }
-  if (buffer_size > maxMessageSize) {
-    bool success = SetMaxMessageSize(buffer_size);
+  // The queue must hold at least two messages
+  bool GrowBuffer = BatchTuning and 2 * Size > maxMessageBufferSizeKb * 1024;
+  if (Size > maxMessageSize or GrowBuffer) {
+    // Applies any other pending changes as well, the message can not be sent
+    // by the current producer. Reconfigured with the lock held throughout as
+    // the status and port threads change the configuration as well.
+    bool success;
+    {
+      std::lock_guard<std::timed_mutex> lock(brokerMutex);
+      success = (Size <= maxMessageSize or ConfigureMaxMessageSize(Size)) and
+                (not GrowBuffer or
+                 ConfigureMessageBufferSizeKbytes(
+                     BatchTuner::RoundUpPow2(2 * Size) / 1024)) and
+                Reconnect();
+    }
     if (not success) {
-      errorState = true;
+      // Only this message is lost, the next one tries again
+      IncrementDroppedMessages();
+      SetConStat(KafkaProducer::ConStat::ERROR,
+                 "Unable to re-configure the producer for a message of " +
+                     std::to_string(Size) + " bytes.");
       return false;
     }
     MaxMessageSize.updateDbValue();
+    MsgBufferSize.updateDbValue();
   }
+  PLUGIN_TRACE_SCOPE("produce", -1);
   std::lock_guard<std::timed_mutex> lock(brokerMutex);
-  if (nullptr == Producer) {
+  if (0 == ActiveShards) {
+    IncrementDroppedMessages();
+    return false;
+  }
+  auto &Used = Shards[NextShard++ % ActiveShards];
+  if (nullptr == Used.Topic) {
+    IncrementDroppedMessages();
     return false;
   }
   auto MessageTime = std::chrono::duration_cast<std::chrono::milliseconds>(
                          Timestamp.time_since_epoch())
                          .count();
-  RdKafka::ErrorCode resp = Producer->produce(
-      TopicName, -1, RdKafka::Producer::RK_MSG_COPY /* Copy payload */,
-      const_cast<unsigned char *>(buffer), buffer_size, nullptr, 0, MessageTime,
-      nullptr);
+  // Identifies this target in the delivery report of a shared producer
+  std::unique_ptr<DeliveryTicket> Ticket(new DeliveryTicket);
+  Ticket->ClientId = Used.ClientId;
+  Ticket->Data = std::move(Data);
+  // Counted first, the delivery report may be served by the pool before
+  // producev() returns
+  ++InFlight;
+  // The C++ API has no produce() call taking both a topic handle and a
+  // timestamp, use the C API with the handles of the C++ objects instead
+  auto resp = static_cast<RdKafka::ErrorCode>(rd_kafka_producev(
+      Used.Producer->get()->c_ptr(), RD_KAFKA_V_RKT(Used.Topic->c_ptr()),
+      RD_KAFKA_V_PARTITION(RD_KAFKA_PARTITION_UA), RD_KAFKA_V_MSGFLAGS(Flags),
+      RD_KAFKA_V_VALUE(Payload, Size), RD_KAFKA_V_TIMESTAMP(MessageTime),
+      RD_KAFKA_V_OPAQUE(Ticket.get()), RD_KAFKA_V_HEADERS(Headers),
+      RD_KAFKA_V_END));
 
   if (RdKafka::ERR_NO_ERROR != resp) {
+    --InFlight;
+    IncrementDroppedMessages();
     SetConStat(KafkaProducer::ConStat::ERROR,
                "Producer failed with error code: " + std::to_string(resp));
     return false;
   }
+  HeadersGuard.release();
+  Ticket.release();
+  Used.Bytes += Size;
+  std::lock_guard<std::mutex> StatsLock(StatsMutex);
+  ++TunerSample.Messages;
+  TunerSample.Bytes += Size;
+  TunerSample.PeakSize = std::max(TunerSample.PeakSize, Size);
   return true;
 }
 
-void KafkaProducer::event_cb(RdKafka::Event &event) {
+void KafkaProducer::IncrementDroppedMessages() {
+  ++DroppedMessages;
+  KafkaDroppedMessages.updateDbValue();
+}
+
+bool KafkaProducer::SetDecimation(int Factor) {
+  if (Factor < 1) {
+    return false;
+  }
+  Decimation = Factor;
+  DecimationCounter = 0;
+  return true;
+}
+
+int KafkaProducer::GetDecimation() { return Decimation; }
+
+bool KafkaProducer::SetPartitioner(std::string const &NewPartitioner) {
+  if (not SetTopicConfig("partitioner", NewPartitioner)) {
+    SetConStat(KafkaProducer::ConStat::ERROR, "Unable to set partitioner.");
+    return false;
+  }
+  Partitioner = NewPartitioner;
+  return true;
+}
+
+std::string KafkaProducer::GetPartitioner() {
+  if (Partitioner.empty()) {
+    tconf->get("partitioner", Partitioner);
+  }
+  return Partitioner;
+}
+
+bool KafkaProducer::SetCompression(std::string const &NewCompression) {
+  if (not SetTopicConfig("compression.codec", NewCompression)) {
+    SetConStat(KafkaProducer::ConStat::ERROR, "Unable to set compression.");
+    return false;
+  }
+  Compression = NewCompression;
+  return true;
+}
+
+std::string KafkaProducer::GetCompression() {
+  if (Compression.empty()) {
+    tconf->get("compression.codec", Compression);
+  }
+  return Compression;
+}
+
+bool KafkaProducer::SetTopicConfig(std::string const &Name,
+                                   std::string const &Value) {
+  if (errorState or Value.empty()) {
+    return false;
+  }
+  {
+    std::lock_guard<std::timed_mutex> lock(brokerMutex);
+    if (RdKafka::Conf::CONF_OK != tconf->set(Name, Value, errstr)) {
+      return false;
+    }
+  }
+  // A topic handle created for a name which already has one (in this or in a
+  // sharing target) is the existing one, the new configuration only takes
+  // effect with new producers
+  RequestReconnect();
+  return true;
+}
+
+bool KafkaProducer::CreateTopicHandle() {
+  std::array<std::unique_ptr<RdKafka::Topic>, MaxShards> NewTopics;
+  for (int i = 0; i < ActiveShards; ++i) {
+    NewTopics[i].reset(RdKafka::Topic::create(
+        Shards[i].Producer->get(), TopicName, tconf.get(), errstr));
+    if (nullptr == NewTopics[i]) {
+      SetConStat(KafkaProducer::ConStat::ERROR,
+                 "Unable to create topic handle.");
+      return false;
+    }
+  }
+  // librdkafka keeps its own reference to the topic for queued messages
+  for (int i = 0; i < ActiveShards; ++i) {
+    Shards[i].Topic = std::move(NewTopics[i]);
+  }
+  return true;
+}
+
+void KafkaProducer::OnDelivery(RdKafka::Message &Message, PooledProducer *) {
+  --InFlight;
+  if (RdKafka::ERR_NO_ERROR == Message.err()) {
+    {
+      std::lock_guard<std::mutex> Lock(StatsMutex);
+      if (not FirstFrameDelivered) {
+        FirstFrameDelivered = true;
+        TimeToFirstFrameMS = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 FirstFrameStartTime)
+                                 .count();
+        KafkaTimeToFirstFrame.updateDbValue();
+      }
+    }
+    // Latency from produce() to delivery in us, -1 if not available
+    auto Latency = Message.latency();
+    if (Latency >= 0) {
+      // Delivery ended now, the latency is in us
+      PLUGIN_TRACE_EVENT("delivery", KafkaTracing::now() - Latency * 1000,
+                         Latency * 1000, -1);
+      double LatencyMS = Latency / 1000.0;
+      LatencySumMS += LatencyMS;
+      LatencyMaxMS = std::max(LatencyMaxMS, LatencyMS);
+      ++LatencyCount;
+    }
+  } else {
+    IncrementDroppedMessages();
+  }
+}
+
+void KafkaProducer::UpdateDeliveryLatency() {
+  if (LatencyCount > 0) {
+    MeanDeliveryLatencyMS = LatencySumMS / LatencyCount;
+  } else {
+    MeanDeliveryLatencyMS = 0;
+  }
+  MaxDeliveryLatencyMS = LatencyMaxMS;
+  LatencySumMS = 0;
+  LatencyMaxMS = 0;
+  LatencyCount = 0;
+  KafkaDeliveryLatency.updateDbValue();
+  KafkaMaxDeliveryLatency.updateDbValue();
+}
+
+void KafkaProducer::ShutDownProducer() {
+  if (doFlush) {
+    WaitForDelivery();
+  }
+  // No callbacks are called once detached, the shards can be changed
+  for (int i = 0; i < ActiveShards; ++i) {
+    Shards[i].Producer->detach(Shards[i].ClientId);
+  }
+  for (int i = 0; i < ActiveShards; ++i) {
+    auto &Current = Shards[i];
+    Current.Topic.reset();
+    // The pool serves the delivery reports of the purged messages, releasing
+    // the shared message data
+    ProducerPool::instance().release(Current.Producer, flushTimeout);
+    Current.UnsentMessages = 0;
+    Current.Throughput = 0;
+  }
+  ActiveShards = 0;
+  // The delivery reports of the remaining messages are no longer received
+  InFlight = 0;
+  EffectiveBufferKBytes = 0;
+  KafkaEffectiveBufferSize.updateDbValue();
+}
+
+bool KafkaProducer::WaitForDelivery() {
+  auto Deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(flushTimeout);
+  while (InFlight > 0 and std::chrono::steady_clock::now() < Deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return InFlight <= 0;
+}
+
+bool KafkaProducer::CreateProducers() {
+  ShutDownProducer();
+  int Count = ShardCount;
+  auto Now = std::chrono::steady_clock::now();
+  for (int i = 0; i < Count; ++i) {
+    auto &Current = Shards[i];
+    Current.Producer = ProducerPool::instance().acquire(
+        conf.get(), tconf.get(), SharedProducer, i, errstr);
+    if (nullptr == Current.Producer) {
+      for (int j = 0; j < i; ++j) {
+        ProducerPool::instance().release(Shards[j].Producer, flushTimeout);
+      }
+      SetConStat(KafkaProducer::ConStat::ERROR,
+                 "Unable to create producer: " + errstr);
+      return false;
+    }
+    Current.Bytes = 0;
+    Current.BytesStart = Now;
+  }
+  // The memory budget of the pool might have limited the queue size
+  std::size_t BufferKBytes{maxMessageBufferSizeKb};
+  for (int i = 0; i < Count; ++i) {
+    BufferKBytes = std::min(BufferKBytes, Shards[i].Producer->bufferKBytes());
+  }
+  if (BufferKBytes < maxMessageBufferSizeKb and
+      2 * maxMessageSize > BufferKBytes * 1024) {
+    for (int i = 0; i < Count; ++i) {
+      ProducerPool::instance().release(Shards[i].Producer, flushTimeout);
+    }
+    SetConStat(KafkaProducer::ConStat::ERROR,
+               "Queue of " + std::to_string(BufferKBytes) +
+                   " kB (memory budget) can not hold two messages of " +
+                   std::to_string(maxMessageSize) + " bytes.");
+    return false;
+  }
+  EffectiveBufferKBytes = BufferKBytes;
+  KafkaEffectiveBufferSize.updateDbValue();
+  ActiveShards = Count;
+  NextShard = 0;
+  for (std::size_t i = 0; i < ShardUnsentParams.size(); ++i) {
+    ShardUnsentParams[i]->updateDbValue();
+    ShardThroughputParams[i]->updateDbValue();
+  }
+  bool Success = CreateTopicHandle();
+  // Only attached once all shards have been set up, as the callbacks read them
+  for (int i = 0; i < Count; ++i) {
+    Shards[i].ClientId = Shards[i].Producer->attach(this);
+  }
+  return Success;
+}
+
+bool KafkaProducer::SetShardCount(int Count) {
+  if (errorState or Count < 1 or Count > MaxShards) {
+    return false;
+  }
+  ShardCount = Count;
+  RequestReconnect();
+  return true;
+}
+
+int KafkaProducer::GetShardCount() { return ShardCount; }
+
+void KafkaProducer::SetSharedProducer(bool Enable) {
+  if (Enable == SharedProducer) {
+    return;
+  }
+  SharedProducer = Enable;
+  if (Enable) {
+    {
+      std::lock_guard<std::mutex> Lock(TuningReasonMutex);
+      TuningReason = "Disabled while sharing the producer.";
+    }
+    KafkaTuningReason.updateDbValue();
+  }
+  RequestReconnect();
+}
+
+bool KafkaProducer::GetSharedProducer() { return SharedProducer; }
+
+std::size_t KafkaProducer::GetEffectiveBufferKBytes() {
+  return EffectiveBufferKBytes;
+}
+
+void KafkaProducer::OnEvent(RdKafka::Event &event, PooledProducer *Source) {
   /// @todo This member function really needs some expanded capability
   switch (event.type()) {
   case RdKafka::Event::EVENT_ERROR:
@@ -211,7 +604,7 @@ void KafkaProducer::event_cb(RdKafka::Event &event) {
     /// @todo Add message/log or something
     break;
   case RdKafka::Event::EVENT_STATS:
-    ParseStatusString(event.str());
+    ParseStatusString(event.str(), Source);
     break;
   default:
     if ((event.type() == RdKafka::Event::EVENT_LOG) and
@@ -228,11 +621,15 @@ void KafkaProducer::SetConStat(KafkaProducer::ConStat stat,
                                std::string const &Msg) {
   CurrentStatus = stat;
   KafkaStatus.updateDbValue();
-  ConnectionMessage = Msg;
+  {
+    std::lock_guard<std::mutex> Lock(ConnectionMessageMutex);
+    ConnectionMessage = Msg;
+  }
   KafkaMessage.updateDbValue();
 }
 
-void KafkaProducer::ParseStatusString(std::string const &msg) {
+void KafkaProducer::ParseStatusString(std::string const &msg,
+                                      PooledProducer *Source) {
   /// @todo We should probably extract some more stats from the JSON message
   const std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
   JSONCPP_STRING err;
@@ -258,8 +655,139 @@ void KafkaProducer::ParseStatusString(std::string const &msg) {
     }
     SetConStat(tempStat, statString);
   }
-  UnsentMessages = root["msg_cnt"].asInt();
+  UpdateShardStats(root, Source);
+  if (Source != Shards[0].Producer.get()) {
+    // The delivery statistics cover all shards and are updated at the stats
+    // events of the first one
+    return;
+  }
+  // The queue of a shared producer also holds the messages of other targets
+  UnsentMessages = std::max(0, InFlight.load());
   UnsentPackets.updateDbValue();
+  UpdateDeliveryLatency();
+  UpdateBatchTuner();
+}
+
+void KafkaProducer::UpdateShardStats(Json::Value const &Stats,
+                                     PooledProducer *Source) {
+  for (int i = 0; i < ActiveShards; ++i) {
+    auto &Current = Shards[i];
+    if (Current.Producer.get() != Source) {
+      continue;
+    }
+    auto Now = std::chrono::steady_clock::now();
+    auto Seconds =
+        std::chrono::duration<double>(Now - Current.BytesStart).count();
+    auto Bytes = Current.Bytes.exchange(0);
+    Current.Throughput =
+        Seconds > 0 ? Bytes / Seconds / (1024.0 * 1024.0) : 0.0;
+    Current.BytesStart = Now;
+    Current.UnsentMessages = Stats["msg_cnt"].asInt();
+    if (static_cast<std::size_t>(i) < ShardUnsentParams.size()) {
+      ShardUnsentParams[i]->updateDbValue();
+      ShardThroughputParams[i]->updateDbValue();
+    }
+    return;
+  }
+}
+
+void KafkaProducer::UpdateBatchTuner() {
+  auto Now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> Lock(StatsMutex);
+  // The settings apply to each shard, which gets its share of the messages
+  auto Shares = std::max(1, ActiveShards.load());
+  TunerSample.Seconds =
+      std::chrono::duration<double>(Now - TunerSampleStart).count() * Shares;
+  TunerSample.LatencyMS = MeanDeliveryLatencyMS;
+  TunerSample.QueuedMessages = UnsentMessages / Shares;
+  Tuner.Update(TunerSample);
+  TunerSample = BatchTuner::Sample();
+  TunerSampleStart = Now;
+  if (not BatchTuning or SharedProducer) {
+    // The settings of a shared producer are those of the target which
+    // created it
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> ReasonLock(TuningReasonMutex);
+    TuningReason = Tuner.Reason();
+  }
+  KafkaTuningReason.updateDbValue();
+  // The producer can not be re-created from its own callback
+  RetunePending = Tuner.RetuneDue(Now);
+}
+
+bool KafkaProducer::ApplyBatchSettings(BatchSettings const &Settings) {
+  auto Now = std::chrono::steady_clock::now();
+  bool Success{true};
+  for (auto const &Setting : BatchSettingNames) {
+    Success = Success and
+              RdKafka::Conf::CONF_OK ==
+                  conf->set(Setting.first,
+                            std::to_string(Settings.*Setting.second), errstr);
+  }
+  std::unique_lock<std::mutex> Lock(StatsMutex);
+  if (not Success) {
+    Tuner.Applied(Tuner.Current(), Now);
+    Lock.unlock();
+    SetConStat(KafkaProducer::ConStat::ERROR,
+               "Unable to set batching settings.");
+    return false;
+  }
+  maxMessageBufferSizeKb = Settings.BufferKBytes;
+  msgQueueSize = Settings.QueueMessages;
+  Tuner.Applied(Settings, Now);
+  ++RetuneCount;
+  PostBatchSettings();
+  Lock.unlock();
+  if (0 == ActiveShards) {
+    return true;
+  }
+  // librdkafka only reads these settings when the producer is created
+  return CreateProducers();
+}
+
+void KafkaProducer::PostBatchSettings() {
+  LingerMS = Tuner.Current().LingerMS;
+  BatchMessages = Tuner.Current().BatchMessages;
+  KafkaLinger.updateDbValue();
+  KafkaBatchMessages.updateDbValue();
+  MsgBufferSize.updateDbValue();
+  KafkaQueueSize.updateDbValue();
+  KafkaRetuneCount.updateDbValue();
+}
+
+void KafkaProducer::SetBatchTuning(bool Enable) {
+  BatchTuning = Enable;
+  if (not Enable) {
+    {
+      std::lock_guard<std::mutex> Lock(TuningReasonMutex);
+      TuningReason = "Disabled.";
+    }
+    KafkaTuningReason.updateDbValue();
+  }
+}
+
+bool KafkaProducer::GetBatchTuning() { return BatchTuning; }
+
+bool KafkaProducer::SetLatencyTargetMS(double Target) {
+  std::lock_guard<std::mutex> Lock(StatsMutex);
+  return Tuner.SetLatencyTargetMS(Target);
+}
+
+double KafkaProducer::GetLatencyTargetMS() {
+  std::lock_guard<std::mutex> Lock(StatsMutex);
+  return Tuner.GetLatencyTargetMS();
+}
+
+bool KafkaProducer::SetBufferSeconds(double Seconds) {
+  std::lock_guard<std::mutex> Lock(StatsMutex);
+  return Tuner.SetBufferSeconds(Seconds);
+}
+
+double KafkaProducer::GetBufferSeconds() {
+  std::lock_guard<std::mutex> Lock(StatsMutex);
+  return Tuner.GetBufferSeconds();
 }
 
 void KafkaProducer::AttemptFlushAtReconnect(bool flush) { doFlush = flush; }
@@ -283,20 +811,18 @@ void KafkaProducer::InitRdKafka() {
     return;
   }
 
+  // The callbacks are set by the ProducerPool, which forwards them
   RdKafka::Conf::ConfResult configResult;
-  configResult = conf->set("event_cb", this, errstr);
-  if (RdKafka::Conf::CONF_OK != configResult) {
-    errorState = true;
-    SetConStat(KafkaProducer::ConStat::ERROR, "Can not set event callback.");
-    return;
-  }
-
   configResult = conf->set("statistics.interval.ms",
                            std::to_string(kafka_stats_interval), errstr);
   if (RdKafka::Conf::CONF_OK != configResult) {
     SetConStat(KafkaProducer::ConStat::ERROR,
                "Unable to set statistics interval.");
   }
+  if (not PluginThreads::Placer.installInterceptors(conf.get(), errstr)) {
+    SetConStat(KafkaProducer::ConStat::ERROR,
+               "Unable to place librdkafka threads.");
+  }
 
   configResult = conf->set("queue.buffering.max.messages",
                            std::to_string(msgQueueSize), errstr);
@@ -322,6 +848,19 @@ void KafkaProducer::InitRdKafka() {
       SetConStat(KafkaProducer::ConStat::ERROR,
           "Unable to set max (copy) message size.");
   }
+
+  // The defaults of this librdkafka version, the starting point of the tuning
+  BatchSettings Settings;
+  for (auto const &Setting : BatchSettingNames) {
+    std::string Value;
+    if (RdKafka::Conf::CONF_OK == conf->get(Setting.first, Value)) {
+      Settings.*Setting.second = std::atoi(Value.c_str());
+    }
+  }
+  std::lock_guard<std::mutex> Lock(StatsMutex);
+  Tuner.SetCurrent(Settings);
+  LingerMS = Settings.LingerMS;
+  BatchMessages = Settings.BatchMessages;
 }
 
 bool KafkaProducer::SetStatsTimeMS(int time) {
@@ -329,16 +868,19 @@ bool KafkaProducer::SetStatsTimeMS(int time) {
   if (errorState or time <= 0) {
     return false;
   }
-  RdKafka::Conf::ConfResult configResult;
-  configResult =
-      conf->set("statistics.interval.ms", std::to_string(time), errstr);
-  if (RdKafka::Conf::CONF_OK != configResult) {
-    SetConStat(KafkaProducer::ConStat::ERROR,
-               "Unable to set statistics interval.");
-    return false;
+  {
+    std::lock_guard<std::timed_mutex> lock(brokerMutex);
+    RdKafka::Conf::ConfResult configResult;
+    configResult =
+        conf->set("statistics.interval.ms", std::to_string(time), errstr);
+    if (RdKafka::Conf::CONF_OK != configResult) {
+      SetConStat(KafkaProducer::ConStat::ERROR,
+                 "Unable to set statistics interval.");
+      return false;
+    }
+    kafka_stats_interval = time;
   }
-  kafka_stats_interval = time;
-  MakeConnection();
+  RequestReconnect();
   return true;
 }
 
@@ -348,40 +890,89 @@ bool KafkaProducer::SetTopic(std::string const &NewTopicName) {
   if (NewTopicName.empty()) {
     return false;
   }
+  std::lock_guard<std::timed_mutex> lock(brokerMutex);
+  auto OldTopicName = TopicName;
   TopicName = NewTopicName;
+  if (not CreateTopicHandle()) {
+    TopicName = OldTopicName;
+    return false;
+  }
   return true;
 }
 
-std::string KafkaProducer::GetTopic() { return TopicName; }
+std::string KafkaProducer::GetTopic() {
+  std::lock_guard<std::timed_mutex> lock(brokerMutex);
+  return TopicName;
+}
 
 bool KafkaProducer::SetBrokerAddr(std::string const &NewBrokerAddr) {
   if (errorState or NewBrokerAddr.empty()) {
     return false;
   }
-  RdKafka::Conf::ConfResult cRes;
-  cRes = conf->set("metadata.broker.list", NewBrokerAddr, errstr);
-  if (RdKafka::Conf::CONF_OK != cRes) {
-    SetConStat(KafkaProducer::ConStat::ERROR, "Can not set new broker.");
-    return false;
+  {
+    std::lock_guard<std::timed_mutex> lock(brokerMutex);
+    RdKafka::Conf::ConfResult cRes;
+    cRes = conf->set("metadata.broker.list", NewBrokerAddr, errstr);
+    if (RdKafka::Conf::CONF_OK != cRes) {
+      SetConStat(KafkaProducer::ConStat::ERROR, "Can not set new broker.");
+      return false;
+    }
+    BrokerAddr = NewBrokerAddr;
   }
-  BrokerAddr = NewBrokerAddr;
-  MakeConnection();
+  RequestReconnect();
   return true;
 }
 
 std::string KafkaProducer::GetBrokerAddr() { return BrokerAddr; }
 
+bool KafkaProducer::SetAutoApply(bool Enable) {
+  AutoApply = Enable;
+  if (Enable) {
+    return ApplyConfiguration();
+  }
+  return true;
+}
+
+bool KafkaProducer::GetAutoApply() { return AutoApply; }
+
+bool KafkaProducer::ApplyConfiguration() {
+  if (not ReconnectPending) {
+    return true;
+  }
+  return MakeConnection();
+}
+
+bool KafkaProducer::ConfigurationPending() { return ReconnectPending; }
+
+bool KafkaProducer::RequestReconnect() {
+  if (AutoApply) {
+    return MakeConnection();
+  }
+  ReconnectPending = true;
+  KafkaConfigPending.updateDbValue();
+  return true;
+}
+
 bool KafkaProducer::MakeConnection() {
+  std::lock_guard<std::timed_mutex> lock(brokerMutex);
+  return Reconnect();
+}
+
+bool KafkaProducer::Reconnect() {
   // Do we know for sure that all possible paths will work? No!
   // This code could probably be improved somewhat.
-  std::lock_guard<std::timed_mutex> lock(brokerMutex);
-  if (not BrokerAddr.empty()) {
-    Producer.reset(RdKafka::Producer::create(conf.get(), errstr));
-    if (nullptr == Producer) {
-      SetConStat(KafkaProducer::ConStat::ERROR, "Unable to create producer.");
-      return false;
+  ReconnectPending = false;
+  KafkaConfigPending.updateDbValue();
+  {
+    std::lock_guard<std::mutex> StatsLock(StatsMutex);
+    if (FirstFrameDelivered) {
+      FirstFrameDelivered = false;
+      FirstFrameStartTime = std::chrono::steady_clock::now();
     }
   }
+  if (not BrokerAddr.empty() and not CreateProducers()) {
+    return false;
+  }
   SetConStat(KafkaProducer::ConStat::CONNECTING, "Trying to open Kafka connection.");
   return true;
 }
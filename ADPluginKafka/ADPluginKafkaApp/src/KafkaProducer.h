@@ -6,16 +6,23 @@
 
 #pragma once
 
+#include "BatchTuner.h"
+#include "FrameHeaders.h"
 #include "Parameter.h"
 #include "ParameterHandler.h"
+#include "ProducerPool.h"
 #include "TimeUtility.h"
 #include "json/json.h"
 #include <asynNDArrayDriver.h>
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #ifdef _WIN32
+#include <rdkafka.h>
 #include <rdkafkacpp.h>
 #else
+#include <librdkafka/rdkafka.h>
 #include <librdkafka/rdkafkacpp.h>
 #endif
 #include <memory>
@@ -29,6 +36,18 @@
  */
 namespace KafkaInterface {
 
+/** @brief A serialized message which can be shared between several producers
+ * without being copied.
+ * The memory is released when the last producer has received the delivery
+ * report of the message.
+ */
+struct SharedMessage {
+  std::shared_ptr<const unsigned char> Data;
+  size_t Size{0};
+  /// @brief Kafka message headers, none if nullptr.
+  std::shared_ptr<const HeaderList> Headers;
+};
+
 /** @brief The class which handles the production of Kafka messages, i.e. it
  * sends data to the
  * broker.
@@ -46,7 +65,7 @@ namespace KafkaInterface {
  * @todo This class copies the data that is to be sent, make it so that it does
  * not have to.
  */
-class KafkaProducer : public RdKafka::EventCb {
+class KafkaProducer : public ProducerClient {
 public:
   /** @brief Sets up the producer to send messages to a Kafka broker.
    * @note The steps for setting up this class as described in the class
@@ -59,12 +78,17 @@ public:
    * @param[in] topic Topic from which the driver should consume messages. Note
    * that only
    * one topic can be specified.
-   * @param[in] queueSize The maximum number of messages that the librdkafka
-   * will store in its
-   * buffer.
+   * @param[in] ParamRegistrar Used to register the PVs of the producer.
+   * @param[in] ParameterSuffix Appended to the name of all parameters. Used to
+   * tell the PVs of several producers in the same plugin apart.
+   * @param[in] DeferConnection If true, the librdkafka producer is not created
+   * until KafkaProducer::ApplyConfiguration() is called, see
+   * KafkaProducer::SetAutoApply().
    */
   KafkaProducer(std::string const &broker, std::string topic,
-                ParameterHandler *ParamRegistrar);
+                ParameterHandler *ParamRegistrar,
+                std::string const &ParameterSuffix = "",
+                bool DeferConnection = false);
 
   /** @brief Simple consumer constructor which will not connect to a broker.
    * @note After calling the constructor, the rest of the instructions given in
@@ -82,10 +106,10 @@ public:
    */
   ~KafkaProducer();
 
-  /** @brief Set topic to consume messages from.
-   * Will try to set a new topic and if successfull; will attempt to drop the
-   * current topic and
-   * connect to the new one.
+  /** @brief Set topic to produce messages to.
+   * Will try to create a new topic handle and if successfull, will replace
+   * the current one. Messages already queued are still sent to the old
+   * topic.
    * @param topicName The new topic.
    * @return True on succes, false on failure.
    */
@@ -209,6 +233,129 @@ public:
   virtual bool SendKafkaPacket(const unsigned char *buffer, size_t buffer_size,
                                time_point Timestamp);
 
+  /** @brief Sends a message shared with other producers to the Kafka broker.
+   * The payload is not copied by librdkafka. Instead a reference to the
+   * message is held until the delivery report has been received.
+   * Messages are skipped (without being counted as dropped) according to the
+   * decimation setting of this producer, see KafkaProducer::SetDecimation().
+   * @param[in] Message The serialized message.
+   * @param[in] Timestamp Timestamp of the Kafka message.
+   * @return False if the message could not be queued, true otherwise (also if
+   * skipped).
+   */
+  virtual bool SendKafkaPacket(SharedMessage const &Message,
+                               time_point Timestamp);
+
+  /** @brief Only send every Nth message given to
+   * KafkaProducer::SendKafkaPacket(SharedMessage const&, time_point).
+   * @param[in] Factor The value of N. Must be >= 1.
+   * @return True on success, false on failure.
+   */
+  virtual bool SetDecimation(int Factor);
+
+  virtual int GetDecimation();
+
+  /** @brief Set the partitioner used for the topic.
+   * Uses the librdkafka names, e.g. "consistent_random" or "murmur2_random".
+   * Requires the producer to be re-created, see KafkaProducer::SetAutoApply().
+   * @param[in] NewPartitioner Name of the partitioner.
+   * @return True on success, false on failure.
+   */
+  virtual bool SetPartitioner(std::string const &NewPartitioner);
+
+  virtual std::string GetPartitioner();
+
+  /** @brief Set the compression codec used for the topic.
+   * Uses the librdkafka names, e.g. "none", "lz4" or "zstd". Requires the
+   * producer to be re-created, see KafkaProducer::SetAutoApply().
+   * @param[in] NewCompression Name of the codec.
+   * @return True on success, false on failure.
+   */
+  virtual bool SetCompression(std::string const &NewCompression);
+
+  virtual std::string GetCompression();
+
+  /** @brief Sets if configuration changes which require the producer to be
+   * re-created are applied immediately.
+   * If false, such changes (broker address, stats interval, queue length,
+   * buffer size, maximum message size, partitioner and compression) are only
+   * stored and several of them are applied together by
+   * KafkaProducer::ApplyConfiguration(). This avoids one re-connect per
+   * changed setting, e.g. when the PINI records are
+   * processed at iocInit. Setting this to true applies any pending changes.
+   * @param[in] Enable True to apply changes immediately.
+   * @return The result of KafkaProducer::ApplyConfiguration() or true.
+   */
+  virtual bool SetAutoApply(bool Enable);
+
+  virtual bool GetAutoApply();
+
+  /** @brief Re-creates the producer if there are pending configuration
+   * changes.
+   * @return True on success or if there was nothing to apply.
+   */
+  virtual bool ApplyConfiguration();
+
+  /// @brief True if there are configuration changes not yet applied.
+  virtual bool ConfigurationPending();
+
+  /** @brief Enables the automatic tuning of the batching and buffer settings
+   * (linger.ms, batch.num.messages, queue.buffering.max.kbytes and
+   * queue.buffering.max.messages), see BatchTuner. Disabled by default, as it
+   * overrides the buffer size and queue length set by the user. librdkafka only reads these settings
+   * when the producer is created, so it is re-created once the queued
+   * messages have been delivered. Disabling keeps the settings in use.
+   */
+  virtual void SetBatchTuning(bool Enable);
+
+  virtual bool GetBatchTuning();
+
+  /** @brief Sets the delivery latency which should not be exceeded because
+   * of batching, see BatchTuner::SetLatencyTargetMS().
+   */
+  virtual bool SetLatencyTargetMS(double Target);
+
+  virtual double GetLatencyTargetMS();
+
+  /** @brief Sets how many seconds of data the producer queue is sized for,
+   * see BatchTuner::SetBufferSeconds().
+   */
+  virtual bool SetBufferSeconds(double Seconds);
+
+  virtual double GetBufferSeconds();
+
+  /// @brief Maximum number of librdkafka producers, see SetShardCount().
+  static const int MaxShards{8};
+
+  /** @brief Sets the number of librdkafka producers (shards) the messages are
+   * distributed over, round-robin.
+   * Each librdkafka producer has its own broker threads, which limit the
+   * throughput of a single producer when sending very large messages. Several
+   * shards make use of more CPU cores. The order of the messages is not
+   * preserved between shards. Requires the producers to be re-created.
+   * @param[in] Count Number of shards, 1 to KafkaProducer::MaxShards.
+   * @return True on success, false on failure.
+   */
+  virtual bool SetShardCount(int Count);
+
+  virtual int GetShardCount();
+
+  /** @brief Sets if the librdkafka producers are shared with the other Kafka
+   * targets (of any plugin) using the same broker and configuration, see
+   * ProducerPool. Shared producers are not re-created by the batch tuning and
+   * their queued messages are not purged when this target disconnects.
+   * Requires the producers to be re-created.
+   */
+  virtual void SetSharedProducer(bool Enable);
+
+  virtual bool GetSharedProducer();
+
+  /** @brief The queue size (queue.buffering.max.kbytes) of the producers in
+   * use, which is smaller than the configured buffer size if limited by the
+   * memory budget of the ProducerPool. 0 if there are no producers.
+   */
+  std::size_t GetEffectiveBufferKBytes();
+
 protected:
   bool errorState{
       false}; /// @brief Set to true if librdkafka could not be initialized.
@@ -216,39 +363,143 @@ protected:
   int32_t flushTimeout{
       500}; /// @brief What is the timeout of the flush attempt?
 
-  size_t maxMessageSize{
+  // The sizes are only changed together with the configuration, while
+  // holding KafkaProducer::brokerMutex, but read without it.
+  std::atomic<size_t> maxMessageSize{
 	  10485760 }; /// @brief Default maximum message size in bytes. 10 MB binary.
-  size_t maxMessageBufferSizeKb{
+  std::atomic<size_t> maxMessageBufferSizeKb{
       10240 };      /// @brief Message buffer size in kilo bytes. 10 MB binary.
-  int msgQueueSize{10}; /// @brief Stored maximum Kafka producer queue length.
+  std::atomic<int> msgQueueSize{
+      10}; /// @brief Stored maximum Kafka producer queue length.
 
   /** @brief Callback member function used by the status and error handling
-   * system of librdkafka.
-   * This member function is registered as a callback function with librdkafka
-   * for error and
-   * status messages. Status messages are received as JSON strings which are
+   * system of librdkafka, forwarded by the producers of the ProducerPool.
+   * Status messages are received as JSON strings which are
    * decoded using
    * jsoncpp. Other events are currently barely handled.
    * @param[in] event RdKafka::Event instance that holds information on
    * statistics, errors or
    * other events.
+   * @param[in] Source The producer (shard) the event is from.
+   */
+  void OnEvent(RdKafka::Event &event, PooledProducer *Source) override;
+
+  /** @brief Called (from the poll thread of the ProducerPool) when a message
+   * of this producer has been delivered or has failed.
+   * Updates the delivery latency and dropped messages statistics. The shared
+   * message data is released with the DeliveryTicket by the pool.
+   */
+  void OnDelivery(RdKafka::Message &Message, PooledProducer *Source) override;
+
+  /** @brief Queues a message for transmission.
+   * @param[in] Payload The message data.
+   * @param[in] Size The size of the message in bytes.
+   * @param[in] Flags Message flags passed to librdkafka.
+   * @param[in] Timestamp Timestamp of the Kafka message.
+   * @param[in] Data Shared message data kept alive until the delivery report
+   * has been received, nullptr if the payload is copied.
+   * @param[in] Headers Message headers, may be nullptr. Owned by librdkafka
+   * if the message was queued, destroyed by this function otherwise.
+   */
+  bool ProduceMessage(void *Payload, size_t Size, int Flags,
+                      time_point Timestamp,
+                      std::shared_ptr<const unsigned char> Data,
+                      rd_kafka_headers_t *Headers = nullptr);
+
+  /// @brief Increments the dropped messages counter and updates its PV.
+  void IncrementDroppedMessages();
+
+  /** @brief Publishes the mean and max delivery latency since the previous
+   * call. Called every time a stats event is received.
    */
-  virtual void event_cb(RdKafka::Event &event);
+  void UpdateDeliveryLatency();
+
+  /** @brief Detaches from the producers and releases them to the
+   * ProducerPool, which destroys them (purging their queued messages) unless
+   * they are shared with other targets. Waits for the messages of this target
+   * first if KafkaProducer::doFlush is set.
+   * Must be called while holding KafkaProducer::brokerMutex.
+   */
+  void ShutDownProducer();
+
+  /** @brief Waits up to KafkaProducer::flushTimeout for the delivery reports
+   * of all messages produced by this target.
+   * @return True if there are no messages in flight.
+   */
+  bool WaitForDelivery();
+
+  /** @brief Destroys the current producers and creates
+   * KafkaProducer::ShardCount new ones, including their topic handles.
+   * Must be called while holding KafkaProducer::brokerMutex.
+   * @return True on success, false on failure.
+   */
+  bool CreateProducers();
 
   /** @brief Thread member function. Should only be called by
    * KafkaProducer::StartThread().
    */
   virtual void ThreadFunction();
 
+  /// @brief See KafkaProducer::SetBatchTuning().
+  std::atomic<bool> BatchTuning{false};
+
+  /** @brief Protects the tuner and the statistics shared between
+   * KafkaProducer::ProduceMessage() and the callbacks. Never held while
+   * calling the ProducerPool or a PooledProducer.
+   */
+  mutable std::mutex StatsMutex;
+
+  /// @brief Only accessed while holding KafkaProducer::StatsMutex.
+  BatchTuner Tuner;
+
+  /// @brief Messages produced since the previous statistics event.
+  BatchTuner::Sample TunerSample;
+  std::chrono::steady_clock::time_point TunerSampleStart{
+      std::chrono::steady_clock::now()};
+
+  /// @brief Set by the statistics event, applied by the status thread.
+  std::atomic<bool> RetunePending{false};
+
+  std::atomic<epicsInt32> RetuneCount{0};
+  std::atomic<epicsInt32> LingerMS{0};
+  std::atomic<epicsInt32> BatchMessages{0};
+
+  /// @brief Protects KafkaProducer::TuningReason only.
+  mutable std::mutex TuningReasonMutex;
+  std::string TuningReason{"Disabled."};
+
+  /** @brief Passes the statistics of the latest interval to the tuner and
+   * marks a retune as pending if it is due. Called with every statistics
+   * event.
+   */
+  void UpdateBatchTuner();
+
+  /** @brief Sets the batching settings in the configuration and re-creates
+   * the producer. Must be called while holding KafkaProducer::brokerMutex and
+   * with no messages in flight, as they would be lost.
+   * @return False if the settings were not applied.
+   */
+  bool ApplyBatchSettings(BatchSettings const &Settings);
+
+  /// @brief Updates the PVs of the settings in use.
+  void PostBatchSettings();
+
   // Kafka connection status enum
   enum class ConStat {
     CONNECTED = 0,
     CONNECTING = 1,
     DISCONNECTED = 2,
     ERROR = 3,
-  } CurrentStatus = ConStat::DISCONNECTED;
+  };
+
+  /** @brief The connection status. Written from librdkafka callbacks and read
+   * by the parameter update thread of the ParameterHandler.
+   */
+  std::atomic<ConStat> CurrentStatus{ConStat::DISCONNECTED};
 
   /** @brief Sets the correct status PV:s.
+   * Does not block and may be called from librdkafka callbacks, the PV:s are
+   * updated by the update thread of the ParameterHandler.
    * Will call KafkaPlugin::DestroyKafkaConnection() if the status id is equal
    * to
    * KafkaPlugin::ERROR.
@@ -268,13 +519,15 @@ protected:
    * broker. This
    * information is then used to update the relevant PV:s.
    * @param[in] msg JSON status message obtained from the Kafka producer system.
+   * @param[in] Source The producer (shard) the message is from.
    */
-  virtual void ParseStatusString(std::string const &msg);
+  virtual void ParseStatusString(std::string const &msg,
+                                 PooledProducer *Source);
 
   int kafka_stats_interval{
       500}; /// @brief Saved Kafka connection stats interval in ms.
 
-  /// @brief Sleep time between poll()-calls. See
+  /// @brief Sleep time between checks for a pending retune. See
   /// KafkaProducer::ThreadFunction().
   const std::chrono::milliseconds PollSleepTime{50};
 
@@ -299,12 +552,114 @@ protected:
    */
   virtual bool MakeConnection();
 
+  /** @brief KafkaProducer::MakeConnection() without taking the lock.
+   * Must be called while holding KafkaProducer::brokerMutex.
+   */
+  bool Reconnect();
+
+  /** @brief Sets the maximum message size in the configuration without
+   * re-connecting.
+   * Must be called while holding KafkaProducer::brokerMutex.
+   */
+  bool ConfigureMaxMessageSize(size_t msgSize);
+
+  /** @brief Sets the message buffer size in the configuration without
+   * re-connecting.
+   * Must be called while holding KafkaProducer::brokerMutex.
+   */
+  bool ConfigureMessageBufferSizeKbytes(size_t msgBufferSize);
+
+  /** @brief Calls KafkaProducer::MakeConnection() if auto-apply is enabled,
+   * otherwise marks the configuration as pending.
+   */
+  bool RequestReconnect();
+
+  /// @brief See KafkaProducer::SetAutoApply().
+  std::atomic<bool> AutoApply{true};
+
+  /// @brief Set when a change requiring a re-connect has not been applied.
+  std::atomic<bool> ReconnectPending{false};
+
+  /** @brief Start of the time-to-first-frame measurement; the construction
+   * of the class or the latest re-connect after a message has been delivered.
+   * Only accessed while holding KafkaProducer::StatsMutex.
+   */
+  std::chrono::steady_clock::time_point FirstFrameStartTime{
+      std::chrono::steady_clock::now()};
+  bool FirstFrameDelivered{false};
+  std::atomic<double> TimeToFirstFrameMS{0};
+
   /// @brief Used to take care of error strings returned by verious librdkafka
   /// functions.
   std::string errstr;
 
-  /// @brief Pointer to Kafka producer in librdkafka.
-  std::unique_ptr<RdKafka::Producer> Producer;
+  /** @brief A librdkafka producer and its statistics, see
+   * KafkaProducer::SetShardCount().
+   * Only changed while holding KafkaProducer::brokerMutex and not attached
+   * to the producer, except for the atomic statistics.
+   */
+  struct Shard {
+    /// @brief The producer obtained from the ProducerPool.
+    std::shared_ptr<PooledProducer> Producer;
+
+    /// @brief See PooledProducer::attach().
+    std::uint64_t ClientId{0};
+
+    /** @brief Cached handle of the current topic, which holds the topic
+     * configuration (partitioner, compression etc.).
+     * Replaced when the topic is changed. Must be destroyed before the
+     * producer.
+     */
+    std::unique_ptr<RdKafka::Topic> Topic;
+
+    /// @brief Bytes produced since the previous stats event.
+    std::atomic<std::uint64_t> Bytes{0};
+    /// @brief Only accessed from the stats events.
+    std::chrono::steady_clock::time_point BytesStart{
+        std::chrono::steady_clock::now()};
+
+    /// @brief Messages queued by the producer, including those of other
+    /// targets sharing it.
+    std::atomic<epicsInt32> UnsentMessages{0};
+    /// @brief MB/s during the previous stats interval.
+    std::atomic<double> Throughput{0};
+  };
+
+  std::array<Shard, MaxShards> Shards;
+
+  /// @brief The requested number of shards, applied at the next re-connect.
+  std::atomic<int> ShardCount{1};
+
+  /** @brief The number of shards created by KafkaProducer::CreateProducers().
+   * Only changed while holding KafkaProducer::brokerMutex.
+   */
+  std::atomic<int> ActiveShards{0};
+
+  /// @brief The shard used for the next message.
+  std::size_t NextShard{0};
+
+  /// @brief See KafkaProducer::SetSharedProducer().
+  std::atomic<bool> SharedProducer{false};
+
+  /// @brief Messages produced by this target and not yet delivered (or failed).
+  std::atomic<epicsInt32> InFlight{0};
+
+  /// @brief See KafkaProducer::GetEffectiveBufferKBytes().
+  std::atomic<std::size_t> EffectiveBufferKBytes{0};
+
+  /** @brief Creates new handles for KafkaProducer::TopicName using the
+   * current topic configuration and replaces the current ones on success.
+   * Must be called while holding KafkaProducer::brokerMutex.
+   * @return True on success (or if there are no producers yet), false on
+   * failure.
+   */
+  bool CreateTopicHandle();
+
+  /// @brief Updates the statistics of the shard the stats event is from.
+  void UpdateShardStats(Json::Value const &Stats, PooledProducer *Source);
+
+  /// @brief Sets a topic configuration property and requests a re-connect.
+  bool SetTopicConfig(std::string const &Name, std::string const &Value);
 
   /// @brief Stores the pointer to a librdkafka configruation object.
   std::unique_ptr<RdKafka::Conf> conf;
@@ -316,8 +671,26 @@ protected:
   std::string BrokerAddr; /// @brief Stores the current broker address used by
                           /// the consumer.
 
+  /// @brief Protects KafkaProducer::ConnectionMessage only.
+  mutable std::mutex ConnectionMessageMutex;
   std::string ConnectionMessage;
-  epicsInt32 UnsentMessages{0};
+  std::atomic<epicsInt32> UnsentMessages{0};
+
+  std::string Partitioner;
+  std::string Compression;
+  /// @brief Atomic as SendKafkaPacket() is called without a lock held.
+  std::atomic<int> Decimation{1};
+  std::atomic<std::int64_t> DecimationCounter{0};
+
+  /// @brief Messages which could not be queued or failed to be delivered.
+  std::atomic<epicsInt32> DroppedMessages{0};
+
+  /// @brief Delivery latency statistics, only accessed from the callbacks.
+  double LatencySumMS{0};
+  double LatencyMaxMS{0};
+  std::int64_t LatencyCount{0};
+  std::atomic<double> MeanDeliveryLatencyMS{0};
+  std::atomic<double> MaxDeliveryLatencyMS{0};
 
   /// @brief The root and broker json objects extracted from a json string.
   Json::Value root, brokers;
@@ -330,49 +703,133 @@ protected:
   /// @brief Used to shut down the stats thread.
   std::atomic_bool runThread{false};
 
-  Parameter<epicsInt32> ReconnectFlush{"KAFKA_RECONNECT_FLUSH",
+  /// @brief Appended to the name of all parameters, see constructor.
+  std::string ParamSuffix;
+
+  Parameter<epicsInt32> ReconnectFlush{"KAFKA_RECONNECT_FLUSH" + ParamSuffix,
                                        [&](epicsInt32 Value) {
                                       AttemptFlushAtReconnect(bool(Value));
                                       return true;
                                     },
                                     [&]() { return doFlush; }};
-  Parameter<epicsInt32> ReconnectFlushTime{"KAFKA_FLUSH_TIME",
+  Parameter<epicsInt32> ReconnectFlushTime{"KAFKA_FLUSH_TIME" + ParamSuffix,
                                            [&](epicsInt32 Value) {
                                           FlushTimeout(Value);
                                           return true;
                                         },
                                         [&]() { return flushTimeout; }};
   Parameter<epicsInt32> MsgBufferSize{
-      "KAFKA_MSG_BUFFER_SIZE",
+      "KAFKA_MSG_BUFFER_SIZE" + ParamSuffix,
       [&](epicsInt32 Value) { return SetMessageBufferSizeKbytes(Value); },
       [&]() { return GetMessageBufferSizeKbytes(); }};
   Parameter<epicsInt32> MaxMessageSize{
-      "KAFKA_MAX_MSG_SIZE",
+      "KAFKA_MAX_MSG_SIZE" + ParamSuffix,
       [&](epicsInt32 Value) { return SetMaxMessageSize(Value); },
       [&]() { return GetMaxMessageSize(); }};
-  Parameter<epicsInt32> UnsentPackets{"KAFKA_UNSENT_PACKETS",
+  Parameter<epicsInt32> UnsentPackets{"KAFKA_UNSENT_PACKETS" + ParamSuffix,
                                       [&](epicsInt32) { return false; },
-                                   [&]() { return UnsentMessages; }};
-  Parameter<epicsInt32> KafkaStatus{"KAFKA_CONNECTION_STATUS",
+                                   [&]() { return UnsentMessages.load(); }};
+  Parameter<epicsInt32> KafkaStatus{"KAFKA_CONNECTION_STATUS" + ParamSuffix,
                                     [&](epicsInt32) { return false; },
-                                 [&]() { return int(CurrentStatus); }};
-  Parameter<std::string> KafkaMessage{"KAFKA_CONNECTION_MESSAGE",
+                                 [&]() { return int(CurrentStatus.load()); }};
+  Parameter<std::string> KafkaMessage{"KAFKA_CONNECTION_MESSAGE" + ParamSuffix,
                                       [&](std::string) { return false; },
-                                      [&]() { return ConnectionMessage; }};
+                                      [&]() {
+                                        std::lock_guard<std::mutex> Lock(
+                                            ConnectionMessageMutex);
+                                        return ConnectionMessage;
+                                      }};
   Parameter<std::string> KafkaTopic{
-      "KAFKA_TOPIC", [&](std::string NewValue) { return SetTopic(NewValue); },
+      "KAFKA_TOPIC" + ParamSuffix, [&](std::string NewValue) { return SetTopic(NewValue); },
       [&]() { return GetTopic(); }};
   Parameter<std::string> KafkaBroker{
-      "KAFKA_BROKER_ADDRESS",
+      "KAFKA_BROKER_ADDRESS" + ParamSuffix,
       [&](std::string NewValue) { return SetBrokerAddr(NewValue); },
       [&]() { return GetBrokerAddr(); }};
   Parameter<epicsInt32> KafkaStatsInterval{
-      "KAFKA_STATS_INT_MS",
+      "KAFKA_STATS_INT_MS" + ParamSuffix,
       [&](epicsInt32 NewValue) { return SetStatsTimeMS(NewValue); },
       [&]() { return GetStatsTimeMS(); }};
   Parameter<epicsInt32> KafkaQueueSize{
-      "KAFKA_QUEUE_SIZE",
+      "KAFKA_QUEUE_SIZE" + ParamSuffix,
       [&](epicsInt32 NewValue) { return SetMessageQueueLength(NewValue); },
       [&]() { return GetMessageQueueLength(); }};
+  Parameter<epicsInt32> KafkaDecimation{
+      "KAFKA_DECIMATION" + ParamSuffix,
+      [&](epicsInt32 NewValue) { return SetDecimation(NewValue); },
+      [&]() { return GetDecimation(); }};
+  Parameter<std::string> KafkaPartitioner{
+      "KAFKA_PARTITIONER" + ParamSuffix,
+      [&](std::string NewValue) { return SetPartitioner(NewValue); },
+      [&]() { return GetPartitioner(); }};
+  Parameter<std::string> KafkaCompression{
+      "KAFKA_COMPRESSION" + ParamSuffix,
+      [&](std::string NewValue) { return SetCompression(NewValue); },
+      [&]() { return GetCompression(); }};
+  Parameter<epicsInt32> KafkaDroppedMessages{
+      "KAFKA_DROPPED_MESSAGES" + ParamSuffix,
+      [&](epicsInt32) { return false; },
+      [&]() { return DroppedMessages.load(); }};
+  Parameter<double> KafkaDeliveryLatency{
+      "KAFKA_DELIVERY_LATENCY" + ParamSuffix, [&](double) { return false; },
+      [&]() { return MeanDeliveryLatencyMS.load(); }};
+  Parameter<double> KafkaMaxDeliveryLatency{
+      "KAFKA_MAX_DELIVERY_LATENCY" + ParamSuffix, [&](double) { return false; },
+      [&]() { return MaxDeliveryLatencyMS.load(); }};
+  Parameter<epicsInt32> KafkaConfigPending{
+      "KAFKA_CONFIG_PENDING" + ParamSuffix, [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(ReconnectPending.load()); }};
+  Parameter<double> KafkaTimeToFirstFrame{
+      "KAFKA_TIME_TO_FIRST_FRAME" + ParamSuffix, [&](double) { return false; },
+      [&]() { return TimeToFirstFrameMS.load(); }};
+  Parameter<epicsInt32> KafkaBatchTuning{
+      "KAFKA_BATCH_TUNING" + ParamSuffix,
+      [&](epicsInt32 NewValue) {
+        SetBatchTuning(0 != NewValue);
+        return true;
+      },
+      [&]() { return static_cast<epicsInt32>(GetBatchTuning()); }};
+  Parameter<double> KafkaLatencyTarget{
+      "KAFKA_LATENCY_TARGET" + ParamSuffix,
+      [&](double NewValue) { return SetLatencyTargetMS(NewValue); },
+      [&]() { return GetLatencyTargetMS(); }};
+  Parameter<double> KafkaBufferTime{
+      "KAFKA_BUFFER_TIME" + ParamSuffix,
+      [&](double NewValue) { return SetBufferSeconds(NewValue); },
+      [&]() { return GetBufferSeconds(); }};
+  Parameter<epicsInt32> KafkaLinger{"KAFKA_LINGER_MS" + ParamSuffix,
+                                    [&](epicsInt32) { return false; },
+                                    [&]() { return LingerMS.load(); }};
+  Parameter<epicsInt32> KafkaBatchMessages{
+      "KAFKA_BATCH_MESSAGES" + ParamSuffix, [&](epicsInt32) { return false; },
+      [&]() { return BatchMessages.load(); }};
+  Parameter<epicsInt32> KafkaRetuneCount{
+      "KAFKA_RETUNE_COUNT" + ParamSuffix, [&](epicsInt32) { return false; },
+      [&]() { return RetuneCount.load(); }};
+  Parameter<std::string> KafkaTuningReason{
+      "KAFKA_BATCH_TUNING_REASON" + ParamSuffix,
+      [&](std::string) { return false; },
+      [&]() {
+        std::lock_guard<std::mutex> Lock(TuningReasonMutex);
+        return TuningReason;
+      }};
+  Parameter<epicsInt32> KafkaShards{
+      "KAFKA_SHARDS" + ParamSuffix,
+      [&](epicsInt32 NewValue) { return SetShardCount(NewValue); },
+      [&]() { return GetShardCount(); }};
+  Parameter<epicsInt32> KafkaSharedProducer{
+      "KAFKA_SHARED_PRODUCER" + ParamSuffix,
+      [&](epicsInt32 NewValue) {
+        SetSharedProducer(0 != NewValue);
+        return true;
+      },
+      [&]() { return static_cast<epicsInt32>(GetSharedProducer()); }};
+  Parameter<epicsInt32> KafkaEffectiveBufferSize{
+      "KAFKA_EFFECTIVE_BUFFER_SIZE" + ParamSuffix,
+      [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(GetEffectiveBufferKBytes()); }};
+  /// @brief Queue length and throughput of each shard, see constructor.
+  std::vector<std::unique_ptr<Parameter<epicsInt32>>> ShardUnsentParams;
+  std::vector<std::unique_ptr<Parameter<double>>> ShardThroughputParams;
 };
 } // namespace KafkaInterface
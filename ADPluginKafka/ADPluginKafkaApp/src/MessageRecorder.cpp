@@ -0,0 +1,528 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  MessageRecorder.cpp
+ *  @brief Implementation of the segment file writer.
+ */
+
+#include "MessageRecorder.h"
+#include <algorithm>
+#include <cerrno>
+#include <ciso646>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <epicsTime.h>
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief Alignment (and size granularity) of O_DIRECT writes.
+const std::size_t BlockSize{4096};
+
+/// @brief Size of the buffer used for direct I/O, a multiple of BlockSize.
+const std::size_t StagingSize{4 * 1024 * 1024};
+
+const std::size_t RecordAlignment{8};
+
+/// @brief Time after which a partially filled block is written when idle.
+const std::chrono::milliseconds IdleFlushTime{500};
+
+std::size_t paddedSize(std::size_t Size, std::size_t Alignment) {
+  return (Size + Alignment - 1) / Alignment * Alignment;
+}
+
+std::string errorString(std::string const &What) {
+  return What + ": " + std::strerror(errno);
+}
+
+#ifndef _WIN32
+bool writeAll(int FileDescriptor, const unsigned char *Data, std::size_t Size,
+              std::size_t Offset) {
+  while (Size > 0) {
+    auto Written = ::pwrite(FileDescriptor, Data, Size, Offset);
+    if (Written < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return false;
+    }
+    Data += Written;
+    Size -= Written;
+    Offset += Written;
+  }
+  return true;
+}
+#endif
+} // namespace
+
+constexpr char MessageRecorder::Magic[8];
+const std::uint32_t MessageRecorder::FormatVersion;
+
+MessageRecorder::MessageRecorder() {
+  WriterThread = std::thread(&MessageRecorder::ThreadFunction, this);
+}
+
+MessageRecorder::MessageRecorder(ParameterHandler *ParamRegistrar)
+    : MessageRecorder() {
+  for (auto Param : std::vector<ParameterBase *>{
+           &EnableParam, &SkipKafkaParam, &DirectoryParam, &FilePrefixParam,
+           &SegmentSizeParam, &DirectIOParam, &PreallocateParam,
+           &QueueSizeParam, &CurrentFileParam, &StatusParam, &ByteRateParam,
+           &MessageRateParam, &BytesWrittenParam, &MessagesWrittenParam,
+           &DroppedParam, &WriteErrorsParam, &QueuedParam}) {
+    ParamRegistrar->registerParameter(Param);
+  }
+}
+
+MessageRecorder::~MessageRecorder() {
+  {
+    std::lock_guard<std::mutex> Lock(RecorderMutex);
+    RunThread = false;
+  }
+  QueueCondition.notify_all();
+  WriterThread.join();
+  std::free(Staging);
+}
+
+bool MessageRecorder::Record(SharedMessage const &Message,
+                             time_point Timestamp) {
+  if (not Enabled) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> Lock(RecorderMutex);
+    if (Queue.size() >= static_cast<std::size_t>(QueueSize)) {
+      ++DroppedMessages;
+      return false;
+    }
+    Queue.push_back(
+        {Message,
+         std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Timestamp.time_since_epoch())
+             .count(),
+         Recording});
+    QueuedMessages = static_cast<epicsInt32>(Queue.size());
+  }
+  QueueCondition.notify_one();
+  return true;
+}
+
+bool MessageRecorder::SetEnabled(bool Enable) {
+  {
+    std::lock_guard<std::mutex> Lock(RecorderMutex);
+    if (Enable and not Enabled) {
+      ++Recording;
+    }
+    Enabled = Enable;
+  }
+  QueueCondition.notify_one();
+  return true;
+}
+
+bool MessageRecorder::GetEnabled() const { return Enabled; }
+
+bool MessageRecorder::SetSkipKafka(bool Skip) {
+  SkipKafka = Skip;
+  return true;
+}
+
+bool MessageRecorder::GetSkipKafka() const { return SkipKafka; }
+
+bool MessageRecorder::KafkaBypassed() const { return Enabled and SkipKafka; }
+
+bool MessageRecorder::SetDirectory(std::string const &NewDirectory) {
+  if (NewDirectory.empty()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  Directory = NewDirectory;
+  return true;
+}
+
+std::string MessageRecorder::GetDirectory() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return Directory;
+}
+
+bool MessageRecorder::SetFilePrefix(std::string const &NewPrefix) {
+  if (NewPrefix.empty() or std::string::npos != NewPrefix.find('/')) {
+    return false;
+  }
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  FilePrefix = NewPrefix;
+  return true;
+}
+
+std::string MessageRecorder::GetFilePrefix() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return FilePrefix;
+}
+
+bool MessageRecorder::SetSegmentSizeMB(int SizeMB) {
+  if (SizeMB < 1) {
+    return false;
+  }
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  SegmentSizeMB = SizeMB;
+  return true;
+}
+
+int MessageRecorder::GetSegmentSizeMB() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return SegmentSizeMB;
+}
+
+bool MessageRecorder::SetDirectIO(bool Enable) {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  DirectIO = Enable;
+  return true;
+}
+
+bool MessageRecorder::GetDirectIO() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return DirectIO;
+}
+
+bool MessageRecorder::SetPreallocate(bool Enable) {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  Preallocate = Enable;
+  return true;
+}
+
+bool MessageRecorder::GetPreallocate() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return Preallocate;
+}
+
+bool MessageRecorder::SetQueueSize(int Size) {
+  if (Size < 1) {
+    return false;
+  }
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  QueueSize = Size;
+  return true;
+}
+
+int MessageRecorder::GetQueueSize() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return QueueSize;
+}
+
+std::string MessageRecorder::GetCurrentFile() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return CurrentFile;
+}
+
+std::string MessageRecorder::GetStatusMessage() const {
+  std::lock_guard<std::mutex> Lock(RecorderMutex);
+  return StatusMessage;
+}
+
+void MessageRecorder::SetStatusMessage(std::string const &Message) {
+  {
+    std::lock_guard<std::mutex> Lock(RecorderMutex);
+    StatusMessage = Message;
+  }
+  StatusParam.updateDbValue();
+}
+
+void MessageRecorder::PublishStats() {
+  auto Now = std::chrono::steady_clock::now();
+  auto Bytes = BytesWritten.load();
+  auto Messages = MessagesWritten.load();
+  double Elapsed = std::chrono::duration<double>(Now - LastStatsTime).count();
+  if (Elapsed > 0) {
+    ByteRateMB = (Bytes - LastBytesWritten) / Elapsed / 1e6;
+    MessageRate = (Messages - LastMessagesWritten) / Elapsed;
+  }
+  LastStatsTime = Now;
+  LastBytesWritten = Bytes;
+  LastMessagesWritten = Messages;
+  for (auto Param : std::vector<ParameterBase *>{
+           &ByteRateParam, &MessageRateParam, &BytesWrittenParam,
+           &MessagesWrittenParam, &DroppedParam, &WriteErrorsParam,
+           &QueuedParam}) {
+    Param->updateDbValue();
+  }
+}
+
+void MessageRecorder::ThreadFunction() {
+  std::unique_lock<std::mutex> Lock(RecorderMutex);
+  while (true) {
+    QueueCondition.wait_for(Lock, IdleFlushTime, [this]() {
+      return not Queue.empty() or not RunThread or
+             (not Enabled and -1 != FileDescriptor);
+    });
+    if (Queue.empty()) {
+      bool Stop = not RunThread;
+      bool Close = Stop or not Enabled;
+      Lock.unlock();
+      if (-1 != FileDescriptor) {
+        if (Close) {
+          CloseSegment();
+        } else if (SegmentDirect and StagingUsed > StagingWritten and
+                   not WriteStaging(false)) {
+          ++WriteErrors;
+          SetStatusMessage(errorString("Write failed"));
+        }
+      }
+      Lock.lock();
+      if (Stop) {
+        break;
+      }
+      continue;
+    }
+    auto Item = std::move(Queue.front());
+    Queue.pop_front();
+    QueuedMessages = static_cast<epicsInt32>(Queue.size());
+    Lock.unlock();
+    if (not WriteMessage(Item)) {
+      ++WriteErrors;
+    }
+    // Release the message data before taking the lock
+    Item.Message.Data.reset();
+    Lock.lock();
+  }
+}
+
+bool MessageRecorder::WriteMessage(QueuedMessage const &Item) {
+  auto RecordSize = sizeof(RecordHeader) +
+                    paddedSize(Item.Message.Size, RecordAlignment);
+  if (-1 != FileDescriptor and (Item.Recording != SegmentRecording or
+                                SegmentUsed + RecordSize > SegmentSize)) {
+    CloseSegment();
+  }
+  if (-1 == FileDescriptor) {
+    if (Item.Recording != SegmentRecording) {
+      SegmentRecording = Item.Recording;
+      SegmentNumber = 0;
+      epicsTimeStamp Now;
+      epicsTimeGetCurrent(&Now);
+      char Buffer[32];
+      epicsTimeToStrftime(Buffer, sizeof(Buffer), "%Y%m%d-%H%M%S", &Now);
+      SegmentRecordingName = Buffer;
+    }
+    if (not OpenSegment(sizeof(SegmentHeader) + RecordSize)) {
+      return false;
+    }
+  }
+  RecordHeader Header{static_cast<std::uint32_t>(Item.Message.Size), 0,
+                      Item.TimestampNs};
+  Index.push_back({SegmentUsed, Header.Size, 0, Item.TimestampNs});
+  static const unsigned char Padding[RecordAlignment]{};
+  if (not Append(&Header, sizeof(Header)) or
+      not Append(Item.Message.Data.get(), Item.Message.Size) or
+      not Append(Padding,
+                 paddedSize(Item.Message.Size, RecordAlignment) -
+                     Item.Message.Size)) {
+    SetStatusMessage(errorString("Write failed"));
+    Index.pop_back();
+    CloseSegment();
+    return false;
+  }
+  ++MessagesWritten;
+  BytesWritten += RecordSize;
+  return true;
+}
+
+bool MessageRecorder::OpenSegment(std::size_t MinimumSize) {
+  std::string Path;
+  bool Direct, Allocate;
+  std::size_t Size;
+  {
+    std::lock_guard<std::mutex> Lock(RecorderMutex);
+    char Number[16];
+    std::snprintf(Number, sizeof(Number), "%06d", SegmentNumber);
+    Path = Directory + "/" + FilePrefix + "_" + SegmentRecordingName + "_" +
+           Number + ".adar";
+    Direct = DirectIO;
+    Allocate = Preallocate;
+    Size = static_cast<std::size_t>(SegmentSizeMB) * 1024 * 1024;
+  }
+  Size = paddedSize(std::max(Size, MinimumSize), BlockSize);
+#ifdef _WIN32
+  SetStatusMessage("Recording is not supported on Windows");
+  return false;
+#else
+  std::string Note;
+  int Flags = O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+  if (Direct) {
+    FileDescriptor = ::open(Path.c_str(), Flags | O_WRONLY | O_DIRECT, 0644);
+    if (-1 == FileDescriptor and EINVAL == errno) {
+      // E.g. tmpfs, fall back to buffered writes of the same blocks
+      Note = " (no direct I/O)";
+      FileDescriptor = ::open(Path.c_str(), Flags | O_WRONLY, 0644);
+    }
+  } else {
+    FileDescriptor = ::open(Path.c_str(), Flags | O_RDWR, 0644);
+  }
+#else
+  FileDescriptor = ::open(Path.c_str(), Flags | O_RDWR, 0644);
+#endif
+  if (-1 == FileDescriptor) {
+    SetStatusMessage(errorString("Unable to create " + Path));
+    return false;
+  }
+  auto Fail = [this, &Path](std::string const &What) {
+    SetStatusMessage(errorString(What));
+    ::close(FileDescriptor);
+    FileDescriptor = -1;
+    ::unlink(Path.c_str());
+    return false;
+  };
+#ifdef __linux__
+  // A full disk would raise SIGBUS when writing a sparse segment through the
+  // mapping, mapped segments are therefore always allocated
+  if (Allocate or not Direct) {
+    int Result = ::posix_fallocate(FileDescriptor, 0, Size);
+    if (0 != Result) {
+      errno = Result;
+      return Fail("Unable to allocate " + Path);
+    }
+  }
+#endif
+  if (not Direct and 0 != ::ftruncate(FileDescriptor, Size)) {
+    return Fail("Unable to resize " + Path);
+  }
+  if (Direct) {
+    void *Buffer{Staging};
+    if (nullptr == Staging and
+        0 != ::posix_memalign(&Buffer, BlockSize, StagingSize)) {
+      return Fail("Unable to allocate buffer");
+    }
+    Staging = static_cast<unsigned char *>(Buffer);
+    StagingUsed = 0;
+    StagingWritten = 0;
+    StagingFileOffset = 0;
+  } else {
+    void *Mapped = ::mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          FileDescriptor, 0);
+    if (MAP_FAILED == Mapped) {
+      return Fail("Unable to map " + Path);
+    }
+    ::madvise(Mapped, Size, MADV_SEQUENTIAL);
+    MappedData = static_cast<unsigned char *>(Mapped);
+  }
+  SegmentDirect = Direct;
+  SegmentPath = Path;
+  SegmentSize = Size;
+  SegmentUsed = 0;
+  Index.clear();
+  ++SegmentNumber;
+  SegmentHeader Header;
+  std::memcpy(Header.Magic, Magic, sizeof(Header.Magic));
+  Header.Version = FormatVersion;
+  Header.HeaderSize = sizeof(SegmentHeader);
+  if (not Append(&Header, sizeof(Header))) {
+    CloseSegment();
+    ::unlink(Path.c_str());
+    SetStatusMessage(errorString("Unable to write " + Path));
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> Lock(RecorderMutex);
+    CurrentFile = Path;
+  }
+  CurrentFileParam.updateDbValue();
+  SetStatusMessage("Recording" + Note);
+  return true;
+#endif
+}
+
+void MessageRecorder::CloseSegment() {
+#ifndef _WIN32
+  if (-1 == FileDescriptor) {
+    return;
+  }
+  if (SegmentDirect) {
+    if (not WriteStaging(true)) {
+      ++WriteErrors;
+      SetStatusMessage(errorString("Write failed"));
+    }
+  } else {
+    ::munmap(MappedData, SegmentSize);
+    MappedData = nullptr;
+  }
+  // Remove the unused (pre-allocated) part of the segment
+  if (0 != ::ftruncate(FileDescriptor, SegmentUsed)) {
+    SetStatusMessage(errorString("Unable to truncate " + SegmentPath));
+  }
+  ::close(FileDescriptor);
+  FileDescriptor = -1;
+  WriteIndex();
+  {
+    std::lock_guard<std::mutex> Lock(RecorderMutex);
+    CurrentFile.clear();
+    if (not Enabled) {
+      StatusMessage = "Idle";
+    }
+  }
+  CurrentFileParam.updateDbValue();
+  StatusParam.updateDbValue();
+#endif
+}
+
+bool MessageRecorder::Append(const void *Data, std::size_t Size) {
+  auto Bytes = static_cast<const unsigned char *>(Data);
+  if (not SegmentDirect) {
+    std::memcpy(MappedData + SegmentUsed, Bytes, Size);
+    SegmentUsed += Size;
+    return true;
+  }
+  while (Size > 0) {
+    auto Chunk = std::min(Size, StagingSize - StagingUsed);
+    std::memcpy(Staging + StagingUsed, Bytes, Chunk);
+    StagingUsed += Chunk;
+    SegmentUsed += Chunk;
+    Bytes += Chunk;
+    Size -= Chunk;
+    if (StagingSize == StagingUsed and not WriteStaging(false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MessageRecorder::WriteStaging(bool Final) {
+#ifdef _WIN32
+  return false;
+#else
+  // Direct I/O requires whole blocks, the last one is padded with zeros and
+  // (unless this is the end of the segment) written again when it is full
+  auto Padded = paddedSize(StagingUsed, BlockSize);
+  std::memset(Staging + StagingUsed, 0, Padded - StagingUsed);
+  if (not writeAll(FileDescriptor, Staging, Padded, StagingFileOffset)) {
+    return false;
+  }
+  StagingWritten = StagingUsed;
+  if (not Final) {
+    auto Complete = StagingUsed / BlockSize * BlockSize;
+    auto Tail = StagingUsed - Complete;
+    std::memmove(Staging, Staging + Complete, Tail);
+    StagingFileOffset += Complete;
+    StagingUsed = Tail;
+    StagingWritten = Tail;
+  }
+  return true;
+#endif
+}
+
+void MessageRecorder::WriteIndex() {
+  std::ofstream File(SegmentPath + ".idx",
+                     std::ios::out | std::ios::binary | std::ios::trunc);
+  File.write(reinterpret_cast<const char *>(Index.data()),
+             Index.size() * sizeof(IndexEntry));
+  if (not File.good()) {
+    ++WriteErrors;
+    SetStatusMessage("Unable to write index of " + SegmentPath);
+  }
+}
+} // namespace KafkaInterface
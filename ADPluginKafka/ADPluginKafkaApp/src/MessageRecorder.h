@@ -0,0 +1,283 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  MessageRecorder.h
+ *  @brief Writes serialized messages to segment files, as an alternative or
+ * an addition to sending them to Kafka.
+ */
+
+#pragma once
+
+#include "KafkaProducer.h"
+#include "Parameter.h"
+#include "ParameterHandler.h"
+#include "TimeUtility.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief Appends serialized (ADAr) messages to segment files.
+ * Used to capture a stream for later replay and to measure the throughput of
+ * the serialisation without a broker (see MessageRecorder::SetSkipKafka()).
+ * Messages are queued by MessageRecorder::Record() without being copied and
+ * written by a separate thread.
+ *
+ * A recording consists of segment files named
+ * "<prefix>_<YYYYmmdd-HHMMSS>_<NNNNNN>.adar" in the recording directory. A new
+ * segment is started when the next message does not fit in the current one.
+ * All values are in host byte order (little-endian on all supported
+ * platforms). A segment file starts with a SegmentHeader, followed by the
+ * records. Each record is a RecordHeader followed by the message, padded with
+ * zeros to a multiple of 8 bytes so that every message starts at an 8-byte
+ * boundary and can be read in place. A record header with Size 0 (e.g. in the
+ * unused part of a segment after a crash) marks the end of the segment. When
+ * a segment is closed, an index file with the same name and the suffix ".idx"
+ * is written. It holds one IndexEntry per message.
+ *
+ * Segments are written either through a memory mapping of the (pre-sized)
+ * file or, if direct I/O is enabled, with O_DIRECT writes of 4 kB aligned
+ * blocks which bypass the page cache. The segment can be pre-allocated with
+ * fallocate() to avoid fragmentation and allocation during recording. Only
+ * supported on POSIX systems.
+ */
+class MessageRecorder {
+public:
+  /// @brief Magic bytes at the start of every segment file.
+  static constexpr char Magic[8]{'A', 'D', 'A', 'R', 'S', 'E', 'G', '\0'};
+  static const std::uint32_t FormatVersion{1};
+
+  struct SegmentHeader {
+    char Magic[8];
+    std::uint32_t Version;
+    std::uint32_t HeaderSize; ///< Size of this header in bytes.
+  };
+
+  struct RecordHeader {
+    std::uint32_t Size; ///< Size of the message in bytes, without padding.
+    std::uint32_t Reserved;
+    std::int64_t TimestampNs; ///< Kafka message timestamp, ns since epoch.
+  };
+
+  struct IndexEntry {
+    std::uint64_t Offset; ///< Offset of the RecordHeader in the segment.
+    std::uint32_t Size;
+    std::uint32_t Reserved;
+    std::int64_t TimestampNs;
+  };
+
+  /** @brief Creates the recorder and registers its PVs.
+   * @param[in] ParamRegistrar Used to register the PVs of the recorder.
+   */
+  explicit MessageRecorder(ParameterHandler *ParamRegistrar);
+
+  /// @brief Creates a recorder without PVs.
+  MessageRecorder();
+
+  /** @brief Writes the queued messages and closes the current segment before
+   * returning.
+   */
+  ~MessageRecorder();
+
+  /** @brief Queues a message to be written. Never blocks on disk I/O.
+   * @return False if recording is disabled or the queue is full; the message
+   * is then not recorded.
+   */
+  bool Record(SharedMessage const &Message, time_point Timestamp);
+
+  /** @brief Starts or stops a recording.
+   * Starting creates a new recording (set of segments). When stopping, the
+   * queued messages are written before the segment is closed.
+   */
+  bool SetEnabled(bool Enable);
+
+  bool GetEnabled() const;
+
+  /// @brief If true, messages are only recorded and not sent to Kafka while
+  /// recording.
+  bool SetSkipKafka(bool Skip);
+
+  bool GetSkipKafka() const;
+
+  /// @brief True if recording with MessageRecorder::SetSkipKafka() set.
+  bool KafkaBypassed() const;
+
+  /** @brief The following settings take effect from the next segment.
+   * @{
+   */
+  bool SetDirectory(std::string const &NewDirectory);
+  std::string GetDirectory() const;
+  bool SetFilePrefix(std::string const &NewPrefix);
+  std::string GetFilePrefix() const;
+  /// @brief Segment size in MB, at least 1.
+  bool SetSegmentSizeMB(int SizeMB);
+  int GetSegmentSizeMB() const;
+  bool SetDirectIO(bool Enable);
+  bool GetDirectIO() const;
+  /// @brief Only used with direct I/O, mapped segments are always allocated.
+  bool SetPreallocate(bool Enable);
+  bool GetPreallocate() const;
+  /// @}
+
+  /// @brief Maximum number of queued messages, at least 1.
+  bool SetQueueSize(int Size);
+  int GetQueueSize() const;
+
+  /// @brief Path of the segment being written, empty if none.
+  std::string GetCurrentFile() const;
+
+  std::string GetStatusMessage() const;
+
+  std::uint64_t GetMessagesWritten() const { return MessagesWritten; }
+  std::uint64_t GetBytesWritten() const { return BytesWritten; }
+  std::uint64_t GetDroppedMessages() const { return DroppedMessages; }
+
+  /** @brief Computes the write rates since the previous call and updates the
+   * statistics PVs. Called periodically by the owner.
+   */
+  void PublishStats();
+
+protected:
+  /// @brief A queued message.
+  struct QueuedMessage {
+    SharedMessage Message;
+    std::int64_t TimestampNs;
+    /// @brief The recording the message belongs to.
+    std::uint64_t Recording;
+  };
+
+  /// @brief The writer thread; writes queued messages.
+  void ThreadFunction();
+
+  /// @brief The following are only called by the writer thread.
+  /// @{
+  bool WriteMessage(QueuedMessage const &Item);
+  bool OpenSegment(std::size_t MinimumSize);
+  void CloseSegment();
+  bool Append(const void *Data, std::size_t Size);
+  bool WriteStaging(bool Final);
+  void WriteIndex();
+  /// @}
+
+  void SetStatusMessage(std::string const &Message);
+
+  /// @brief Protects the settings below, the queue and the state variables.
+  mutable std::mutex RecorderMutex;
+  std::condition_variable QueueCondition;
+  std::deque<QueuedMessage> Queue;
+  std::thread WriterThread;
+  bool RunThread{true};
+
+  std::atomic<bool> Enabled{false};
+  std::atomic<bool> SkipKafka{false};
+  /// @brief Incremented when a recording is started.
+  std::uint64_t Recording{0};
+  std::string Directory{"."};
+  std::string FilePrefix{"capture"};
+  int SegmentSizeMB{1024};
+  bool DirectIO{false};
+  bool Preallocate{true};
+  int QueueSize{100};
+  std::string CurrentFile;
+  std::string StatusMessage{"Idle"};
+
+  /// @brief State of the current segment, only used by the writer thread.
+  /// @{
+  std::uint64_t SegmentRecording{0};
+  /// @brief Date and time the first segment of the recording was opened.
+  std::string SegmentRecordingName;
+  int SegmentNumber{0};
+  int FileDescriptor{-1};
+  std::string SegmentPath;
+  std::size_t SegmentSize{0};
+  std::size_t SegmentUsed{0};
+  unsigned char *MappedData{nullptr};
+  bool SegmentDirect{false};
+  unsigned char *Staging{nullptr};
+  std::size_t StagingUsed{0};
+  /// @brief The start of the staging buffer which is already on disk.
+  std::size_t StagingWritten{0};
+  std::size_t StagingFileOffset{0};
+  std::vector<IndexEntry> Index;
+  /// @}
+
+  std::atomic<std::uint64_t> MessagesWritten{0};
+  std::atomic<std::uint64_t> BytesWritten{0};
+  std::atomic<std::uint64_t> DroppedMessages{0};
+  std::atomic<std::uint64_t> WriteErrors{0};
+  std::atomic<epicsInt32> QueuedMessages{0};
+
+  std::chrono::steady_clock::time_point LastStatsTime{
+      std::chrono::steady_clock::now()};
+  std::uint64_t LastBytesWritten{0};
+  std::uint64_t LastMessagesWritten{0};
+  double ByteRateMB{0};
+  double MessageRate{0};
+
+  Parameter<epicsInt32> EnableParam{
+      "RECORD_ENABLE",
+      [&](epicsInt32 Value) { return SetEnabled(Value != 0); },
+      [&]() { return static_cast<epicsInt32>(GetEnabled()); }};
+  Parameter<epicsInt32> SkipKafkaParam{
+      "RECORD_SKIP_KAFKA",
+      [&](epicsInt32 Value) { return SetSkipKafka(Value != 0); },
+      [&]() { return static_cast<epicsInt32>(GetSkipKafka()); }};
+  Parameter<std::string> DirectoryParam{
+      "RECORD_DIRECTORY",
+      [&](std::string Value) { return SetDirectory(Value); },
+      [&]() { return GetDirectory(); }};
+  Parameter<std::string> FilePrefixParam{
+      "RECORD_FILE_PREFIX",
+      [&](std::string Value) { return SetFilePrefix(Value); },
+      [&]() { return GetFilePrefix(); }};
+  Parameter<epicsInt32> SegmentSizeParam{
+      "RECORD_SEGMENT_SIZE",
+      [&](epicsInt32 Value) { return SetSegmentSizeMB(Value); },
+      [&]() { return GetSegmentSizeMB(); }};
+  Parameter<epicsInt32> DirectIOParam{
+      "RECORD_DIRECT_IO",
+      [&](epicsInt32 Value) { return SetDirectIO(Value != 0); },
+      [&]() { return static_cast<epicsInt32>(GetDirectIO()); }};
+  Parameter<epicsInt32> PreallocateParam{
+      "RECORD_PREALLOCATE",
+      [&](epicsInt32 Value) { return SetPreallocate(Value != 0); },
+      [&]() { return static_cast<epicsInt32>(GetPreallocate()); }};
+  Parameter<epicsInt32> QueueSizeParam{
+      "RECORD_QUEUE_SIZE",
+      [&](epicsInt32 Value) { return SetQueueSize(Value); },
+      [&]() { return GetQueueSize(); }};
+  Parameter<std::string> CurrentFileParam{
+      "RECORD_CURRENT_FILE", [&](std::string) { return false; },
+      [&]() { return GetCurrentFile(); }};
+  Parameter<std::string> StatusParam{
+      "RECORD_STATUS", [&](std::string) { return false; },
+      [&]() { return GetStatusMessage(); }};
+  Parameter<double> ByteRateParam{"RECORD_BYTE_RATE",
+                                  [&](double) { return false; },
+                                  [&]() { return ByteRateMB; }};
+  Parameter<double> MessageRateParam{"RECORD_MESSAGE_RATE",
+                                     [&](double) { return false; },
+                                     [&]() { return MessageRate; }};
+  Parameter<double> BytesWrittenParam{
+      "RECORD_BYTES_WRITTEN", [&](double) { return false; },
+      [&]() { return BytesWritten.load() / 1e6; }};
+  Parameter<epicsInt32> MessagesWrittenParam{
+      "RECORD_MESSAGES_WRITTEN", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(MessagesWritten.load()); }};
+  Parameter<epicsInt32> DroppedParam{
+      "RECORD_DROPPED_MESSAGES", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(DroppedMessages.load()); }};
+  Parameter<epicsInt32> WriteErrorsParam{
+      "RECORD_WRITE_ERRORS", [&](epicsInt32) { return false; },
+      [&]() { return static_cast<epicsInt32>(WriteErrors.load()); }};
+  Parameter<epicsInt32> QueuedParam{
+      "RECORD_QUEUED_MESSAGES", [&](epicsInt32) { return false; },
+      [&]() { return QueuedMessages.load(); }};
+};
+} // namespace KafkaInterface
@@ -0,0 +1,521 @@
+/** Copyright (C) 2020 European Spallation Source */
+
+/** @file  NDArrayPreprocessor.cpp
+ *  @brief Implementation of the ROI, binning and decimation stage of the Kafka
+ * plugin.
+ */
+
+#include "NDArrayPreprocessor.h"
+#include <algorithm>
+#include <ciso646>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+/// @brief Wide type used when summing pixels so that a bin can not overflow.
+template <typename T>
+using Accumulator = typename std::conditional<
+    std::is_floating_point<T>::value, double,
+    typename std::conditional<std::is_signed<T>::value, std::int64_t,
+                              std::uint64_t>::type>::type;
+
+/// @brief Converts an accumulated value back to the pixel type, saturating at
+/// the limits of the pixel type.
+template <typename T, typename AccType> T Saturate(AccType Value) {
+  // The maximum of a 64-bit integer is rounded up (to 2^63 or 2^64) when
+  // converted to double, so the converted maximum itself is out of range
+  constexpr bool RoundedMax = std::is_integral<T>::value and
+                              std::is_floating_point<AccType>::value;
+  auto Max = static_cast<AccType>(std::numeric_limits<T>::max());
+  if (Value > Max or (RoundedMax and Value >= Max)) {
+    return std::numeric_limits<T>::max();
+  }
+  if (Value < static_cast<AccType>(std::numeric_limits<T>::lowest())) {
+    return std::numeric_limits<T>::lowest();
+  }
+  return static_cast<T>(Value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, T>::type
+Mean(Accumulator<T> Value, double Divisor) {
+  return Saturate<T, double>(std::round(static_cast<double>(Value) / Divisor));
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, T>::type
+Mean(Accumulator<T> Value, double Divisor) {
+  return Saturate<T, double>(Value / Divisor);
+}
+
+/// @brief Adds to an accumulator.
+template <typename T>
+typename std::enable_if<not(std::is_integral<T>::value and
+                            sizeof(T) == sizeof(Accumulator<T>))>::type
+Accumulate(Accumulator<T> &Sum, Accumulator<T> Value) {
+  Sum += Value;
+}
+
+/// @brief Adds to an accumulator that is no wider than the (unsigned 64-bit)
+/// pixel type, saturating instead of wrapping around.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value and
+                        std::is_unsigned<T>::value and
+                        sizeof(T) == sizeof(Accumulator<T>)>::type
+Accumulate(Accumulator<T> &Sum, Accumulator<T> Value) {
+  using AccType = Accumulator<T>;
+  if (Value > std::numeric_limits<AccType>::max() - Sum) {
+    Sum = std::numeric_limits<AccType>::max();
+  } else {
+    Sum += Value;
+  }
+}
+
+/// @brief Adds to an accumulator that is no wider than the (signed 64-bit)
+/// pixel type, saturating instead of overflowing.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value and
+                        std::is_signed<T>::value and
+                        sizeof(T) == sizeof(Accumulator<T>)>::type
+Accumulate(Accumulator<T> &Sum, Accumulator<T> Value) {
+  using AccType = Accumulator<T>;
+  if (Value > 0 and Sum > std::numeric_limits<AccType>::max() - Value) {
+    Sum = std::numeric_limits<AccType>::max();
+  } else if (Value < 0 and
+             Sum < std::numeric_limits<AccType>::lowest() - Value) {
+    Sum = std::numeric_limits<AccType>::lowest();
+  } else {
+    Sum += Value;
+  }
+}
+
+/// @brief Where the pixels of one plane are found (in elements) in the input
+/// and written to in the output as well as the region and binning to apply.
+struct PlaneLayout {
+  size_t InXStride{1};
+  size_t InYStride{1};
+  size_t OutXStride{1};
+  size_t OutYStride{1};
+  size_t MinX{0};
+  size_t MinY{0};
+  size_t OutX{1};
+  size_t OutY{1};
+  size_t BinX{1};
+  size_t BinY{1};
+  bool UseMean{false};
+};
+
+/** @brief Crops and bins one plane of pixels.
+ * The pixels of one output row are summed into a row of wide accumulators.
+ * If the pixels of a row are contiguous (i.e. the array is not pixel
+ * interleaved colour), all inner loops run over contiguous memory without
+ * branches in order for the compiler to be able to vectorize them.
+ */
+template <typename T>
+void BinPlane(T const *Input, T *Output, PlaneLayout const &Layout,
+              Accumulator<T> *Row) {
+  using AccType = Accumulator<T>;
+  const size_t InXStride = Layout.InXStride;
+  const size_t OutXStride = Layout.OutXStride;
+  const size_t OutX = Layout.OutX;
+  const size_t BinX = Layout.BinX;
+  if (1 == BinX and 1 == Layout.BinY) {
+    for (size_t y = 0; y < Layout.OutY; ++y) {
+      T const *InRow = Input + (Layout.MinY + y) * Layout.InYStride +
+                       Layout.MinX * InXStride;
+      T *OutRow = Output + y * Layout.OutYStride;
+      if (1 == InXStride and 1 == OutXStride) {
+        std::memcpy(OutRow, InRow, OutX * sizeof(T));
+      } else {
+        for (size_t x = 0; x < OutX; ++x) {
+          OutRow[x * OutXStride] = InRow[x * InXStride];
+        }
+      }
+    }
+    return;
+  }
+  const double Divisor = static_cast<double>(BinX * Layout.BinY);
+  for (size_t y = 0; y < Layout.OutY; ++y) {
+    std::fill(Row, Row + OutX, AccType(0));
+    for (size_t by = 0; by < Layout.BinY; ++by) {
+      T const *InRow =
+          Input + (Layout.MinY + y * Layout.BinY + by) * Layout.InYStride +
+          Layout.MinX * InXStride;
+      if (1 == InXStride and 1 == BinX) {
+        for (size_t x = 0; x < OutX; ++x) {
+          Accumulate<T>(Row[x], InRow[x]);
+        }
+      } else if (1 == InXStride) {
+        for (size_t x = 0; x < OutX; ++x) {
+          T const *Bin = InRow + x * BinX;
+          AccType Sum{0};
+          for (size_t bx = 0; bx < BinX; ++bx) {
+            Accumulate<T>(Sum, Bin[bx]);
+          }
+          Accumulate<T>(Row[x], Sum);
+        }
+      } else {
+        for (size_t x = 0; x < OutX; ++x) {
+          T const *Bin = InRow + x * BinX * InXStride;
+          AccType Sum{0};
+          for (size_t bx = 0; bx < BinX; ++bx) {
+            Accumulate<T>(Sum, Bin[bx * InXStride]);
+          }
+          Accumulate<T>(Row[x], Sum);
+        }
+      }
+    }
+    T *OutRow = Output + y * Layout.OutYStride;
+    if (Layout.UseMean) {
+      for (size_t x = 0; x < OutX; ++x) {
+        OutRow[x * OutXStride] = Mean<T>(Row[x], Divisor);
+      }
+    } else {
+      for (size_t x = 0; x < OutX; ++x) {
+        OutRow[x * OutXStride] = Saturate<T>(Row[x]);
+      }
+    }
+  }
+}
+
+template <typename T>
+void BinPlanes(void const *Input, void *Output, PlaneLayout const &Layout,
+               std::vector<std::pair<size_t, size_t>> const &PlaneOffsets,
+               std::vector<std::uint8_t> &Buffer) {
+  Buffer.resize(Layout.OutX * sizeof(Accumulator<T>));
+  auto Row = reinterpret_cast<Accumulator<T> *>(Buffer.data());
+  auto InPtr = reinterpret_cast<T const *>(Input);
+  auto OutPtr = reinterpret_cast<T *>(Output);
+  for (auto const &Offsets : PlaneOffsets) {
+    BinPlane<T>(InPtr + Offsets.first, OutPtr + Offsets.second, Layout, Row);
+  }
+}
+
+} // namespace
+
+bool NDArrayPreprocessor::acceptArray(
+    std::chrono::steady_clock::time_point Now) {
+  auto CurrentArray = ArrayCounter++;
+  if (DecimationFactor > 1 and 0 != CurrentArray % DecimationFactor) {
+    SkippedArrays++;
+    return false;
+  }
+  if (MaxRate > 0.0 and HasSentArray) {
+    auto MinPeriod = std::chrono::duration<double>(1.0 / MaxRate);
+    if (Now - LastSentTime < MinPeriod) {
+      SkippedArrays++;
+      return false;
+    }
+  }
+  HasSentArray = true;
+  LastSentTime = Now;
+  return true;
+}
+
+bool NDArrayPreprocessor::isTransformEnabled() const {
+  return RoiEnabled or BinX > 1 or BinY > 1;
+}
+
+bool NDArrayPreprocessor::isDecimationEnabled() const {
+  return DecimationFactor > 1 or MaxRate > 0.0;
+}
+
+NDArrayPreprocessor::Geometry
+NDArrayPreprocessor::calculateGeometry(NDArray const &Array) const {
+  Geometry Used;
+  if (Array.ndims > 1) {
+    Used.YDim = 1;
+  }
+  // Select the X and Y dimensions of colour arrays the way NDPluginROI does
+  if (3 == Array.ndims) {
+    int ColorMode{NDColorModeMono};
+    NDAttribute *ColorAttr = Array.pAttributeList->find("ColorMode");
+    if (nullptr != ColorAttr) {
+      ColorAttr->getValue(NDAttrInt32, &ColorMode);
+    }
+    if (NDColorModeRGB1 == ColorMode) {
+      Used.XDim = 1;
+      Used.YDim = 2;
+    } else if (NDColorModeRGB2 == ColorMode) {
+      Used.XDim = 0;
+      Used.YDim = 2;
+    }
+  }
+  Used.SizeX = Array.dims[Used.XDim].size;
+  if (Used.YDim >= 0) {
+    Used.SizeY = Array.dims[Used.YDim].size;
+  }
+  size_t WidthX = Used.SizeX;
+  size_t WidthY = Used.SizeY;
+  if (RoiEnabled) {
+    Used.MinX = std::min<size_t>(RoiMinX, Used.SizeX - 1);
+    WidthX = Used.SizeX - Used.MinX;
+    if (RoiSizeX > 0) {
+      WidthX = std::min<size_t>(RoiSizeX, WidthX);
+    }
+    if (Used.YDim >= 0) {
+      Used.MinY = std::min<size_t>(RoiMinY, Used.SizeY - 1);
+      WidthY = Used.SizeY - Used.MinY;
+      if (RoiSizeY > 0) {
+        WidthY = std::min<size_t>(RoiSizeY, WidthY);
+      }
+    }
+  }
+  Used.BinX = std::min<size_t>(BinX, WidthX);
+  Used.BinY = Used.YDim >= 0 ? std::min<size_t>(BinY, WidthY) : 1;
+  Used.OutX = WidthX / Used.BinX;
+  Used.OutY = WidthY / Used.BinY;
+  return Used;
+}
+
+NDArray *NDArrayPreprocessor::process(NDArray *pArray, NDArrayPool *Pool) {
+  TransformAttributes.clear();
+  if (isDecimationEnabled()) {
+    epicsInt32 UsedFactor = DecimationFactor;
+    TransformAttributes.add("KafkaDecimation",
+                            "Only every Nth array is sent to Kafka",
+                            NDAttrInt32, &UsedFactor);
+    epicsFloat64 UsedRate = MaxRate;
+    TransformAttributes.add("KafkaMaxRate",
+                            "Max. rate (Hz) of arrays sent to Kafka",
+                            NDAttrFloat64, &UsedRate);
+  }
+  if (not isTransformEnabled() or pArray->ndims < 1) {
+    return pArray;
+  }
+  NDArrayInfo_t ArrayInfo;
+  pArray->getInfo(&ArrayInfo);
+  if (0 == ArrayInfo.nElements) {
+    return pArray;
+  }
+  auto Used = calculateGeometry(*pArray);
+
+  size_t OutDims[ND_ARRAY_MAX_DIMS];
+  for (int i = 0; i < pArray->ndims; ++i) {
+    OutDims[i] = pArray->dims[i].size;
+  }
+  OutDims[Used.XDim] = Used.OutX;
+  if (Used.YDim >= 0) {
+    OutDims[Used.YDim] = Used.OutY;
+  }
+  NDArray *pOutput =
+      Pool->alloc(pArray->ndims, OutDims, pArray->dataType, 0, nullptr);
+  if (nullptr == pOutput) {
+    return nullptr;
+  }
+  pOutput->uniqueId = pArray->uniqueId;
+  pOutput->timeStamp = pArray->timeStamp;
+  pOutput->epicsTS = pArray->epicsTS;
+  pArray->pAttributeList->copy(pOutput->pAttributeList);
+
+  // Keep track of the transform in the dimension meta data as NDPluginROI does
+  pOutput->dims[Used.XDim].offset = pArray->dims[Used.XDim].offset + Used.MinX;
+  pOutput->dims[Used.XDim].binning =
+      pArray->dims[Used.XDim].binning * Used.BinX;
+  if (Used.YDim >= 0) {
+    pOutput->dims[Used.YDim].offset =
+        pArray->dims[Used.YDim].offset + Used.MinY;
+    pOutput->dims[Used.YDim].binning =
+        pArray->dims[Used.YDim].binning * Used.BinY;
+  }
+
+  size_t InStride[ND_ARRAY_MAX_DIMS] = {};
+  size_t OutStride[ND_ARRAY_MAX_DIMS] = {};
+  size_t InSize{1};
+  size_t OutSize{1};
+  for (int i = 0; i < pArray->ndims; ++i) {
+    InStride[i] = InSize;
+    OutStride[i] = OutSize;
+    InSize *= pArray->dims[i].size;
+    OutSize *= OutDims[i];
+  }
+  PlaneLayout Layout;
+  Layout.InXStride = InStride[Used.XDim];
+  Layout.OutXStride = OutStride[Used.XDim];
+  if (Used.YDim >= 0) {
+    Layout.InYStride = InStride[Used.YDim];
+    Layout.OutYStride = OutStride[Used.YDim];
+  }
+  Layout.MinX = Used.MinX;
+  Layout.MinY = Used.MinY;
+  Layout.OutX = Used.OutX;
+  Layout.OutY = Used.OutY;
+  Layout.BinX = Used.BinX;
+  Layout.BinY = Used.BinY;
+  Layout.UseMean = BinMode::MEAN == Mode;
+
+  // Every other dimension (e.g. colour) is a stack of independent planes
+  PlaneOffsets.assign(1, std::make_pair(size_t(0), size_t(0)));
+  for (int i = 0; i < pArray->ndims; ++i) {
+    if (i == Used.XDim or i == Used.YDim) {
+      continue;
+    }
+    auto Planes = PlaneOffsets.size();
+    for (size_t j = 1; j < pArray->dims[i].size; ++j) {
+      for (size_t k = 0; k < Planes; ++k) {
+        auto Offsets = PlaneOffsets[k];
+        PlaneOffsets.emplace_back(Offsets.first + j * InStride[i],
+                                  Offsets.second + j * OutStride[i]);
+      }
+    }
+  }
+
+  switch (pArray->dataType) {
+  case NDInt8:
+    BinPlanes<std::int8_t>(pArray->pData, pOutput->pData, Layout,
+                           PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDUInt8:
+    BinPlanes<std::uint8_t>(pArray->pData, pOutput->pData, Layout,
+                            PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDInt16:
+    BinPlanes<std::int16_t>(pArray->pData, pOutput->pData, Layout,
+                            PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDUInt16:
+    BinPlanes<std::uint16_t>(pArray->pData, pOutput->pData, Layout,
+                             PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDInt32:
+    BinPlanes<std::int32_t>(pArray->pData, pOutput->pData, Layout,
+                            PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDUInt32:
+    BinPlanes<std::uint32_t>(pArray->pData, pOutput->pData, Layout,
+                             PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDInt64:
+    BinPlanes<std::int64_t>(pArray->pData, pOutput->pData, Layout,
+                            PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDUInt64:
+    BinPlanes<std::uint64_t>(pArray->pData, pOutput->pData, Layout,
+                             PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDFloat32:
+    BinPlanes<float>(pArray->pData, pOutput->pData, Layout,
+                     PlaneOffsets, AccumulatorBuffer);
+    break;
+  case NDFloat64:
+    BinPlanes<double>(pArray->pData, pOutput->pData, Layout,
+                      PlaneOffsets, AccumulatorBuffer);
+    break;
+  default:
+    pOutput->release();
+    return nullptr;
+  }
+  addAttributes(Used);
+  return pOutput;
+}
+
+void NDArrayPreprocessor::addAttributes(Geometry const &Used) {
+  auto AddValue = [&](const char *Name, const char *Description,
+                      size_t Value) {
+    epicsInt32 TempValue = static_cast<epicsInt32>(Value);
+    TransformAttributes.add(Name, Description, NDAttrInt32, &TempValue);
+  };
+  AddValue("KafkaROIMinX", "ROI start (X) applied before sending", Used.MinX);
+  AddValue("KafkaROIMinY", "ROI start (Y) applied before sending", Used.MinY);
+  AddValue("KafkaROISizeX", "ROI size (X) applied before sending",
+           Used.OutX * Used.BinX);
+  AddValue("KafkaROISizeY", "ROI size (Y) applied before sending",
+           Used.OutY * Used.BinY);
+  AddValue("KafkaBinX", "Binning (X) applied before sending", Used.BinX);
+  AddValue("KafkaBinY", "Binning (Y) applied before sending", Used.BinY);
+  char ModeName[] = "Sum";
+  char MeanName[] = "Mean";
+  TransformAttributes.add("KafkaBinMode", "Binning mode",
+                          NDAttrString,
+                          BinMode::MEAN == Mode ? MeanName : ModeName);
+}
+
+NDAttributeList *NDArrayPreprocessor::getTransformAttributes() {
+  if (0 == TransformAttributes.count()) {
+    return nullptr;
+  }
+  return &TransformAttributes;
+}
+
+bool NDArrayPreprocessor::setRoiEnabled(bool Enable) {
+  RoiEnabled = Enable;
+  return true;
+}
+
+bool NDArrayPreprocessor::setRoiMinX(int Value) {
+  if (Value < 0) {
+    return false;
+  }
+  RoiMinX = Value;
+  return true;
+}
+
+bool NDArrayPreprocessor::setRoiMinY(int Value) {
+  if (Value < 0) {
+    return false;
+  }
+  RoiMinY = Value;
+  return true;
+}
+
+bool NDArrayPreprocessor::setRoiSizeX(int Value) {
+  if (Value < 0) {
+    return false;
+  }
+  RoiSizeX = Value;
+  return true;
+}
+
+bool NDArrayPreprocessor::setRoiSizeY(int Value) {
+  if (Value < 0) {
+    return false;
+  }
+  RoiSizeY = Value;
+  return true;
+}
+
+bool NDArrayPreprocessor::setBinX(int Value) {
+  if (Value < 1) {
+    return false;
+  }
+  BinX = Value;
+  return true;
+}
+
+bool NDArrayPreprocessor::setBinY(int Value) {
+  if (Value < 1) {
+    return false;
+  }
+  BinY = Value;
+  return true;
+}
+
+bool NDArrayPreprocessor::setBinMode(int NewMode) {
+  if (NewMode != static_cast<int>(BinMode::SUM) and
+      NewMode != static_cast<int>(BinMode::MEAN)) {
+    return false;
+  }
+  Mode = static_cast<BinMode>(NewMode);
+  return true;
+}
+
+bool NDArrayPreprocessor::setDecimationFactor(int Factor) {
+  if (Factor < 1) {
+    return false;
+  }
+  DecimationFactor = Factor;
+  ArrayCounter = 0;
+  return true;
+}
+
+bool NDArrayPreprocessor::setMaxRate(double Rate) {
+  if (Rate < 0.0 or not std::isfinite(Rate)) {
+    return false;
+  }
+  MaxRate = Rate;
+  return true;
+}
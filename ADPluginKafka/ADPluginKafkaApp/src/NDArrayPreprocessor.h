@@ -0,0 +1,151 @@
+/** Copyright (C) 2020 European Spallation Source */
+
+/** @file  NDArrayPreprocessor.h
+ *  @brief Optional ROI, binning and decimation stage applied before an NDArray
+ * is serialized.
+ */
+
+#pragma once
+
+#include <NDArray.h>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/** @brief Reduces the amount of data sent to Kafka by cropping, binning and
+ * decimating NDArrays before they are serialized.
+ * The first dimension of an NDArray is treated as X and the second (if
+ * present) as Y. For RGB1 and RGB2 arrays (according to the "ColorMode"
+ * attribute), X and Y are selected as NDPluginROI does instead. Any further
+ * dimensions (including the colour one) are treated as a stack of planes, each
+ * of which is transformed in the same way. If neither the ROI nor binning is
+ * enabled, the input array is passed through untouched and no copy is made.
+ *
+ * The class is not thread safe. The configuration is expected to be changed
+ * and the arrays processed while holding the asyn port lock of the plugin.
+ */
+class NDArrayPreprocessor {
+public:
+  /// @brief How the pixels within a bin are combined.
+  enum class BinMode {
+    SUM = 0,  ///< Saturating sum of all pixels in the bin.
+    MEAN = 1, ///< Mean value of all pixels in the bin.
+  };
+
+  NDArrayPreprocessor() = default;
+
+  /** @brief Decides if the current array should be sent or dropped by the
+   * decimation stage.
+   * Must be called exactly once per incoming array as it increments the
+   * internal frame counter.
+   * @param[in] Now The time at which the array was received.
+   * @return True if the array should be sent, false if it should be skipped.
+   */
+  bool acceptArray(std::chrono::steady_clock::time_point Now);
+
+  /** @brief Applies the ROI and binning stage to an array.
+   * Also updates the list of attributes describing the applied transform, see
+   * NDArrayPreprocessor::getTransformAttributes().
+   * @param[in] pArray The input array. Not modified.
+   * @param[in] Pool The pool from which a new array is allocated if a
+   * transform is applied.
+   * @return pArray if no transform is enabled, a new array (which the caller
+   * must release) if a transform was applied or nullptr if no array could be
+   * allocated from the pool.
+   */
+  NDArray *process(NDArray *pArray, NDArrayPool *Pool);
+
+  /** @brief Attributes describing the transform applied to the latest array
+   * given to NDArrayPreprocessor::process().
+   * These are added to the serialized message instead of to the NDArray in
+   * order to not modify arrays shared with other plugins.
+   * @return nullptr if no transform or decimation is enabled.
+   */
+  NDAttributeList *getTransformAttributes();
+
+  /// @brief Returns true if processing will produce a new array.
+  bool isTransformEnabled() const;
+
+  /// @brief Returns true if some arrays will be skipped.
+  bool isDecimationEnabled() const;
+
+  bool setRoiEnabled(bool Enable);
+  bool getRoiEnabled() const { return RoiEnabled; }
+  bool setRoiMinX(int Value);
+  int getRoiMinX() const { return RoiMinX; }
+  bool setRoiMinY(int Value);
+  int getRoiMinY() const { return RoiMinY; }
+  /// @brief A size of 0 means "to the end of the dimension".
+  bool setRoiSizeX(int Value);
+  int getRoiSizeX() const { return RoiSizeX; }
+  /// @brief A size of 0 means "to the end of the dimension".
+  bool setRoiSizeY(int Value);
+  int getRoiSizeY() const { return RoiSizeY; }
+
+  bool setBinX(int Value);
+  int getBinX() const { return BinX; }
+  bool setBinY(int Value);
+  int getBinY() const { return BinY; }
+  bool setBinMode(int NewMode);
+  int getBinMode() const { return static_cast<int>(Mode); }
+
+  /** @brief Only send every Nth array.
+   * @param[in] Factor Value of N, must be >= 1. A value of 1 disables
+   * decimation by count.
+   */
+  bool setDecimationFactor(int Factor);
+  int getDecimationFactor() const { return DecimationFactor; }
+
+  /** @brief Limit the rate at which arrays are sent.
+   * @param[in] Rate Maximum rate in Hz. A value of 0 disables the limit.
+   */
+  bool setMaxRate(double Rate);
+  double getMaxRate() const { return MaxRate; }
+
+  /// @brief Number of arrays that have been skipped by the decimation stage.
+  std::int64_t getSkippedArrays() const { return SkippedArrays; }
+
+private:
+  /// @brief The region (in input pixels) and binning used for one array.
+  struct Geometry {
+    int XDim{0};
+    int YDim{-1}; ///< -1 if the array has only one dimension.
+    size_t SizeX{1};
+    size_t SizeY{1};
+    size_t MinX{0};
+    size_t MinY{0};
+    size_t BinX{1};
+    size_t BinY{1};
+    size_t OutX{1};
+    size_t OutY{1};
+  };
+
+  Geometry calculateGeometry(NDArray const &Array) const;
+  void addAttributes(Geometry const &Used);
+
+  bool RoiEnabled{false};
+  int RoiMinX{0};
+  int RoiMinY{0};
+  int RoiSizeX{0};
+  int RoiSizeY{0};
+  int BinX{1};
+  int BinY{1};
+  BinMode Mode{BinMode::SUM};
+  int DecimationFactor{1};
+  double MaxRate{0.0};
+
+  std::int64_t ArrayCounter{0};
+  std::int64_t SkippedArrays{0};
+  bool HasSentArray{false};
+  std::chrono::steady_clock::time_point LastSentTime;
+
+  NDAttributeList TransformAttributes;
+
+  /// @brief Re-used scratch memory for the per-row bin accumulators.
+  std::vector<std::uint8_t> AccumulatorBuffer;
+
+  /// @brief Re-used offsets (in elements) of each plane in the input and
+  /// output array.
+  std::vector<std::pair<size_t, size_t>> PlaneOffsets;
+};
@@ -7,6 +7,7 @@
 
 #include "NDArraySerializer.h"
 #include "TimeUtility.h"
+#include <algorithm>
 #include <cassert>
 #include <ciso646>
 #include <cstdint>
@@ -29,69 +30,116 @@ std::string NDArraySerializer::getSourceName() { return SourceName; }
 
 void NDArraySerializer::SerializeData(NDArray &pArray,
                                       unsigned char *&bufferPtr,
-                                      size_t &bufferSize) {
+                                      size_t &bufferSize,
+                                      NDAttributeList *ExtraAttributes) {
+  // Required to not have a memory leak
+  builder.Clear();
+
+  BuildMessage(builder, pArray, ExtraAttributes);
+
+  bufferPtr = builder.GetBufferPointer();
+  bufferSize = builder.GetSize();
+}
+
+std::shared_ptr<flatbuffers::DetachedBuffer>
+NDArraySerializer::SerializeDataShared(NDArray &pArray,
+                                       NDAttributeList *ExtraAttributes) {
   NDArrayInfo ndInfo{};
   pArray.getInfo(&ndInfo);
 
-  // Required to not have a memory leak
-  builder.Clear();
+  // Allocate (close to) the final size up front as growing the buffer of the
+  // builder would copy the payload
+  flatbuffers::FlatBufferBuilder SharedBuilder(ndInfo.totalBytes +
+                                               MessageOverhead);
+  BuildMessage(SharedBuilder, pArray, ExtraAttributes);
+  MessageOverhead =
+      std::max(MessageOverhead, SharedBuilder.GetSize() - ndInfo.totalBytes);
+  return std::make_shared<flatbuffers::DetachedBuffer>(SharedBuilder.Release());
+}
 
-  auto SourceNamePtr = builder.CreateString(SourceName);
+void NDArraySerializer::BuildMessage(flatbuffers::FlatBufferBuilder &Builder,
+                                     NDArray &pArray,
+                                     NDAttributeList *ExtraAttributes) {
+  NDArrayInfo ndInfo{};
+  pArray.getInfo(&ndInfo);
+
+  auto SourceNamePtr = Builder.CreateString(SourceName);
 
   std::vector<std::uint64_t> tempDims;
   for (size_t y = 0; y < pArray.ndims; y++) {
     tempDims.push_back(pArray.dims[y].size);
   }
-  auto dims = builder.CreateVector(tempDims);
+  auto dims = Builder.CreateVector(tempDims);
   auto dType = GetFB_DType(pArray.dataType);
 
   std::uint8_t *tempPtr;
   auto payload =
-      builder.CreateUninitializedVector(ndInfo.totalBytes, 1, &tempPtr);
+      Builder.CreateUninitializedVector(ndInfo.totalBytes, 1, &tempPtr);
   std::memcpy(tempPtr, pArray.pData, ndInfo.totalBytes);
 
   // Get all attributes of this data package
   std::vector<flatbuffers::Offset<Attribute>> attrVec;
 
-  // When passing NULL, get first element
-  NDAttribute *attr_ptr = pArray.pAttributeList->next(nullptr);
-
-  // Itterate over attributes, next(ptr) returns NULL when there are no more
-  while (attr_ptr != nullptr) {
-    auto temp_attr_str = builder.CreateString(attr_ptr->getName());
-    auto temp_attr_desc = builder.CreateString(attr_ptr->getDescription());
-    auto temp_attr_src = builder.CreateString(attr_ptr->getSource());
-    size_t bytes;
-    NDAttrDataType_t c_type;
-    attr_ptr->getValueInfo(&c_type, &bytes);
-    auto attrDType = GetFB_DType(c_type);
-
-    std::unique_ptr<char[]> attrValueBuffer(new char[bytes]);
-    int attrValueRes = attr_ptr->getValue(
-        c_type, reinterpret_cast<void *>(attrValueBuffer.get()), bytes);
-    if (ND_SUCCESS == attrValueRes) {
-      auto attrValuePayload = builder.CreateVector(
-          reinterpret_cast<unsigned char *>(attrValueBuffer.get()), bytes);
-
-      auto attr = CreateAttribute(builder, temp_attr_str, temp_attr_desc,
-                                  temp_attr_src, attrDType, attrValuePayload);
-      attrVec.push_back(attr);
-    } else {
-      assert(false);
-    }
+  auto AddAttributes = [&](NDAttributeList *AttrList) {
+    // When passing NULL, get first element
+    NDAttribute *attr_ptr = AttrList->next(nullptr);
+
+    // Itterate over attributes, next(ptr) returns NULL when there are no more
+    while (attr_ptr != nullptr) {
+      auto temp_attr_str = Builder.CreateString(attr_ptr->getName());
+      auto temp_attr_desc = Builder.CreateString(attr_ptr->getDescription());
+      auto temp_attr_src = Builder.CreateString(attr_ptr->getSource());
+      size_t bytes;
+      NDAttrDataType_t c_type;
+      attr_ptr->getValueInfo(&c_type, &bytes);
+      auto attrDType = GetFB_DType(c_type);
 
-    attr_ptr = pArray.pAttributeList->next(attr_ptr);
+      std::unique_ptr<char[]> attrValueBuffer(new char[bytes]);
+      int attrValueRes = attr_ptr->getValue(
+          c_type, reinterpret_cast<void *>(attrValueBuffer.get()), bytes);
+      if (ND_SUCCESS == attrValueRes) {
+        auto attrValuePayload = Builder.CreateVector(
+            reinterpret_cast<unsigned char *>(attrValueBuffer.get()), bytes);
+
+        auto attr = CreateAttribute(Builder, temp_attr_str, temp_attr_desc,
+                                    temp_attr_src, attrDType, attrValuePayload);
+        attrVec.push_back(attr);
+      } else {
+        assert(false);
+      }
+
+      attr_ptr = AttrList->next(attr_ptr);
+    }
+  };
+  AddAttributes(pArray.pAttributeList);
+  if (nullptr != ExtraAttributes) {
+    AddAttributes(ExtraAttributes);
   }
-  auto attributes = builder.CreateVector(attrVec);
+  auto attributes = Builder.CreateVector(attrVec);
   auto Timestamp = epicsTimeToNsec(pArray.epicsTS);
-  auto kf_pkg = CreateADArray(builder, SourceNamePtr, pArray.uniqueId,
+  auto kf_pkg = CreateADArray(Builder, SourceNamePtr, pArray.uniqueId,
                               Timestamp, dims, dType, payload, attributes);
 
   // Write data to buffer
-  builder.Finish(kf_pkg, ADArrayIdentifier());
+  Builder.Finish(kf_pkg, ADArrayIdentifier());
+}
 
-  bufferPtr = builder.GetBufferPointer();
-  bufferSize = builder.GetSize();
+KafkaInterface::FrameHeaders
+NDArraySerializer::CreateFrameHeaders(NDArray &pArray) {
+  NDArrayInfo ndInfo{};
+  pArray.getInfo(&ndInfo);
+  KafkaInterface::FrameHeaders Frame;
+  Frame.SourceName = SourceName;
+  Frame.UniqueId = pArray.uniqueId;
+  Frame.TimestampNs =
+      static_cast<std::int64_t>(epicsTimeToNsec(pArray.epicsTS));
+  Frame.DataType = static_cast<std::int8_t>(GetFB_DType(pArray.dataType));
+  for (int i = 0; i < pArray.ndims; ++i) {
+    Frame.Dims.push_back(pArray.dims[i].size);
+  }
+  Frame.DataSize = ndInfo.totalBytes;
+  Frame.SchemaId = ADArrayIdentifier();
+  return Frame;
 }
 
 DType NDArraySerializer::GetFB_DType(NDDataType_t arrType) {
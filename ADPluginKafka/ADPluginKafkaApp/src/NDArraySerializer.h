@@ -6,8 +6,10 @@
 #pragma once
 
 #include "ADArray_schema_generated.h"
+#include "FrameHeaders.h"
 #include <NDArray.h>
 #include <flatbuffers/flatbuffers.h>
+#include <memory>
 
 /** @brief Class which is used to serialize NDArray data using flatbuffers.
  * The C++ flatbuffers implementatione has an internal buffer for storing the
@@ -40,9 +42,32 @@ public:
    * pointer is only
    * valid until the member function is called again.
    * @param[out] bufferSize Size of serialized data in bytes.
+   * @param[in] ExtraAttributes Optional attributes which are added to the
+   * message after the attributes of the NDArray.
    */
   void SerializeData(NDArray &pArray, unsigned char *&bufferPtr,
-                     size_t &bufferSize);
+                     size_t &bufferSize,
+                     NDAttributeList *ExtraAttributes = nullptr);
+
+  /** @brief Serializes data held in the input NDArray into a new buffer.
+   * Unlike NDArraySerializer::SerializeData(NDArray&, unsigned char*&,
+   * size_t&, NDAttributeList*), the returned buffer stays valid for as long as
+   * a reference to it is held. It can thus be handed to several Kafka
+   * producers without being copied.
+   * @param[in] pArray The data to be serialized.
+   * @param[in] ExtraAttributes Optional attributes which are added to the
+   * message after the attributes of the NDArray.
+   * @return The serialized message.
+   */
+  std::shared_ptr<flatbuffers::DetachedBuffer>
+  SerializeDataShared(NDArray &pArray,
+                      NDAttributeList *ExtraAttributes = nullptr);
+
+  /** @brief Returns the metadata of a serialized NDArray, to be sent as Kafka
+   * message headers.
+   * @param[in] pArray The NDArray as passed to the serialisation functions.
+   */
+  KafkaInterface::FrameHeaders CreateFrameHeaders(NDArray &pArray);
 
   bool setSourceName(std::string NewSourceName);
   std::string getSourceName();
@@ -90,8 +115,16 @@ protected:
   static NDAttrDataType_t GetND_AttrDType(DType attrType);
 
 private:
+  /// @brief Adds all the parts of an ADArray message to a builder.
+  void BuildMessage(flatbuffers::FlatBufferBuilder &Builder, NDArray &pArray,
+                    NDAttributeList *ExtraAttributes);
+
   std::string SourceName;
 
+  /// @brief Largest seen size of a message minus its payload, used to size
+  /// the buffer of NDArraySerializer::SerializeDataShared().
+  size_t MessageOverhead{4096};
+
   /// @brief The flatbuffer builder which serializes the data.
   flatbuffers::FlatBufferBuilder builder;
 };
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <string>
 
@@ -17,11 +18,21 @@ public:
   virtual ~ParameterBase() = default;
   void registerRegistrar(ParameterHandler *Registrar);
   std::string const& getParameterName() const { return ParameterName; }
+  /** @brief Requests that the value of the parameter is written to the
+   * parameter library.
+   * Never blocks and may be called from any thread, including librdkafka
+   * callback threads. See ParameterHandler::updateDbValue().
+   */
   virtual void updateDbValue();
 
 private:
+  friend class ParameterHandler;
   ParameterHandler *HandlerPtr{nullptr};
   std::string ParameterName;
+  /// @brief Set while the parameter is queued for a parameter library update.
+  std::atomic<bool> UpdatePending{false};
+  /// @brief Next parameter in the update queue of the ParameterHandler.
+  ParameterBase *NextPending{nullptr};
 };
 
 template <class ParamType> class Parameter : public ParameterBase {
@@ -14,11 +14,14 @@
 ParameterHandler::ParameterHandler(asynPortDriver *DriverPtr)
     : Driver(DriverPtr) {}
 
+ParameterHandler::~ParameterHandler() { stopUpdateThread(); }
+
 void ParameterHandler::registerParameter(ParameterBase *Param) {
   std::map<std::size_t, asynParamType> TypeMap{
       {typeid(Parameter<std::string>).hash_code(), asynParamOctet},
       {typeid(Parameter<epicsInt64>).hash_code(), asynParamInt64},
       {typeid(Parameter<epicsInt32>).hash_code(), asynParamInt32},
+      {typeid(Parameter<double>).hash_code(), asynParamFloat64},
   };
   asynParamType ParameterType{TypeMap.at(typeid(*Param).hash_code())};
   int ParameterIndex;
@@ -29,6 +32,88 @@ void ParameterHandler::registerParameter(ParameterBase *Param) {
 }
 
 void ParameterHandler::updateDbValue(ParameterBase *ParamPtr) {
+  if (ParamPtr == nullptr or
+      ParamPtr->UpdatePending.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  auto Head = UpdateQueueHead.load(std::memory_order_relaxed);
+  do {
+    ParamPtr->NextPending = Head;
+  } while (not UpdateQueueHead.compare_exchange_weak(
+      Head, ParamPtr, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool ParameterHandler::processQueuedUpdates() {
+  auto Head = UpdateQueueHead.exchange(nullptr, std::memory_order_acquire);
+  if (Head == nullptr) {
+    return false;
+  }
+  // The queue is a stack, reverse it to apply the updates in order.
+  ParameterBase *Ordered{nullptr};
+  while (Head != nullptr) {
+    auto Next = Head->NextPending;
+    Head->NextPending = Ordered;
+    Ordered = Head;
+    Head = Next;
+  }
+  while (Ordered != nullptr) {
+    auto Current = Ordered;
+    Ordered = Current->NextPending;
+    Current->NextPending = nullptr;
+    // Cleared before the value is read so that a new value set while
+    // writing is queued again instead of being lost.
+    Current->UpdatePending.store(false, std::memory_order_release);
+    writeDbValue(Current);
+  }
+  if (Driver != nullptr) {
+    Driver->callParamCallbacks();
+  }
+  return true;
+}
+
+void ParameterHandler::startUpdateThread(std::chrono::milliseconds Period) {
+  if (RunUpdateThread.exchange(true)) {
+    return;
+  }
+  UpdateThread =
+      std::thread(&ParameterHandler::updateThreadFunction, this, Period);
+}
+
+void ParameterHandler::setPeriodicTask(std::function<void()> Task,
+                                       std::chrono::milliseconds Period) {
+  PeriodicTask = std::move(Task);
+  PeriodicTaskPeriod = Period;
+}
+
+void ParameterHandler::stopUpdateThread() {
+  RunUpdateThread = false;
+  if (UpdateThread.joinable()) {
+    UpdateThread.join();
+  }
+}
+
+void ParameterHandler::updateThreadFunction(std::chrono::milliseconds Period) {
+  auto NextTaskTime = std::chrono::steady_clock::now() + PeriodicTaskPeriod;
+  while (RunUpdateThread) {
+    std::this_thread::sleep_for(Period);
+    auto Now = std::chrono::steady_clock::now();
+    bool RunTask = PeriodicTask and Now >= NextTaskTime;
+    if (Driver == nullptr or
+        (not RunTask and
+         UpdateQueueHead.load(std::memory_order_relaxed) == nullptr)) {
+      continue;
+    }
+    Driver->lock();
+    if (RunTask) {
+      NextTaskTime = std::max(NextTaskTime + PeriodicTaskPeriod, Now);
+      PeriodicTask();
+    }
+    processQueuedUpdates();
+    Driver->unlock();
+  }
+}
+
+void ParameterHandler::writeDbValue(ParameterBase *ParamPtr) {
   if (Driver == nullptr) {
     return;
   }
@@ -60,7 +145,12 @@ void ParameterHandler::updateDbValue(ParameterBase *ParamPtr) {
              UsedIndex,
              dynamic_cast<Parameter<epicsInt32> *>(ParamPtr)->readValue());
        }},
+       {typeid(Parameter<double>).hash_code(),
+       [&]() {
+         Driver->setDoubleParam(
+             UsedIndex,
+             dynamic_cast<Parameter<double> *>(ParamPtr)->readValue());
+       }},
   };
   CallMap.at(typeid(*ParamPtr).hash_code())();
-  Driver->callParamCallbacks();
 }
\ No newline at end of file
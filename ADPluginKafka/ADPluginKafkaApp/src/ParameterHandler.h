@@ -8,12 +8,26 @@
 
 #include "Parameter.h"
 #include <asynPortDriver.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <map>
+#include <thread>
 
+/** @brief Connects instances of Parameter<> to the parameter library of an
+ * asyn port driver.
+ * Parameter library updates are requested through
+ * ParameterHandler::updateDbValue() which may be called from any thread
+ * without taking the port lock. The requests are put in a lock-free
+ * multiple-producer single-consumer queue and applied by a single thread
+ * which holds the port lock, see ParameterHandler::startUpdateThread().
+ * Repeated requests for a parameter which is already queued are coalesced as
+ * the value is read when the queue is drained.
+ */
 class ParameterHandler {
 public:
   ParameterHandler(asynPortDriver *DriverPtr);
-  virtual ~ParameterHandler() = default;
+  virtual ~ParameterHandler();
   void registerParameter(ParameterBase *Param);
 
   template <class ParamType> bool write(int Index, ParamType Value) {
@@ -42,9 +56,56 @@ public:
     }
     return true;
   }
+
+  /** @brief Queues an update of the parameter library value of a parameter.
+   * Lock-free and never blocks. Does nothing if the parameter is already
+   * queued.
+   */
   virtual void updateDbValue(ParameterBase *ParamPtr);
 
+  /** @brief Writes the values of all queued parameters to the parameter
+   * library and calls the parameter callbacks once.
+   * Must only be called by one thread at a time and with the port lock held.
+   * @return True if any parameter was updated.
+   */
+  bool processQueuedUpdates();
+
+  /** @brief Starts the thread which drains the update queue.
+   * Until the thread is started, updates are kept in the queue. Should be
+   * called at the end of the constructor of the driver as the thread will
+   * take the port lock.
+   * @param[in] Period Time between updates, limits the rate at which the
+   * parameter library is updated.
+   */
+  void startUpdateThread(
+      std::chrono::milliseconds Period = std::chrono::milliseconds(20));
+
+  /** @brief Sets a function which is called periodically by the update
+   * thread, with the port lock held. The queued updates are applied right
+   * after the function has been called. Must be called before
+   * ParameterHandler::startUpdateThread().
+   * @param[in] Task The function, typically used to publish statistics.
+   * @param[in] Period Time between calls.
+   */
+  void setPeriodicTask(std::function<void()> Task,
+                       std::chrono::milliseconds Period);
+
+  /** @brief Stops the update thread. Must be called before the registered
+   * parameters are destroyed.
+   */
+  void stopUpdateThread();
+
 private:
+  void writeDbValue(ParameterBase *ParamPtr);
+  void updateThreadFunction(std::chrono::milliseconds Period);
+
   std::map<int, ParameterBase *> KnownParameters;
   asynPortDriver *Driver;
+
+  /// @brief Most recently queued parameter, linked by ParameterBase::NextPending.
+  std::atomic<ParameterBase *> UpdateQueueHead{nullptr};
+  std::atomic<bool> RunUpdateThread{false};
+  std::function<void()> PeriodicTask;
+  std::chrono::milliseconds PeriodicTaskPeriod{1000};
+  std::thread UpdateThread;
 };
\ No newline at end of file
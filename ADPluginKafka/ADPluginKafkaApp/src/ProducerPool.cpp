@@ -0,0 +1,260 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ProducerPool.cpp
+ *  @brief Implementation of the process-wide producer registry.
+ */
+
+#include "ProducerPool.h"
+#include "ThreadPlacement.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstdlib>
+#include <list>
+
+namespace KafkaInterface {
+
+namespace {
+const std::string BufferSizeName{"queue.buffering.max.kbytes"};
+
+/// @brief Client ids are unique in the process, not only per producer.
+std::atomic<std::uint64_t> NextClientId{1};
+
+/** @brief The settings of a configuration, except for the callbacks (which
+ * differ for every producer).
+ */
+std::string dumpConf(RdKafka::Conf *Conf) {
+  std::string Result;
+  if (nullptr == Conf) {
+    return Result;
+  }
+  std::unique_ptr<std::list<std::string>> Dump(Conf->dump());
+  for (auto It = Dump->begin(); It != Dump->end(); ++It) {
+    auto Name = *It;
+    if (++It == Dump->end()) {
+      break;
+    }
+    if (std::string::npos != Name.find("_cb") or
+        std::string::npos != Name.find("opaque")) {
+      continue;
+    }
+    Result += Name + "=" + *It + "\n";
+  }
+  return Result;
+}
+} // namespace
+
+const std::size_t ProducerPool::MinBufferKBytes;
+
+PooledProducer::PooledProducer(std::string ProducerKey, bool IsShared)
+    : Key(std::move(ProducerKey)), Shared(IsShared) {}
+
+std::uint64_t PooledProducer::attach(ProducerClient *Client) {
+  auto Id = NextClientId++;
+  std::lock_guard<std::mutex> Lock(ClientsMutex);
+  Clients[Id] = Client;
+  return Id;
+}
+
+void PooledProducer::detach(std::uint64_t ClientId) {
+  std::lock_guard<std::mutex> Lock(ClientsMutex);
+  Clients.erase(ClientId);
+}
+
+std::size_t PooledProducer::clientCount() const {
+  std::lock_guard<std::mutex> Lock(ClientsMutex);
+  return Clients.size();
+}
+
+void PooledProducer::event_cb(RdKafka::Event &Event) {
+  std::lock_guard<std::mutex> Lock(ClientsMutex);
+  for (auto &Client : Clients) {
+    Client.second->OnEvent(Event, this);
+  }
+}
+
+void PooledProducer::dr_cb(RdKafka::Message &Message) {
+  auto Ticket = static_cast<DeliveryTicket *>(Message.msg_opaque());
+  if (nullptr != Ticket) {
+    std::lock_guard<std::mutex> Lock(ClientsMutex);
+    auto Client = Clients.find(Ticket->ClientId);
+    if (Clients.end() != Client) {
+      Client->second->OnDelivery(Message, this);
+    }
+  }
+  delete Ticket;
+}
+
+void PooledProducer::poll() {
+  // The poll thread skips a producer while it is being shut down rather than
+  // waiting for the flush
+  std::unique_lock<std::mutex> Lock(ProducerMutex, std::try_to_lock);
+  if (Lock.owns_lock() and nullptr != Producer) {
+    Producer->poll(0);
+  }
+}
+
+void PooledProducer::shutDown(int TimeoutMS) {
+  std::lock_guard<std::mutex> Lock(ProducerMutex);
+  if (nullptr == Producer) {
+    return;
+  }
+  // Flushing serves the delivery reports of the purged messages, freeing
+  // their tickets
+  Producer->purge(RdKafka::Producer::PURGE_QUEUE |
+                  RdKafka::Producer::PURGE_INFLIGHT);
+  Producer->flush(TimeoutMS);
+  Producer.reset();
+}
+
+ProducerPool &ProducerPool::instance() {
+  static ProducerPool Pool;
+  return Pool;
+}
+
+ProducerPool::~ProducerPool() {
+  RunThread = false;
+  if (PollThread.joinable()) {
+    PollThread.join();
+  }
+  for (auto &Producer : Producers) {
+    Producer->shutDown(DestructionTimeoutMS);
+  }
+  Producers.clear();
+}
+
+std::shared_ptr<PooledProducer>
+ProducerPool::acquire(RdKafka::Conf *Conf, RdKafka::Conf *TopicConf,
+                      bool Shared, int Slot, std::string &ErrStr) {
+  auto Key = dumpConf(Conf) + "--\n" + dumpConf(TopicConf) +
+             "slot=" + std::to_string(Slot);
+  std::lock_guard<std::mutex> Lock(PoolMutex);
+  if (Shared) {
+    for (auto &Existing : Producers) {
+      if (Existing->Shared and Existing->Key == Key) {
+        ++Existing->Users;
+        return Existing;
+      }
+    }
+  }
+
+  std::string Requested;
+  Conf->get(BufferSizeName, Requested);
+  auto BufferKBytes =
+      static_cast<std::size_t>(std::strtoull(Requested.c_str(), nullptr, 10));
+  if (BudgetKBytes > 0 and CommittedKBytes + BufferKBytes > BudgetKBytes) {
+    if (CommittedKBytes + MinBufferKBytes > BudgetKBytes) {
+      ErrStr = "Kafka memory budget exhausted.";
+      return nullptr;
+    }
+    BufferKBytes = BudgetKBytes - CommittedKBytes;
+  }
+
+  auto Created = std::make_shared<PooledProducer>(Key, Shared);
+  std::string SetError;
+  Conf->set(BufferSizeName, std::to_string(BufferKBytes), SetError);
+  Conf->set("event_cb", static_cast<RdKafka::EventCb *>(Created.get()),
+            SetError);
+  Conf->set("dr_cb", static_cast<RdKafka::DeliveryReportCb *>(Created.get()),
+            SetError);
+  Created->Producer.reset(RdKafka::Producer::create(Conf, ErrStr));
+  // librdkafka copies the configuration, the caller keeps its own queue size
+  Conf->set(BufferSizeName, Requested, SetError);
+  if (nullptr == Created->Producer) {
+    return nullptr;
+  }
+  Created->BufferKBytes = BufferKBytes;
+  Created->Users = 1;
+  CommittedKBytes += BufferKBytes;
+  Producers.push_back(Created);
+  if (not RunThread) {
+    if (PollThread.joinable()) {
+      PollThread.join();
+    }
+    RunThread = true;
+    PollThread = std::thread(&ProducerPool::pollThread, this);
+  }
+  return Created;
+}
+
+void ProducerPool::release(std::shared_ptr<PooledProducer> &Producer,
+                           int TimeoutMS) {
+  if (nullptr == Producer) {
+    return;
+  }
+  std::shared_ptr<PooledProducer> Unused;
+  {
+    std::lock_guard<std::mutex> Lock(PoolMutex);
+    if (0 == --Producer->Users) {
+      Producers.erase(
+          std::remove(Producers.begin(), Producers.end(), Producer),
+          Producers.end());
+      CommittedKBytes -= Producer->BufferKBytes;
+      Unused = Producer;
+    }
+  }
+  Producer.reset();
+  if (nullptr != Unused) {
+    // Outside of the lock as flushing may take a while
+    Unused->shutDown(TimeoutMS);
+  }
+}
+
+void ProducerPool::setBudgetKBytes(std::size_t KBytes) {
+  std::lock_guard<std::mutex> Lock(PoolMutex);
+  BudgetKBytes = KBytes;
+}
+
+std::size_t ProducerPool::getBudgetKBytes() const {
+  std::lock_guard<std::mutex> Lock(PoolMutex);
+  return BudgetKBytes;
+}
+
+std::size_t ProducerPool::getCommittedKBytes() const {
+  std::lock_guard<std::mutex> Lock(PoolMutex);
+  return CommittedKBytes;
+}
+
+std::size_t ProducerPool::getProducerCount() const {
+  std::lock_guard<std::mutex> Lock(PoolMutex);
+  return Producers.size();
+}
+
+std::string ProducerPool::report() const {
+  std::lock_guard<std::mutex> Lock(PoolMutex);
+  std::string Result = std::to_string(Producers.size()) + " producers, " +
+                       std::to_string(CommittedKBytes) + " kB queued of " +
+                       (BudgetKBytes > 0 ? std::to_string(BudgetKBytes) + " kB"
+                                         : std::string("no budget")) +
+                       "\n";
+  for (auto &Producer : Producers) {
+    Result += "  " + Producer->get()->name() + ": " +
+              (Producer->Shared ? "shared" : "exclusive") + ", " +
+              std::to_string(Producer->Users) + " users, " +
+              std::to_string(Producer->BufferKBytes) + " kB queue, " +
+              std::to_string(Producer->get()->outq_len()) +
+              " messages queued\n";
+  }
+  return Result;
+}
+
+void ProducerPool::pollThread() {
+  PluginThreads::Placer.placeCurrentThread(PluginThreads::Role::POLL,
+                                           "producer pool poll");
+  std::vector<std::shared_ptr<PooledProducer>> Current;
+  while (RunThread) {
+    auto Start = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> Lock(PoolMutex);
+      Current = Producers;
+    }
+    // Polling serves the callbacks, which must not be called while holding
+    // the lock
+    for (auto &Producer : Current) {
+      Producer->poll();
+    }
+    Current.clear();
+    std::this_thread::sleep_until(Start + PollSleepTime);
+  }
+  PluginThreads::Placer.forgetCurrentThread();
+}
+} // namespace KafkaInterface
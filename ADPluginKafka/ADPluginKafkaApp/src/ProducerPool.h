@@ -0,0 +1,205 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ProducerPool.h
+ *  @brief Process-wide registry of librdkafka producers which can be shared
+ * by the Kafka targets of all plugins in an IOC.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <rdkafkacpp.h>
+#else
+#include <librdkafka/rdkafkacpp.h>
+#endif
+
+namespace KafkaInterface {
+
+class PooledProducer;
+
+/** @brief Passed to librdkafka as the opaque of every produced message.
+ * Deleted by PooledProducer::dr_cb() after the client has been notified.
+ */
+struct DeliveryTicket {
+  /// @brief See PooledProducer::attach().
+  std::uint64_t ClientId{0};
+  /// @brief Shared message data kept alive until delivery, may be nullptr.
+  std::shared_ptr<const unsigned char> Data;
+};
+
+/** @brief Receives the callbacks of the pooled producers it is attached to.
+ * The callbacks are called from the poll thread of the ProducerPool while
+ * PooledProducer::detach() is blocked. They must thus not call detach() or the
+ * ProducerPool, nor wait for a lock held by the client while doing so.
+ */
+class ProducerClient {
+public:
+  virtual ~ProducerClient() = default;
+
+  /// @brief Delivery report of a message produced with the client id.
+  virtual void OnDelivery(RdKafka::Message &Message,
+                          PooledProducer *Source) = 0;
+
+  /// @brief Errors and statistics of the producer, sent to all clients.
+  virtual void OnEvent(RdKafka::Event &Event, PooledProducer *Source) = 0;
+};
+
+/** @brief A librdkafka producer and the clients using it.
+ * Created and destroyed by ProducerPool. The delivery reports are passed to
+ * the client which produced the message (see DeliveryTicket) and the events to
+ * all clients.
+ */
+class PooledProducer : public RdKafka::EventCb,
+                       public RdKafka::DeliveryReportCb {
+public:
+  PooledProducer(std::string ProducerKey, bool IsShared);
+
+  /** @brief Thread safe, as is producing messages with it. nullptr after
+   * the producer has been shut down by the pool.
+   */
+  RdKafka::Producer *get() const { return Producer.get(); }
+
+  /** @brief Starts passing callbacks to the client.
+   * @return The client id to be used in the DeliveryTicket of its messages.
+   */
+  std::uint64_t attach(ProducerClient *Client);
+
+  /** @brief Stops passing callbacks to the client. Blocks while a callback is
+   * being called. Delivery reports of messages still queued are dropped.
+   */
+  void detach(std::uint64_t ClientId);
+
+  std::string const &key() const { return Key; }
+  bool isShared() const { return Shared; }
+  /// @brief The size of the producer queue, as limited by the memory budget.
+  std::size_t bufferKBytes() const { return BufferKBytes; }
+  std::size_t clientCount() const;
+
+  void event_cb(RdKafka::Event &Event) override;
+  void dr_cb(RdKafka::Message &Message) override;
+
+private:
+  friend class ProducerPool;
+
+  /// @brief Serves the callbacks, skipped while the producer is shut down.
+  void poll();
+
+  /** @brief Removes the queued messages, serves their delivery reports and
+   * destroys the librdkafka producer.
+   */
+  void shutDown(int TimeoutMS);
+
+  std::string Key;
+  bool Shared;
+  std::size_t BufferKBytes{0};
+  /// @brief Number of ProducerPool::acquire() calls not yet released. Only
+  /// accessed while holding ProducerPool::PoolMutex.
+  std::size_t Users{0};
+
+  /// @brief Serialises poll() and shutDown(), which resets the producer.
+  std::mutex ProducerMutex;
+  std::unique_ptr<RdKafka::Producer> Producer;
+
+  mutable std::mutex ClientsMutex;
+  std::map<std::uint64_t, ProducerClient *> Clients;
+};
+
+/** @brief Creates the librdkafka producers of all Kafka targets in the
+ * process.
+ * Targets with identical (global and topic) configurations may share a
+ * producer, so that the broker connections, librdkafka threads and queue
+ * memory scale with the number of broker clusters rather than with the number
+ * of plugins. Producers are reference counted and destroyed when released by
+ * the last target. All producers are polled by a single thread of the pool.
+ *
+ * The sum of the queue sizes ("queue.buffering.max.kbytes") of all producers
+ * can be limited by a memory budget. A new producer gets the remaining budget
+ * if it requests more; it is not created if less than
+ * ProducerPool::MinBufferKBytes remain.
+ */
+class ProducerPool {
+public:
+  /// @brief The pool shared by all plugins.
+  static ProducerPool &instance();
+
+  ProducerPool() = default;
+
+  /** @brief Stops the poll thread and shuts down the producers still in use,
+   * which must not be used by their clients any more.
+   */
+  ~ProducerPool();
+
+  /// @brief Smallest queue created within the budget, in kB.
+  static const std::size_t MinBufferKBytes{1024};
+
+  /** @brief Returns a producer for the configuration.
+   * @param[in] Conf Global configuration. Its callbacks are replaced by those
+   * of the returned producer and the queue size is temporarily changed, so it
+   * must not be used by other threads during the call.
+   * @param[in] TopicConf Topic configuration, only used to tell different
+   * configurations apart as librdkafka shares topics within a producer.
+   * @param[in] Shared If true, an existing shared producer with the same
+   * configurations and slot is returned if there is one.
+   * @param[in] Slot Keeps several shared producers with the same
+   * configuration apart, e.g. the shards of a target.
+   * @param[out] ErrStr The reason of a failure.
+   * @return nullptr on failure.
+   */
+  std::shared_ptr<PooledProducer> acquire(RdKafka::Conf *Conf,
+                                          RdKafka::Conf *TopicConf,
+                                          bool Shared, int Slot,
+                                          std::string &ErrStr);
+
+  /** @brief Gives up a producer returned by ProducerPool::acquire().
+   * The producer is destroyed (and its queued messages purged) if this was
+   * its last user. Clients must have been detached from it.
+   * @param[in,out] Producer Reset by the call.
+   * @param[in] TimeoutMS Time to wait for the purged messages to be served.
+   */
+  void release(std::shared_ptr<PooledProducer> &Producer, int TimeoutMS);
+
+  /** @brief Sets the memory budget of all producers, applied to producers
+   * created from now on.
+   * @param[in] KBytes 0 for no limit.
+   */
+  void setBudgetKBytes(std::size_t KBytes);
+  std::size_t getBudgetKBytes() const;
+
+  /// @brief The sum of the queue sizes of all producers.
+  std::size_t getCommittedKBytes() const;
+
+  /// @brief Number of producers (not counting the users of shared ones).
+  std::size_t getProducerCount() const;
+
+  /// @brief A description of the producers, one per line.
+  std::string report() const;
+
+private:
+  /// @brief Polls all producers, serving their callbacks.
+  void pollThread();
+
+  mutable std::mutex PoolMutex;
+  std::vector<std::shared_ptr<PooledProducer>> Producers;
+  std::size_t BudgetKBytes{0};
+  std::size_t CommittedKBytes{0};
+
+  std::thread PollThread;
+  std::atomic<bool> RunThread{false};
+
+  /// @brief Sleep time between polling all producers.
+  const std::chrono::milliseconds PollSleepTime{50};
+
+  /// @brief Time to wait for purged messages when the pool is destroyed.
+  const int DestructionTimeoutMS{1000};
+};
+} // namespace KafkaInterface
@@ -0,0 +1,102 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RateLimiter.cpp
+ *  @brief Implementation of the byte rate limit.
+ */
+
+#include "RateLimiter.h"
+#include <algorithm>
+#include <ciso646>
+
+namespace {
+const double MegaByte{1024.0 * 1024.0};
+} // namespace
+
+void RateLimiter::refill(Clock::time_point Now) {
+  if (HasRefilled and Now > LastRefill) {
+    Tokens = std::min(BurstBytes,
+                      Tokens + BytesPerSecond *
+                                   std::chrono::duration<double>(
+                                       Now - LastRefill)
+                                       .count());
+  }
+  if (not HasRefilled or Now > LastRefill) {
+    LastRefill = Now;
+  }
+  HasRefilled = true;
+}
+
+bool RateLimiter::acquire(std::size_t Bytes, Clock::time_point Now,
+                          Clock::duration &Delay) {
+  Delay = Clock::duration::zero();
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  if (BytesPerSecond <= 0) {
+    return true;
+  }
+  refill(Now);
+  auto Size = static_cast<double>(Bytes);
+  auto Required = std::min(Size, BurstBytes);
+  // Ignore rounding errors of the refills (less than a byte)
+  if (Required - Tokens > 0.5) {
+    if (Policy::DROP == UsedPolicy) {
+      ++DroppedMessages;
+      return false;
+    }
+    Delay = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>((Required - Tokens) / BytesPerSecond));
+  }
+  Tokens -= Size;
+  return true;
+}
+
+bool RateLimiter::setRate(double MegaBytesPerSecond) {
+  if (MegaBytesPerSecond < 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  BytesPerSecond = MegaBytesPerSecond * MegaByte;
+  // Start with a full bucket, the old debt does not apply to the new limit
+  Tokens = BurstBytes;
+  HasRefilled = false;
+  return true;
+}
+
+double RateLimiter::getRate() const {
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  return BytesPerSecond / MegaByte;
+}
+
+bool RateLimiter::setBurst(double MegaBytes) {
+  if (MegaBytes <= 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  BurstBytes = MegaBytes * MegaByte;
+  Tokens = std::min(Tokens, BurstBytes);
+  return true;
+}
+
+double RateLimiter::getBurst() const {
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  return BurstBytes / MegaByte;
+}
+
+bool RateLimiter::setPolicy(int NewPolicy) {
+  if (NewPolicy != static_cast<int>(Policy::DELAY) and
+      NewPolicy != static_cast<int>(Policy::DROP)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  UsedPolicy = static_cast<Policy>(NewPolicy);
+  return true;
+}
+
+RateLimiter::Policy RateLimiter::getPolicy() const {
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  return UsedPolicy;
+}
+
+std::uint64_t RateLimiter::getDroppedMessages() const {
+  std::lock_guard<std::mutex> Lock(LimiterMutex);
+  return DroppedMessages;
+}
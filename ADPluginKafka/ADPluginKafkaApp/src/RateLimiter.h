@@ -0,0 +1,84 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RateLimiter.h
+ *  @brief Token bucket limiting the number of bytes per second sent to Kafka.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/** @brief Limits the byte rate of the messages sent by one plugin.
+ * The bucket holds up to RateLimiter::getBurst() bytes and is refilled at
+ * RateLimiter::getRate(). A message may be sent when the bucket holds its size
+ * (or is full, for messages larger than the burst size); its size is then
+ * removed from the bucket, which may become negative. The long term rate thus
+ * never exceeds the limit, while short bursts are sent at line rate.
+ *
+ * Messages exceeding the limit are either delayed until enough bytes have
+ * been refilled or dropped, see RateLimiter::Policy. A delayed message
+ * reserves its bytes immediately, so that concurrent callers are delayed in
+ * turn. The waiting itself is left to the caller, which must not hold the port
+ * lock while doing so.
+ *
+ * The class is thread safe; the settings may be changed while messages are
+ * being sent.
+ */
+class RateLimiter {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief What to do with a message exceeding the limit.
+  enum class Policy {
+    DELAY = 0, ///< Wait until the message can be sent.
+    DROP = 1,  ///< Do not send the message.
+  };
+
+  /** @brief Decides if (and when) a message may be sent.
+   * Must be called exactly once per message.
+   * @param[in] Bytes Size of the message.
+   * @param[in] Now The current time.
+   * @param[out] Delay The time to wait before sending the message, zero if it
+   * can be sent immediately.
+   * @return False if the message should be dropped.
+   */
+  bool acquire(std::size_t Bytes, Clock::time_point Now, Clock::duration &Delay);
+
+  /** @brief Sets the limit in MB/s.
+   * @param[in] MegaBytesPerSecond 0 for no limit.
+   * @return False if negative.
+   */
+  bool setRate(double MegaBytesPerSecond);
+  double getRate() const;
+
+  /** @brief Sets the size of the bucket in MB.
+   * @return False if not positive.
+   */
+  bool setBurst(double MegaBytes);
+  double getBurst() const;
+
+  /// @return False if the value is not a RateLimiter::Policy.
+  bool setPolicy(int NewPolicy);
+  Policy getPolicy() const;
+
+  /// @brief Number of messages dropped by the limit.
+  std::uint64_t getDroppedMessages() const;
+
+private:
+  /// @brief Adds the bytes accumulated since the last refill.
+  void refill(Clock::time_point Now);
+
+  mutable std::mutex LimiterMutex;
+  double BytesPerSecond{0};
+  double BurstBytes{100.0 * 1024 * 1024};
+  Policy UsedPolicy{Policy::DELAY};
+
+  /// @brief Bytes in the bucket, negative after a message larger than them.
+  double Tokens{100.0 * 1024 * 1024};
+  bool HasRefilled{false};
+  Clock::time_point LastRefill;
+  std::uint64_t DroppedMessages{0};
+};
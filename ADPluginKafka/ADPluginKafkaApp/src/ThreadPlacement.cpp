@@ -0,0 +1,12 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThreadPlacement.cpp
+ *  @brief The thread placer of ADPluginKafka.
+ */
+
+#include "ThreadPlacement.h"
+
+namespace PluginThreads {
+KafkaThreads::ThreadPlacer Placer{
+    {"poll", "librdkafka"}, Role::LIBRDKAFKA, "ADPluginKafka thread placement"};
+} // namespace PluginThreads
@@ -0,0 +1,28 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThreadPlacement.h
+ *  @brief The thread placement of ADPluginKafka.
+ *
+ * The placement of each kind of thread (see PluginThreads::Role) is set before
+ * iocInit with the iocsh command KafkaPluginThreadPlacement. The effective
+ * placement of every running thread is printed by
+ * KafkaPluginThreadReport. See ThreadPlacer.h.
+ */
+
+#pragma once
+
+#include "ThreadPlacer.h"
+
+namespace PluginThreads {
+
+/// @brief The kinds of threads which can be placed.
+namespace Role {
+enum {
+  POLL = 0,   ///< The thread polling the producers, see ProducerPool.
+  LIBRDKAFKA, ///< The internal (main and broker) threads of librdkafka.
+};
+} // namespace Role
+
+/// @brief The placements of the threads of ADPluginKafka.
+extern KafkaThreads::ThreadPlacer Placer;
+} // namespace PluginThreads
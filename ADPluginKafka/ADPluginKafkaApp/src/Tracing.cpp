@@ -0,0 +1,12 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Tracing.cpp
+ *  @brief The trace of the plugin.
+ */
+
+#include "Tracing.h"
+
+namespace PluginTracing {
+// Process id 2 is used by the driver
+KafkaTracing::TraceLog Log{1, "KafkaPlugin"};
+} // namespace PluginTracing
@@ -0,0 +1,26 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Tracing.h
+ *  @brief Trace points of the plugin, see TraceLog.h.
+ *
+ * Tracing is enabled with the iocsh command KafkaPluginTraceEnable and the
+ * trace is written to a file with KafkaPluginTraceDump.
+ */
+
+#pragma once
+
+#include "TraceLog.h"
+
+namespace PluginTracing {
+/// @brief The trace of ADPluginKafka.
+extern KafkaTracing::TraceLog Log;
+} // namespace PluginTracing
+
+#define PLUGIN_TRACE_SCOPE(Name, Id)                                           \
+  KAFKA_TRACE_SCOPE(PluginTracing::Log, Name, Id)
+#define PLUGIN_TRACE_START(Variable)                                           \
+  KAFKA_TRACE_START(PluginTracing::Log, Variable)
+#define PLUGIN_TRACE_END(Variable, Name, Id)                                   \
+  KAFKA_TRACE_END(PluginTracing::Log, Variable, Name, Id)
+#define PLUGIN_TRACE_EVENT(Name, StartNs, DurationNs, Id)                      \
+  KAFKA_TRACE_EVENT(PluginTracing::Log, Name, StartNs, DurationNs, Id)
@@ -22,10 +22,34 @@ NDStdArraysConfigure("Image1", 3, 0, "$(ADURL_PORT)", 0)
 # This waveform only allows transporting 8-bit images
 dbLoadRecords("$(ADCORE)/db/NDStdArrays.template", "P=$(PREFIX),R=:image1:,PORT=Image1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(ADURL_PORT),TYPE=Int8,FTVL=UCHAR,NELEMENTS=10485760")
 
+# Limit the queue memory of all Kafka producers in the IOC (see KafkaSharedProducer).
+# KafkaPluginProducerBudget(int megaBytes)
+# KafkaPluginProducerBudget(4096)
+
+# CPU affinity and scheduling of the Kafka threads, role "poll" or "librdkafka" (Linux only).
+# KafkaPluginThreadPlacement(const char *role, const char *cpus, const char *scheduling)
+# KafkaPluginThreadPlacement("librdkafka", "4-7", "nice:-5")
+
 # KafkaPluginConfigure(const char *portName, int queueSize, int blockingCallbacks, const char *NDArrayPort, int NDArrayAddr, size_t maxMemory, const char *brokerAddress, const char *topic, const char *sourceName
 KafkaPluginConfigure("$(K_PORT)", 3, 1, "$(ADURL_PORT)", 0, -1, "localhost:9092", "url_data_topic", "$(ADURL_PORT)")
 dbLoadRecords("$(ADPLUGINKAFKA)/db/ADPluginKafka.template", "P=$(PREFIX),R=:KFK:,PORT=$(K_PORT),ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(ADURL_PORT),FTVL=UCHAR,NELEMENTS=10485760")
 
+# Send the same (serialized) data to an additional topic and/or cluster.
+# KafkaPluginAddTarget(const char *portName, const char *brokerAddress, const char *topic)
+# KafkaPluginAddTarget("$(K_PORT)", "remotehost:9092", "url_data_analysis")
+# dbLoadRecords("$(ADPLUGINKAFKA)/db/ADPluginKafkaTarget.template", "P=$(PREFIX),R=:KFK:,PORT=$(K_PORT),ADDR=0,TIMEOUT=1,N=2")
+
+# Queue length and throughput of the producer shards (see KafkaShards), one
+# set of records per shard. Set T=_N for the shards of target N.
+# dbLoadRecords("$(ADPLUGINKAFKA)/db/ADPluginKafkaShard.template", "P=$(PREFIX),R=:KFK:,PORT=$(K_PORT),ADDR=0,TIMEOUT=1,SHARD=1,T=")
+# dbLoadRecords("$(ADPLUGINKAFKA)/db/ADPluginKafkaShard.template", "P=$(PREFIX),R=:KFK:,PORT=$(K_PORT),ADDR=0,TIMEOUT=1,SHARD=2,T=")
+
+# Load test the plugin with synthetic frames instead of the URL driver: replace
+# $(ADURL_PORT) with LOADGEN1 as NDARRAY_PORT of the Kafka plugin above.
+# KafkaLoadGeneratorConfig(const char *portName, int maxBuffers, size_t maxMemory)
+# KafkaLoadGeneratorConfig("LOADGEN1", 0, 0)
+# dbLoadRecords("$(ADPLUGINKAFKA)/db/KafkaLoadGenerator.template","P=$(PREFIX),R=:gen1:,PORT=LOADGEN1,ADDR=0,TIMEOUT=1")
+
 # Load all other plugins using commonPlugins.cmd
 # < $(ADCORE)/iocBoot/commonPlugins.cmd
 
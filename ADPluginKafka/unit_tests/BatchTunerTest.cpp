@@ -0,0 +1,113 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  BatchTunerTest.cpp
+ *  @brief Unit tests of the producer batching controller.
+ */
+
+#include "BatchTuner.h"
+#include <gtest/gtest.h>
+
+using KafkaInterface::BatchSettings;
+using KafkaInterface::BatchTuner;
+
+namespace {
+const std::int64_t MiB{1024 * 1024};
+
+/// @brief Adds half second samples of messages with a fixed size and rate.
+void addSamples(BatchTuner &UnderTest, int Count, std::size_t Size,
+                double Rate, double LatencyMS, std::int64_t Queued = 0) {
+  for (int i = 0; i < Count; ++i) {
+    BatchTuner::Sample Stats;
+    Stats.Seconds = 0.5;
+    Stats.Messages = static_cast<std::uint64_t>(Rate * Stats.Seconds);
+    Stats.Bytes = Stats.Messages * Size;
+    Stats.PeakSize = Size;
+    Stats.LatencyMS = LatencyMS;
+    Stats.QueuedMessages = Queued;
+    UnderTest.Update(Stats);
+  }
+}
+} // namespace
+
+TEST(BatchTuner, NothingRecommendedWhileObserving) {
+  BatchTuner UnderTest;
+  addSamples(UnderTest, 2, 1024, 1000, 10);
+  EXPECT_FALSE(UnderTest.RetuneDue(BatchTuner::Clock::now()));
+  EXPECT_EQ(UnderTest.Recommend(), UnderTest.Current());
+  EXPECT_EQ(UnderTest.Reason(), "Observing messages.");
+}
+
+TEST(BatchTuner, IdleSamplesAreIgnored) {
+  BatchTuner UnderTest;
+  addSamples(UnderTest, 2, 1024, 1000, 10);
+  addSamples(UnderTest, 5, 1024, 0, 0);
+  EXPECT_FALSE(UnderTest.RetuneDue(BatchTuner::Clock::now()));
+}
+
+TEST(BatchTuner, HugeFramesAreSentImmediately) {
+  BatchTuner UnderTest;
+  addSamples(UnderTest, 5, 48 * MiB, 14, 50);
+  ASSERT_TRUE(UnderTest.RetuneDue(BatchTuner::Clock::now()));
+  auto Settings = UnderTest.Recommend();
+  EXPECT_EQ(Settings.LingerMS, 0);
+  EXPECT_EQ(Settings.BatchMessages, 1);
+  // Two seconds of data (1344 MB) rounded up
+  EXPECT_EQ(Settings.BufferKBytes, 2048 * 1024);
+  EXPECT_EQ(Settings.QueueMessages, 32);
+  EXPECT_EQ(UnderTest.Reason(),
+            "48.0 MB @ 14.0 Hz: linger 0 ms, 1 msgs/batch, queue 2.0 GB");
+}
+
+TEST(BatchTuner, SmallFramesAreBatched) {
+  BatchTuner UnderTest;
+  addSamples(UnderTest, 5, 1024, 10000, 20);
+  auto Settings = UnderTest.Recommend();
+  EXPECT_EQ(Settings.BatchMessages, 1024);
+  // Limited to half of the default latency target of 100 ms
+  EXPECT_EQ(Settings.LingerMS, 50);
+  EXPECT_EQ(Settings.BufferKBytes, 32 * 1024);
+  EXPECT_EQ(Settings.QueueMessages, 32768);
+}
+
+TEST(BatchTuner, NoLingerAtLowRate) {
+  BatchTuner UnderTest;
+  addSamples(UnderTest, 5, 1024, 5, 20);
+  auto Settings = UnderTest.Recommend();
+  EXPECT_EQ(Settings.LingerMS, 0);
+  EXPECT_EQ(Settings.BufferKBytes, 16 * 1024);
+}
+
+TEST(BatchTuner, LatencyFeedback) {
+  BatchTuner UnderTest;
+  ASSERT_TRUE(UnderTest.SetLatencyTargetMS(40));
+  EXPECT_FALSE(UnderTest.SetLatencyTargetMS(0));
+  addSamples(UnderTest, 5, 1024, 10000, 10);
+  EXPECT_EQ(UnderTest.Recommend().LingerMS, 20);
+  // Too slow with a short queue, the linger time is reduced
+  addSamples(UnderTest, 2, 1024, 10000, 100, 10);
+  EXPECT_EQ(UnderTest.Recommend().LingerMS, 5);
+  // Too slow with a long queue, batching is increased again
+  addSamples(UnderTest, 2, 1024, 10000, 100, 100000);
+  EXPECT_EQ(UnderTest.Recommend().LingerMS, 20);
+}
+
+TEST(BatchTuner, BufferTime) {
+  BatchTuner UnderTest;
+  EXPECT_FALSE(UnderTest.SetBufferSeconds(-1));
+  ASSERT_TRUE(UnderTest.SetBufferSeconds(0.5));
+  addSamples(UnderTest, 5, 4 * MiB, 25, 10);
+  // Half a second of data (50 MB)
+  EXPECT_EQ(UnderTest.Recommend().BufferKBytes, 64 * 1024);
+}
+
+TEST(BatchTuner, RetuneInterval) {
+  BatchTuner UnderTest;
+  addSamples(UnderTest, 5, 1024, 10000, 10);
+  auto Now = BatchTuner::Clock::now();
+  ASSERT_TRUE(UnderTest.RetuneDue(Now));
+  UnderTest.Applied(UnderTest.Recommend(), Now);
+  EXPECT_FALSE(UnderTest.RetuneDue(Now));
+  addSamples(UnderTest, 10, 8 * MiB, 10, 10);
+  EXPECT_FALSE(UnderTest.RetuneDue(Now + std::chrono::seconds(10)));
+  EXPECT_TRUE(UnderTest.RetuneDue(Now + std::chrono::seconds(31)));
+}
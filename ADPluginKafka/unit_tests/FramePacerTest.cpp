@@ -0,0 +1,82 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FramePacerTest.cpp
+ *  @brief Unit tests of the schedule of the load generator frames.
+ */
+
+#include "FramePacer.h"
+#include <gtest/gtest.h>
+
+using Clock = FramePacer::Clock;
+using std::chrono::milliseconds;
+
+TEST(FramePacer, FixedRate) {
+  auto Start = Clock::now();
+  FramePacer UnderTest(100.0, 0.0, 0.0, Start);
+  bool Late{true};
+  EXPECT_EQ(UnderTest.schedule(Start, Late), Start);
+  EXPECT_FALSE(Late);
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(1), Late),
+            Start + milliseconds(10));
+  EXPECT_FALSE(Late);
+  // Sent a bit late; the schedule does not drift.
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(25), Late),
+            Start + milliseconds(25));
+  EXPECT_FALSE(Late);
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(26), Late),
+            Start + milliseconds(30));
+}
+
+TEST(FramePacer, NoRateMeansImmediately) {
+  auto Start = Clock::now();
+  FramePacer UnderTest(0.0, 0.0, 0.0, Start);
+  bool Late{true};
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(UnderTest.schedule(Start + milliseconds(i), Late),
+              Start + milliseconds(i));
+    EXPECT_FALSE(Late);
+  }
+}
+
+TEST(FramePacer, LateFrameResetsSchedule) {
+  auto Start = Clock::now();
+  FramePacer UnderTest(100.0, 0.0, 0.0, Start);
+  bool Late{false};
+  UnderTest.schedule(Start, Late);
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(35), Late),
+            Start + milliseconds(35));
+  EXPECT_TRUE(Late);
+  // The missed frames are not caught up.
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(36), Late),
+            Start + milliseconds(45));
+  EXPECT_FALSE(Late);
+}
+
+TEST(FramePacer, BurstAndIdle) {
+  auto Start = Clock::now();
+  FramePacer UnderTest(100.0, 0.05, 0.1, Start);
+  bool Late{true};
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(UnderTest.schedule(Start + milliseconds(10 * i), Late),
+              Start + milliseconds(10 * i));
+    EXPECT_FALSE(Late);
+  }
+  // The burst has ended, the next frame is due after the idle time.
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(50), Late),
+            Start + milliseconds(150));
+  EXPECT_FALSE(Late);
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(150), Late),
+            Start + milliseconds(160));
+}
+
+TEST(FramePacer, BurstStartsNowAfterLongPause) {
+  auto Start = Clock::now();
+  FramePacer UnderTest(100.0, 0.05, 0.1, Start);
+  bool Late{true};
+  UnderTest.schedule(Start, Late);
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(500), Late),
+            Start + milliseconds(500));
+  EXPECT_FALSE(Late);
+  EXPECT_EQ(UnderTest.schedule(Start + milliseconds(500), Late),
+            Start + milliseconds(510));
+}
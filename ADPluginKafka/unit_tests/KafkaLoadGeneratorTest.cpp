@@ -0,0 +1,114 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  KafkaLoadGeneratorTest.cpp
+ *  @brief Unit tests of the frame pool of the load generator driver.
+ */
+
+#include "KafkaLoadGenerator.h"
+#include "PortName.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <utility>
+#include <vector>
+
+/// @brief Simple stand-in class used for unit tests.
+class KafkaLoadGeneratorStandIn : public KafkaLoadGenerator {
+public:
+  KafkaLoadGeneratorStandIn()
+      : KafkaLoadGenerator(PortName().c_str(), 0, 0, 0, 0) {}
+  using KafkaLoadGenerator::Frame;
+  using KafkaLoadGenerator::FramePool;
+  using KafkaLoadGenerator::FramePoolStale;
+  using KafkaLoadGenerator::NumAttributesParam;
+  using KafkaLoadGenerator::PoolSizeParam;
+  using KafkaLoadGenerator::SparsityParam;
+  using KafkaLoadGenerator::generateFramePool;
+
+  void generate(int SizeX, int SizeY, NDDataType_t DataType) {
+    lock();
+    setIntegerParam(ADSizeX, SizeX);
+    setIntegerParam(ADSizeY, SizeY);
+    setIntegerParam(NDDataType, DataType);
+    generateFramePool();
+    unlock();
+  }
+};
+
+namespace {
+using Frames = std::vector<KafkaLoadGeneratorStandIn::Frame>;
+
+/// @brief Fraction of the pixels of an NDUInt16 frame pool which are zero.
+double zeroFraction(Frames const &Pool) {
+  size_t Zeros{0};
+  size_t Pixels{0};
+  for (auto const &CurrentFrame : Pool) {
+    auto Data =
+        reinterpret_cast<epicsUInt16 const *>(CurrentFrame.Data.data());
+    auto Elements = CurrentFrame.Data.size() / sizeof(epicsUInt16);
+    Zeros += std::count(Data, Data + Elements, 0);
+    Pixels += Elements;
+  }
+  return static_cast<double>(Zeros) / Pixels;
+}
+} // namespace
+
+TEST(KafkaLoadGenerator, PoolSizeAndAttributes) {
+  KafkaLoadGeneratorStandIn UnderTest;
+  ASSERT_TRUE(UnderTest.PoolSizeParam.writeValue(4));
+  ASSERT_TRUE(UnderTest.NumAttributesParam.writeValue(7));
+  UnderTest.generate(8, 4, NDUInt16);
+  ASSERT_EQ(UnderTest.FramePool.size(), 4u);
+  EXPECT_FALSE(UnderTest.FramePoolStale);
+  for (auto const &CurrentFrame : UnderTest.FramePool) {
+    EXPECT_EQ(CurrentFrame.Attributes->count(), 7);
+    EXPECT_NE(CurrentFrame.Attributes->find("LoadGenAttr0"), nullptr);
+    EXPECT_NE(CurrentFrame.Attributes->find("LoadGenAttr6"), nullptr);
+  }
+}
+
+TEST(KafkaLoadGenerator, InvalidPoolSettings) {
+  KafkaLoadGeneratorStandIn UnderTest;
+  EXPECT_FALSE(UnderTest.PoolSizeParam.writeValue(0));
+  EXPECT_FALSE(UnderTest.NumAttributesParam.writeValue(-1));
+  EXPECT_FALSE(UnderTest.SparsityParam.writeValue(1.5));
+  EXPECT_TRUE(UnderTest.PoolSizeParam.writeValue(2));
+  EXPECT_TRUE(UnderTest.FramePoolStale);
+}
+
+TEST(KafkaLoadGenerator, DataTypes) {
+  KafkaLoadGeneratorStandIn UnderTest;
+  ASSERT_TRUE(UnderTest.PoolSizeParam.writeValue(2));
+  std::vector<std::pair<NDDataType_t, size_t>> Types{
+      {NDInt8, 1},  {NDUInt8, 1},  {NDInt16, 2},  {NDUInt16, 2},
+      {NDInt32, 4}, {NDUInt32, 4}, {NDInt64, 8},  {NDUInt64, 8},
+      {NDFloat32, 4}, {NDFloat64, 8}};
+  for (auto const &Type : Types) {
+    UnderTest.generate(8, 4, Type.first);
+    ASSERT_EQ(UnderTest.FramePool.size(), 2u) << Type.first;
+    EXPECT_EQ(UnderTest.FramePool[0].Data.size(), 8 * 4 * Type.second)
+        << Type.first;
+  }
+}
+
+TEST(KafkaLoadGenerator, InvalidFrameGivesEmptyPool) {
+  KafkaLoadGeneratorStandIn UnderTest;
+  UnderTest.generate(0, 4, NDUInt16);
+  EXPECT_TRUE(UnderTest.FramePool.empty());
+  EXPECT_TRUE(UnderTest.FramePoolStale);
+  UnderTest.generate(8, 4, static_cast<NDDataType_t>(42));
+  EXPECT_TRUE(UnderTest.FramePool.empty());
+}
+
+TEST(KafkaLoadGenerator, Sparsity) {
+  KafkaLoadGeneratorStandIn UnderTest;
+  ASSERT_TRUE(UnderTest.PoolSizeParam.writeValue(2));
+  ASSERT_TRUE(UnderTest.SparsityParam.writeValue(1.0));
+  UnderTest.generate(100, 100, NDUInt16);
+  EXPECT_EQ(zeroFraction(UnderTest.FramePool), 1.0);
+  ASSERT_TRUE(UnderTest.SparsityParam.writeValue(0.0));
+  UnderTest.generate(100, 100, NDUInt16);
+  EXPECT_LT(zeroFraction(UnderTest.FramePool), 0.01);
+  ASSERT_TRUE(UnderTest.SparsityParam.writeValue(0.5));
+  UnderTest.generate(100, 100, NDUInt16);
+  EXPECT_NEAR(zeroFraction(UnderTest.FramePool), 0.5, 0.05);
+}
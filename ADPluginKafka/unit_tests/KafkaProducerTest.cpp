@@ -65,6 +65,103 @@ TEST_F(KafkaProducerEnv, InitTest) {
   ASSERT_FALSE(prod.SendKafkaPacket(tempStr, 0, time_point()));
 }
 
+TEST_F(KafkaProducerEnv, SetDecimation) {
+  KafkaProducer prod;
+  ASSERT_FALSE(prod.SetDecimation(0));
+  ASSERT_EQ(prod.GetDecimation(), 1);
+  ASSERT_TRUE(prod.SetDecimation(3));
+  ASSERT_EQ(prod.GetDecimation(), 3);
+}
+
+/// @brief Gives access to the producers of the shards.
+class KafkaProducerShardsStandIn : public KafkaProducer {
+public:
+  using KafkaProducer::Shards;
+};
+
+TEST_F(KafkaProducerEnv, SetTopicConfig) {
+  KafkaProducerShardsStandIn prod;
+  ASSERT_TRUE(prod.SetTopic("some_topic"));
+  ASSERT_EQ(prod.GetTopic(), "some_topic");
+  ASSERT_FALSE(prod.SetTopic(""));
+  ASSERT_EQ(prod.GetTopic(), "some_topic");
+  ASSERT_TRUE(prod.SetBrokerAddr("localhost:9999"));
+  ASSERT_NE(prod.Shards[0].Producer, nullptr);
+  ASSERT_TRUE(prod.SetCompression("lz4"));
+  ASSERT_EQ(prod.GetCompression(), "lz4");
+  ASSERT_FALSE(prod.SetCompression("no_such_codec"));
+  ASSERT_EQ(prod.GetCompression(), "lz4");
+  ASSERT_TRUE(prod.SetPartitioner("murmur2"));
+  // The producer (and thereby the topic handle) has been re-created with the
+  // new topic configuration, which is part of its key in the pool
+  ASSERT_NE(prod.Shards[0].Producer, nullptr);
+  ASSERT_NE(prod.Shards[0].Topic, nullptr);
+  auto Key = prod.Shards[0].Producer->key();
+  EXPECT_NE(Key.find("=lz4\n"), std::string::npos);
+  EXPECT_NE(Key.find("partitioner=murmur2\n"), std::string::npos);
+}
+
+TEST_F(KafkaProducerEnv, MemoryBudgetLimitsQueue) {
+  // The budget is process-wide, restore it even if the test fails
+  struct BudgetGuard {
+    ~BudgetGuard() { ProducerPool::instance().setBudgetKBytes(0); }
+  } Guard;
+  ProducerPool::instance().setBudgetKBytes(4096);
+  KafkaProducer prod;
+  ASSERT_TRUE(prod.SetMessageBufferSizeKbytes(16384));
+  ASSERT_TRUE(prod.SetMaxMessageSize(4 * 1024 * 1024));
+  prod.SetBrokerAddr("localhost:9999");
+  // Two messages of 4 MB do not fit in the remaining 4 MB
+  EXPECT_EQ(prod.GetEffectiveBufferKBytes(), 0u);
+  EXPECT_EQ(ProducerPool::instance().getCommittedKBytes(), 0u);
+  ASSERT_TRUE(prod.SetMaxMessageSize(1024 * 1024));
+  EXPECT_EQ(prod.GetEffectiveBufferKBytes(), 4096u);
+}
+
+TEST_F(KafkaProducerEnv, DeferredApply) {
+  KafkaProducer prod;
+  ASSERT_TRUE(prod.GetAutoApply());
+  ASSERT_TRUE(prod.SetStatsTimeMS(100));
+  ASSERT_FALSE(prod.ConfigurationPending());
+  ASSERT_TRUE(prod.SetAutoApply(false));
+  ASSERT_TRUE(prod.SetStatsTimeMS(200));
+  ASSERT_TRUE(prod.SetMessageQueueLength(20));
+  ASSERT_TRUE(prod.ConfigurationPending());
+  ASSERT_TRUE(prod.ApplyConfiguration());
+  ASSERT_FALSE(prod.ConfigurationPending());
+  ASSERT_TRUE(prod.SetStatsTimeMS(300));
+  ASSERT_TRUE(prod.SetAutoApply(true));
+  ASSERT_FALSE(prod.ConfigurationPending());
+}
+
+TEST_F(KafkaProducerEnv, SendSharedMessageWithDecimation) {
+  KafkaProducer prod;
+  ASSERT_TRUE(prod.SetDecimation(2));
+  SharedMessage Message;
+  Message.Data = std::shared_ptr<const unsigned char>(
+      new unsigned char[4]{1, 2, 3, 4}, std::default_delete<unsigned char[]>());
+  Message.Size = 4;
+  // No broker, the first message is sent and fails
+  ASSERT_FALSE(prod.SendKafkaPacket(Message, time_point()));
+  // Skipped by decimation, which is not a failure
+  ASSERT_TRUE(prod.SendKafkaPacket(Message, time_point()));
+  // The failed message must not hold on to the data
+  ASSERT_EQ(Message.Data.use_count(), 1);
+}
+
+TEST_F(KafkaProducerEnv, SetShardCount) {
+  KafkaProducer prod;
+  ASSERT_EQ(prod.GetShardCount(), 1);
+  ASSERT_FALSE(prod.SetShardCount(0));
+  ASSERT_FALSE(prod.SetShardCount(KafkaProducer::MaxShards + 1));
+  ASSERT_EQ(prod.GetShardCount(), 1);
+  ASSERT_TRUE(prod.SetShardCount(4));
+  ASSERT_EQ(prod.GetShardCount(), 4);
+  // No broker, so no producers to send the message with
+  unsigned char tempStr[] = "some";
+  ASSERT_FALSE(prod.SendKafkaPacket(tempStr, 4, time_point()));
+}
+
 //TEST_F(KafkaProducerEnv, SetTopicAndConnectionTest1) {
 //  KafkaProducerStandIn prod;
 //  EXPECT_CALL(prod, MakeConnection()).Times(AtLeast(1));
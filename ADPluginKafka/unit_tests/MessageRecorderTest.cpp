@@ -0,0 +1,184 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  MessageRecorderTest.cpp
+ *  @brief Unit tests of the segment file writer.
+ */
+
+#include "MessageRecorder.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <unistd.h>
+
+using namespace KafkaInterface;
+
+namespace {
+SharedMessage makeMessage(std::size_t Size, unsigned char Value) {
+  auto Buffer = std::make_shared<std::vector<unsigned char>>(Size, Value);
+  SharedMessage Message;
+  Message.Data = std::shared_ptr<const unsigned char>(Buffer, Buffer->data());
+  Message.Size = Size;
+  return Message;
+}
+
+std::vector<char> readFile(std::string const &Path) {
+  std::ifstream File(Path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(File),
+          std::istreambuf_iterator<char>()};
+}
+} // namespace
+
+class MessageRecorderTest : public ::testing::Test {
+public:
+  void SetUp() override {
+    char Template[] = "/tmp/MessageRecorderTestXXXXXX";
+    ASSERT_NE(mkdtemp(Template), nullptr);
+    Directory = Template;
+  }
+
+  void TearDown() override {
+    for (auto const &Name : listFiles()) {
+      unlink((Directory + "/" + Name).c_str());
+    }
+    rmdir(Directory.c_str());
+  }
+
+  std::vector<std::string> listFiles(std::string const &Suffix = "") {
+    std::vector<std::string> Files;
+    auto Dir = opendir(Directory.c_str());
+    if (nullptr == Dir) {
+      return Files;
+    }
+    while (auto Entry = readdir(Dir)) {
+      std::string Name{Entry->d_name};
+      if (Name.size() > Suffix.size() and
+          0 == Name.compare(Name.size() - Suffix.size(), Suffix.size(),
+                            Suffix) and
+          '.' != Name[0]) {
+        Files.push_back(Name);
+      }
+    }
+    closedir(Dir);
+    std::sort(Files.begin(), Files.end());
+    return Files;
+  }
+
+  /// @brief Records messages of the given sizes, the byte value of message i
+  /// is i + 1 and its timestamp i ns.
+  void record(std::vector<std::size_t> const &Sizes, bool DirectIO,
+              int SegmentSizeMB = 1) {
+    MessageRecorder UnderTest;
+    ASSERT_TRUE(UnderTest.SetDirectory(Directory));
+    ASSERT_TRUE(UnderTest.SetFilePrefix("test"));
+    ASSERT_TRUE(UnderTest.SetSegmentSizeMB(SegmentSizeMB));
+    UnderTest.SetDirectIO(DirectIO);
+    UnderTest.SetQueueSize(static_cast<int>(Sizes.size()));
+    UnderTest.SetEnabled(true);
+    for (std::size_t i = 0; i < Sizes.size(); ++i) {
+      EXPECT_TRUE(UnderTest.Record(
+          makeMessage(Sizes[i], static_cast<unsigned char>(i + 1)),
+          time_point(std::chrono::nanoseconds(i))));
+    }
+    UnderTest.SetEnabled(false);
+    // The destructor writes the queued messages
+  }
+
+  /// @brief Checks a segment and returns the messages in it.
+  std::vector<std::vector<char>> readSegment(std::string const &Name) {
+    std::vector<std::vector<char>> Messages;
+    auto Data = readFile(Directory + "/" + Name);
+    auto Index = readFile(Directory + "/" + Name + ".idx");
+    MessageRecorder::SegmentHeader Header;
+    EXPECT_GE(Data.size(), sizeof(Header));
+    std::memcpy(&Header, Data.data(), sizeof(Header));
+    EXPECT_EQ(0, std::memcmp(Header.Magic, MessageRecorder::Magic, 8));
+    EXPECT_EQ(Header.Version, MessageRecorder::FormatVersion);
+    std::size_t Offset{Header.HeaderSize};
+    std::size_t IndexOffset{0};
+    while (Offset < Data.size()) {
+      MessageRecorder::RecordHeader Record;
+      std::memcpy(&Record, Data.data() + Offset, sizeof(Record));
+      MessageRecorder::IndexEntry Entry;
+      EXPECT_LE(IndexOffset + sizeof(Entry), Index.size());
+      std::memcpy(&Entry, Index.data() + IndexOffset, sizeof(Entry));
+      EXPECT_EQ(Entry.Offset, Offset);
+      EXPECT_EQ(Entry.Size, Record.Size);
+      EXPECT_EQ(Entry.TimestampNs, Record.TimestampNs);
+      auto Start = Data.begin() + Offset + sizeof(Record);
+      Messages.emplace_back(Start, Start + Record.Size);
+      Offset += sizeof(Record) + (Record.Size + 7) / 8 * 8;
+      IndexOffset += sizeof(Entry);
+    }
+    EXPECT_EQ(Offset, Data.size());
+    EXPECT_EQ(IndexOffset, Index.size());
+    return Messages;
+  }
+
+  std::string Directory;
+};
+
+TEST_F(MessageRecorderTest, NothingRecordedWhenDisabled) {
+  {
+    MessageRecorder UnderTest;
+    UnderTest.SetDirectory(Directory);
+    EXPECT_FALSE(UnderTest.Record(makeMessage(10, 1), time_point()));
+    EXPECT_FALSE(UnderTest.KafkaBypassed());
+  }
+  EXPECT_TRUE(listFiles().empty());
+}
+
+TEST_F(MessageRecorderTest, InvalidSettings) {
+  MessageRecorder UnderTest;
+  EXPECT_FALSE(UnderTest.SetDirectory(""));
+  EXPECT_FALSE(UnderTest.SetFilePrefix("a/b"));
+  EXPECT_FALSE(UnderTest.SetSegmentSizeMB(0));
+  EXPECT_FALSE(UnderTest.SetQueueSize(0));
+}
+
+TEST_F(MessageRecorderTest, MessagesAreWrittenToSegment) {
+  std::vector<std::size_t> Sizes{5, 16, 100};
+  record(Sizes, false);
+  auto Segments = listFiles(".adar");
+  ASSERT_EQ(Segments.size(), 1u);
+  EXPECT_EQ(Segments[0].find("test_"), 0u);
+  auto Messages = readSegment(Segments[0]);
+  ASSERT_EQ(Messages.size(), Sizes.size());
+  for (std::size_t i = 0; i < Sizes.size(); ++i) {
+    EXPECT_EQ(Messages[i],
+              std::vector<char>(Sizes[i], static_cast<char>(i + 1)));
+  }
+}
+
+TEST_F(MessageRecorderTest, SegmentsAreRotated) {
+  std::vector<std::size_t> Sizes(5, 300000);
+  record(Sizes, false);
+  auto Segments = listFiles(".adar");
+  ASSERT_EQ(Segments.size(), 2u);
+  EXPECT_EQ(readSegment(Segments[0]).size(), 3u);
+  EXPECT_EQ(readSegment(Segments[1]).size(), 2u);
+}
+
+TEST_F(MessageRecorderTest, MessageLargerThanSegment) {
+  record({2 * 1024 * 1024}, false);
+  auto Segments = listFiles(".adar");
+  ASSERT_EQ(Segments.size(), 1u);
+  EXPECT_EQ(readSegment(Segments[0]).size(), 1u);
+}
+
+TEST_F(MessageRecorderTest, DirectIO) {
+  std::vector<std::size_t> Sizes{5, 5000, 300000, 17};
+  record(Sizes, true, 2);
+  auto Segments = listFiles(".adar");
+  ASSERT_EQ(Segments.size(), 1u);
+  auto Messages = readSegment(Segments[0]);
+  ASSERT_EQ(Messages.size(), Sizes.size());
+  for (std::size_t i = 0; i < Sizes.size(); ++i) {
+    EXPECT_EQ(Messages[i],
+              std::vector<char>(Sizes[i], static_cast<char>(i + 1)));
+  }
+}
@@ -0,0 +1,235 @@
+/** Copyright (C) 2020 European Spallation Source */
+
+/** @file  NDArrayPreprocessorTest.cpp
+ *  @brief Unit tests of the ROI, binning and decimation stage.
+ */
+
+#include "NDArrayPreprocessor.h"
+#include <ciso646>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <limits>
+#include <memory>
+
+class NDArrayPreprocessorTest : public ::testing::Test {
+public:
+  void SetUp() override { Pool.reset(new NDArrayPool(nullptr, 0)); }
+
+  template <typename T>
+  NDArray *makeArray(size_t SizeX, size_t SizeY, NDDataType_t Type) {
+    size_t Dims[] = {SizeX, SizeY};
+    auto Array = Pool->alloc(2, Dims, Type, 0, nullptr);
+    auto Data = reinterpret_cast<T *>(Array->pData);
+    for (size_t i = 0; i < SizeX * SizeY; ++i) {
+      Data[i] = static_cast<T>(i);
+    }
+    Array->uniqueId = 42;
+    return Array;
+  }
+
+  std::unique_ptr<NDArrayPool> Pool;
+  NDArrayPreprocessor UnderTest;
+};
+
+TEST_F(NDArrayPreprocessorTest, AcceptAllByDefault) {
+  auto Now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(UnderTest.acceptArray(Now));
+  }
+  EXPECT_EQ(UnderTest.getSkippedArrays(), 0);
+}
+
+TEST_F(NDArrayPreprocessorTest, DecimationSendsEveryNthArray) {
+  ASSERT_TRUE(UnderTest.setDecimationFactor(3));
+  auto Now = std::chrono::steady_clock::now();
+  int Accepted{0};
+  for (int i = 0; i < 9; ++i) {
+    if (UnderTest.acceptArray(Now)) {
+      ++Accepted;
+    }
+  }
+  EXPECT_EQ(Accepted, 3);
+  EXPECT_EQ(UnderTest.getSkippedArrays(), 6);
+}
+
+TEST_F(NDArrayPreprocessorTest, InvalidDecimationFails) {
+  EXPECT_FALSE(UnderTest.setDecimationFactor(0));
+  EXPECT_EQ(UnderTest.getDecimationFactor(), 1);
+}
+
+TEST_F(NDArrayPreprocessorTest, MaxRateSkipsArrays) {
+  ASSERT_TRUE(UnderTest.setMaxRate(10.0));
+  auto Now = std::chrono::steady_clock::now();
+  EXPECT_TRUE(UnderTest.acceptArray(Now));
+  EXPECT_FALSE(UnderTest.acceptArray(Now + std::chrono::milliseconds(50)));
+  EXPECT_TRUE(UnderTest.acceptArray(Now + std::chrono::milliseconds(100)));
+  EXPECT_EQ(UnderTest.getSkippedArrays(), 1);
+}
+
+TEST_F(NDArrayPreprocessorTest, PassThroughWhenDisabled) {
+  auto Array = makeArray<std::uint16_t>(4, 4, NDUInt16);
+  EXPECT_EQ(UnderTest.process(Array, Pool.get()), Array);
+  EXPECT_EQ(UnderTest.getTransformAttributes(), nullptr);
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, Crop) {
+  auto Array = makeArray<std::int32_t>(4, 4, NDInt32);
+  UnderTest.setRoiEnabled(true);
+  UnderTest.setRoiMinX(1);
+  UnderTest.setRoiMinY(2);
+  UnderTest.setRoiSizeX(2);
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  ASSERT_NE(Result, Array);
+  ASSERT_EQ(Result->ndims, 2);
+  EXPECT_EQ(Result->dims[0].size, 2u);
+  EXPECT_EQ(Result->dims[1].size, 2u);
+  EXPECT_EQ(Result->uniqueId, 42);
+  auto Data = reinterpret_cast<std::int32_t *>(Result->pData);
+  EXPECT_EQ(Data[0], 9);
+  EXPECT_EQ(Data[1], 10);
+  EXPECT_EQ(Data[2], 13);
+  EXPECT_EQ(Data[3], 14);
+  Result->release();
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, BinSum) {
+  auto Array = makeArray<std::int32_t>(4, 2, NDInt32);
+  UnderTest.setBinX(2);
+  UnderTest.setBinY(2);
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  EXPECT_EQ(Result->dims[0].size, 2u);
+  EXPECT_EQ(Result->dims[1].size, 1u);
+  auto Data = reinterpret_cast<std::int32_t *>(Result->pData);
+  EXPECT_EQ(Data[0], 0 + 1 + 4 + 5);
+  EXPECT_EQ(Data[1], 2 + 3 + 6 + 7);
+  Result->release();
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, BinSumSaturates) {
+  size_t Dims[] = {2, 2};
+  auto Array = Pool->alloc(2, Dims, NDUInt8, 0, nullptr);
+  auto InData = reinterpret_cast<std::uint8_t *>(Array->pData);
+  std::fill(InData, InData + 4, 200);
+  UnderTest.setBinX(2);
+  UnderTest.setBinY(2);
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  EXPECT_EQ(reinterpret_cast<std::uint8_t *>(Result->pData)[0], 255);
+  Result->release();
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, BinSumSaturates64Bit) {
+  size_t Dims[] = {2, 1};
+  auto Array = Pool->alloc(2, Dims, NDInt64, 0, nullptr);
+  auto InData = reinterpret_cast<std::int64_t *>(Array->pData);
+  InData[0] = std::numeric_limits<std::int64_t>::lowest();
+  InData[1] = -1;
+  UnderTest.setBinX(2);
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  EXPECT_EQ(reinterpret_cast<std::int64_t *>(Result->pData)[0],
+            std::numeric_limits<std::int64_t>::lowest());
+  Result->release();
+  Array->release();
+
+  Array = Pool->alloc(2, Dims, NDUInt64, 0, nullptr);
+  auto InUData = reinterpret_cast<std::uint64_t *>(Array->pData);
+  std::fill(InUData, InUData + 2, std::numeric_limits<std::uint64_t>::max());
+  Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  EXPECT_EQ(reinterpret_cast<std::uint64_t *>(Result->pData)[0],
+            std::numeric_limits<std::uint64_t>::max());
+  Result->release();
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, BinRGB1KeepsColours) {
+  size_t Dims[] = {3, 4, 2};
+  auto Array = Pool->alloc(3, Dims, NDInt32, 0, nullptr);
+  auto InData = reinterpret_cast<std::int32_t *>(Array->pData);
+  for (int i = 0; i < 3 * 4 * 2; ++i) {
+    InData[i] = i;
+  }
+  epicsInt32 ColorMode{NDColorModeRGB1};
+  Array->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32,
+                             &ColorMode);
+  UnderTest.setBinX(2);
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  ASSERT_EQ(Result->ndims, 3);
+  EXPECT_EQ(Result->dims[0].size, 3u);
+  EXPECT_EQ(Result->dims[1].size, 2u);
+  EXPECT_EQ(Result->dims[2].size, 2u);
+  EXPECT_EQ(Result->dims[1].binning, 2);
+  auto Data = reinterpret_cast<std::int32_t *>(Result->pData);
+  EXPECT_EQ(Data[0], 0 + 3);
+  EXPECT_EQ(Data[1], 1 + 4);
+  EXPECT_EQ(Data[11], 20 + 23);
+  Result->release();
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, CropRGB2KeepsColours) {
+  size_t Dims[] = {4, 3, 2};
+  auto Array = Pool->alloc(3, Dims, NDInt32, 0, nullptr);
+  auto InData = reinterpret_cast<std::int32_t *>(Array->pData);
+  for (int i = 0; i < 4 * 3 * 2; ++i) {
+    InData[i] = i;
+  }
+  epicsInt32 ColorMode{NDColorModeRGB2};
+  Array->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32,
+                             &ColorMode);
+  UnderTest.setRoiEnabled(true);
+  UnderTest.setRoiMinX(1);
+  UnderTest.setRoiSizeX(2);
+  UnderTest.setRoiMinY(1);
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  ASSERT_EQ(Result->ndims, 3);
+  EXPECT_EQ(Result->dims[0].size, 2u);
+  EXPECT_EQ(Result->dims[1].size, 3u);
+  EXPECT_EQ(Result->dims[2].size, 1u);
+  EXPECT_EQ(Result->dims[2].offset, 1);
+  auto Data = reinterpret_cast<std::int32_t *>(Result->pData);
+  EXPECT_EQ(Data[0], 13);
+  EXPECT_EQ(Data[1], 14);
+  EXPECT_EQ(Data[2], 17);
+  EXPECT_EQ(Data[5], 22);
+  Result->release();
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, BinMean) {
+  auto Array = makeArray<float>(2, 2, NDFloat32);
+  UnderTest.setBinX(2);
+  UnderTest.setBinY(2);
+  ASSERT_TRUE(UnderTest.setBinMode(
+      static_cast<int>(NDArrayPreprocessor::BinMode::MEAN)));
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  EXPECT_FLOAT_EQ(reinterpret_cast<float *>(Result->pData)[0], 1.5f);
+  Result->release();
+  Array->release();
+}
+
+TEST_F(NDArrayPreprocessorTest, TransformAttributesAdded) {
+  auto Array = makeArray<std::uint16_t>(4, 4, NDUInt16);
+  UnderTest.setBinX(2);
+  UnderTest.setDecimationFactor(2);
+  auto Result = UnderTest.process(Array, Pool.get());
+  ASSERT_NE(Result, nullptr);
+  auto Attributes = UnderTest.getTransformAttributes();
+  ASSERT_NE(Attributes, nullptr);
+  EXPECT_NE(Attributes->find("KafkaBinX"), nullptr);
+  EXPECT_NE(Attributes->find("KafkaBinMode"), nullptr);
+  EXPECT_NE(Attributes->find("KafkaDecimation"), nullptr);
+  EXPECT_EQ(Array->pAttributeList->find("KafkaBinX"), nullptr);
+  Result->release();
+  Array->release();
+}
@@ -97,6 +97,54 @@ TEST_F(Serializer, SerializeTest) {
   delete sendArr;
 }
 
+TEST_F(Serializer, SerializeSharedEqualsSerializeTest) {
+  NDArraySerializer ser("Some name");
+  auto sendArr = arrGen->GenerateNDArray(10, 1000, 2, NDUInt16);
+  auto SharedBuffer = ser.SerializeDataShared(*sendArr);
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  ASSERT_EQ(SharedBuffer->size(), bufferSize);
+  EXPECT_EQ(std::memcmp(SharedBuffer->data(), bufferPtr, bufferSize), 0);
+
+  // The shared buffer must remain valid after the serializer is re-used
+  auto recvArr = GetADArray(SharedBuffer->data());
+  CompareData(sendArr, recvArr);
+  CompareAttributes(sendArr, recvArr);
+  sendArr->release();
+}
+
+TEST_F(Serializer, FrameHeadersMatchMessage) {
+  NDArraySerializer ser("Some name");
+  auto sendArr = arrGen->GenerateNDArray(2, 50, 3, NDInt32);
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  auto recvArr = GetADArray(bufferPtr);
+
+  auto Headers = KafkaInterface::EncodeFrameHeaders(
+      ser.CreateFrameHeaders(*sendArr));
+  KafkaInterface::FrameHeaders Frame;
+  for (auto const &Header : Headers) {
+    EXPECT_TRUE(KafkaInterface::DecodeFrameHeader(
+        Header.first, Header.second.data(), Header.second.size(), Frame));
+  }
+  EXPECT_EQ(Frame.SourceName, recvArr->source_name()->str());
+  EXPECT_EQ(Frame.UniqueId, recvArr->id());
+  EXPECT_EQ(static_cast<std::uint64_t>(Frame.TimestampNs),
+            recvArr->timestamp());
+  EXPECT_EQ(Frame.DataType, static_cast<std::int8_t>(recvArr->data_type()));
+  ASSERT_EQ(Frame.Dims.size(), recvArr->dimensions()->size());
+  for (size_t i = 0; i < Frame.Dims.size(); ++i) {
+    EXPECT_EQ(Frame.Dims[i], recvArr->dimensions()->Get(i));
+  }
+  EXPECT_EQ(Frame.DataSize, recvArr->data()->size());
+  EXPECT_EQ(Frame.Codec, "none");
+  EXPECT_EQ(Frame.SchemaId, "ADAr");
+  EXPECT_FALSE(KafkaInterface::DecodeFrameHeader("id", "abc", 3, Frame));
+  sendArr->release();
+}
+
 /// @brief A testing fixture used for setting up unit tests.
 class DeSerializer : public ::testing::Test {
 public:
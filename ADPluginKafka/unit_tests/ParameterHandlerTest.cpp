@@ -6,7 +6,10 @@
 
 #include "Parameter.h"
 #include "ParameterHandler.h"
+#include <atomic>
 #include <gtest/gtest.h>
+#include <thread>
+#include <vector>
 #include "NDPluginDriverStandIn.h"
 
 using ::testing::_;
@@ -44,6 +47,15 @@ TEST(ParameterHandler, RegisterInt64Parameter) {
   UnderTest.registerParameter(&Parameter);
 }
 
+TEST(ParameterHandler, RegisterFloat64Parameter) {
+  std::string ParameterName{"PARAM_NAME"};
+  Parameter<double> Parameter(ParameterName, [](double){return true;}, []()->double {return {};});
+  auto DriverPlugin = createStandInDriverPlugin();
+  ParameterHandler UnderTest(DriverPlugin.get());
+  EXPECT_CALL(*DriverPlugin, createParam(StrEq(ParameterName), asynParamFloat64, _)).Times(Exactly(1)).WillOnce(Return(asynSuccess));
+  UnderTest.registerParameter(&Parameter);
+}
+
 TEST(ParameterHandler, RegisterUnknownTypeParameter) {
   std::string ParameterName{"PARAM_NAME"};
   Parameter<uint32_t> Parameter(ParameterName, [](uint32_t){return true;}, []()->uint32_t {return {};});
@@ -154,6 +166,7 @@ TEST(ParameterHandler, UpdateDbUnknownParameter) {
   EXPECT_CALL(*DriverPlugin, setInteger64Param(_, _)).Times(0);
   EXPECT_CALL(*DriverPlugin, setIntegerParam(_, _)).Times(0);
   UnderTest.updateDbValue(&Parameter2);
+  UnderTest.processQueuedUpdates();
 }
 
 TEST(ParameterHandler, UpdateDbInt32Parameter) {
@@ -166,6 +179,7 @@ TEST(ParameterHandler, UpdateDbInt32Parameter) {
   UnderTest.registerParameter(&Parameter1);
   EXPECT_CALL(*DriverPlugin, setIntegerParam(ParamIndex, ReturnValue)).Times(Exactly(1)).WillOnce(Return(asynSuccess));
   UnderTest.updateDbValue(&Parameter1);
+  EXPECT_TRUE(UnderTest.processQueuedUpdates());
 }
 
 TEST(ParameterHandler, UpdateDbInt64Parameter) {
@@ -178,6 +192,7 @@ TEST(ParameterHandler, UpdateDbInt64Parameter) {
   UnderTest.registerParameter(&Parameter1);
   EXPECT_CALL(*DriverPlugin, setInteger64Param(ParamIndex, ReturnValue)).Times(Exactly(1)).WillOnce(Return(asynSuccess));
   UnderTest.updateDbValue(&Parameter1);
+  EXPECT_TRUE(UnderTest.processQueuedUpdates());
 }
 
 TEST(ParameterHandler, UpdateDbStringParameter) {
@@ -190,4 +205,81 @@ TEST(ParameterHandler, UpdateDbStringParameter) {
   UnderTest.registerParameter(&Parameter1);
   EXPECT_CALL(*DriverPlugin, setStringParam(ParamIndex, ReturnValue)).Times(Exactly(1)).WillOnce(Return(asynSuccess));
   UnderTest.updateDbValue(&Parameter1);
-}
\ No newline at end of file
+  EXPECT_TRUE(UnderTest.processQueuedUpdates());
+}
+
+TEST(ParameterHandler, UpdateDbNotWrittenUntilProcessed) {
+  int32_t const ReturnValue{42};
+  int32_t const ParamIndex{12345};
+  Parameter<int32_t> Parameter1("PARAM_NAME", [&](int32_t){return true;}, []()->int32_t {return ReturnValue;});
+  auto DriverPlugin = createStandInDriverPlugin();
+  ParameterHandler UnderTest(DriverPlugin.get());
+  EXPECT_CALL(*DriverPlugin, createParam(_, _, _)).Times(Exactly(1)).WillOnce(DoAll(SetArgPointee<2>(ParamIndex), Return(asynSuccess)));
+  UnderTest.registerParameter(&Parameter1);
+  EXPECT_CALL(*DriverPlugin, setIntegerParam(_, _)).Times(0);
+  UnderTest.updateDbValue(&Parameter1);
+  testing::Mock::VerifyAndClearExpectations(DriverPlugin.get());
+  EXPECT_CALL(*DriverPlugin, setIntegerParam(ParamIndex, ReturnValue)).Times(Exactly(1)).WillOnce(Return(asynSuccess));
+  EXPECT_TRUE(UnderTest.processQueuedUpdates());
+  EXPECT_FALSE(UnderTest.processQueuedUpdates());
+}
+
+TEST(ParameterHandler, UpdateDbCoalescesRepeatedUpdates) {
+  int32_t Value{1};
+  int32_t const ParamIndex{12345};
+  Parameter<int32_t> Parameter1("PARAM_NAME", [&](int32_t){return true;}, [&]()->int32_t {return Value;});
+  auto DriverPlugin = createStandInDriverPlugin();
+  ParameterHandler UnderTest(DriverPlugin.get());
+  EXPECT_CALL(*DriverPlugin, createParam(_, _, _)).Times(Exactly(1)).WillOnce(DoAll(SetArgPointee<2>(ParamIndex), Return(asynSuccess)));
+  UnderTest.registerParameter(&Parameter1);
+  EXPECT_CALL(*DriverPlugin, setIntegerParam(ParamIndex, 3)).Times(Exactly(1)).WillOnce(Return(asynSuccess));
+  UnderTest.updateDbValue(&Parameter1);
+  Value = 2;
+  UnderTest.updateDbValue(&Parameter1);
+  Value = 3;
+  UnderTest.updateDbValue(&Parameter1);
+  EXPECT_TRUE(UnderTest.processQueuedUpdates());
+}
+
+TEST(ParameterHandler, UpdateDbFromSeveralThreads) {
+  int const NrOfParameters{8};
+  auto DriverPlugin = createStandInDriverPlugin();
+  ParameterHandler UnderTest(DriverPlugin.get());
+  std::vector<std::unique_ptr<Parameter<int32_t>>> Parameters;
+  int ParamIndex{100};
+  EXPECT_CALL(*DriverPlugin, createParam(_, _, _)).Times(Exactly(NrOfParameters)).WillRepeatedly(DoAll(testing::Invoke([&](const char *, asynParamType, int *Index){*Index = ParamIndex++;}), Return(asynSuccess)));
+  for (int i = 0; i < NrOfParameters; ++i) {
+    Parameters.emplace_back(new Parameter<int32_t>("PARAM_" + std::to_string(i), [](int32_t){return true;}, [i]()->int32_t {return i;}));
+    UnderTest.registerParameter(Parameters.back().get());
+  }
+  for (int i = 0; i < NrOfParameters; ++i) {
+    EXPECT_CALL(*DriverPlugin, setIntegerParam(100 + i, i)).Times(Exactly(1)).WillOnce(Return(asynSuccess));
+  }
+  std::vector<std::thread> Threads;
+  for (auto &CurrentParameter : Parameters) {
+    auto ParamPtr = CurrentParameter.get();
+    Threads.emplace_back([&UnderTest, ParamPtr]() {
+      for (int j = 0; j < 1000; ++j) {
+        UnderTest.updateDbValue(ParamPtr);
+      }
+    });
+  }
+  for (auto &CurrentThread : Threads) {
+    CurrentThread.join();
+  }
+  EXPECT_TRUE(UnderTest.processQueuedUpdates());
+}
+
+TEST(ParameterHandler, PeriodicTaskIsCalled) {
+  auto DriverPlugin = createStandInDriverPlugin();
+  ParameterHandler UnderTest(DriverPlugin.get());
+  std::atomic<int> Calls{0};
+  UnderTest.setPeriodicTask([&Calls]() { ++Calls; }, std::chrono::milliseconds(10));
+  UnderTest.startUpdateThread(std::chrono::milliseconds(2));
+  auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (Calls < 3 and std::chrono::steady_clock::now() < Deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  UnderTest.stopUpdateThread();
+  EXPECT_GE(Calls, 3);
+}
@@ -0,0 +1,157 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ProducerPoolTest.cpp
+ *  @brief Unit tests of the process-wide producer registry.
+ */
+
+#include "ProducerPool.h"
+#include <atomic>
+#include <ciso646>
+#include <gtest/gtest.h>
+#include <librdkafka/rdkafka.h>
+
+using namespace KafkaInterface;
+
+namespace {
+std::unique_ptr<RdKafka::Conf> makeConf(std::string const &Broker,
+                                        int BufferKBytes = 2048) {
+  std::unique_ptr<RdKafka::Conf> Conf(
+      RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL));
+  std::string ErrStr;
+  Conf->set("metadata.broker.list", Broker, ErrStr);
+  Conf->set("queue.buffering.max.kbytes", std::to_string(BufferKBytes),
+            ErrStr);
+  return Conf;
+}
+
+class CountingClient : public ProducerClient {
+public:
+  void OnDelivery(RdKafka::Message &, PooledProducer *) override {
+    ++Deliveries;
+  }
+  void OnEvent(RdKafka::Event &, PooledProducer *) override {}
+  std::atomic<int> Deliveries{0};
+};
+} // namespace
+
+TEST(ProducerPool, SharedProducerIsReused) {
+  ProducerPool UnderTest;
+  auto Conf = makeConf("localhost:9999");
+  std::string ErrStr;
+  auto First = UnderTest.acquire(Conf.get(), nullptr, true, 0, ErrStr);
+  auto Second = UnderTest.acquire(Conf.get(), nullptr, true, 0, ErrStr);
+  ASSERT_NE(First, nullptr);
+  EXPECT_EQ(First, Second);
+  EXPECT_EQ(UnderTest.getProducerCount(), 1u);
+  UnderTest.release(First, 100);
+  EXPECT_EQ(First, nullptr);
+  EXPECT_EQ(UnderTest.getProducerCount(), 1u);
+  UnderTest.release(Second, 100);
+  EXPECT_EQ(UnderTest.getProducerCount(), 0u);
+}
+
+TEST(ProducerPool, ProducersAreKeptApart) {
+  ProducerPool UnderTest;
+  auto Conf = makeConf("localhost:9999");
+  auto OtherConf = makeConf("otherhost:9999");
+  std::string ErrStr;
+  auto Shared = UnderTest.acquire(Conf.get(), nullptr, true, 0, ErrStr);
+  auto Exclusive = UnderTest.acquire(Conf.get(), nullptr, false, 0, ErrStr);
+  auto OtherSlot = UnderTest.acquire(Conf.get(), nullptr, true, 1, ErrStr);
+  auto OtherBroker =
+      UnderTest.acquire(OtherConf.get(), nullptr, true, 0, ErrStr);
+  EXPECT_NE(Shared, Exclusive);
+  EXPECT_NE(Shared, OtherSlot);
+  EXPECT_NE(Shared, OtherBroker);
+  EXPECT_FALSE(Exclusive->isShared());
+  EXPECT_EQ(UnderTest.getProducerCount(), 4u);
+  for (auto Producer : {&Shared, &Exclusive, &OtherSlot, &OtherBroker}) {
+    UnderTest.release(*Producer, 100);
+  }
+  EXPECT_EQ(UnderTest.getProducerCount(), 0u);
+}
+
+TEST(ProducerPool, BudgetLimitsQueues) {
+  ProducerPool UnderTest;
+  UnderTest.setBudgetKBytes(3072);
+  auto Conf = makeConf("localhost:9999", 2048);
+  std::string ErrStr;
+  auto First = UnderTest.acquire(Conf.get(), nullptr, false, 0, ErrStr);
+  auto Second = UnderTest.acquire(Conf.get(), nullptr, false, 0, ErrStr);
+  ASSERT_NE(Second, nullptr);
+  EXPECT_EQ(First->bufferKBytes(), 2048u);
+  EXPECT_EQ(Second->bufferKBytes(), 1024u);
+  EXPECT_EQ(UnderTest.getCommittedKBytes(), 3072u);
+  // The configuration keeps the requested size
+  std::string Requested;
+  Conf->get("queue.buffering.max.kbytes", Requested);
+  EXPECT_EQ(Requested, "2048");
+  EXPECT_EQ(UnderTest.acquire(Conf.get(), nullptr, false, 0, ErrStr), nullptr);
+  EXPECT_FALSE(ErrStr.empty());
+  UnderTest.release(First, 100);
+  EXPECT_EQ(UnderTest.getCommittedKBytes(), 1024u);
+  auto Third = UnderTest.acquire(Conf.get(), nullptr, false, 0, ErrStr);
+  EXPECT_NE(Third, nullptr);
+  UnderTest.release(Second, 100);
+  UnderTest.release(Third, 100);
+  EXPECT_EQ(UnderTest.getCommittedKBytes(), 0u);
+}
+
+TEST(ProducerPool, DeliveryReportsGoToProducingClient) {
+  ProducerPool UnderTest;
+  auto Conf = makeConf("localhost:9999");
+  std::string ErrStr;
+  auto Producer = UnderTest.acquire(Conf.get(), nullptr, true, 0, ErrStr);
+  ASSERT_NE(Producer, nullptr);
+  CountingClient First, Second;
+  auto FirstId = Producer->attach(&First);
+  auto SecondId = Producer->attach(&Second);
+  EXPECT_EQ(Producer->clientCount(), 2u);
+  char Payload[]{"payload"};
+  for (auto Id : {FirstId, FirstId, SecondId}) {
+    auto Ticket = new DeliveryTicket;
+    Ticket->ClientId = Id;
+    ASSERT_EQ(RD_KAFKA_RESP_ERR_NO_ERROR,
+              rd_kafka_producev(Producer->get()->c_ptr(),
+                                RD_KAFKA_V_TOPIC("some_topic"),
+                                RD_KAFKA_V_VALUE(Payload, sizeof(Payload)),
+                                RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
+                                RD_KAFKA_V_OPAQUE(Ticket), RD_KAFKA_V_END));
+  }
+  // No broker, the purged messages are reported as failed
+  Producer->get()->purge(RdKafka::Producer::PURGE_QUEUE);
+  Producer->get()->flush(1000);
+  EXPECT_EQ(First.Deliveries, 2);
+  EXPECT_EQ(Second.Deliveries, 1);
+  Producer->detach(FirstId);
+  Producer->detach(SecondId);
+  EXPECT_EQ(Producer->clientCount(), 0u);
+  UnderTest.release(Producer, 100);
+}
+
+TEST(ProducerPool, DestructionShutsDownProducersInUse) {
+  std::shared_ptr<PooledProducer> Producer;
+  {
+    ProducerPool UnderTest;
+    auto Conf = makeConf("localhost:9999");
+    std::string ErrStr;
+    Producer = UnderTest.acquire(Conf.get(), nullptr, true, 0, ErrStr);
+    ASSERT_NE(Producer, nullptr);
+  }
+  EXPECT_EQ(Producer->get(), nullptr);
+}
+
+TEST(ProducerPool, ReleaseWhilePolling) {
+  ProducerPool UnderTest;
+  auto Conf = makeConf("localhost:9999");
+  std::string ErrStr;
+  // Keeps the poll thread running while the others are released
+  auto Kept = UnderTest.acquire(Conf.get(), nullptr, false, 0, ErrStr);
+  for (int i = 0; i < 20; ++i) {
+    auto Producer = UnderTest.acquire(Conf.get(), nullptr, false, 1, ErrStr);
+    ASSERT_NE(Producer, nullptr);
+    UnderTest.release(Producer, 10);
+  }
+  UnderTest.release(Kept, 10);
+  EXPECT_EQ(UnderTest.getProducerCount(), 0u);
+}
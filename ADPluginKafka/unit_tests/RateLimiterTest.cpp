@@ -0,0 +1,130 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RateLimiterTest.cpp
+ *  @brief Unit tests of the byte rate limit.
+ */
+
+#include "RateLimiter.h"
+#include <gtest/gtest.h>
+
+using Clock = RateLimiter::Clock;
+using std::chrono::milliseconds;
+
+namespace {
+const std::size_t MB{1024 * 1024};
+
+double toMS(Clock::duration Delay) {
+  return std::chrono::duration<double, std::milli>(Delay).count();
+}
+} // namespace
+
+TEST(RateLimiter, NoLimitByDefault) {
+  RateLimiter UnderTest;
+  auto Now = Clock::now();
+  Clock::duration Delay;
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(UnderTest.acquire(1000 * MB, Now, Delay));
+    EXPECT_EQ(Delay, Clock::duration::zero());
+  }
+}
+
+TEST(RateLimiter, InvalidSettings) {
+  RateLimiter UnderTest;
+  EXPECT_FALSE(UnderTest.setRate(-1));
+  EXPECT_FALSE(UnderTest.setBurst(0));
+  EXPECT_FALSE(UnderTest.setPolicy(2));
+  EXPECT_TRUE(UnderTest.setRate(0));
+  EXPECT_TRUE(UnderTest.setPolicy(1));
+  EXPECT_EQ(UnderTest.getPolicy(), RateLimiter::Policy::DROP);
+}
+
+TEST(RateLimiter, BurstIsSentImmediately) {
+  RateLimiter UnderTest;
+  UnderTest.setBurst(10);
+  UnderTest.setRate(1);
+  auto Now = Clock::now();
+  Clock::duration Delay;
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+    EXPECT_EQ(Delay, Clock::duration::zero());
+  }
+  EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_NEAR(toMS(Delay), 1000.0, 1.0);
+}
+
+TEST(RateLimiter, DelaysAccumulate) {
+  RateLimiter UnderTest;
+  UnderTest.setBurst(1);
+  UnderTest.setRate(10);
+  auto Now = Clock::now();
+  Clock::duration Delay;
+  EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_EQ(Delay, Clock::duration::zero());
+  // Concurrent callers wait in turn
+  EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_NEAR(toMS(Delay), 100.0, 1.0);
+  EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_NEAR(toMS(Delay), 200.0, 1.0);
+  EXPECT_TRUE(UnderTest.acquire(MB, Now + milliseconds(300), Delay));
+  EXPECT_EQ(Delay, Clock::duration::zero());
+}
+
+TEST(RateLimiter, LargeMessagesWaitForFullBucket) {
+  RateLimiter UnderTest;
+  UnderTest.setBurst(1);
+  UnderTest.setRate(10);
+  auto Now = Clock::now();
+  Clock::duration Delay;
+  EXPECT_TRUE(UnderTest.acquire(5 * MB, Now, Delay));
+  EXPECT_EQ(Delay, Clock::duration::zero());
+  // The debt of 4 MB and a full bucket
+  EXPECT_TRUE(UnderTest.acquire(5 * MB, Now, Delay));
+  EXPECT_NEAR(toMS(Delay), 500.0, 1.0);
+}
+
+TEST(RateLimiter, DropPolicy) {
+  RateLimiter UnderTest;
+  UnderTest.setBurst(2);
+  UnderTest.setRate(10);
+  UnderTest.setPolicy(static_cast<int>(RateLimiter::Policy::DROP));
+  auto Now = Clock::now();
+  Clock::duration Delay;
+  EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_FALSE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_EQ(Delay, Clock::duration::zero());
+  EXPECT_FALSE(UnderTest.acquire(MB, Now + milliseconds(50), Delay));
+  EXPECT_TRUE(UnderTest.acquire(MB, Now + milliseconds(100), Delay));
+  EXPECT_EQ(UnderTest.getDroppedMessages(), 2u);
+}
+
+TEST(RateLimiter, RateOverTime) {
+  RateLimiter UnderTest;
+  UnderTest.setBurst(1);
+  UnderTest.setRate(100);
+  UnderTest.setPolicy(static_cast<int>(RateLimiter::Policy::DROP));
+  auto Now = Clock::now();
+  Clock::duration Delay;
+  std::size_t Sent{0};
+  // 1 MB every ms for 10 s, i.e. ten times the limit
+  for (int i = 0; i < 10000; ++i) {
+    if (UnderTest.acquire(MB, Now + milliseconds(i), Delay)) {
+      ++Sent;
+    }
+  }
+  EXPECT_NEAR(Sent, 1000u, 2u);
+}
+
+TEST(RateLimiter, NewRateStartsWithFullBucket) {
+  RateLimiter UnderTest;
+  UnderTest.setBurst(1);
+  UnderTest.setRate(1);
+  auto Now = Clock::now();
+  Clock::duration Delay;
+  UnderTest.acquire(100 * MB, Now, Delay);
+  UnderTest.setRate(2);
+  EXPECT_TRUE(UnderTest.acquire(MB, Now, Delay));
+  EXPECT_EQ(Delay, Clock::duration::zero());
+  EXPECT_DOUBLE_EQ(UnderTest.getRate(), 2.0);
+  EXPECT_DOUBLE_EQ(UnderTest.getBurst(), 1.0);
+}
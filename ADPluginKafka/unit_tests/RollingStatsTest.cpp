@@ -0,0 +1,55 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RollingStatsTest.cpp
+ *  @brief Unit tests of the rolling-window accumulator.
+ */
+
+#include "RollingStats.h"
+#include <gtest/gtest.h>
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+TEST(RollingStats, EmptySummary) {
+  auto Start = Clock::now();
+  RollingStats<2> UnderTest(milliseconds(1000), Start);
+  auto Summary = UnderTest.summarize(Start + milliseconds(500));
+  EXPECT_EQ(Summary.Count, 0u);
+  EXPECT_EQ(Summary.mean(0), 0.0);
+  EXPECT_EQ(Summary.rate(), 0.0);
+}
+
+TEST(RollingStats, MeanMaxAndRate) {
+  auto Start = Clock::now();
+  RollingStats<2> UnderTest(milliseconds(1000), Start);
+  for (int i = 0; i < 10; ++i) {
+    UnderTest.add({{static_cast<double>(i), 100.0}},
+                  Start + milliseconds(50 + 100 * i));
+  }
+  auto Summary = UnderTest.summarize(Start + milliseconds(999));
+  EXPECT_EQ(Summary.Count, 10u);
+  EXPECT_DOUBLE_EQ(Summary.mean(0), 4.5);
+  EXPECT_DOUBLE_EQ(Summary.Max[0], 9.0);
+  EXPECT_NEAR(Summary.Seconds, 1.0, 1e-2);
+  EXPECT_NEAR(Summary.rate(), 10.0, 0.1);
+  EXPECT_NEAR(Summary.rate(1), 1000.0, 10.0);
+}
+
+TEST(RollingStats, OldSamplesAreDropped) {
+  auto Start = Clock::now();
+  RollingStats<1> UnderTest(milliseconds(1000), Start);
+  UnderTest.add({{50.0}}, Start + milliseconds(10));
+  UnderTest.add({{1.0}}, Start + milliseconds(1510));
+  auto Summary = UnderTest.summarize(Start + milliseconds(1550));
+  EXPECT_EQ(Summary.Count, 1u);
+  EXPECT_DOUBLE_EQ(Summary.Max[0], 1.0);
+  EXPECT_EQ(UnderTest.summarize(Start + milliseconds(5000)).Count, 0u);
+}
+
+TEST(RollingStats, Reset) {
+  auto Start = Clock::now();
+  RollingStats<1> UnderTest(milliseconds(1000), Start);
+  UnderTest.add({{1.0}}, Start + milliseconds(10));
+  UnderTest.reset(Start + milliseconds(20));
+  EXPECT_EQ(UnderTest.summarize(Start + milliseconds(30)).Count, 0u);
+}
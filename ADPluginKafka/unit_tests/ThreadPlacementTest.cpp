@@ -0,0 +1,70 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThreadPlacementTest.cpp
+ *  @brief Unit tests of the parsing of the Kafka thread placements.
+ */
+
+#include "ThreadPlacement.h"
+#include <ciso646>
+#include <gtest/gtest.h>
+
+using namespace KafkaThreads;
+using PluginThreads::Placer;
+
+TEST(ThreadPlacement, ParseCpuList) {
+  std::vector<int> Cpus;
+  EXPECT_TRUE(parseCpuList("6,2-3,3", Cpus));
+  EXPECT_EQ(Cpus, (std::vector<int>{2, 3, 6}));
+  EXPECT_TRUE(parseCpuList("", Cpus));
+  EXPECT_TRUE(Cpus.empty());
+}
+
+TEST(ThreadPlacement, ParseMalformedCpuList) {
+  std::vector<int> Cpus{1};
+  for (auto Text : {"a", "3-2", "-1", "1,,2", "1-", "1024"}) {
+    EXPECT_FALSE(parseCpuList(Text, Cpus)) << Text;
+  }
+  EXPECT_EQ(Cpus, std::vector<int>{1});
+}
+
+TEST(ThreadPlacement, FormatMergesRanges) {
+  EXPECT_EQ(formatCpuList({0, 1, 2, 4, 6, 7}), "0-2,4,6-7");
+  EXPECT_EQ(formatCpuList({}), "");
+}
+
+TEST(ThreadPlacement, ParseScheduling) {
+  Placement Result;
+  EXPECT_TRUE(parseScheduling("fifo:10", Result));
+  EXPECT_EQ(Result.Scheduling, Placement::Policy::FIFO);
+  EXPECT_EQ(Result.Level, 10);
+  EXPECT_TRUE(parseScheduling("nice:-5", Result));
+  EXPECT_EQ(Result.Scheduling, Placement::Policy::NICE);
+  EXPECT_EQ(Result.Level, -5);
+  EXPECT_TRUE(parseScheduling("", Result));
+  EXPECT_EQ(Result.Scheduling, Placement::Policy::INHERIT);
+  for (auto Text : {"fifo", "fifo:0", "fifo:100", "nice:20", "rr:1"}) {
+    EXPECT_FALSE(parseScheduling(Text, Result)) << Text;
+  }
+}
+
+TEST(ThreadPlacement, ParseRole) {
+  int Result{PluginThreads::Role::LIBRDKAFKA};
+  EXPECT_TRUE(Placer.parseRole("poll", Result));
+  EXPECT_EQ(Result, PluginThreads::Role::POLL);
+  EXPECT_EQ(Placer.roleName(PluginThreads::Role::LIBRDKAFKA), "librdkafka");
+  EXPECT_FALSE(Placer.parseRole("consume", Result));
+}
+
+TEST(ThreadPlacement, PlacersAreIndependent) {
+  ThreadPlacer Other({"consume", "librdkafka"}, 1, "test thread placement");
+  Placement NewPlacement;
+  NewPlacement.Cpus = {0};
+  Other.setPlacement(0, NewPlacement);
+  EXPECT_EQ(Other.getPlacement(0).Cpus, std::vector<int>{0});
+  EXPECT_TRUE(Placer.getPlacement(PluginThreads::Role::POLL).Cpus.empty());
+  Other.placeCurrentThread(1, "test");
+  EXPECT_NE(Other.threadReport().find("test (librdkafka)"), std::string::npos);
+  EXPECT_EQ(Placer.threadReport().find("test (librdkafka)"), std::string::npos);
+  Other.forgetCurrentThread();
+  EXPECT_TRUE(Other.threadReport().empty());
+}
@@ -0,0 +1,80 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  TracingTest.cpp
+ *  @brief Unit tests of the per-thread trace ring buffers.
+ */
+
+#include "Tracing.h"
+#include <ciso646>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+
+using namespace KafkaTracing;
+using PluginTracing::Log;
+
+class TracingTest : public ::testing::Test {
+public:
+  void SetUp() override { Log.setEnabled(true); }
+  void TearDown() override { Log.setEnabled(false); }
+};
+
+TEST_F(TracingTest, DisabledRecordsNothing) {
+  Log.setEnabled(false);
+  { PLUGIN_TRACE_SCOPE("DisabledScope", 1); }
+  EXPECT_EQ(Log.toJson().find("DisabledScope"), std::string::npos);
+}
+
+TEST_F(TracingTest, ScopeIsRecorded) {
+  { PLUGIN_TRACE_SCOPE("EnabledScope", 42); }
+  auto Json = Log.toJson();
+  auto Position = Json.find(R"({"name":"EnabledScope")");
+  ASSERT_NE(Position, std::string::npos);
+  EXPECT_NE(Json.find(R"("args":{"id":42})", Position), std::string::npos);
+}
+
+TEST_F(TracingTest, StartAndFinish) {
+  PLUGIN_TRACE_START(StartTime);
+  PLUGIN_TRACE_END(StartTime, "StartFinishEvent", -1);
+  EXPECT_NE(Log.toJson().find("StartFinishEvent"), std::string::npos);
+}
+
+TEST_F(TracingTest, EventsFromOtherThreadsAreRecorded) {
+  std::thread Worker([]() { PLUGIN_TRACE_EVENT("WorkerEvent", now(), 0, 7); });
+  Worker.join();
+  auto Json = Log.toJson();
+  auto Position = Json.find(R"({"name":"WorkerEvent")");
+  ASSERT_NE(Position, std::string::npos);
+  EXPECT_NE(Json.find(R"("ph":"i")", Position), std::string::npos);
+}
+
+TEST_F(TracingTest, RingKeepsNewestEvents) {
+  std::unique_ptr<Ring> UnderTest(new Ring(1, "test"));
+  for (std::size_t i = 0; i < Ring::Size + 10; ++i) {
+    Event NewEvent;
+    NewEvent.Name = "RingEvent";
+    NewEvent.Id = static_cast<std::int64_t>(i);
+    UnderTest->push(NewEvent);
+  }
+  std::vector<Event> Events;
+  UnderTest->read(Events);
+  ASSERT_EQ(Events.size(), Ring::Size);
+  EXPECT_EQ(Events.front().Id, 10);
+  EXPECT_EQ(Events.back().Id, static_cast<std::int64_t>(Ring::Size + 9));
+  EXPECT_EQ(UnderTest->count(), Ring::Size + 10);
+}
+
+TEST_F(TracingTest, DumpToInvalidPathFails) {
+  EXPECT_FALSE(Log.dump("/this/path/does/not/exist/trace.json"));
+}
+
+TEST_F(TracingTest, LogsAreIndependent) {
+  TraceLog Other(3, "Other");
+  { PLUGIN_TRACE_SCOPE("PluginScope", -1); }
+  Other.record("OtherEvent", now(), 0, -1);
+  EXPECT_EQ(Log.toJson().find("OtherEvent"), std::string::npos);
+  auto Json = Other.toJson();
+  EXPECT_EQ(Json.find("PluginScope"), std::string::npos);
+  EXPECT_NE(Json.find("OtherEvent"), std::string::npos);
+  EXPECT_NE(Json.find(R"("args":{"name":"Other"})"), std::string::npos);
+}
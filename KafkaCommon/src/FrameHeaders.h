@@ -0,0 +1,136 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FrameHeaders.h
+ *  @brief Kafka message headers describing the NDArray in a message.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief Metadata of the NDArray in an ADAr message, sent as Kafka message
+ * headers so that consumers (e.g. routers and filters) can inspect it without
+ * accessing the flatbuffer.
+ * Numbers are encoded as little-endian integers of a fixed size:
+ * | Key      | Value                                                    |
+ * |----------|----------------------------------------------------------|
+ * | "src"    | Source name (UTF-8)                                      |
+ * | "id"     | Unique id of the NDArray, int64                          |
+ * | "ts"     | NDArray timestamp in ns since the Unix epoch, int64      |
+ * | "dtype"  | Data type (the DType value of the ADAr schema), int8     |
+ * | "dims"   | Dimensions in NDArray order (fastest first), uint64 each |
+ * | "size"   | Size of the array data in bytes, uint64                  |
+ * | "codec"  | Codec of the array data, "none" if uncompressed          |
+ * | "schema" | Flatbuffer file identifier of the payload, e.g. "ADAr"   |
+ *
+ * This header is identical in ADPluginKafka and ADKafka; it only contains
+ * inline functions so that both libraries can be loaded by one IOC.
+ */
+struct FrameHeaders {
+  std::string SourceName;
+  std::int64_t UniqueId{0};
+  std::int64_t TimestampNs{0};
+  std::int8_t DataType{-1};
+  std::vector<std::uint64_t> Dims;
+  std::uint64_t DataSize{0};
+  std::string Codec{"none"};
+  std::string SchemaId;
+};
+
+/// @brief Key and (binary) value of each header.
+using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+namespace FrameHeaderKeys {
+const char SourceName[]{"src"};
+const char UniqueId[]{"id"};
+const char Timestamp[]{"ts"};
+const char DataType[]{"dtype"};
+const char Dims[]{"dims"};
+const char DataSize[]{"size"};
+const char Codec[]{"codec"};
+const char SchemaId[]{"schema"};
+} // namespace FrameHeaderKeys
+
+namespace FrameHeaderEncoding {
+inline void appendUInt64(std::string &Out, std::uint64_t Value) {
+  for (int i = 0; i < 8; ++i) {
+    Out.push_back(static_cast<char>((Value >> (8 * i)) & 0xff));
+  }
+}
+
+inline std::uint64_t readUInt64(const unsigned char *In) {
+  std::uint64_t Value{0};
+  for (int i = 7; i >= 0; --i) {
+    Value = (Value << 8) | In[i];
+  }
+  return Value;
+}
+} // namespace FrameHeaderEncoding
+
+/// @brief Encodes all fields of the frame metadata.
+inline HeaderList EncodeFrameHeaders(FrameHeaders const &Frame) {
+  using namespace FrameHeaderEncoding;
+  HeaderList Headers;
+  Headers.reserve(8);
+  Headers.emplace_back(FrameHeaderKeys::SourceName, Frame.SourceName);
+  std::string Value;
+  appendUInt64(Value, static_cast<std::uint64_t>(Frame.UniqueId));
+  Headers.emplace_back(FrameHeaderKeys::UniqueId, Value);
+  Value.clear();
+  appendUInt64(Value, static_cast<std::uint64_t>(Frame.TimestampNs));
+  Headers.emplace_back(FrameHeaderKeys::Timestamp, Value);
+  Headers.emplace_back(FrameHeaderKeys::DataType,
+                       std::string(1, static_cast<char>(Frame.DataType)));
+  Value.clear();
+  for (auto Dim : Frame.Dims) {
+    appendUInt64(Value, Dim);
+  }
+  Headers.emplace_back(FrameHeaderKeys::Dims, Value);
+  Value.clear();
+  appendUInt64(Value, Frame.DataSize);
+  Headers.emplace_back(FrameHeaderKeys::DataSize, Value);
+  Headers.emplace_back(FrameHeaderKeys::Codec, Frame.Codec);
+  Headers.emplace_back(FrameHeaderKeys::SchemaId, Frame.SchemaId);
+  return Headers;
+}
+
+/** @brief Decodes one header into the matching field of the metadata.
+ * @return False if the key is unknown or the value has the wrong size.
+ */
+inline bool DecodeFrameHeader(std::string const &Key, const void *Value,
+                              std::size_t Size, FrameHeaders &Frame) {
+  using namespace FrameHeaderEncoding;
+  auto Data = static_cast<const unsigned char *>(Value);
+  if (nullptr == Data and 0 != Size) {
+    return false;
+  }
+  if (Key == FrameHeaderKeys::SourceName) {
+    Frame.SourceName.assign(reinterpret_cast<const char *>(Data), Size);
+  } else if (Key == FrameHeaderKeys::UniqueId and 8 == Size) {
+    Frame.UniqueId = static_cast<std::int64_t>(readUInt64(Data));
+  } else if (Key == FrameHeaderKeys::Timestamp and 8 == Size) {
+    Frame.TimestampNs = static_cast<std::int64_t>(readUInt64(Data));
+  } else if (Key == FrameHeaderKeys::DataType and 1 == Size) {
+    Frame.DataType = static_cast<std::int8_t>(Data[0]);
+  } else if (Key == FrameHeaderKeys::Dims and 0 == Size % 8) {
+    Frame.Dims.clear();
+    for (std::size_t i = 0; i < Size; i += 8) {
+      Frame.Dims.push_back(readUInt64(Data + i));
+    }
+  } else if (Key == FrameHeaderKeys::DataSize and 8 == Size) {
+    Frame.DataSize = readUInt64(Data);
+  } else if (Key == FrameHeaderKeys::Codec) {
+    Frame.Codec.assign(reinterpret_cast<const char *>(Data), Size);
+  } else if (Key == FrameHeaderKeys::SchemaId) {
+    Frame.SchemaId.assign(reinterpret_cast<const char *>(Data), Size);
+  } else {
+    return false;
+  }
+  return true;
+}
+} // namespace KafkaInterface
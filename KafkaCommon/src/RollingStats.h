@@ -0,0 +1,128 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RollingStats.h
+ *  @brief Fixed-size rolling-window accumulator for timing and rate values.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/** @brief Accumulates the count, sum and maximum of a number of values over a
+ * rolling time window.
+ * The window is split in a fixed number of buckets which are re-used as time
+ * passes; adding a sample does not allocate memory. The class is not thread
+ * safe, add() and summarize() must be serialised by the caller (e.g. by the
+ * port lock).
+ * @tparam Channels The number of values per sample.
+ */
+template <std::size_t Channels> class RollingStats {
+public:
+  using Clock = std::chrono::steady_clock;
+  using Values = std::array<double, Channels>;
+
+  /// @brief Number of buckets the window is split in.
+  static const std::size_t Buckets{10};
+
+  /// @brief The result of RollingStats::summarize().
+  struct Summary {
+    std::uint64_t Count{0};
+    Values Sum{};
+    Values Max{};
+    /// @brief Time covered by the summary, in seconds.
+    double Seconds{0};
+
+    double mean(std::size_t Channel) const {
+      return 0 == Count ? 0.0 : Sum[Channel] / Count;
+    }
+    double rate() const { return Seconds > 0 ? Count / Seconds : 0.0; }
+    double rate(std::size_t Channel) const {
+      return Seconds > 0 ? Sum[Channel] / Seconds : 0.0;
+    }
+  };
+
+  explicit RollingStats(
+      std::chrono::milliseconds Window = std::chrono::milliseconds(5000),
+      Clock::time_point Now = Clock::now())
+      : BucketLength(std::max(Window / static_cast<int>(Buckets),
+                              std::chrono::milliseconds(1))),
+        Start(Now) {}
+
+  /// @brief Adds one sample.
+  void add(Values const &Sample, Clock::time_point Now = Clock::now()) {
+    auto &Current = bucketAt(Now);
+    ++Current.Count;
+    for (std::size_t i = 0; i < Channels; ++i) {
+      Current.Sum[i] += Sample[i];
+      Current.Max[i] = std::max(Current.Max[i], Sample[i]);
+    }
+  }
+
+  /// @brief Combines the buckets within the window ending at Now.
+  Summary summarize(Clock::time_point Now = Clock::now()) const {
+    Summary Result;
+    auto CurrentIndex = bucketIndex(Now);
+    for (auto const &Current : BucketList) {
+      if (Current.Index + Buckets <= CurrentIndex or
+          Current.Index > CurrentIndex or 0 == Current.Count) {
+        continue;
+      }
+      Result.Count += Current.Count;
+      for (std::size_t i = 0; i < Channels; ++i) {
+        Result.Sum[i] += Current.Sum[i];
+        Result.Max[i] = std::max(Result.Max[i], Current.Max[i]);
+      }
+    }
+    // The current bucket is only partly filled
+    auto CurrentStart =
+        Start + BucketLength * static_cast<Clock::rep>(CurrentIndex);
+    auto Covered = std::min<Clock::duration>(
+        Now - Start,
+        BucketLength * static_cast<Clock::rep>(Buckets - 1) +
+            (Now - CurrentStart));
+    Result.Seconds = std::chrono::duration<double>(Covered).count();
+    return Result;
+  }
+
+  /// @brief Removes all samples.
+  void reset(Clock::time_point Now = Clock::now()) {
+    BucketList = {};
+    Start = Now;
+  }
+
+private:
+  struct Bucket {
+    std::uint64_t Index{0};
+    std::uint64_t Count{0};
+    Values Sum{};
+    Values Max{};
+  };
+
+  std::uint64_t bucketIndex(Clock::time_point Now) const {
+    if (Now < Start) {
+      return 0;
+    }
+    return static_cast<std::uint64_t>((Now - Start) / BucketLength);
+  }
+
+  Bucket &bucketAt(Clock::time_point Now) {
+    auto Index = bucketIndex(Now);
+    auto &Current = BucketList[Index % Buckets];
+    if (Current.Index != Index) {
+      Current = Bucket();
+      Current.Index = Index;
+    }
+    return Current;
+  }
+
+  Clock::duration BucketLength;
+  Clock::time_point Start;
+  std::array<Bucket, Buckets> BucketList{};
+};
+
+template <std::size_t Channels>
+const std::size_t RollingStats<Channels>::Buckets;
@@ -0,0 +1,305 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThreadPlacer.cpp
+ *  @brief Implementation of the Kafka thread placement.
+ */
+
+#include "ThreadPlacer.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstdlib>
+#include <errlog.h>
+#include <sstream>
+#include <utility>
+#ifdef _WIN32
+#include <rdkafka.h>
+#else
+#include <librdkafka/rdkafka.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace KafkaThreads {
+
+namespace {
+long currentThreadId() {
+#ifdef __linux__
+  return static_cast<long>(syscall(SYS_gettid));
+#else
+  return 0;
+#endif
+}
+
+bool parseInt(std::string const &Text, int &Value) {
+  if (Text.empty()) {
+    return false;
+  }
+  char *End{nullptr};
+  auto Result = std::strtol(Text.c_str(), &End, 10);
+  if (*End != '\0') {
+    return false;
+  }
+  Value = static_cast<int>(Result);
+  return true;
+}
+
+#ifdef __linux__
+/// @brief The placement the calling thread actually got.
+std::string describeCurrentThread() {
+  std::ostringstream Result;
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  if (0 == pthread_getaffinity_np(pthread_self(), sizeof(Set), &Set)) {
+    std::vector<int> Cpus;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &Set)) {
+        Cpus.push_back(i);
+      }
+    }
+    Result << "cpus " << formatCpuList(Cpus);
+  }
+  int Policy{0};
+  sched_param Param{};
+  if (0 == pthread_getschedparam(pthread_self(), &Policy, &Param)) {
+    if (SCHED_FIFO == Policy) {
+      Result << ", SCHED_FIFO " << Param.sched_priority;
+    } else if (SCHED_RR == Policy) {
+      Result << ", SCHED_RR " << Param.sched_priority;
+    } else {
+      errno = 0;
+      auto Nice =
+          getpriority(PRIO_PROCESS, static_cast<id_t>(currentThreadId()));
+      Result << ", SCHED_OTHER nice " << (0 == errno ? Nice : 0);
+    }
+  }
+  return Result.str();
+}
+#endif
+
+// The opaque pointer of all interceptors is the ThreadPlacer
+
+rd_kafka_resp_err_t onThreadStart(rd_kafka_t *, rd_kafka_thread_type_t,
+                                  const char *ThreadName, void *Opaque) {
+  auto Placer = static_cast<ThreadPlacer *>(Opaque);
+  Placer->placeCurrentThread(Placer->librdkafkaRole(), ThreadName);
+  return RD_KAFKA_RESP_ERR_NO_ERROR;
+}
+
+rd_kafka_resp_err_t onThreadExit(rd_kafka_t *, rd_kafka_thread_type_t,
+                                 const char *, void *Opaque) {
+  static_cast<ThreadPlacer *>(Opaque)->forgetCurrentThread();
+  return RD_KAFKA_RESP_ERR_NO_ERROR;
+}
+
+rd_kafka_resp_err_t onNew(rd_kafka_t *Instance, const rd_kafka_conf_t *,
+                          void *Opaque, char *, size_t) {
+  auto Name = static_cast<ThreadPlacer *>(Opaque)->interceptorName();
+  // The instance interceptors can only be added while it is being created
+  rd_kafka_interceptor_add_on_thread_start(Instance, Name, onThreadStart,
+                                           Opaque);
+  rd_kafka_interceptor_add_on_thread_exit(Instance, Name, onThreadExit,
+                                          Opaque);
+  return RD_KAFKA_RESP_ERR_NO_ERROR;
+}
+
+rd_kafka_resp_err_t addConfInterceptors(rd_kafka_conf_t *Conf, void *Opaque);
+
+rd_kafka_resp_err_t onConfDup(rd_kafka_conf_t *NewConf,
+                              const rd_kafka_conf_t *, size_t, const char **,
+                              void *Opaque) {
+  // Interceptors are not copied with the configuration, which librdkafka
+  // duplicates when creating an instance
+  return addConfInterceptors(NewConf, Opaque);
+}
+
+rd_kafka_resp_err_t addConfInterceptors(rd_kafka_conf_t *Conf, void *Opaque) {
+  auto Name = static_cast<ThreadPlacer *>(Opaque)->interceptorName();
+  auto Result = rd_kafka_conf_interceptor_add_on_new(Conf, Name, onNew, Opaque);
+  if (RD_KAFKA_RESP_ERR_NO_ERROR != Result and
+      RD_KAFKA_RESP_ERR__CONFLICT != Result) {
+    return Result;
+  }
+  Result =
+      rd_kafka_conf_interceptor_add_on_conf_dup(Conf, Name, onConfDup, Opaque);
+  if (RD_KAFKA_RESP_ERR__CONFLICT == Result) {
+    // Already installed
+    return RD_KAFKA_RESP_ERR_NO_ERROR;
+  }
+  return Result;
+}
+} // namespace
+
+bool parseCpuList(std::string const &Text, std::vector<int> &Cpus) {
+  std::vector<int> Result;
+  std::istringstream Stream(Text);
+  std::string Item;
+  while (std::getline(Stream, Item, ',')) {
+    auto Dash = Item.find('-');
+    int First{0}, Last{0};
+    if (std::string::npos == Dash) {
+      if (not parseInt(Item, First)) {
+        return false;
+      }
+      Last = First;
+    } else if (not parseInt(Item.substr(0, Dash), First) or
+               not parseInt(Item.substr(Dash + 1), Last)) {
+      return false;
+    }
+    if (First < 0 or Last < First or Last >= 1024) {
+      return false;
+    }
+    for (int Cpu = First; Cpu <= Last; ++Cpu) {
+      Result.push_back(Cpu);
+    }
+  }
+  std::sort(Result.begin(), Result.end());
+  Result.erase(std::unique(Result.begin(), Result.end()), Result.end());
+  Cpus = Result;
+  return true;
+}
+
+std::string formatCpuList(std::vector<int> const &Cpus) {
+  std::string Result;
+  for (std::size_t i = 0; i < Cpus.size(); ++i) {
+    auto First = Cpus[i];
+    while (i + 1 < Cpus.size() and Cpus[i + 1] == Cpus[i] + 1) {
+      ++i;
+    }
+    if (not Result.empty()) {
+      Result += ",";
+    }
+    Result += std::to_string(First);
+    if (Cpus[i] != First) {
+      Result += "-" + std::to_string(Cpus[i]);
+    }
+  }
+  return Result;
+}
+
+bool parseScheduling(std::string const &Text, Placement &Result) {
+  if (Text.empty()) {
+    Result.Scheduling = Placement::Policy::INHERIT;
+    Result.Level = 0;
+    return true;
+  }
+  auto Colon = Text.find(':');
+  int Level{0};
+  if (std::string::npos == Colon or
+      not parseInt(Text.substr(Colon + 1), Level)) {
+    return false;
+  }
+  auto Name = Text.substr(0, Colon);
+  if ("nice" == Name and Level >= -20 and Level <= 19) {
+    Result.Scheduling = Placement::Policy::NICE;
+  } else if ("fifo" == Name and Level >= 1 and Level <= 99) {
+    Result.Scheduling = Placement::Policy::FIFO;
+  } else {
+    return false;
+  }
+  Result.Level = Level;
+  return true;
+}
+
+ThreadPlacer::ThreadPlacer(std::vector<std::string> RoleNames,
+                           int LibrdkafkaRole, std::string InterceptorName)
+    : RoleNames(std::move(RoleNames)), LibrdkafkaRole(LibrdkafkaRole),
+      InterceptorName(std::move(InterceptorName)),
+      Placements(this->RoleNames.size()) {}
+
+std::string ThreadPlacer::roleName(int Role) const {
+  return RoleNames.at(static_cast<std::size_t>(Role));
+}
+
+bool ThreadPlacer::parseRole(std::string const &Name, int &Role) const {
+  for (std::size_t i = 0; i < RoleNames.size(); ++i) {
+    if (Name == RoleNames[i]) {
+      Role = static_cast<int>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPlacer::setPlacement(int Role, Placement const &NewPlacement) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Placements.at(static_cast<std::size_t>(Role)) = NewPlacement;
+}
+
+Placement ThreadPlacer::getPlacement(int Role) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Placements.at(static_cast<std::size_t>(Role));
+}
+
+void ThreadPlacer::placeCurrentThread(int Role, std::string const &Name) {
+  auto Used = getPlacement(Role);
+#ifdef __linux__
+  if (not Used.Cpus.empty()) {
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    for (auto Cpu : Used.Cpus) {
+      CPU_SET(Cpu, &Set);
+    }
+    auto Error = pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+    if (0 != Error) {
+      errlogPrintf("Kafka thread %s: Unable to set CPU affinity %s: %s\n",
+                   Name.c_str(), formatCpuList(Used.Cpus).c_str(),
+                   std::strerror(Error));
+    }
+  }
+  if (Placement::Policy::FIFO == Used.Scheduling) {
+    sched_param Param{};
+    Param.sched_priority = Used.Level;
+    auto Error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param);
+    if (0 != Error) {
+      errlogPrintf("Kafka thread %s: Unable to set SCHED_FIFO %d: %s\n",
+                   Name.c_str(), Used.Level, std::strerror(Error));
+    }
+  } else if (Placement::Policy::NICE == Used.Scheduling) {
+    sched_param Param{};
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &Param);
+    // On Linux the nice value of a thread is set with its thread id
+    if (0 != setpriority(PRIO_PROCESS, static_cast<id_t>(currentThreadId()),
+                         Used.Level)) {
+      errlogPrintf("Kafka thread %s: Unable to set nice %d: %s\n",
+                   Name.c_str(), Used.Level, std::strerror(errno));
+    }
+  }
+  auto Effective = describeCurrentThread();
+#else
+  auto Effective = std::string("placement not supported");
+#endif
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Threads[currentThreadId()] = Name + " (" + roleName(Role) + "): " + Effective;
+}
+
+void ThreadPlacer::forgetCurrentThread() {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Threads.erase(currentThreadId());
+}
+
+std::string ThreadPlacer::threadReport() {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  std::string Result;
+  for (auto const &Thread : Threads) {
+    Result += "  " + std::to_string(Thread.first) + " " + Thread.second + "\n";
+  }
+  return Result;
+}
+
+bool ThreadPlacer::installInterceptors(RdKafka::Conf *Conf,
+                                       std::string &ErrStr) {
+  auto Result = addConfInterceptors(Conf->c_ptr_global(), this);
+  if (RD_KAFKA_RESP_ERR_NO_ERROR != Result) {
+    ErrStr = rd_kafka_err2str(Result);
+    return false;
+  }
+  return true;
+}
+} // namespace KafkaThreads
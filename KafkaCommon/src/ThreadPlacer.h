@@ -0,0 +1,117 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThreadPlacer.h
+ *  @brief CPU affinity and scheduling of the Kafka threads.
+ *
+ * The placement of each kind of thread (its role) is set before iocInit with
+ * an iocsh command (KafkaPluginThreadPlacement or KafkaDriverThreadPlacement)
+ * and applied by the threads themselves when they start; the librdkafka
+ * threads through a thread-start interceptor installed in the configuration.
+ * The effective placement of every running thread is printed by
+ * KafkaPluginThreadReport or KafkaDriverThreadReport.
+ * Only supported on Linux, elsewhere the placements are ignored.
+ *
+ * ADPluginKafka and ADKafka each have their own KafkaThreads::ThreadPlacer
+ * (see ThreadPlacement.h of each library) so that both libraries can be
+ * loaded by one IOC and placed independently.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <rdkafkacpp.h>
+#else
+#include <librdkafka/rdkafkacpp.h>
+#endif
+
+namespace KafkaThreads {
+
+/// @brief How a thread is scheduled.
+struct Placement {
+  /// @brief CPUs the thread may run on, all if empty.
+  std::vector<int> Cpus;
+  enum class Policy {
+    INHERIT, ///< Not changed.
+    NICE,    ///< SCHED_OTHER with the nice value Placement::Level.
+    FIFO,    ///< SCHED_FIFO with the priority Placement::Level.
+  } Scheduling{Policy::INHERIT};
+  int Level{0};
+};
+
+/** @brief Parses a CPU list, e.g. "2-3,6".
+ * @return False if malformed. An empty string gives an empty list.
+ */
+bool parseCpuList(std::string const &Text, std::vector<int> &Cpus);
+
+/// @brief The inverse of parseCpuList(), ranges are merged.
+std::string formatCpuList(std::vector<int> const &Cpus);
+
+/** @brief Parses a scheduling setting: "" (not changed), "nice:N" (N from -20
+ * to 19) or "fifo:N" (N from 1 to 99).
+ * @return False if malformed or out of range.
+ */
+bool parseScheduling(std::string const &Text, Placement &Result);
+
+/** @brief The placements of the threads of one library.
+ * Roles are identified by their index in the list of role names. Thread safe.
+ */
+class ThreadPlacer {
+public:
+  /** @param[in] RoleNames The names of the roles as used by the iocsh command,
+   * e.g. "poll".
+   * @param[in] LibrdkafkaRole The role of the internal (main and broker)
+   * threads of librdkafka.
+   * @param[in] InterceptorName Name of the librdkafka interceptors, must be
+   * unique per library.
+   */
+  ThreadPlacer(std::vector<std::string> RoleNames, int LibrdkafkaRole,
+               std::string InterceptorName);
+
+  /// @brief The name of a role as used by the iocsh command.
+  std::string roleName(int Role) const;
+
+  /// @brief Returns false if the name is not the one of a role.
+  bool parseRole(std::string const &Name, int &Role) const;
+
+  /// @brief Sets the placement of a role, used by threads started from now on.
+  void setPlacement(int Role, Placement const &NewPlacement);
+  Placement getPlacement(int Role);
+
+  /** @brief Applies the placement of the role to the calling thread and
+   * records its effective placement for threadReport(). Failures (e.g. no
+   * permission for SCHED_FIFO) are logged and the thread keeps running.
+   * @param[in] Name Name of the thread in the report.
+   */
+  void placeCurrentThread(int Role, std::string const &Name);
+
+  /// @brief Removes the calling thread from the report, call before exiting.
+  void forgetCurrentThread();
+
+  /// @brief The effective placement of the placed threads, one per line.
+  std::string threadReport();
+
+  /** @brief Installs the interceptors placing the threads of librdkafka
+   * instances created with the configuration.
+   * @return False if not supported by this librdkafka version.
+   */
+  bool installInterceptors(RdKafka::Conf *Conf, std::string &ErrStr);
+
+  /// @brief Used by the librdkafka interceptors.
+  int librdkafkaRole() const { return LibrdkafkaRole; }
+  const char *interceptorName() const { return InterceptorName.c_str(); }
+
+private:
+  const std::vector<std::string> RoleNames;
+  const int LibrdkafkaRole;
+  const std::string InterceptorName;
+
+  std::mutex Mutex;
+  std::vector<Placement> Placements;
+  /// @brief Effective placement of the placed threads by thread id.
+  std::map<long, std::string> Threads;
+};
+} // namespace KafkaThreads
@@ -0,0 +1,143 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  TraceLog.cpp
+ *  @brief Implementation of the per-thread trace ring buffers.
+ */
+
+#include "TraceLog.h"
+#include <ciso646>
+#include <epicsThread.h>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace KafkaTracing {
+
+namespace {
+std::string escape(std::string const &Text) {
+  std::string Result;
+  for (auto Character : Text) {
+    if ('"' == Character or '\\' == Character) {
+      Result += '\\';
+    } else if (Character < ' ') {
+      continue;
+    }
+    Result += Character;
+  }
+  return Result;
+}
+} // namespace
+
+const std::size_t Ring::Size;
+
+Ring::Ring(std::uint64_t ThreadId, std::string ThreadName)
+    : ThreadId(ThreadId), ThreadName(std::move(ThreadName)) {}
+
+void Ring::push(Event const &NewEvent) {
+  auto Index = Head.load(std::memory_order_relaxed);
+  auto &CurrentSlot = Slots[Index & (Size - 1)];
+  // Odd sequence numbers mark a slot that is being written
+  CurrentSlot.Sequence.store(2 * Index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  CurrentSlot.Data = NewEvent;
+  CurrentSlot.Sequence.store(2 * Index + 2, std::memory_order_release);
+  Head.store(Index + 1, std::memory_order_release);
+}
+
+void Ring::read(std::vector<Event> &Events) const {
+  auto End = Head.load(std::memory_order_acquire);
+  auto Begin = End > Size ? End - Size : 0;
+  for (auto Index = Begin; Index < End; ++Index) {
+    auto &CurrentSlot = Slots[Index & (Size - 1)];
+    auto Before = CurrentSlot.Sequence.load(std::memory_order_acquire);
+    Event Copy = CurrentSlot.Data;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto After = CurrentSlot.Sequence.load(std::memory_order_relaxed);
+    if (Before == After and 2 * Index + 2 == Before) {
+      Events.push_back(Copy);
+    }
+  }
+}
+
+TraceLog::TraceLog(int ProcessId, std::string ProcessName)
+    : ProcessId(ProcessId), ProcessName(std::move(ProcessName)) {}
+
+Ring *TraceLog::threadRing() {
+  // A thread may record to the logs of both libraries, e.g. when the driver
+  // thread calls a plugin directly
+  thread_local std::vector<std::pair<TraceLog const *, Ring *>> LocalRings;
+  for (auto const &LocalRing : LocalRings) {
+    if (this == LocalRing.first) {
+      return LocalRing.second;
+    }
+  }
+  const char *Name = epicsThreadGetNameSelf();
+  std::lock_guard<std::mutex> Lock(RingsMutex);
+  Rings.emplace_back(
+      new Ring(Rings.size() + 1, nullptr == Name ? "unknown" : Name));
+  LocalRings.emplace_back(this, Rings.back().get());
+  return Rings.back().get();
+}
+
+void TraceLog::record(const char *Name, std::uint64_t StartNs,
+                      std::uint64_t DurationNs, std::int64_t Id) {
+  Event NewEvent;
+  NewEvent.Name = Name;
+  NewEvent.StartNs = StartNs;
+  NewEvent.DurationNs = DurationNs;
+  NewEvent.Id = Id;
+  threadRing()->push(NewEvent);
+}
+
+std::string TraceLog::toJson() {
+  std::vector<Ring *> UsedRings;
+  {
+    std::lock_guard<std::mutex> Lock(RingsMutex);
+    for (auto &CurrentRing : Rings) {
+      UsedRings.push_back(CurrentRing.get());
+    }
+  }
+  std::ostringstream Json;
+  Json << "{\"traceEvents\":[\n";
+  Json << R"({"name":"process_name","ph":"M","pid":)" << ProcessId
+       << R"(,"args":{"name":")" << escape(ProcessName) << "\"}}";
+  std::vector<Event> Events;
+  for (auto CurrentRing : UsedRings) {
+    Json << ",\n"
+         << R"({"name":"thread_name","ph":"M","pid":)" << ProcessId
+         << R"(,"tid":)" << CurrentRing->ThreadId << R"(,"args":{"name":")"
+         << escape(CurrentRing->ThreadName) << "\"}}";
+    Events.clear();
+    CurrentRing->read(Events);
+    for (auto const &CurrentEvent : Events) {
+      // Time stamps are in us
+      Json << ",\n"
+           << R"({"name":")" << CurrentEvent.Name << R"(","pid":)"
+           << ProcessId << R"(,"tid":)" << CurrentRing->ThreadId
+           << R"(,"ts":)" << CurrentEvent.StartNs / 1000 << "."
+           << CurrentEvent.StartNs % 1000 / 100;
+      if (0 == CurrentEvent.DurationNs) {
+        Json << R"(,"ph":"i","s":"t")";
+      } else {
+        Json << R"(,"ph":"X","dur":)" << CurrentEvent.DurationNs / 1000 << "."
+             << CurrentEvent.DurationNs % 1000 / 100;
+      }
+      if (CurrentEvent.Id >= 0) {
+        Json << R"(,"args":{"id":)" << CurrentEvent.Id << "}";
+      }
+      Json << "}";
+    }
+  }
+  Json << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return Json.str();
+}
+
+bool TraceLog::dump(std::string const &FileName) {
+  std::ofstream File(FileName, std::ios::out | std::ios::trunc);
+  if (not File.is_open()) {
+    return false;
+  }
+  File << toJson();
+  return File.good();
+}
+} // namespace KafkaTracing
@@ -0,0 +1,176 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  TraceLog.h
+ *  @brief Lightweight trace points recorded in per-thread ring buffers.
+ *
+ * The trace points are removed at compile time if KAFKA_TRACE_DISABLE is
+ * defined. When compiled in, recording is off until enabled at run time (see
+ * KafkaPluginTraceEnable and KafkaDriverTraceEnable) and a disabled trace
+ * point costs one relaxed atomic load. Each thread writes to its own ring
+ * buffer without taking a lock, the rings can be written to a file in the
+ * Chrome trace-event JSON format (see KafkaPluginTraceDump and
+ * KafkaDriverTraceDump) and viewed in e.g. chrome://tracing or Perfetto.
+ *
+ * ADPluginKafka and ADKafka each have their own KafkaTracing::TraceLog (see
+ * Tracing.h of each library) so that both libraries can be loaded by one IOC
+ * and traced independently.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace KafkaTracing {
+
+/// @brief A trace event, instant events have a duration of 0.
+struct Event {
+  /// @brief Must point to a string literal, only the pointer is stored.
+  const char *Name{nullptr};
+  std::uint64_t StartNs{0};
+  std::uint64_t DurationNs{0};
+  /// @brief NDArray unique id (or Kafka offset), -1 if not applicable.
+  std::int64_t Id{-1};
+};
+
+/** @brief Fixed size single-writer ring buffer of trace events.
+ * Only the owning thread writes to the ring. Other threads can read it at any
+ * time; every slot has a sequence number (seqlock) so that events being
+ * overwritten while read are skipped instead of being returned torn.
+ */
+class Ring {
+public:
+  /// @brief Number of events kept per thread, must be a power of two.
+  static const std::size_t Size{8192};
+
+  Ring(std::uint64_t ThreadId, std::string ThreadName);
+
+  void push(Event const &NewEvent);
+
+  /// @brief Appends the events currently in the ring, oldest first.
+  void read(std::vector<Event> &Events) const;
+
+  /// @brief Number of events pushed since the ring was created.
+  std::uint64_t count() const { return Head.load(std::memory_order_acquire); }
+
+  const std::uint64_t ThreadId;
+  const std::string ThreadName;
+
+private:
+  struct Slot {
+    std::atomic<std::uint64_t> Sequence{0};
+    Event Data;
+  };
+  Slot Slots[Size];
+  std::atomic<std::uint64_t> Head{0};
+};
+
+/// @brief Time stamp used for all events, ns of std::chrono::steady_clock.
+inline std::uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/** @brief The trace events of one library, one ring per thread.
+ * Thread safe.
+ */
+class TraceLog {
+public:
+  /** @param[in] ProcessId Process id used in the JSON output, in order for
+   * the traces of the libraries to be shown separately when merged.
+   * @param[in] ProcessName Process name used in the JSON output.
+   */
+  TraceLog(int ProcessId, std::string ProcessName);
+
+  bool isEnabled() const { return Enabled.load(std::memory_order_relaxed); }
+
+  void setEnabled(bool Enable) { Enabled = Enable; }
+
+  /// @brief Returns the time stamp to pass to finish() or 0 if not enabled.
+  std::uint64_t start() const { return isEnabled() ? now() : 0; }
+
+  /// @brief Records an event in the ring buffer of the calling thread.
+  void record(const char *Name, std::uint64_t StartNs,
+              std::uint64_t DurationNs, std::int64_t Id);
+
+  /// @brief Records an event started by start(), if tracing was enabled then.
+  void finish(const char *Name, std::uint64_t StartNs, std::int64_t Id) {
+    if (0 != StartNs) {
+      record(Name, StartNs, now() - StartNs, Id);
+    }
+  }
+
+  /// @brief The content of all rings as Chrome trace-event JSON.
+  std::string toJson();
+
+  /// @brief Writes toJson() to a file, returns false if that failed.
+  bool dump(std::string const &FileName);
+
+private:
+  Ring *threadRing();
+
+  std::atomic<bool> Enabled{false};
+  const int ProcessId;
+  const std::string ProcessName;
+
+  std::mutex RingsMutex;
+  /// @brief All rings, never freed so that a ring can be read after its
+  /// thread has exited.
+  std::vector<std::unique_ptr<Ring>> Rings;
+};
+
+/// @brief Records the time from construction to destruction.
+class Scope {
+public:
+  Scope(TraceLog &Log, const char *Name, std::int64_t Id = -1)
+      : Log(Log), Name(Name), Id(Id), StartNs(Log.start()) {}
+  ~Scope() { Log.finish(Name, StartNs, Id); }
+  Scope(Scope const &) = delete;
+  Scope &operator=(Scope const &) = delete;
+
+private:
+  TraceLog &Log;
+  const char *Name;
+  std::int64_t Id;
+  std::uint64_t StartNs;
+};
+} // namespace KafkaTracing
+
+#ifndef KAFKA_TRACE_DISABLE
+#define KAFKA_TRACE_CONCAT_(A, B) A##B
+#define KAFKA_TRACE_CONCAT(A, B) KAFKA_TRACE_CONCAT_(A, B)
+/// @brief Traces the rest of the enclosing block.
+#define KAFKA_TRACE_SCOPE(Log, Name, Id)                                       \
+  KafkaTracing::Scope KAFKA_TRACE_CONCAT(TraceScope, __LINE__) { Log, Name, Id }
+/// @brief Starts a trace event which is ended with KAFKA_TRACE_END.
+#define KAFKA_TRACE_START(Log, Variable)                                       \
+  std::uint64_t Variable = (Log).start()
+#define KAFKA_TRACE_END(Log, Variable, Name, Id)                               \
+  (Log).finish(Name, Variable, Id)
+/// @brief Records an event with a known start time and duration.
+#define KAFKA_TRACE_EVENT(Log, Name, StartNs, DurationNs, Id)                  \
+  do {                                                                         \
+    if ((Log).isEnabled()) {                                                   \
+      (Log).record(Name, StartNs, DurationNs, Id);                             \
+    }                                                                          \
+  } while (false)
+#else
+#define KAFKA_TRACE_SCOPE(Log, Name, Id)                                       \
+  do {                                                                         \
+  } while (false)
+#define KAFKA_TRACE_START(Log, Variable)                                       \
+  do {                                                                         \
+  } while (false)
+#define KAFKA_TRACE_END(Log, Variable, Name, Id)                               \
+  do {                                                                         \
+  } while (false)
+#define KAFKA_TRACE_EVENT(Log, Name, StartNs, DurationNs, Id)                  \
+  do {                                                                         \
+  } while (false)
+#endif
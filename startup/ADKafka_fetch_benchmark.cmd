@@ -0,0 +1,43 @@
+# Consumer throughput with and without the automatic fetch tuning, see the
+# "Fetch tuning" section of ADKafka_README.md. The frames of the load generator
+# are sent through the broker (BROKER) to the driver; compare
+# $(PREFIX):KFK_DRVR:KafkaFrameRate_RBV and KafkaByteRate_RBV between runs.
+require adcore,2.6+
+require ADPluginKafka,1.0.0-BETA
+
+epicsEnvSet("PREFIX", "$(PREFIX=DMSC)")
+epicsEnvSet("BROKER", "$(BROKER=localhost:9092)")
+epicsEnvSet("TOPIC", "$(TOPIC=fetch_benchmark)")
+epicsEnvSet("XSIZE", "$(XSIZE=64)")
+epicsEnvSet("YSIZE", "$(YSIZE=64)")
+epicsEnvSet("RATE", "$(RATE=0)")
+epicsEnvSet("FETCH_TUNING", "$(FETCH_TUNING=1)")
+epicsEnvSet("GEN_PORT", "$(PREFIX)_GEN")
+epicsEnvSet("K_PORT", "$(PREFIX)K")
+epicsEnvSet("KFKDET_PORT", "$(PREFIX)_AD_KAFKA")
+
+KafkaLoadGeneratorConfig("$(GEN_PORT)", 0, 0)
+dbLoadRecords("KafkaLoadGenerator.template", "P=$(PREFIX):, R=GEN:, PORT=$(GEN_PORT), ADDR=0, TIMEOUT=1")
+
+KafkaPluginConfigure("$(K_PORT)", 100, 1, "$(GEN_PORT)", 0, -1, "$(BROKER)", "$(TOPIC)")
+dbLoadRecords("ADPluginKafka.template", "P=$(PREFIX):, R=KFK_PLG:, PORT=$(K_PORT), ADDR=0, TIMEOUT=1, NDARRAY_PORT=$(GEN_PORT)")
+
+KafkaDriverConfigure("$(KFKDET_PORT)", 10, 0, 0, 0, "$(BROKER)", "$(TOPIC)")
+dbLoadRecords("ADKafka.template", "P=$(PREFIX):, R=KFK_DRVR:, PORT=$(KFKDET_PORT), ADDR=0, TIMEOUT=1")
+
+iocInit
+
+dbpf $(PREFIX):KFK_DRVR:StartMessageOffset End
+dbpf $(PREFIX):KFK_DRVR:KafkaFetchTuning $(FETCH_TUNING)
+dbpf $(PREFIX):KFK_DRVR:ImageMode Continuous
+dbpf $(PREFIX):KFK_DRVR:Acquire 1
+
+dbpf $(PREFIX):KFK_PLG:EnableCallbacks Enable
+dbpf $(PREFIX):GEN:SizeX $(XSIZE)
+dbpf $(PREFIX):GEN:SizeY $(YSIZE)
+dbpf $(PREFIX):GEN:DataType UInt32
+dbpf $(PREFIX):GEN:FrameRate $(RATE)
+dbpf $(PREFIX):GEN:ImageMode Continuous
+dbpf $(PREFIX):GEN:Acquire 1
+
+#Remember; file MUST end with a new line
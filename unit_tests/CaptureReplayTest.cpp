@@ -0,0 +1,152 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  CaptureReplayTest.cpp
+ *  @brief Unit tests of the capture file reader.
+ */
+
+#include "CaptureReplay.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+using KafkaInterface::CaptureReplay;
+
+class CaptureReplayTest : public ::testing::Test {
+public:
+  void SetUp() override {
+    char dirTemplate[] = "/tmp/CaptureReplayTestXXXXXX";
+    ASSERT_NE(mkdtemp(dirTemplate), nullptr);
+    directory = dirTemplate;
+  }
+
+  void TearDown() override {
+    for (auto const &file : files) {
+      unlink(file.c_str());
+    }
+    rmdir(directory.c_str());
+  }
+
+  /// @brief Writes a segment in which message i has the size sizes[i], the
+  /// byte value firstValue + i and the timestamp firstValue + i ms.
+  void writeSegment(std::string const &name, std::vector<size_t> const &sizes,
+                    unsigned char firstValue, size_t unusedBytes = 0) {
+    files.push_back(directory + "/" + name);
+    std::ofstream file(files.back(), std::ios::binary);
+    CaptureReplay::SegmentHeader header;
+    std::memcpy(header.Magic, CaptureReplay::Magic, sizeof(header.Magic));
+    header.Version = CaptureReplay::FormatVersion;
+    header.HeaderSize = sizeof(header);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      CaptureReplay::RecordHeader record{};
+      record.Size = static_cast<std::uint32_t>(sizes[i]);
+      record.TimestampNs = (firstValue + i) * 1000000;
+      file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+      std::vector<char> data((sizes[i] + 7) / 8 * 8, 0);
+      std::fill(data.begin(), data.begin() + sizes[i],
+                static_cast<char>(firstValue + i));
+      file.write(data.data(), data.size());
+    }
+    // E.g. the pre-allocated part of a segment which was not closed
+    std::vector<char> zeros(unusedBytes, 0);
+    file.write(zeros.data(), zeros.size());
+  }
+
+  std::string directory;
+  std::vector<std::string> files;
+};
+
+TEST_F(CaptureReplayTest, MissingFiles) {
+  CaptureReplay replay;
+  EXPECT_FALSE(replay.Open(directory, 0, false));
+  EXPECT_FALSE(replay.GetErrorMessage().empty());
+  CaptureReplay::Message msg;
+  EXPECT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::ERROR);
+}
+
+TEST_F(CaptureReplayTest, NotACaptureFile) {
+  files.push_back(directory + "/bad.adar");
+  std::ofstream(files.back()) << "This is not a capture file.";
+  CaptureReplay replay;
+  ASSERT_TRUE(replay.Open(directory, 0, false));
+  CaptureReplay::Message msg;
+  EXPECT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::ERROR);
+  EXPECT_FALSE(replay.GetErrorMessage().empty());
+}
+
+TEST_F(CaptureReplayTest, MessagesInOrder) {
+  writeSegment("test_000001.adar", {3, 16, 100}, 1, 4096);
+  writeSegment("test_000002.adar", {9}, 4);
+  CaptureReplay replay;
+  ASSERT_TRUE(replay.Open(directory, 0, false));
+  EXPECT_EQ(replay.GetFileCount(), 2u);
+  std::vector<size_t> sizes{3, 16, 100, 9};
+  CaptureReplay::Message msg;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    ASSERT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::MESSAGE);
+    ASSERT_EQ(msg.Size, sizes[i]);
+    EXPECT_EQ(msg.Data[0], i + 1);
+    EXPECT_EQ(msg.Data[msg.Size - 1], i + 1);
+    EXPECT_EQ(msg.TimestampNs, static_cast<std::int64_t>(i + 1) * 1000000);
+  }
+  EXPECT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::END);
+  EXPECT_EQ(replay.GetMessageCount(), sizes.size());
+  EXPECT_DOUBLE_EQ(replay.GetProgress(), 1.0);
+}
+
+TEST_F(CaptureReplayTest, GlobPattern) {
+  writeSegment("a_000001.adar", {8}, 1);
+  writeSegment("b_000001.adar", {8}, 2);
+  CaptureReplay replay;
+  ASSERT_TRUE(replay.Open(directory + "/b_*.adar", 0, false));
+  EXPECT_EQ(replay.GetFileCount(), 1u);
+  CaptureReplay::Message msg;
+  ASSERT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::MESSAGE);
+  EXPECT_EQ(msg.Data[0], 2);
+}
+
+TEST_F(CaptureReplayTest, Loop) {
+  writeSegment("test_000001.adar", {8, 8}, 1);
+  CaptureReplay replay;
+  ASSERT_TRUE(replay.Open(directory, 0, true));
+  CaptureReplay::Message msg;
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::MESSAGE);
+    EXPECT_EQ(msg.Data[0], i % 2 + 1);
+  }
+}
+
+TEST_F(CaptureReplayTest, Retry) {
+  writeSegment("test_000001.adar", {8}, 1);
+  writeSegment("test_000002.adar", {8}, 2);
+  CaptureReplay replay;
+  ASSERT_TRUE(replay.Open(directory, 0, false));
+  CaptureReplay::Message msg;
+  ASSERT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::MESSAGE);
+  replay.RetryMessage();
+  ASSERT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::MESSAGE);
+  EXPECT_EQ(msg.Data[0], 1);
+  ASSERT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::MESSAGE);
+  EXPECT_EQ(msg.Data[0], 2);
+  EXPECT_EQ(replay.GetMessageCount(), 2u);
+}
+
+TEST_F(CaptureReplayTest, OriginalPace) {
+  // Timestamps 1, 2 and 3 ms; 1, 41 and 81 ms when replayed at 1/40 speed
+  writeSegment("test_000001.adar", {8, 8, 8}, 1);
+  CaptureReplay replay;
+  ASSERT_TRUE(replay.Open(directory, 1.0 / 40, false));
+  CaptureReplay::Message msg;
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::MESSAGE);
+  EXPECT_EQ(replay.WaitForMessage(msg, 10), CaptureReplay::Result::TIMEOUT);
+  ASSERT_EQ(replay.WaitForMessage(msg, 100), CaptureReplay::Result::MESSAGE);
+  EXPECT_EQ(msg.Data[0], 2);
+  ASSERT_EQ(replay.WaitForMessage(msg, 100), CaptureReplay::Result::MESSAGE);
+  EXPECT_EQ(msg.Data[0], 3);
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(80));
+}
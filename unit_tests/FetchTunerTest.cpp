@@ -0,0 +1,91 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FetchTunerTest.cpp
+ *  @brief Unit tests of the fetch settings controller.
+ */
+
+#include "FetchTuner.h"
+#include <gtest/gtest.h>
+
+using KafkaInterface::FetchSettings;
+using KafkaInterface::FetchTuner;
+
+namespace {
+const std::int64_t MiB{1024 * 1024};
+
+/// @brief Adds messages of a fixed size at a fixed rate, starting at start.
+FetchTuner::Clock::time_point addMessages(FetchTuner &tuner,
+                                          FetchTuner::Clock::time_point start,
+                                          std::size_t size, double rate,
+                                          double seconds) {
+  auto period = std::chrono::duration_cast<FetchTuner::Clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+  auto time = start;
+  for (int i = 0; i < static_cast<int>(rate * seconds); ++i) {
+    tuner.AddMessage(size, time);
+    time += period;
+  }
+  return time;
+}
+} // namespace
+
+TEST(FetchTuner, RoundUpPow2) {
+  EXPECT_EQ(FetchTuner::RoundUpPow2(0), 1);
+  EXPECT_EQ(FetchTuner::RoundUpPow2(1), 1);
+  EXPECT_EQ(FetchTuner::RoundUpPow2(3), 4);
+  EXPECT_EQ(FetchTuner::RoundUpPow2(4096), 4096);
+  EXPECT_EQ(FetchTuner::RoundUpPow2(100 * MiB), 128 * MiB);
+}
+
+TEST(FetchTuner, NothingRecommendedWhileObserving) {
+  FetchTuner tuner;
+  auto end = addMessages(tuner, FetchTuner::Clock::now(), 50 * MiB, 10, 2);
+  EXPECT_FALSE(tuner.RetuneDue(end));
+  EXPECT_EQ(tuner.Recommend(), tuner.Current());
+}
+
+TEST(FetchTuner, HugeFrames) {
+  FetchTuner tuner;
+  auto end = addMessages(tuner, FetchTuner::Clock::now(), 50 * MiB, 10, 5);
+  ASSERT_TRUE(tuner.RetuneDue(end));
+  auto settings = tuner.Recommend();
+  EXPECT_EQ(settings.MaxPartitionFetchBytes, 128 * MiB);
+  EXPECT_EQ(settings.FetchMaxBytes, 256 * MiB);
+  // One second of data (500 MB) rounded up
+  EXPECT_EQ(settings.QueuedMaxKBytes, 512 * 1024);
+  EXPECT_EQ(settings.FetchWaitMaxMs, 100);
+  EXPECT_EQ(tuner.Reason(),
+            "50.0 MB @ 10.0 Hz: 128.0 MB/partition, queue 512.0 MB, wait "
+            "100 ms");
+}
+
+TEST(FetchTuner, SmallFrames) {
+  FetchTuner tuner;
+  auto end = addMessages(tuner, FetchTuner::Clock::now(), 10 * 1024, 1000, 5);
+  ASSERT_TRUE(tuner.RetuneDue(end));
+  auto settings = tuner.Recommend();
+  EXPECT_EQ(settings.MaxPartitionFetchBytes, 1 * MiB);
+  EXPECT_EQ(settings.FetchMaxBytes, 64 * MiB);
+  EXPECT_EQ(settings.QueuedMaxKBytes, 16 * 1024);
+  EXPECT_EQ(settings.FetchWaitMaxMs, 10);
+}
+
+TEST(FetchTuner, RetuneIntervalAndHysteresis) {
+  FetchTuner tuner;
+  auto end = addMessages(tuner, FetchTuner::Clock::now(), 50 * MiB, 10, 5);
+  ASSERT_TRUE(tuner.RetuneDue(end));
+  tuner.Applied(tuner.Recommend(), end);
+  EXPECT_FALSE(tuner.RetuneDue(end));
+  // A small change of the frame size does not change the settings
+  end = addMessages(tuner, end, 51 * MiB, 10, 40);
+  EXPECT_FALSE(tuner.RetuneDue(end));
+  // Much smaller frames, but not before the minimum interval has passed
+  FetchSettings before = tuner.Current();
+  tuner.Applied(before, end);
+  end = addMessages(tuner, end, 1 * MiB, 10, 20);
+  EXPECT_FALSE(tuner.RetuneDue(end));
+  end = addMessages(tuner, end, 1 * MiB, 10, 15);
+  EXPECT_TRUE(tuner.RetuneDue(end));
+  EXPECT_LT(tuner.Recommend().MaxPartitionFetchBytes,
+            before.MaxPartitionFetchBytes);
+}
@@ -24,6 +24,8 @@ public:
   using KafkaInterface::KafkaConsumer::paramCallback;
   using KafkaInterface::KafkaConsumer::PV;
   using KafkaInterface::KafkaConsumer::paramsList;
+  using KafkaInterface::KafkaConsumer::UpdatePartitionLag;
+  using KafkaInterface::KafkaConsumer::storedOffsets;
   void SetConStatParent(KafkaConsumerStandIn::ConStat stat, std::string msg) {
     KafkaInterface::KafkaConsumer::SetConStat(stat, msg);
   };
@@ -60,6 +62,7 @@ public:
                           priority, stackSize){};
   MOCK_METHOD2(setStringParam, asynStatus(int, const char *));
   MOCK_METHOD2(setIntegerParam, asynStatus(int, int));
+  MOCK_METHOD2(setInteger64Param, asynStatus(int, epicsInt64));
   MOCK_METHOD3(createParam, asynStatus(const char *, asynParamType, int *));
 };
 
@@ -143,7 +146,7 @@ TEST_F(KafkaConsumerEnv, SetOffsetSuccess1Test) {
     ctr++;
   }
   std::int64_t usedValue = RdKafka::Topic::OFFSET_BEGINNING;
-  EXPECT_CALL(*asynDrvr, setIntegerParam(_, Eq(usedValue))).Times(Exactly(1));
+  EXPECT_CALL(*asynDrvr, setInteger64Param(_, Eq(usedValue))).Times(Exactly(1));
   ASSERT_TRUE(cons.SetOffset(usedValue));
   ASSERT_EQ(cons.GetCurrentOffset(), usedValue);
   Mock::VerifyAndClear(asynDrvr);
@@ -158,7 +161,7 @@ TEST_F(KafkaConsumerEnv, SetOffsetSuccess2Test) {
     ctr++;
   }
   std::int64_t usedValue = RdKafka::Topic::OFFSET_END;
-  EXPECT_CALL(*asynDrvr, setIntegerParam(_, Eq(usedValue))).Times(Exactly(1));
+  EXPECT_CALL(*asynDrvr, setInteger64Param(_, Eq(usedValue))).Times(Exactly(1));
   ASSERT_TRUE(cons.SetOffset(usedValue));
   ASSERT_EQ(cons.GetCurrentOffset(), usedValue);
   Mock::VerifyAndClear(asynDrvr);
@@ -173,7 +176,7 @@ TEST_F(KafkaConsumerEnv, SetOffsetSuccess3Test) {
     ctr++;
   }
   std::int64_t usedValue = RdKafka::Topic::OFFSET_STORED;
-  EXPECT_CALL(*asynDrvr, setIntegerParam(_, Eq(usedValue))).Times(Exactly(1));
+  EXPECT_CALL(*asynDrvr, setInteger64Param(_, Eq(usedValue))).Times(Exactly(1));
   ASSERT_TRUE(cons.SetOffset(usedValue));
   ASSERT_EQ(cons.GetCurrentOffset(), usedValue);
   Mock::VerifyAndClear(asynDrvr);
@@ -188,7 +191,7 @@ TEST_F(KafkaConsumerEnv, SetOffsetFailTest) {
     ctr++;
   }
   int usedValue = -3;
-  EXPECT_CALL(*asynDrvr, setIntegerParam(_, Eq(usedValue))).Times(Exactly(0));
+  EXPECT_CALL(*asynDrvr, setInteger64Param(_, Eq(usedValue))).Times(Exactly(0));
   ASSERT_FALSE(cons.SetOffset(usedValue));
   ASSERT_NE(cons.GetCurrentOffset(), usedValue);
   Mock::VerifyAndClear(asynDrvr);
@@ -220,6 +223,7 @@ TEST_F(KafkaConsumerEnv, StatsStatusTest) {
   EXPECT_CALL(*asynDrvr, setIntegerParam(Ne(statusIndex), _)).Times(AtLeast(0));
   EXPECT_CALL(*asynDrvr, setIntegerParam(Eq(statusIndex), _)).Times(AtLeast(1));
   auto msg = cons.WaitForPkg(1000);
+  cons.PublishParamUpdates();
 
   Mock::VerifyAndClear(asynDrvr);
 }
@@ -302,6 +306,36 @@ TEST_F(KafkaConsumerEnv, SetStatsTimeTest) {
   cons.SetStatsTimeIntervalMS(100);
 }
 
+TEST_F(KafkaConsumerEnv, DeferredApplyTest) {
+  KafkaConsumerStandIn cons("addr", "tpic");
+  cons.SetAutoApply(false);
+  EXPECT_CALL(cons, MakeConnection()).Times(Exactly(0));
+  EXPECT_CALL(cons, UpdateTopic()).Times(Exactly(0));
+  cons.SetBrokerAddr("new_broker");
+  cons.SetGroupId("some_group");
+  cons.SetTopic("new_topic");
+  cons.SetOffset(0);
+  ASSERT_TRUE(cons.ConfigurationPending());
+  Mock::VerifyAndClear(&cons);
+  EXPECT_CALL(cons, MakeConnection()).Times(Exactly(1));
+  EXPECT_CALL(cons, UpdateTopic()).Times(Exactly(0));
+  cons.ApplyConfiguration();
+  ASSERT_FALSE(cons.ConfigurationPending());
+}
+
+TEST_F(KafkaConsumerEnv, DeferredTopicUpdateTest) {
+  KafkaConsumerStandIn cons("addr", "tpic");
+  cons.SetAutoApply(false);
+  EXPECT_CALL(cons, UpdateTopic()).Times(Exactly(0));
+  cons.SetTopic("new_topic");
+  cons.SetOffset(0);
+  Mock::VerifyAndClear(&cons);
+  EXPECT_CALL(cons, MakeConnection()).Times(Exactly(0));
+  EXPECT_CALL(cons, UpdateTopic()).Times(Exactly(1));
+  cons.SetAutoApply(true);
+  ASSERT_FALSE(cons.ConfigurationPending());
+}
+
 TEST_F(KafkaConsumerEnv, SetStatsTimeValueTest) {
   KafkaConsumer cons("addr", "tpic", "some_group");
   int usedTime = 100;
@@ -345,6 +379,66 @@ TEST_F(KafkaConsumerEnv, SetConStatTest) {
       .Times(Exactly(1));
   EXPECT_CALL(*asynDrvr, setStringParam(Eq(messageIndex), _)).Times(Exactly(1));
   cons.SetConStatParent(KafkaConsumerStandIn::ConStat::ERROR, "some message");
+  ASSERT_TRUE(cons.PublishParamUpdates());
+  Mock::VerifyAndClear(asynDrvr);
+}
+
+TEST_F(KafkaConsumerEnv, SetConStatCoalescedTest) {
+  KafkaConsumerStandIn cons("addr", "tpic");
+  auto params = cons.GetParams();
+  int ctr = 1;
+  for (auto p : params) {
+    *p.index = ctr;
+    ctr++;
+  }
+  int messageIndex = *params[KafkaConsumerStandIn::PV::con_msg].index;
+  int statusIndex = *params[KafkaConsumerStandIn::PV::con_status].index;
+  cons.RegisterParamCallbackClass(asynDrvr);
+  EXPECT_CALL(*asynDrvr, setIntegerParam(_, _)).Times(Exactly(0));
+  EXPECT_CALL(*asynDrvr, setStringParam(_, _)).Times(Exactly(0));
+  cons.SetConStatParent(KafkaConsumerStandIn::ConStat::DISCONNECTED,
+                        "first message");
+  cons.SetConStatParent(KafkaConsumerStandIn::ConStat::CONNECTED,
+                        "second message");
+  Mock::VerifyAndClear(asynDrvr);
+  EXPECT_CALL(*asynDrvr,
+              setIntegerParam(Eq(statusIndex),
+                              Eq(int(KafkaConsumerStandIn::ConStat::CONNECTED))))
+      .Times(Exactly(1));
+  EXPECT_CALL(*asynDrvr, setStringParam(Eq(messageIndex), StrEq("second message")))
+      .Times(Exactly(1));
+  ASSERT_TRUE(cons.PublishParamUpdates());
+  ASSERT_FALSE(cons.PublishParamUpdates());
+  Mock::VerifyAndClear(asynDrvr);
+}
+
+TEST_F(KafkaConsumerEnv, LagAlarmTest) {
+  KafkaConsumerStandIn cons("addr", "tpic");
+  auto params = cons.GetParams();
+  int ctr = 1;
+  for (auto p : params) {
+    *p.index = ctr;
+    ctr++;
+  }
+  int lagIndex = *params[KafkaConsumerStandIn::PV::partition_lag].index;
+  int alarmIndex = *params[KafkaConsumerStandIn::PV::lag_alarm].index;
+  cons.RegisterParamCallbackClass(asynDrvr);
+  ASSERT_FALSE(cons.SetLagAlarmThreshold(-1));
+  ASSERT_TRUE(cons.SetLagAlarmThreshold(100));
+  cons.UpdatePartitionLag(150);
+  EXPECT_CALL(*asynDrvr, setInteger64Param(Eq(lagIndex), Eq(150)))
+      .Times(Exactly(1));
+  EXPECT_CALL(*asynDrvr, setIntegerParam(Eq(alarmIndex), Eq(1)))
+      .Times(Exactly(1));
+  EXPECT_CALL(*asynDrvr, setIntegerParam(Ne(alarmIndex), _)).Times(AnyNumber());
+  ASSERT_TRUE(cons.PublishParamUpdates());
+  Mock::VerifyAndClear(asynDrvr);
+  cons.UpdatePartitionLag(10);
+  EXPECT_CALL(*asynDrvr, setInteger64Param(Eq(lagIndex), Eq(10)))
+      .Times(Exactly(1));
+  EXPECT_CALL(*asynDrvr, setIntegerParam(Eq(alarmIndex), Eq(0)))
+      .Times(Exactly(1));
+  ASSERT_TRUE(cons.PublishParamUpdates());
   Mock::VerifyAndClear(asynDrvr);
 }
 
@@ -352,4 +446,123 @@ TEST_F(KafkaConsumerEnv, TestNrOfParams) {
   KafkaConsumer prod("some_addr", "some_topic", "some_group");
   ASSERT_EQ(prod.GetParams().size(), prod.GetNumberOfPVs());
 }
+
+TEST_F(KafkaConsumerEnv, PoolOccupancyTest) {
+  NDArrayPool pool(nullptr, 1000);
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool), 0);
+  size_t dims[] = {500};
+  auto array = pool.alloc(1, dims, NDUInt8, 0, nullptr);
+  ASSERT_NE(array, nullptr);
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool), 50);
+  array->release();
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool), 0);
+}
+
+TEST_F(KafkaConsumerEnv, PoolOccupancyUnlimitedTest) {
+  NDArrayPool pool(nullptr, 0);
+  size_t dims[] = {500};
+  auto array = pool.alloc(1, dims, NDUInt8, 0, nullptr);
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool), 0);
+  array->release();
+}
+
+TEST_F(KafkaConsumerEnv, SetPoolWatermarksTest) {
+  KafkaConsumer cons("some_group");
+  ASSERT_TRUE(cons.SetPoolWatermarks(80, 50));
+  ASSERT_FALSE(cons.SetPoolWatermarks(50, 50));
+  ASSERT_FALSE(cons.SetPoolWatermarks(101, 50));
+  ASSERT_FALSE(cons.SetPoolWatermarks(80, -1));
+}
+
+TEST_F(KafkaConsumerEnv, BackpressurePauseAndResumeTest) {
+  KafkaConsumer cons("some_group");
+  ASSERT_TRUE(cons.SetPoolWatermarks(40, 20));
+  NDArrayPool pool(nullptr, 1000);
+  size_t dims[] = {500};
+  auto array = pool.alloc(1, dims, NDUInt8, 0, nullptr);
+  cons.UpdateBackpressure(&pool, 0);
+  ASSERT_TRUE(cons.IsBackpressurePaused());
+  array->release();
+  cons.UpdateBackpressure(&pool, 0);
+  ASSERT_FALSE(cons.IsBackpressurePaused());
+}
+
+TEST_F(KafkaConsumerEnv, PoolOccupancyBufferCountTest) {
+  NDArrayPool pool(nullptr, 0);
+  size_t dims[] = {500};
+  auto array = pool.alloc(1, dims, NDUInt8, 0, nullptr);
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool, 10), 10);
+  ASSERT_EQ(KafkaConsumer::GetUsedBuffers(&pool), 1);
+  array->release();
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool, 10), 0);
+  ASSERT_EQ(KafkaConsumer::GetUsedBuffers(&pool), 0);
+}
+
+TEST_F(KafkaConsumerEnv, PoolOccupancyLargestTest) {
+  NDArrayPool pool(nullptr, 1000);
+  size_t dims[] = {500};
+  auto array = pool.alloc(1, dims, NDUInt8, 0, nullptr);
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool, 100), 50);
+  ASSERT_EQ(KafkaConsumer::GetPoolOccupancy(&pool, 1), 100);
+  array->release();
+}
+
+TEST_F(KafkaConsumerEnv, LatestFrameModeTest) {
+  KafkaConsumer cons("some_group");
+  ASSERT_FALSE(cons.GetLatestFrameMode());
+  cons.SetLatestFrameMode(true);
+  ASSERT_TRUE(cons.GetLatestFrameMode());
+  ASSERT_EQ(cons.WaitForPkg(10), nullptr);
+  ASSERT_EQ(cons.GetSkippedMessages(), 0);
+}
+
+TEST_F(KafkaConsumerEnv, SubscribeModeTest) {
+  KafkaConsumerStandIn cons("addr", "tpic");
+  ASSERT_FALSE(cons.GetSubscribeMode());
+  EXPECT_CALL(cons, MakeConnection()).Times(Exactly(1)).WillOnce(Return(true));
+  ASSERT_TRUE(cons.SetSubscribeMode(true));
+  ASSERT_TRUE(cons.GetSubscribeMode());
+  // No re-connect if the mode is unchanged
+  ASSERT_TRUE(cons.SetSubscribeMode(true));
+}
+
+TEST_F(KafkaConsumerEnv, CommitSettingsTest) {
+  KafkaConsumer cons("some_group");
+  ASSERT_TRUE(cons.SetCommitBatch(10));
+  ASSERT_EQ(cons.GetCommitBatch(), 10);
+  ASSERT_FALSE(cons.SetCommitBatch(0));
+  ASSERT_TRUE(cons.SetCommitIntervalMS(0));
+  ASSERT_EQ(cons.GetCommitIntervalMS(), 0);
+  ASSERT_FALSE(cons.SetCommitIntervalMS(-1));
+}
+
+TEST_F(KafkaConsumerEnv, StoreOffsetTest) {
+  KafkaConsumerStandIn cons;
+  cons.SetCommitBatch(1);
+  // Without a consumer, nothing is committed
+  cons.StoreOffset("some_topic", 0, 41);
+  cons.StoreOffset("some_topic", 0, 40);
+  cons.StoreOffset("some_topic", 1, 7);
+  ASSERT_EQ(cons.storedOffsets.size(), 2u);
+  // The committed offset is that of the next message
+  EXPECT_EQ(cons.storedOffsets[std::make_pair(std::string("some_topic"), 0)],
+            42);
+  EXPECT_EQ(cons.storedOffsets[std::make_pair(std::string("some_topic"), 1)],
+            8);
+}
+
+TEST_F(KafkaConsumerEnv, SetOffsetFromTimeFailsWithoutConsumerTest) {
+  KafkaConsumer cons("some_group");
+  ASSERT_FALSE(cons.SetOffsetFromTime(1500000000000));
+}
+
+TEST_F(KafkaConsumerEnv, StopTimeTest) {
+  KafkaConsumer cons("some_group");
+  ASSERT_EQ(cons.GetStopTime(), 0);
+  ASSERT_FALSE(cons.StopTimeReached());
+  cons.SetStopTime(1500000000000);
+  ASSERT_EQ(cons.GetStopTime(), 1500000000000);
+  ASSERT_EQ(cons.WaitForPkg(10), nullptr);
+  ASSERT_FALSE(cons.StopTimeReached());
+}
 }
@@ -40,6 +40,7 @@ public:
   using ADDriver::ADStatusMessage;
   MOCK_METHOD2(setStringParam, asynStatus(int, const char *));
   MOCK_METHOD2(setIntegerParam, asynStatus(int, int));
+  MOCK_METHOD2(setInteger64Param, asynStatus(int, epicsInt64));
 };
 
 /// @brief A testing fixture used for setting up unit tests.
@@ -90,7 +91,7 @@ TEST_F(KafkaDriverEnv, ParameterCountTest) {
 TEST_F(KafkaDriverEnv, ParamCallbackIsSetTest) {
   KafkaDriverStandIn drvr;
   int usedValue = 5000;
-  EXPECT_CALL(drvr, setIntegerParam(_, Eq(usedValue))).Times(Exactly(1));
+  EXPECT_CALL(drvr, setInteger64Param(_, Eq(usedValue))).Times(Exactly(1));
   ASSERT_TRUE(drvr.consumer.SetOffset(usedValue));
   // Ugly hack to make sure that the thread actually starts
   std::this_thread::sleep_for(std::chrono::milliseconds(50));
@@ -142,8 +143,17 @@ TEST_F(KafkaDriverEnv, ThreadRunningTest) {
   std::this_thread::sleep_for(std::chrono::milliseconds(100));
 }
 
+TEST_F(KafkaDriverEnv, ConsumerCreatedWhenIocRunningTest) {
+  KafkaDriverStandIn drvr;
+  ASSERT_TRUE(drvr.consumer.ConfigurationPending());
+  drvr.iocRunning();
+  ASSERT_FALSE(drvr.consumer.ConfigurationPending());
+  ASSERT_TRUE(drvr.consumer.GetAutoApply());
+}
+
 TEST_F(KafkaDriverEnv, ConnectionStatusUpdateTest) {
   NiceMock<KafkaDriverStandIn> drvr;
+  drvr.iocRunning();
   int msgIndex = -1;
   for (auto p : drvr.consumer.GetParams()) {
     if ("KAFKA_CONNECTION_MESSAGE" == p.desc) {
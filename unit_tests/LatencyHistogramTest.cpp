@@ -0,0 +1,55 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  LatencyHistogramTest.cpp
+ *  @brief Unit tests of the latency histograms.
+ */
+
+#include "LatencyHistogram.h"
+#include <gtest/gtest.h>
+
+TEST(LatencyHistogram, BinIndex) {
+  EXPECT_EQ(LatencyHistogram::binIndex(-5.0), 0u);
+  EXPECT_EQ(LatencyHistogram::binIndex(0.05), 0u);
+  EXPECT_EQ(LatencyHistogram::binIndex(0.1), 1u);
+  EXPECT_EQ(LatencyHistogram::binIndex(1.0), 5u);
+  EXPECT_EQ(LatencyHistogram::binIndex(1e9), LatencyHistogram::BinCount - 1);
+}
+
+TEST(LatencyHistogram, ValuesAreWithinTheirBin) {
+  for (double value : {0.15, 2.5, 37.0, 999.0, 12345.0}) {
+    auto bin = LatencyHistogram::binIndex(value);
+    EXPECT_LE(LatencyHistogram::lowerEdge(bin), value);
+    EXPECT_GT(LatencyHistogram::lowerEdge(bin + 1), value);
+  }
+}
+
+TEST(LatencyHistogram, EmptyPercentile) {
+  LatencyHistogram hist;
+  EXPECT_EQ(hist.percentile(0.5), 0.0);
+}
+
+TEST(LatencyHistogram, Percentiles) {
+  LatencyHistogram hist;
+  for (int i = 0; i < 99; ++i) {
+    hist.add(1.0);
+  }
+  hist.add(500.0);
+  EXPECT_EQ(hist.count(), 100u);
+  auto median = hist.percentile(0.5);
+  EXPECT_GE(median, 1.0);
+  EXPECT_LT(median, LatencyHistogram::lowerEdge(6));
+  auto max = hist.percentile(1.0);
+  EXPECT_GE(max, 500.0 / 1.8);
+  EXPECT_LE(max, 500.0 * 1.8);
+}
+
+TEST(RollingLatencyHistogram, OldSlicesAreDropped) {
+  RollingLatencyHistogram hist;
+  hist.add(1.0);
+  for (std::size_t i = 0; i < RollingLatencyHistogram::Slices - 1; ++i) {
+    hist.rotate();
+    EXPECT_EQ(hist.summarize().count(), 1u);
+  }
+  hist.rotate();
+  EXPECT_EQ(hist.summarize().count(), 0u);
+}
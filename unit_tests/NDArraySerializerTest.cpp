@@ -9,6 +9,7 @@
 #include "NDArraySerializer.h"
 #include "NDArray_schema_generated.h"
 #include <ciso646>
+#include <cstring>
 #include <fstream>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -41,6 +42,28 @@ void CompareAttributes(NDArray *arr1, const FB_Tables::NDArray *arr2);
 
 void GenerateData(NDDataType_t type, size_t elements, void *ptr);
 
+/// @brief Maps the types of the legacy NDAr schema, which has no 64-bit types.
+NDDataType_t GetFB_Tables_ND_DType(FB_Tables::DType type) {
+  std::map<FB_Tables::DType, NDDataType_t> typeMap = {
+      {FB_Tables::DType_int8, NDInt8},
+      {FB_Tables::DType_uint8, NDUInt8},
+      {FB_Tables::DType_int16, NDInt16},
+      {FB_Tables::DType_uint16, NDUInt16},
+      {FB_Tables::DType_int32, NDInt32},
+      {FB_Tables::DType_uint32, NDUInt32},
+      {FB_Tables::DType_float32, NDFloat32},
+      {FB_Tables::DType_float64, NDFloat64},
+  };
+  return typeMap.at(type);
+}
+
+NDAttrDataType_t GetFB_Tables_ND_AttrDType(FB_Tables::DType type) {
+  if (FB_Tables::DType_c_string == type) {
+    return NDAttrString;
+  }
+  return static_cast<NDAttrDataType_t>(GetFB_Tables_ND_DType(type));
+}
+
 /// @brief A testing fixture used for setting up unit tests.
 class Serializer : public ::testing::Test {
 public:
@@ -66,7 +89,7 @@ public:
 };
 
 TEST_F(Serializer, SerializeTest) {
-  NDArraySerializer ser;
+  NDArraySerializer ser("Some name");
   std::vector<size_t> numAttr = {0, 1, 10};
   std::vector<size_t> numElements = {1, 10, 50};
   std::vector<NDDataType_t> dataTypes = {NDUInt8,   NDInt8,   NDUInt16,
@@ -137,8 +160,135 @@ TEST_F(DeSerializer, FileContentTest) {
   ASSERT_EQ(recvArr->id(), 2720);
 }
 
+TEST_F(DeSerializer, DeSerializeFileTest) {
+  NDArrayPool pool(nullptr, 0);
+  NDArray *recvArr = nullptr;
+  ASSERT_EQ(DeSerializeData(&pool, rawData, fileSize, recvArr),
+            DeSerializeResult::SUCCESS);
+  ASSERT_NE(recvArr, nullptr);
+  auto fbArr = FB_Tables::GetNDArray(rawData);
+  EXPECT_EQ(recvArr->uniqueId, 2720);
+  CompareDataTypes(recvArr, fbArr);
+  CompareSizeAndDims(recvArr, fbArr);
+  CompareTimeStamps(recvArr, fbArr);
+  CompareData(recvArr, fbArr);
+  recvArr->release();
+}
+
+TEST_F(DeSerializer, UnknownIdentifierTest) {
+  NDArrayPool pool(nullptr, 0);
+  std::vector<unsigned char> buffer(rawData, rawData + fileSize);
+  std::memcpy(buffer.data() + 4, "XXXX", 4);
+  NDArray *recvArr = nullptr;
+  EXPECT_EQ(DeSerializeData(&pool, buffer.data(), buffer.size(), recvArr),
+            DeSerializeResult::UNKNOWN_FORMAT);
+  EXPECT_EQ(recvArr, nullptr);
+  EXPECT_EQ(DeSerializeData(&pool, rawData, 7, recvArr),
+            DeSerializeResult::UNKNOWN_FORMAT);
+}
+
+TEST_F(DeSerializer, TruncatedBufferTest) {
+  NDArrayPool pool(nullptr, 0);
+  std::vector<unsigned char> buffer(rawData, rawData + fileSize / 2);
+  NDArray *recvArr = nullptr;
+  EXPECT_EQ(DeSerializeData(&pool, buffer.data(), buffer.size(), recvArr),
+            DeSerializeResult::UNKNOWN_FORMAT);
+  EXPECT_EQ(recvArr, nullptr);
+}
+
+TEST_F(Serializer, TruncatedADArrayTest) {
+  NDArraySerializer ser("detector_1");
+  size_t dims[] = {30, 20};
+  NDArray *sendArr = recvPool->alloc(2, dims, NDUInt16, 0, nullptr);
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  std::vector<unsigned char> buffer(bufferPtr, bufferPtr + bufferSize / 2);
+  NDArray *recvArr = nullptr;
+  EXPECT_EQ(DeSerializeData(recvPool, buffer.data(), buffer.size(), recvArr),
+            DeSerializeResult::UNKNOWN_FORMAT);
+  EXPECT_EQ(recvArr, nullptr);
+  std::string sourceName;
+  EXPECT_FALSE(PeekSourceName(buffer.data(), buffer.size(), sourceName));
+  sendArr->release();
+}
+
+TEST_F(Serializer, PeekSourceNameTest) {
+  NDArraySerializer ser("detector_1");
+  size_t dims[] = {3, 2};
+  NDArray *sendArr = recvPool->alloc(2, dims, NDUInt8, 0, nullptr);
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  std::string sourceName;
+  ASSERT_TRUE(PeekSourceName(bufferPtr, bufferSize, sourceName));
+  EXPECT_EQ(sourceName, "detector_1");
+  EXPECT_FALSE(PeekSourceName(bufferPtr, 7, sourceName));
+  sendArr->release();
+}
+
+DeSerializeResult StandInDecoder(NDArrayPool *, const unsigned char *, size_t,
+                                 NDArray *&) {
+  return DeSerializeResult::ALLOC_FAILED;
+}
+
+TEST_F(DeSerializer, RegisterDeSerializerTest) {
+  NDArrayPool pool(nullptr, 0);
+  std::vector<unsigned char> buffer(rawData, rawData + fileSize);
+  std::memcpy(buffer.data() + 4, "TEST", 4);
+  EXPECT_FALSE(RegisterDeSerializer("TES", StandInDecoder));
+  EXPECT_FALSE(RegisterDeSerializer("TEST", nullptr));
+  ASSERT_TRUE(RegisterDeSerializer("TEST", StandInDecoder));
+  NDArray *recvArr = nullptr;
+  EXPECT_EQ(DeSerializeData(&pool, buffer.data(), buffer.size(), recvArr),
+            DeSerializeResult::ALLOC_FAILED);
+  // The registry is shared by all tests of the process
+  ASSERT_TRUE(UnregisterDeSerializer("TEST"));
+  EXPECT_FALSE(UnregisterDeSerializer("TEST"));
+  EXPECT_EQ(DeSerializeData(&pool, buffer.data(), buffer.size(), recvArr),
+            DeSerializeResult::UNKNOWN_FORMAT);
+}
+
+TEST_F(Serializer, SerializeDeserializeInt64Test) {
+  NDArraySerializer ser("Some name");
+  for (auto dType : {NDInt64, NDUInt64}) {
+    size_t dims[] = {3, 2};
+    NDArray *sendArr = recvPool->alloc(2, dims, dType, 0, nullptr);
+    auto sendData = reinterpret_cast<epicsInt64 *>(sendArr->pData);
+    for (int i = 0; i < 6; i++) {
+      sendData[i] = (epicsInt64(1) << 40) + i;
+    }
+    sendArr->uniqueId = 42;
+    sendArr->epicsTS.secPastEpoch = 1484046150;
+    sendArr->epicsTS.nsec = 21212121;
+    sendArr->pAttributeList->clear();
+    epicsInt64 attrValue = -(epicsInt64(1) << 50);
+    sendArr->pAttributeList->add("Int64Attr", "Description", NDAttrInt64,
+                                 &attrValue);
+    unsigned char *bufferPtr = nullptr;
+    size_t bufferSize;
+    ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+    NDArray *recvArr = nullptr;
+    ASSERT_EQ(DeSerializeData(recvPool, bufferPtr, bufferSize, recvArr),
+              DeSerializeResult::SUCCESS);
+    CompareDataTypes(sendArr, recvArr);
+    CompareSizeAndDims(sendArr, recvArr);
+    CompareTimeStamps(sendArr, recvArr);
+    CompareData(sendArr, recvArr);
+    EXPECT_EQ(recvArr->uniqueId, 42);
+    auto recvAttr = recvArr->pAttributeList->find("Int64Attr");
+    ASSERT_NE(recvAttr, nullptr);
+    epicsInt64 recvValue = 0;
+    ASSERT_EQ(recvAttr->getValue(NDAttrInt64, &recvValue, sizeof(recvValue)),
+              ND_SUCCESS);
+    EXPECT_EQ(recvValue, attrValue);
+    sendArr->release();
+    recvArr->release();
+  }
+}
+
 // TEST_F(Serializer, SerializeDeserializeProfiling) {
-//    NDArraySerializer ser;
+//    NDArraySerializer ser("Some name");
 //    size_t numAttr = 10;
 //    size_t numElements = 50;
 //    NDDataType_t dataType = NDInt32;
@@ -166,7 +316,7 @@ TEST_F(DeSerializer, FileContentTest) {
 //}
 
 TEST_F(Serializer, SerializeDeserializeTest) {
-  NDArraySerializer ser;
+  NDArraySerializer ser("Some name");
   std::vector<size_t> numAttr = {0, 1, 10};
   std::vector<size_t> numElements = {1, 10, 50};
   std::vector<NDDataType_t> dataTypes = {NDUInt8,   NDInt8,   NDUInt16,
@@ -183,7 +333,8 @@ TEST_F(Serializer, SerializeDeserializeTest) {
           unsigned char *bufferPtr = nullptr;
           size_t bufferSize;
           ser.SerializeData(*sendArr, bufferPtr, bufferSize);
-          DeSerializeData(recvPool, bufferPtr, recvArr);
+          ASSERT_EQ(DeSerializeData(recvPool, bufferPtr, bufferSize, recvArr),
+                    DeSerializeResult::SUCCESS);
           CompareDataTypes(sendArr, recvArr);
           CompareSizeAndDims(sendArr, recvArr);
           CompareTimeStamps(sendArr, recvArr);
@@ -206,13 +357,14 @@ void CompareDataTypes(NDArray *arr1, NDArray *arr2) {
 
 void CompareDataTypes(NDArray *arr1, const FB_Tables::NDArray *arr2) {
   ASSERT_EQ(arr1->dataType,
-            NDArraySerializerStandIn::GetND_DType(arr2->dataType()));
+            GetFB_Tables_ND_DType(arr2->dataType()));
 }
 
 void CompareSizeAndDims(NDArray *arr1, NDArray *arr2) {
   std::map<NDDataType_t, int> sizeList = {
       {NDInt8, 1},  {NDUInt8, 1},  {NDInt16, 2},   {NDUInt16, 2},
-      {NDInt32, 4}, {NDUInt32, 4}, {NDFloat32, 4}, {NDFloat64, 8},
+      {NDInt32, 4}, {NDUInt32, 4}, {NDInt64, 8},   {NDUInt64, 8},
+      {NDFloat32, 4}, {NDFloat64, 8},
   };
   NDArrayInfo_t arr1Info;
   NDArrayInfo_t arr2Info;
@@ -241,7 +393,8 @@ void CompareSizeAndDims(NDArray *arr1, NDArray *arr2) {
 void CompareSizeAndDims(NDArray *arr1, const FB_Tables::NDArray *arr2) {
   std::map<NDDataType_t, int> sizeList = {
       {NDInt8, 1},  {NDUInt8, 1},  {NDInt16, 2},   {NDUInt16, 2},
-      {NDInt32, 4}, {NDUInt32, 4}, {NDFloat32, 4}, {NDFloat64, 8},
+      {NDInt32, 4}, {NDUInt32, 4}, {NDInt64, 8},   {NDUInt64, 8},
+      {NDFloat32, 4}, {NDFloat64, 8},
   };
   NDArrayInfo_t arr1Info;
   arr1->getInfo(&arr1Info);
@@ -264,7 +417,9 @@ void CompareSizeAndDims(NDArray *arr1, const FB_Tables::NDArray *arr2) {
 }
 
 void CompareTimeStamps(NDArray *arr1, NDArray *arr2) {
-  ASSERT_EQ(arr1->timeStamp, arr2->timeStamp);
+  // The ADAr schema only transmits the EPICS timestamp
+  ASSERT_DOUBLE_EQ(arr2->timeStamp,
+                   arr1->epicsTS.secPastEpoch + arr1->epicsTS.nsec / 1.e9);
   ASSERT_EQ(arr1->epicsTS.secPastEpoch, arr2->epicsTS.secPastEpoch);
   ASSERT_EQ(arr1->epicsTS.nsec, arr2->epicsTS.nsec);
 }
@@ -322,7 +477,7 @@ void CompareAttributes(NDArray *arr1, const FB_Tables::NDArray *arr2) {
     ASSERT_EQ(std::string(cAttr->getSource()), srcStr);
 
     ASSERT_EQ(cAttr->getDataType(),
-              NDArraySerializerStandIn::GetND_AttrDType(compAttr->dataType()));
+              GetFB_Tables_ND_AttrDType(compAttr->dataType()));
 
     size_t dataSize1;
     NDAttrDataType_t dType1;
@@ -330,7 +485,7 @@ void CompareAttributes(NDArray *arr1, const FB_Tables::NDArray *arr2) {
     size_t dataSize2;
     ASSERT_NE(cAttr->getValueInfo(&dType1, &dataSize1), ND_ERROR);
 
-    dType2 = NDArraySerializerStandIn::GetND_AttrDType(compAttr->dataType());
+    dType2 = GetFB_Tables_ND_AttrDType(compAttr->dataType());
 
     ASSERT_EQ(dType1, dType2);
 
@@ -124,3 +124,40 @@ TEST_F(ParamUtility, SetIntegerParamFailTest) {
   PV_param test(descStr.c_str(), asynParamOctet, testIndex);
   ASSERT_DEATH(setParam(plugin, test, testValue), "");
 }
+
+TEST_F(ParamUtility, PendingUpdatesAreCoalesced) {
+  std::vector<PV_param> testParams{PV_param("DESC_1", asynParamInt32, 11),
+                                   PV_param("DESC_2", asynParamOctet, 12)};
+  PendingParamUpdates underTest(testParams.size());
+  underTest.post(0, 1);
+  underTest.post(0, 2);
+  underTest.post(1, std::string("first"));
+  underTest.post(1, std::string("second"));
+  EXPECT_CALL(*plugin, setIntegerParam(11, 2)).Times(Exactly(1));
+  EXPECT_CALL(*plugin, setStringParam(12, CharToStringMatcher("second")))
+      .Times(Exactly(1));
+  EXPECT_TRUE(underTest.publish(plugin, testParams));
+  EXPECT_FALSE(underTest.publish(plugin, testParams));
+}
+
+TEST_F(ParamUtility, PendingStringBuffersAreSwapped) {
+  std::vector<PV_param> testParams{PV_param("DESC_1", asynParamOctet, 12)};
+  PendingParamUpdates underTest(testParams.size());
+  InSequence sequence;
+  for (auto value : {"first", "second", "third"}) {
+    EXPECT_CALL(*plugin, setStringParam(12, CharToStringMatcher(value)))
+        .Times(Exactly(1));
+    underTest.post(0, std::string(value));
+    EXPECT_TRUE(underTest.publish(plugin, testParams));
+  }
+}
+
+TEST_F(ParamUtility, DiscardedUpdateIsNotPublished) {
+  std::vector<PV_param> testParams{PV_param("DESC_1", asynParamInt32, 11)};
+  PendingParamUpdates underTest(testParams.size());
+  underTest.post(0, 42);
+  underTest.discard(0);
+  underTest.post(5, 42);
+  EXPECT_CALL(*plugin, setIntegerParam(_, _)).Times(Exactly(0));
+  EXPECT_FALSE(underTest.publish(plugin, testParams));
+}